@@ -0,0 +1,901 @@
+/**
+ * Start a local dqlite cluster and drive it over the wire protocol with a
+ * configurable workload, then report throughput and latency percentiles as a
+ * single JSON object on standard output.
+ *
+ * All nodes run in this process, each with its own event loop thread and
+ * data directory, and talk to each other over abstract Unix sockets or
+ * loopback TCP. Each client is a thread with its own blocking connection to
+ * the leader.
+ */
+
+#include <arpa/inet.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "../include/dqlite.h"
+
+#include "../src/client.h"
+#include "../src/metrics.h"
+#include "../src/protocol.h"
+#include "../src/server.h"
+#include "../src/tuple.h"
+
+#define MAX_NODES 9
+
+/* Number of rows inserted by each transaction when loading the table. */
+#define LOAD_BATCH 1000
+
+/* Give up on a client after this many consecutive failures. */
+#define MAX_ERRORS 100
+
+enum { INSERT = 0, BATCH, SELECT, SCAN, MIXED };
+
+static const char *workloads[] = {"insert", "batch", "select",
+				  "scan",   "mixed", NULL};
+
+struct options
+{
+	int workload;                  /* Workload to run */
+	unsigned nodes;                /* Number of nodes in the cluster */
+	bool tcp;                      /* Use loopback TCP instead of Unix */
+	unsigned port;                 /* First TCP port */
+	unsigned clients;              /* Number of concurrent clients */
+	unsigned duration;             /* Seconds to run the workload for */
+	unsigned rows;                 /* Rows loaded before reading */
+	unsigned value_size;           /* Bytes in each row's value */
+	unsigned batch;                /* Rows per transaction of batch */
+	unsigned scan;                 /* Rows per range scan */
+	unsigned read_ratio;           /* Percent of reads in mixed */
+	unsigned page_size;            /* Database page size */
+	unsigned checkpoint_threshold; /* WAL frames before checkpointing */
+	const char *dir;               /* Parent of the data directories */
+};
+
+struct node
+{
+	unsigned id;
+	char address[64];
+	char dir[PATH_MAX];
+	dqlite_node *dqlite;
+};
+
+/* Prepared statements of a client. */
+enum { STMT_INSERT = 0,
+       STMT_SELECT,
+       STMT_SCAN,
+       STMT_BEGIN,
+       STMT_COMMIT,
+       STMT_ROLLBACK,
+       N_STMTS };
+
+static const char *statements[N_STMTS] = {
+    "INSERT INTO bench(k, v) VALUES(?, ?)",
+    "SELECT k, v FROM bench WHERE id = ?",
+    "SELECT k, v FROM bench WHERE id >= ? LIMIT ?",
+    "BEGIN",
+    "COMMIT",
+    "ROLLBACK",
+};
+
+struct worker
+{
+	struct options *opts;
+	pthread_t thread;
+	struct client client;
+	unsigned stmts[N_STMTS];
+	unsigned seed;            /* For rand_r() */
+	void *value;              /* Value inserted in new rows */
+	struct histogram latency; /* Latency of each operation */
+	uint64_t ops;             /* Completed operations */
+	uint64_t errors;          /* Failed operations */
+	uint64_t rows;            /* Rows written or read */
+	bool failed;              /* Gave up because of errors */
+};
+
+static struct options options = {
+    .workload = INSERT,
+    .nodes = 3,
+    .tcp = false,
+    .port = 9001,
+    .clients = 1,
+    .duration = 10,
+    .rows = 10000,
+    .value_size = 100,
+    .batch = 100,
+    .scan = 100,
+    .read_ratio = 90,
+    .page_size = 4096,
+    .checkpoint_threshold = 1000,
+    .dir = "/tmp",
+};
+
+static struct node nodes[MAX_NODES];
+static pthread_barrier_t ready;
+static volatile bool stop;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: dqlite-bench [options]\n"
+		"  -w, --workload NAME          "
+		"insert, batch, select, scan or mixed (insert)\n"
+		"  -n, --nodes N                nodes in the cluster (3)\n"
+		"  -t, --transport unix|tcp     "
+		"abstract Unix sockets or loopback TCP (unix)\n"
+		"  -p, --port N                 first TCP port (9001)\n"
+		"  -c, --clients N              concurrent clients (1)\n"
+		"  -d, --duration SECS          time to run for (10)\n"
+		"  -r, --rows N                 "
+		"rows loaded for read workloads (10000)\n"
+		"  -s, --value-size BYTES       size of row values (100)\n"
+		"  -b, --batch N                "
+		"rows per transaction of batch (100)\n"
+		"  -l, --scan N                 rows per range scan (100)\n"
+		"  -R, --read-ratio PERCENT     reads in mixed (90)\n"
+		"  -P, --page-size BYTES        database page size (4096)\n"
+		"  -C, --checkpoint-threshold N "
+		"WAL frames before checkpoint (1000)\n"
+		"  -D, --dir PATH               "
+		"parent of the data directories (/tmp)\n");
+	exit(2);
+}
+
+static unsigned parseUnsigned(const char *name, const char *value)
+{
+	char *end;
+	unsigned long n = strtoul(value, &end, 10);
+	if (*value == '\0' || *end != '\0' || n > UINT_MAX) {
+		fprintf(stderr, "dqlite-bench: invalid %s: %s\n", name, value);
+		exit(2);
+	}
+	return (unsigned)n;
+}
+
+static void parseOptions(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+	    {"workload", required_argument, NULL, 'w'},
+	    {"nodes", required_argument, NULL, 'n'},
+	    {"transport", required_argument, NULL, 't'},
+	    {"port", required_argument, NULL, 'p'},
+	    {"clients", required_argument, NULL, 'c'},
+	    {"duration", required_argument, NULL, 'd'},
+	    {"rows", required_argument, NULL, 'r'},
+	    {"value-size", required_argument, NULL, 's'},
+	    {"batch", required_argument, NULL, 'b'},
+	    {"scan", required_argument, NULL, 'l'},
+	    {"read-ratio", required_argument, NULL, 'R'},
+	    {"page-size", required_argument, NULL, 'P'},
+	    {"checkpoint-threshold", required_argument, NULL, 'C'},
+	    {"dir", required_argument, NULL, 'D'},
+	    {"help", no_argument, NULL, 'h'},
+	    {NULL, 0, NULL, 0},
+	};
+	int opt;
+	int i;
+
+	while ((opt = getopt_long(argc, argv, "w:n:t:p:c:d:r:s:b:l:R:P:C:D:h",
+				  long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'w':
+				for (i = 0; workloads[i] != NULL; i++) {
+					if (strcmp(optarg, workloads[i]) == 0) {
+						break;
+					}
+				}
+				if (workloads[i] == NULL) {
+					usage();
+				}
+				options.workload = i;
+				break;
+			case 'n':
+				options.nodes = parseUnsigned("nodes", optarg);
+				break;
+			case 't':
+				if (strcmp(optarg, "tcp") == 0) {
+					options.tcp = true;
+				} else if (strcmp(optarg, "unix") == 0) {
+					options.tcp = false;
+				} else {
+					usage();
+				}
+				break;
+			case 'p':
+				options.port = parseUnsigned("port", optarg);
+				break;
+			case 'c':
+				options.clients =
+				    parseUnsigned("clients", optarg);
+				break;
+			case 'd':
+				options.duration =
+				    parseUnsigned("duration", optarg);
+				break;
+			case 'r':
+				options.rows = parseUnsigned("rows", optarg);
+				break;
+			case 's':
+				options.value_size =
+				    parseUnsigned("value size", optarg);
+				break;
+			case 'b':
+				options.batch = parseUnsigned("batch", optarg);
+				break;
+			case 'l':
+				options.scan = parseUnsigned("scan", optarg);
+				break;
+			case 'R':
+				options.read_ratio =
+				    parseUnsigned("read ratio", optarg);
+				break;
+			case 'P':
+				options.page_size =
+				    parseUnsigned("page size", optarg);
+				break;
+			case 'C':
+				options.checkpoint_threshold =
+				    parseUnsigned("checkpoint threshold", optarg);
+				break;
+			case 'D':
+				options.dir = optarg;
+				break;
+			default:
+				usage();
+		}
+	}
+
+	if (optind != argc || options.nodes == 0 ||
+	    options.nodes > MAX_NODES || options.clients == 0 ||
+	    options.batch == 0 || options.read_ratio > 100) {
+		usage();
+	}
+	if (options.workload == SELECT || options.workload == SCAN ||
+	    options.workload == MIXED) {
+		if (options.rows == 0) {
+			usage();
+		}
+	}
+}
+
+/* Connect to a node, either over an abstract Unix socket (addresses starting
+ * with '@') or over TCP (host:port addresses). */
+static int connectFunc(void *arg, const char *address, int *fd)
+{
+	struct sockaddr_un addr_un;
+	struct sockaddr_in addr_in;
+	struct sockaddr *addr;
+	socklen_t len;
+	(void)arg;
+
+	if (address[0] == '@') {
+		memset(&addr_un, 0, sizeof addr_un);
+		addr_un.sun_family = AF_UNIX;
+		strcpy(addr_un.sun_path + 1, address + 1);
+		addr = (struct sockaddr *)&addr_un;
+		len = (socklen_t)(sizeof(sa_family_t) + strlen(address));
+		*fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	} else {
+		char host[64];
+		const char *colon = strchr(address, ':');
+		if (colon == NULL || (size_t)(colon - address) >= sizeof host) {
+			return DQLITE_ERROR;
+		}
+		memcpy(host, address, (size_t)(colon - address));
+		host[colon - address] = '\0';
+		memset(&addr_in, 0, sizeof addr_in);
+		addr_in.sin_family = AF_INET;
+		addr_in.sin_port = htons((uint16_t)atoi(colon + 1));
+		if (inet_pton(AF_INET, host, &addr_in.sin_addr) != 1) {
+			return DQLITE_ERROR;
+		}
+		addr = (struct sockaddr *)&addr_in;
+		len = sizeof addr_in;
+		*fd = socket(AF_INET, SOCK_STREAM, 0);
+	}
+
+	if (*fd == -1) {
+		return DQLITE_ERROR;
+	}
+	if (connect(*fd, addr, len) != 0) {
+		close(*fd);
+		return DQLITE_ERROR;
+	}
+	return 0;
+}
+
+/* Connect the given client to the given node and open the bench database. */
+static int clientConnect(struct client *c, struct node *n)
+{
+	int fd;
+	int rv;
+
+	rv = connectFunc(NULL, n->address, &fd);
+	if (rv != 0) {
+		goto err;
+	}
+	rv = clientInit(c, fd);
+	if (rv != 0) {
+		goto err_after_connect;
+	}
+	rv = clientSendHandshake(c);
+	if (rv != 0) {
+		goto err_after_client_init;
+	}
+	rv = clientSendOpen(c, "bench");
+	if (rv != 0) {
+		goto err_after_client_init;
+	}
+	rv = clientRecvDb(c);
+	if (rv != 0) {
+		goto err_after_client_init;
+	}
+	return 0;
+
+err_after_client_init:
+	clientClose(c);
+err_after_connect:
+	close(fd);
+err:
+	return rv;
+}
+
+static void clientDisconnect(struct client *c)
+{
+	close(c->fd);
+	clientClose(c);
+}
+
+/* Prepare and execute the given SQL, without parameters. */
+static int execSQL(struct client *c, const char *sql)
+{
+	unsigned stmt_id;
+	unsigned last_insert_id;
+	unsigned rows_affected;
+	int rv;
+
+	rv = clientSendPrepare(c, sql);
+	if (rv != 0) {
+		return rv;
+	}
+	rv = clientRecvStmt(c, &stmt_id);
+	if (rv != 0) {
+		return rv;
+	}
+	rv = clientSendExec(c, stmt_id);
+	if (rv != 0) {
+		return rv;
+	}
+	return clientRecvResult(c, &last_insert_id, &rows_affected);
+}
+
+/* Execute the given prepared statement. */
+static int exec(struct client *c,
+		unsigned stmt_id,
+		struct value *params,
+		unsigned n)
+{
+	unsigned last_insert_id;
+	unsigned rows_affected;
+	int rv;
+
+	rv = clientSendExecParams(c, stmt_id, params, n);
+	if (rv != 0) {
+		return rv;
+	}
+	return clientRecvResult(c, &last_insert_id, &rows_affected);
+}
+
+/* Run the given prepared query, receiving all its rows. */
+static int query(struct client *c,
+		 unsigned stmt_id,
+		 struct value *params,
+		 unsigned n,
+		 uint64_t *count)
+{
+	struct rows rows;
+	struct row *row;
+	int rv;
+
+	rv = clientSendQueryParams(c, stmt_id, params, n);
+	if (rv != 0) {
+		return rv;
+	}
+	do {
+		rv = clientRecvRows(c, &rows);
+		if (rv != 0) {
+			return rv;
+		}
+		for (row = rows.next; row != NULL; row = row->next) {
+			(*count)++;
+		}
+		clientCloseRows(&rows);
+	} while (rows.more);
+
+	return 0;
+}
+
+/* Insert a single row with a random key. */
+static int insertRow(struct worker *w)
+{
+	struct value params[2];
+
+	params[0].type = SQLITE_INTEGER;
+	params[0].integer = rand_r(&w->seed);
+	params[1].type = SQLITE_BLOB;
+	params[1].blob.base = w->value;
+	params[1].blob.len = w->opts->value_size;
+
+	return exec(&w->client, w->stmts[STMT_INSERT], params, 2);
+}
+
+/* Return a random row ID such that @n rows starting from it exist. */
+static int64_t randomID(struct worker *w, unsigned n)
+{
+	unsigned range = w->opts->rows > n ? w->opts->rows - n + 1 : 1;
+	return 1 + (int64_t)((unsigned)rand_r(&w->seed) % range);
+}
+
+static int doInsert(struct worker *w)
+{
+	int rv = insertRow(w);
+	if (rv == 0) {
+		w->rows++;
+	}
+	return rv;
+}
+
+static int doBatch(struct worker *w)
+{
+	unsigned i;
+	int rv;
+
+	rv = exec(&w->client, w->stmts[STMT_BEGIN], NULL, 0);
+	if (rv != 0) {
+		return rv;
+	}
+	for (i = 0; i < w->opts->batch; i++) {
+		rv = insertRow(w);
+		if (rv != 0) {
+			goto err;
+		}
+	}
+	rv = exec(&w->client, w->stmts[STMT_COMMIT], NULL, 0);
+	if (rv != 0) {
+		goto err;
+	}
+	w->rows += w->opts->batch;
+	return 0;
+
+err:
+	exec(&w->client, w->stmts[STMT_ROLLBACK], NULL, 0);
+	return rv;
+}
+
+static int doSelect(struct worker *w)
+{
+	struct value param;
+	param.type = SQLITE_INTEGER;
+	param.integer = randomID(w, 1);
+	return query(&w->client, w->stmts[STMT_SELECT], &param, 1, &w->rows);
+}
+
+static int doScan(struct worker *w)
+{
+	struct value params[2];
+	params[0].type = SQLITE_INTEGER;
+	params[0].integer = randomID(w, w->opts->scan);
+	params[1].type = SQLITE_INTEGER;
+	params[1].integer = w->opts->scan;
+	return query(&w->client, w->stmts[STMT_SCAN], params, 2, &w->rows);
+}
+
+static int doMixed(struct worker *w)
+{
+	if ((unsigned)rand_r(&w->seed) % 100 < w->opts->read_ratio) {
+		return doSelect(w);
+	}
+	return doInsert(w);
+}
+
+static int (*operations[])(struct worker *w) = {doInsert, doBatch, doSelect,
+						doScan, doMixed};
+
+static void *workerRun(void *arg)
+{
+	struct worker *w = arg;
+	int (*op)(struct worker *w) = operations[w->opts->workload];
+	unsigned consecutive = 0;
+
+	pthread_barrier_wait(&ready);
+
+	while (!stop) {
+		unsigned long long start = metrics__now();
+		if (op(w) != 0) {
+			w->errors++;
+			consecutive++;
+			if (consecutive == MAX_ERRORS) {
+				w->failed = true;
+				break;
+			}
+			continue;
+		}
+		histogram__record(&w->latency, metrics__now() - start);
+		w->ops++;
+		consecutive = 0;
+	}
+
+	return NULL;
+}
+
+static int workerInit(struct worker *w, unsigned i)
+{
+	unsigned j;
+	int rv;
+
+	memset(w, 0, sizeof *w);
+	w->opts = &options;
+	w->seed = i + 1;
+	w->value = malloc(options.value_size > 0 ? options.value_size : 1);
+	if (w->value == NULL) {
+		return DQLITE_NOMEM;
+	}
+	for (j = 0; j < options.value_size; j++) {
+		((uint8_t *)w->value)[j] = (uint8_t)rand_r(&w->seed);
+	}
+
+	rv = clientConnect(&w->client, &nodes[0]);
+	if (rv != 0) {
+		goto err_after_value_alloc;
+	}
+	for (j = 0; j < N_STMTS; j++) {
+		rv = clientSendPrepare(&w->client, statements[j]);
+		if (rv != 0) {
+			goto err_after_connect;
+		}
+		rv = clientRecvStmt(&w->client, &w->stmts[j]);
+		if (rv != 0) {
+			goto err_after_connect;
+		}
+	}
+	return 0;
+
+err_after_connect:
+	clientDisconnect(&w->client);
+err_after_value_alloc:
+	free(w->value);
+	return rv;
+}
+
+static void workerClose(struct worker *w)
+{
+	clientDisconnect(&w->client);
+	free(w->value);
+}
+
+static int nodeStart(struct node *n, const char *dir, unsigned id)
+{
+	int rv;
+
+	n->id = id;
+	if (options.tcp) {
+		sprintf(n->address, "127.0.0.1:%u", options.port + id - 1);
+	} else {
+		sprintf(n->address, "@dqlite-bench-%d-%u", (int)getpid(), id);
+	}
+	sprintf(n->dir, "%s/%u", dir, id);
+	if (mkdir(n->dir, 0755) != 0) {
+		return DQLITE_ERROR;
+	}
+
+	rv = dqlite_node_create(id, n->address, n->dir, &n->dqlite);
+	if (rv != 0) {
+		return rv;
+	}
+	rv = dqlite_node_set_bind_address(n->dqlite, n->address);
+	if (rv != 0) {
+		goto err;
+	}
+	rv = dqlite_node_set_connect_func(n->dqlite, connectFunc, NULL);
+	if (rv != 0) {
+		goto err;
+	}
+
+	/* These tunables have no public setter yet. */
+	n->dqlite->config.page_size = options.page_size;
+	n->dqlite->config.checkpoint_threshold = options.checkpoint_threshold;
+
+	rv = dqlite_node_start(n->dqlite);
+	if (rv != 0) {
+		goto err;
+	}
+	return 0;
+
+err:
+	dqlite_node_destroy(n->dqlite);
+	n->dqlite = NULL;
+	return rv;
+}
+
+static void nodeStop(struct node *n)
+{
+	if (n->dqlite == NULL) {
+		return;
+	}
+	dqlite_node_stop(n->dqlite);
+	dqlite_node_destroy(n->dqlite);
+	n->dqlite = NULL;
+}
+
+/* Add the other nodes to the cluster bootstrapped by the first one, retrying
+ * until it's elected leader. */
+static int clusterJoin(struct client *c)
+{
+	unsigned i;
+	unsigned attempts;
+	int rv;
+
+	for (i = 1; i < options.nodes; i++) {
+		struct node *n = &nodes[i];
+		for (attempts = 0; attempts < 300; attempts++) {
+			rv = clientSendAdd(c, n->id, n->address);
+			if (rv != 0) {
+				return rv;
+			}
+			rv = clientRecvEmpty(c);
+			if (rv == 0) {
+				break;
+			}
+			usleep(100 * 1000);
+		}
+		if (rv != 0) {
+			return rv;
+		}
+		rv = clientSendAssign(c, n->id, DQLITE_VOTER);
+		if (rv != 0) {
+			return rv;
+		}
+		rv = clientRecvEmpty(c);
+		if (rv != 0) {
+			return rv;
+		}
+	}
+	return 0;
+}
+
+/* Create the table and wait for the leader to accept writes. */
+static int setupSchema(struct client *c)
+{
+	unsigned attempts;
+	int rv;
+
+	for (attempts = 0; attempts < 300; attempts++) {
+		rv = execSQL(c,
+			     "CREATE TABLE IF NOT EXISTS bench "
+			     "(id INTEGER PRIMARY KEY, k INTEGER, v BLOB)");
+		if (rv == 0) {
+			return 0;
+		}
+		usleep(100 * 1000);
+	}
+	return rv;
+}
+
+/* Load the table with the rows read by the read workloads. */
+static int load(void)
+{
+	struct worker w;
+	unsigned loaded = 0;
+	int rv;
+
+	rv = workerInit(&w, 0);
+	if (rv != 0) {
+		return rv;
+	}
+	while (loaded < options.rows) {
+		unsigned i;
+		unsigned n = options.rows - loaded;
+		if (n > LOAD_BATCH) {
+			n = LOAD_BATCH;
+		}
+		rv = exec(&w.client, w.stmts[STMT_BEGIN], NULL, 0);
+		if (rv != 0) {
+			goto out;
+		}
+		for (i = 0; i < n; i++) {
+			rv = insertRow(&w);
+			if (rv != 0) {
+				goto out;
+			}
+		}
+		rv = exec(&w.client, w.stmts[STMT_COMMIT], NULL, 0);
+		if (rv != 0) {
+			goto out;
+		}
+		loaded += n;
+	}
+
+out:
+	workerClose(&w);
+	return rv;
+}
+
+static void histogramMerge(struct histogram *dst, const struct histogram *src)
+{
+	unsigned i;
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max) {
+		dst->max = src->max;
+	}
+	for (i = 0; i < METRICS__BUCKETS; i++) {
+		dst->buckets[i] += src->buckets[i];
+	}
+}
+
+static void report(struct worker *workers, double seconds)
+{
+	struct histogram latency;
+	uint64_t ops = 0;
+	uint64_t errors = 0;
+	uint64_t rows = 0;
+	unsigned i;
+
+	memset(&latency, 0, sizeof latency);
+	for (i = 0; i < options.clients; i++) {
+		ops += workers[i].ops;
+		errors += workers[i].errors;
+		rows += workers[i].rows;
+		histogramMerge(&latency, &workers[i].latency);
+	}
+
+	printf("{\"workload\": \"%s\", \"nodes\": %u, \"transport\": \"%s\", "
+	       "\"clients\": %u, \"seconds\": %.3f, \"value_size\": %u, ",
+	       workloads[options.workload], options.nodes,
+	       options.tcp ? "tcp" : "unix", options.clients, seconds,
+	       options.value_size);
+	printf("\"batch\": %u, \"scan\": %u, \"read_ratio\": %u, "
+	       "\"page_size\": %u, \"checkpoint_threshold\": %u, ",
+	       options.batch, options.scan, options.read_ratio,
+	       options.page_size, options.checkpoint_threshold);
+	printf("\"ops\": %llu, \"errors\": %llu, \"rows\": %llu, "
+	       "\"ops_per_sec\": %.1f, \"rows_per_sec\": %.1f, ",
+	       (unsigned long long)ops, (unsigned long long)errors,
+	       (unsigned long long)rows, ops / seconds, rows / seconds);
+	printf("\"latency_us\": {\"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, "
+	       "\"p99\": %llu, \"p999\": %llu, \"max\": %llu}}\n",
+	       latency.count > 0 ? (double)latency.sum / latency.count : 0.0,
+	       (unsigned long long)histogram__percentile(&latency, 500),
+	       (unsigned long long)histogram__percentile(&latency, 900),
+	       (unsigned long long)histogram__percentile(&latency, 990),
+	       (unsigned long long)histogram__percentile(&latency, 999),
+	       (unsigned long long)latency.max);
+}
+
+static int removeEntry(const char *path,
+		       const struct stat *sb,
+		       int type,
+		       struct FTW *ftw)
+{
+	(void)sb;
+	(void)type;
+	(void)ftw;
+	return remove(path);
+}
+
+int main(int argc, char *argv[])
+{
+	char dir[PATH_MAX];
+	struct worker *workers;
+	struct client admin;
+	unsigned long long start;
+	double seconds;
+	unsigned started = 0;
+	unsigned i;
+	int status = 1;
+	int rv;
+
+	parseOptions(argc, argv);
+
+	snprintf(dir, sizeof dir, "%s/dqlite-bench-XXXXXX", options.dir);
+	if (mkdtemp(dir) == NULL) {
+		perror("dqlite-bench: mkdtemp");
+		return 1;
+	}
+
+	workers = calloc(options.clients, sizeof *workers);
+	if (workers == NULL) {
+		goto out;
+	}
+
+	for (i = 0; i < options.nodes; i++) {
+		rv = nodeStart(&nodes[i], dir, i + 1);
+		if (rv != 0) {
+			fprintf(stderr, "dqlite-bench: start node %u: %d\n",
+				i + 1, rv);
+			goto out_after_nodes_start;
+		}
+	}
+
+	rv = clientConnect(&admin, &nodes[0]);
+	if (rv != 0) {
+		fprintf(stderr, "dqlite-bench: connect: %d\n", rv);
+		goto out_after_nodes_start;
+	}
+	rv = clusterJoin(&admin);
+	if (rv == 0) {
+		rv = setupSchema(&admin);
+	}
+	clientDisconnect(&admin);
+	if (rv != 0) {
+		fprintf(stderr, "dqlite-bench: setup cluster: %d\n", rv);
+		goto out_after_nodes_start;
+	}
+
+	if (options.workload == SELECT || options.workload == SCAN ||
+	    options.workload == MIXED) {
+		rv = load();
+		if (rv != 0) {
+			fprintf(stderr, "dqlite-bench: load rows: %d\n", rv);
+			goto out_after_nodes_start;
+		}
+	}
+
+	for (i = 0; i < options.clients; i++) {
+		rv = workerInit(&workers[i], i + 1);
+		if (rv != 0) {
+			fprintf(stderr, "dqlite-bench: client %u: %d\n", i, rv);
+			goto out_after_workers_init;
+		}
+		started++;
+	}
+
+	pthread_barrier_init(&ready, NULL, options.clients + 1);
+	for (i = 0; i < options.clients; i++) {
+		pthread_create(&workers[i].thread, NULL, workerRun,
+			       &workers[i]);
+	}
+	pthread_barrier_wait(&ready);
+	start = metrics__now();
+	sleep(options.duration);
+	stop = true;
+	for (i = 0; i < options.clients; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+	seconds = (double)(metrics__now() - start) / 1000000;
+	pthread_barrier_destroy(&ready);
+
+	report(workers, seconds);
+	status = 0;
+	for (i = 0; i < options.clients; i++) {
+		if (workers[i].failed) {
+			fprintf(stderr, "dqlite-bench: client %u failed\n", i);
+			status = 1;
+		}
+	}
+
+out_after_workers_init:
+	for (i = 0; i < started; i++) {
+		workerClose(&workers[i]);
+	}
+out_after_nodes_start:
+	for (i = options.nodes; i > 0; i--) {
+		nodeStop(&nodes[i - 1]);
+	}
+	free(workers);
+out:
+	nftw(dir, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+	return status;
+}
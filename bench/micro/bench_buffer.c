@@ -0,0 +1,53 @@
+#include "../../src/lib/buffer.h"
+
+#include "harness.h"
+
+/* Reset the buffer after this many bytes, so it doesn't grow forever. */
+#define MAX_SIZE (1024 * 1024)
+
+struct state
+{
+	struct buffer buffer;
+	size_t size; /* Bytes to advance at each iteration */
+};
+
+/* Advance a buffer by @arg bytes at a time. */
+static void *setup(unsigned long arg, size_t *bytes)
+{
+	struct state *s = malloc(sizeof *s);
+	int rv;
+	MICRO_CHECK(s != NULL);
+	rv = buffer__init(&s->buffer);
+	MICRO_CHECK(rv == 0);
+	s->size = arg;
+	/* Grow the buffer to its final size up front. */
+	MICRO_CHECK(buffer__advance(&s->buffer, MAX_SIZE) != NULL);
+	buffer__reset(&s->buffer);
+	*bytes = arg;
+	return s;
+}
+
+static void tearDown(void *data)
+{
+	struct state *s = data;
+	buffer__close(&s->buffer);
+	free(s);
+}
+
+static void run(void *data, unsigned long n)
+{
+	struct state *s = data;
+	unsigned long i;
+	for (i = 0; i < n; i++) {
+		if (buffer__offset(&s->buffer) + s->size > MAX_SIZE) {
+			buffer__reset(&s->buffer);
+		}
+		MICRO_CHECK(buffer__advance(&s->buffer, s->size) != NULL);
+	}
+}
+
+struct micro micro_buffer[] = {
+    {"buffer_advance/8", setup, run, tearDown, 8},
+    {"buffer_advance/4k", setup, run, tearDown, 4096},
+    MICRO_END,
+};
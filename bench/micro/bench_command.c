@@ -0,0 +1,110 @@
+#include <string.h>
+
+#include <raft.h>
+#include <sqlite3.h>
+
+#include "../../src/command.h"
+
+#include "harness.h"
+
+/* Number of frames of a command. */
+#define N_FRAMES 1000
+
+struct state
+{
+	sqlite3_wal_replication_frame frames[N_FRAMES];
+	void *pages;             /* Content of all pages */
+	struct command_frames c; /* Command to encode */
+	struct raft_buffer buf;  /* Encoded command */
+};
+
+/* A Frames command with N_FRAMES pages of @arg bytes each. */
+static void *setup(unsigned long arg, size_t *bytes)
+{
+	struct state *s = malloc(sizeof *s);
+	unsigned i;
+	int rv;
+
+	/* The page size field of a Frames command is 16 bits wide, so 64k
+	 * pages can't be encoded. */
+	MICRO_CHECK(arg < 65536);
+
+	MICRO_CHECK(s != NULL);
+	s->pages = malloc(N_FRAMES * arg);
+	MICRO_CHECK(s->pages != NULL);
+	memset(s->pages, 0xab, N_FRAMES * arg);
+
+	for (i = 0; i < N_FRAMES; i++) {
+		s->frames[i].pBuf = (uint8_t *)s->pages + i * arg;
+		s->frames[i].pgno = i + 1;
+		s->frames[i].iPrev = 0;
+	}
+
+	s->c.filename = "test.db";
+	s->c.tx_id = 1;
+	s->c.truncate = 0;
+	s->c.is_commit = 1;
+	s->c.frames.n_pages = N_FRAMES;
+	s->c.frames.page_size = (uint16_t)arg;
+	s->c.frames.data = s->frames;
+
+	rv = command__encode(COMMAND_FRAMES, &s->c, &s->buf);
+	MICRO_CHECK(rv == 0);
+	*bytes = s->buf.len;
+
+	return s;
+}
+
+static void tearDown(void *data)
+{
+	struct state *s = data;
+	raft_free(s->buf.base);
+	free(s->pages);
+	free(s);
+}
+
+static void runEncode(void *data, unsigned long n)
+{
+	struct state *s = data;
+	struct raft_buffer buf;
+	unsigned long i;
+	int rv;
+
+	for (i = 0; i < n; i++) {
+		rv = command__encode(COMMAND_FRAMES, &s->c, &buf);
+		MICRO_CHECK(rv == 0);
+		raft_free(buf.base);
+	}
+}
+
+/* Decode the command and extract its page numbers and pages, like the FSM
+ * does when applying it. */
+static void runDecode(void *data, unsigned long n)
+{
+	struct state *s = data;
+	unsigned long i;
+	int rv;
+
+	for (i = 0; i < n; i++) {
+		struct command_frames *c;
+		unsigned *page_numbers;
+		void *pages;
+		int type;
+		rv = command__decode(&s->buf, &type, (void **)&c);
+		MICRO_CHECK(rv == 0);
+		MICRO_CHECK(type == COMMAND_FRAMES);
+		rv = command_frames__page_numbers(c, &page_numbers);
+		MICRO_CHECK(rv == 0);
+		command_frames__pages(c, &pages);
+		sqlite3_free(page_numbers);
+		raft_free(c);
+	}
+}
+
+struct micro micro_command[] = {
+    {"command_encode/frames-1000x4k", setup, runEncode, tearDown, 4096},
+    {"command_encode/frames-1000x32k", setup, runEncode, tearDown, 32768},
+    {"command_decode/frames-1000x4k", setup, runDecode, tearDown, 4096},
+    {"command_decode/frames-1000x32k", setup, runDecode, tearDown, 32768},
+    MICRO_END,
+};
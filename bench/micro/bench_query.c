@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <sqlite3.h>
+
+#include "../../src/lib/buffer.h"
+#include "../../src/query.h"
+
+#include "harness.h"
+
+/* Number of rows of the queried tables. */
+#define N_ROWS 10000
+
+struct state
+{
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	struct buffer buffer;
+};
+
+static void exec(sqlite3 *db, const char *sql)
+{
+	int rv = sqlite3_exec(db, sql, NULL, NULL, NULL);
+	MICRO_CHECK(rv == SQLITE_OK);
+}
+
+/* Query an in-memory table whose rows have 16 columns, or a single blob
+ * column of @arg bytes if @arg is not zero. Each iteration encodes one
+ * batch of rows. */
+static void *setup(unsigned long arg, size_t *bytes)
+{
+	struct state *s = malloc(sizeof *s);
+	char sql[512];
+	int rv;
+
+	MICRO_CHECK(s != NULL);
+	rv = sqlite3_open(":memory:", &s->db);
+	MICRO_CHECK(rv == SQLITE_OK);
+
+	if (arg == 0) {
+		exec(s->db,
+		     "CREATE TABLE t (a INT, b REAL, c TEXT, d BLOB, e INT, "
+		     "f REAL, g TEXT, h BLOB, i INT, j REAL, k TEXT, l BLOB, "
+		     "m INT, n REAL, o TEXT, p BLOB)");
+		sprintf(sql,
+			"WITH RECURSIVE s(x) AS (SELECT 1 UNION ALL "
+			"SELECT x + 1 FROM s WHERE x < %d) "
+			"INSERT INTO t SELECT x, x * 1.5, printf('%%032d', x), "
+			"randomblob(64), x, x * 2.5, 'text', randomblob(8), x, "
+			"x * 3.5, NULL, NULL, x, x * 4.5, 'more text', "
+			"randomblob(32) FROM s",
+			N_ROWS);
+	} else {
+		exec(s->db, "CREATE TABLE t (v BLOB)");
+		sprintf(sql,
+			"WITH RECURSIVE s(x) AS (SELECT 1 UNION ALL "
+			"SELECT x + 1 FROM s WHERE x < %d) "
+			"INSERT INTO t SELECT randomblob(%lu) FROM s",
+			N_ROWS, arg);
+	}
+	exec(s->db, sql);
+
+	rv = sqlite3_prepare_v2(s->db, "SELECT * FROM t", -1, &s->stmt, NULL);
+	MICRO_CHECK(rv == SQLITE_OK);
+	rv = buffer__init(&s->buffer);
+	MICRO_CHECK(rv == 0);
+
+	/* Measure the size of the first batch. */
+	rv = query__batch(s->stmt, &s->buffer);
+	MICRO_CHECK(rv == SQLITE_ROW);
+	*bytes = buffer__offset(&s->buffer);
+	sqlite3_reset(s->stmt);
+
+	return s;
+}
+
+static void tearDown(void *data)
+{
+	struct state *s = data;
+	buffer__close(&s->buffer);
+	sqlite3_finalize(s->stmt);
+	sqlite3_close(s->db);
+	free(s);
+}
+
+static void run(void *data, unsigned long n)
+{
+	struct state *s = data;
+	unsigned long i;
+	int rv;
+	for (i = 0; i < n; i++) {
+		buffer__reset(&s->buffer);
+		rv = query__batch(s->stmt, &s->buffer);
+		if (rv == SQLITE_DONE) {
+			sqlite3_reset(s->stmt);
+			continue;
+		}
+		MICRO_CHECK(rv == SQLITE_ROW);
+	}
+}
+
+struct micro micro_query[] = {
+    {"query_batch/wide", setup, run, tearDown, 0},
+    {"query_batch/blob-4k", setup, run, tearDown, 4096},
+    MICRO_END,
+};
@@ -0,0 +1,107 @@
+#include <stdio.h>
+
+#include <sqlite3.h>
+
+#include "../../src/config.h"
+#include "../../src/registry.h"
+#include "../../src/vfs.h"
+
+#include "harness.h"
+
+struct state
+{
+	struct config config;
+	struct sqlite3_vfs vfs;
+	struct registry registry;
+	unsigned n; /* Number of databases */
+};
+
+/* Register, open and write to @arg databases, each with its database and WAL
+ * files in the VFS. */
+static void *setup(unsigned long arg, size_t *bytes)
+{
+	struct state *s = malloc(sizeof *s);
+	int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+	char filename[32];
+	struct db *db;
+	sqlite3 *conn;
+	unsigned i;
+	int rv;
+
+	MICRO_CHECK(s != NULL);
+	rv = config__init(&s->config, 1, "1");
+	MICRO_CHECK(rv == 0);
+	rv = vfsInit(&s->vfs, &s->config);
+	MICRO_CHECK(rv == 0);
+	registry__init(&s->registry, &s->config);
+	s->n = (unsigned)arg;
+
+	for (i = 0; i < s->n; i++) {
+		sprintf(filename, "test-%u.db", i);
+		rv = registry__db_get(&s->registry, filename, &db);
+		MICRO_CHECK(rv == 0);
+		rv = sqlite3_open_v2(filename, &conn, flags, s->config.name);
+		MICRO_CHECK(rv == SQLITE_OK);
+		rv = sqlite3_exec(conn,
+				  "PRAGMA synchronous=OFF;"
+				  "PRAGMA journal_mode=WAL;"
+				  "CREATE TABLE test (n INT);"
+				  "INSERT INTO test(n) VALUES(1)",
+				  NULL, NULL, NULL);
+		MICRO_CHECK(rv == SQLITE_OK);
+		rv = sqlite3_close(conn);
+		MICRO_CHECK(rv == SQLITE_OK);
+	}
+
+	*bytes = 0;
+	return s;
+}
+
+static void tearDown(void *data)
+{
+	struct state *s = data;
+	registry__close(&s->registry);
+	vfsClose(&s->vfs);
+	config__close(&s->config);
+	free(s);
+}
+
+/* Look up registered databases by name. */
+static void runLookup(void *data, unsigned long n)
+{
+	struct state *s = data;
+	char filename[32];
+	struct db *db;
+	unsigned long i;
+	int rv;
+	for (i = 0; i < n; i++) {
+		sprintf(filename, "test-%lu.db", i % s->n);
+		rv = registry__db_get(&s->registry, filename, &db);
+		MICRO_CHECK(rv == 0);
+	}
+}
+
+/* Open and close connections against existing databases, which looks up
+ * their files in the VFS. */
+static void runOpen(void *data, unsigned long n)
+{
+	struct state *s = data;
+	char filename[32];
+	sqlite3 *conn;
+	unsigned long i;
+	int rv;
+	for (i = 0; i < n; i++) {
+		sprintf(filename, "test-%lu.db", i % s->n);
+		rv = sqlite3_open_v2(filename, &conn, SQLITE_OPEN_READWRITE,
+				     s->config.name);
+		MICRO_CHECK(rv == SQLITE_OK);
+		rv = sqlite3_close(conn);
+		MICRO_CHECK(rv == SQLITE_OK);
+	}
+}
+
+struct micro micro_registry[] = {
+    {"registry_lookup/10000-dbs", setup, runLookup, tearDown, 10000},
+    {"registry_open/10000-dbs", setup, runOpen, tearDown, 10000},
+    MICRO_END,
+};
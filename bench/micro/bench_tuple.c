@@ -0,0 +1,161 @@
+#include <string.h>
+
+#include <sqlite3.h>
+
+#include "../../src/lib/buffer.h"
+#include "../../src/tuple.h"
+
+#include "harness.h"
+
+/* Number of columns of a wide row. */
+#define WIDE_COLUMNS 16
+
+/* Size of the text and blob columns of a wide row. */
+#define WIDE_TEXT 32
+#define WIDE_BLOB 256
+
+struct state
+{
+	struct value values[WIDE_COLUMNS];
+	unsigned n;          /* Number of values in the tuple */
+	char text[WIDE_TEXT];
+	void *blob;
+	struct buffer buffer; /* Encoded tuple */
+};
+
+static void encode(struct state *s)
+{
+	struct tuple_encoder encoder;
+	unsigned i;
+	int rv;
+
+	buffer__reset(&s->buffer);
+	rv = tuple_encoder__init(&encoder, s->n, TUPLE__ROW, &s->buffer);
+	MICRO_CHECK(rv == 0);
+	for (i = 0; i < s->n; i++) {
+		rv = tuple_encoder__next(&encoder, &s->values[i]);
+		MICRO_CHECK(rv == 0);
+	}
+}
+
+/* A row of mixed integer, float, text, blob and null columns. */
+static void *setupWide(unsigned long arg, size_t *bytes)
+{
+	struct state *s = malloc(sizeof *s);
+	unsigned i;
+	int rv;
+	(void)arg;
+
+	MICRO_CHECK(s != NULL);
+	memset(s->text, 'x', WIDE_TEXT - 1);
+	s->text[WIDE_TEXT - 1] = '\0';
+	s->blob = malloc(WIDE_BLOB);
+	MICRO_CHECK(s->blob != NULL);
+	memset(s->blob, 0xab, WIDE_BLOB);
+
+	s->n = WIDE_COLUMNS;
+	for (i = 0; i < s->n; i++) {
+		struct value *v = &s->values[i];
+		switch (i % 5) {
+			case 0:
+				v->type = SQLITE_INTEGER;
+				v->integer = (int64_t)i * 1000003;
+				break;
+			case 1:
+				v->type = SQLITE_FLOAT;
+				v->float_ = i * 3.14;
+				break;
+			case 2:
+				v->type = SQLITE_TEXT;
+				v->text = s->text;
+				break;
+			case 3:
+				v->type = SQLITE_BLOB;
+				v->blob.base = s->blob;
+				v->blob.len = WIDE_BLOB;
+				break;
+			case 4:
+				v->type = SQLITE_NULL;
+				v->null = 0;
+				break;
+		}
+	}
+
+	rv = buffer__init(&s->buffer);
+	MICRO_CHECK(rv == 0);
+	encode(s);
+	*bytes = buffer__offset(&s->buffer);
+
+	return s;
+}
+
+/* A row with a single blob of @arg bytes. */
+static void *setupBlob(unsigned long arg, size_t *bytes)
+{
+	struct state *s = malloc(sizeof *s);
+	int rv;
+
+	MICRO_CHECK(s != NULL);
+	s->blob = malloc(arg);
+	MICRO_CHECK(s->blob != NULL);
+	memset(s->blob, 0xab, arg);
+
+	s->n = 1;
+	s->values[0].type = SQLITE_BLOB;
+	s->values[0].blob.base = s->blob;
+	s->values[0].blob.len = arg;
+
+	rv = buffer__init(&s->buffer);
+	MICRO_CHECK(rv == 0);
+	encode(s);
+	*bytes = buffer__offset(&s->buffer);
+
+	return s;
+}
+
+static void tearDown(void *data)
+{
+	struct state *s = data;
+	buffer__close(&s->buffer);
+	free(s->blob);
+	free(s);
+}
+
+static void runEncode(void *data, unsigned long n)
+{
+	struct state *s = data;
+	unsigned long i;
+	for (i = 0; i < n; i++) {
+		encode(s);
+	}
+}
+
+static void runDecode(void *data, unsigned long n)
+{
+	struct state *s = data;
+	struct tuple_decoder decoder;
+	struct cursor cursor;
+	struct value value;
+	unsigned long i;
+	unsigned j;
+	int rv;
+
+	for (i = 0; i < n; i++) {
+		cursor.p = buffer__cursor(&s->buffer, 0);
+		cursor.cap = buffer__offset(&s->buffer);
+		rv = tuple_decoder__init(&decoder, s->n, TUPLE__ROW, &cursor);
+		MICRO_CHECK(rv == 0);
+		for (j = 0; j < s->n; j++) {
+			rv = tuple_decoder__next(&decoder, &value);
+			MICRO_CHECK(rv == 0);
+		}
+	}
+}
+
+struct micro micro_tuple[] = {
+    {"tuple_encode/wide", setupWide, runEncode, tearDown, 0},
+    {"tuple_encode/blob-64k", setupBlob, runEncode, tearDown, 65536},
+    {"tuple_decode/wide", setupWide, runDecode, tearDown, 0},
+    {"tuple_decode/blob-64k", setupBlob, runDecode, tearDown, 65536},
+    MICRO_END,
+};
@@ -0,0 +1,207 @@
+#include <string.h>
+
+#include <sqlite3.h>
+
+#include "../../src/config.h"
+#include "../../src/format.h"
+#include "../../src/vfs.h"
+
+#include "harness.h"
+
+/* Number of pages of the database and of the WAL. */
+#define N_PAGES 256
+
+struct state
+{
+	struct config config;
+	struct sqlite3_vfs vfs;
+	sqlite3_file *db;
+	sqlite3_file *wal;
+	unsigned page_size;
+	void *page;                                   /* Page buffer */
+	uint8_t frame_hdr[FORMAT__WAL_FRAME_HDR_SIZE]; /* Frame header buffer */
+};
+
+static sqlite3_file *openFile(struct state *s, const char *name, int type)
+{
+	sqlite3_file *file = malloc((size_t)s->vfs.szOsFile);
+	int flags = SQLITE_OPEN_EXCLUSIVE | SQLITE_OPEN_CREATE | type;
+	int rv;
+	MICRO_CHECK(file != NULL);
+	rv = s->vfs.xOpen(&s->vfs, name, file, flags, &flags);
+	MICRO_CHECK(rv == SQLITE_OK);
+	return file;
+}
+
+/* A database of N_PAGES pages of @arg bytes each. */
+static void *setupDb(unsigned long arg, size_t *bytes)
+{
+	struct state *s = malloc(sizeof *s);
+	uint8_t *header;
+	unsigned i;
+	int rv;
+
+	MICRO_CHECK(s != NULL);
+	rv = config__init(&s->config, 1, "1");
+	MICRO_CHECK(rv == 0);
+	rv = vfsInit(&s->vfs, &s->config);
+	MICRO_CHECK(rv == 0);
+
+	s->page_size = (unsigned)arg;
+	s->page = malloc(s->page_size);
+	MICRO_CHECK(s->page != NULL);
+	memset(s->page, 0, s->page_size);
+	memset(s->frame_hdr, 0, sizeof s->frame_hdr);
+
+	/* Every page carries the header of the first one, which doesn't hurt
+	 * other pages and lets any page be written at offset 0. A page size of
+	 * 65536 is stored as 1. */
+	header = s->page;
+	header[16] = (uint8_t)((s->page_size >> 8) & 0xff);
+	header[17] = s->page_size == FORMAT__PAGE_SIZE_MAX ? 1 : s->page_size & 0xff;
+
+	s->db = openFile(s, "bench.db", SQLITE_OPEN_MAIN_DB);
+	s->wal = NULL;
+	for (i = 0; i < N_PAGES; i++) {
+		rv = s->db->pMethods->xWrite(s->db, s->page, (int)s->page_size,
+					     (sqlite3_int64)i * s->page_size);
+		MICRO_CHECK(rv == SQLITE_OK);
+	}
+
+	*bytes = s->page_size;
+	return s;
+}
+
+/* Write the WAL frame with the given index. */
+static void writeFrame(struct state *s, unsigned i)
+{
+	sqlite3_int64 offset = FORMAT__WAL_HDR_SIZE +
+			       (sqlite3_int64)i * (FORMAT__WAL_FRAME_HDR_SIZE +
+						   s->page_size);
+	int rv;
+	rv = s->wal->pMethods->xWrite(s->wal, s->frame_hdr,
+				      FORMAT__WAL_FRAME_HDR_SIZE, offset);
+	MICRO_CHECK(rv == SQLITE_OK);
+	rv = s->wal->pMethods->xWrite(s->wal, s->page, (int)s->page_size,
+				      offset + FORMAT__WAL_FRAME_HDR_SIZE);
+	MICRO_CHECK(rv == SQLITE_OK);
+}
+
+/* Write the WAL header. */
+static void writeWalHeader(struct state *s)
+{
+	uint8_t header[FORMAT__WAL_HDR_SIZE];
+	int rv;
+
+	memset(header, 0, sizeof header);
+	header[8] = (uint8_t)((s->page_size >> 24) & 0xff);
+	header[9] = (uint8_t)((s->page_size >> 16) & 0xff);
+	header[10] = (uint8_t)((s->page_size >> 8) & 0xff);
+	header[11] = (uint8_t)(s->page_size & 0xff);
+
+	rv = s->wal->pMethods->xWrite(s->wal, header, sizeof header, 0);
+	MICRO_CHECK(rv == SQLITE_OK);
+}
+
+/* A database and a WAL of N_PAGES frames of @arg bytes each. */
+static void *setupWal(unsigned long arg, size_t *bytes)
+{
+	struct state *s = setupDb(arg, bytes);
+	unsigned i;
+
+	s->wal = openFile(s, "bench.db-wal", SQLITE_OPEN_WAL);
+	writeWalHeader(s);
+	for (i = 0; i < N_PAGES; i++) {
+		writeFrame(s, i);
+	}
+
+	*bytes = FORMAT__WAL_FRAME_HDR_SIZE + s->page_size;
+	return s;
+}
+
+static void tearDown(void *data)
+{
+	struct state *s = data;
+	if (s->wal != NULL) {
+		s->wal->pMethods->xClose(s->wal);
+		free(s->wal);
+	}
+	s->db->pMethods->xClose(s->db);
+	free(s->db);
+	free(s->page);
+	vfsClose(&s->vfs);
+	config__close(&s->config);
+	free(s);
+}
+
+static void runDbRead(void *data, unsigned long n)
+{
+	struct state *s = data;
+	unsigned long i;
+	int rv;
+	for (i = 0; i < n; i++) {
+		sqlite3_int64 offset = (sqlite3_int64)(i % N_PAGES) * s->page_size;
+		rv = s->db->pMethods->xRead(s->db, s->page, (int)s->page_size,
+					    offset);
+		MICRO_CHECK(rv == SQLITE_OK);
+	}
+}
+
+static void runDbWrite(void *data, unsigned long n)
+{
+	struct state *s = data;
+	unsigned long i;
+	int rv;
+	for (i = 0; i < n; i++) {
+		sqlite3_int64 offset = (sqlite3_int64)(i % N_PAGES) * s->page_size;
+		rv = s->db->pMethods->xWrite(s->db, s->page, (int)s->page_size,
+					     offset);
+		MICRO_CHECK(rv == SQLITE_OK);
+	}
+}
+
+static void runWalWrite(void *data, unsigned long n)
+{
+	struct state *s = data;
+	unsigned long i;
+	for (i = 0; i < n; i++) {
+		writeFrame(s, (unsigned)(i % N_PAGES));
+	}
+}
+
+/* Grow the WAL to N_PAGES frames and reset it, like a checkpoint does, which
+ * allocates all its pages and then releases them back to their slabs. */
+static void *setupWalReset(unsigned long arg, size_t *bytes)
+{
+	struct state *s = setupWal(arg, bytes);
+	*bytes *= N_PAGES;
+	return s;
+}
+
+static void runWalReset(void *data, unsigned long n)
+{
+	struct state *s = data;
+	unsigned long i;
+	unsigned j;
+	int rv;
+	for (i = 0; i < n; i++) {
+		rv = s->wal->pMethods->xTruncate(s->wal, 0);
+		MICRO_CHECK(rv == SQLITE_OK);
+		writeWalHeader(s);
+		for (j = 0; j < N_PAGES; j++) {
+			writeFrame(s, j);
+		}
+	}
+}
+
+struct micro micro_vfs[] = {
+    {"vfs_read/db-4k", setupDb, runDbRead, tearDown, 4096},
+    {"vfs_read/db-64k", setupDb, runDbRead, tearDown, 65536},
+    {"vfs_write/db-4k", setupDb, runDbWrite, tearDown, 4096},
+    {"vfs_write/db-64k", setupDb, runDbWrite, tearDown, 65536},
+    {"vfs_write/wal-4k", setupWal, runWalWrite, tearDown, 4096},
+    {"vfs_write/wal-64k", setupWal, runWalWrite, tearDown, 65536},
+    {"vfs_wal_reset/512", setupWalReset, runWalReset, tearDown, 512},
+    {"vfs_wal_reset/4k", setupWalReset, runWalReset, tearDown, 4096},
+    MICRO_END,
+};
@@ -0,0 +1,89 @@
+#include <time.h>
+
+#include "harness.h"
+
+/* Minimum duration of a calibration run, in nanoseconds. */
+#define CALIBRATION_MIN (10 * 1000 * 1000)
+
+static unsigned long long now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000 +
+	       (unsigned long long)ts.tv_nsec;
+}
+
+/* Return the nanoseconds taken by @n iterations. */
+static unsigned long long timeRun(const struct micro *m,
+				  void *state,
+				  unsigned long n)
+{
+	unsigned long long start = now();
+	m->run(state, n);
+	return now() - start;
+}
+
+void micro_print_header(const struct micro_options *options)
+{
+	if (options->json) {
+		return;
+	}
+	printf("%-32s %12s %14s %12s\n", "benchmark", "iterations", "ns/op",
+	       "MB/s");
+}
+
+void micro_run(const struct micro *m, const struct micro_options *options)
+{
+	unsigned long long elapsed;
+	unsigned long long target;
+	unsigned long long best = 0;
+	unsigned long n = 1;
+	double ns_per_op;
+	double mb_per_sec;
+	size_t bytes = 0;
+	void *state;
+	unsigned i;
+
+	state = m->setup(m->arg, &bytes);
+
+	/* Grow the number of iterations until a run is long enough for the
+	 * clock resolution not to matter. */
+	while (1) {
+		elapsed = timeRun(m, state, n);
+		if (elapsed >= CALIBRATION_MIN) {
+			break;
+		}
+		n *= elapsed > 0 && CALIBRATION_MIN / elapsed < 10
+			 ? CALIBRATION_MIN / elapsed + 1
+			 : 10;
+	}
+
+	/* Scale it to the target duration. */
+	target = (unsigned long long)options->target * 1000 * 1000;
+	if (elapsed < target) {
+		n = (unsigned long)((double)n * target / elapsed);
+	}
+
+	for (i = 0; i < options->runs; i++) {
+		elapsed = timeRun(m, state, n);
+		if (i == 0 || elapsed < best) {
+			best = elapsed;
+		}
+	}
+
+	m->tear_down(state);
+
+	ns_per_op = (double)best / n;
+	mb_per_sec = bytes > 0 ? (double)bytes * 1000 / ns_per_op : 0;
+
+	if (options->json) {
+		printf("{\"benchmark\": \"%s\", \"iterations\": %lu, "
+		       "\"ns_per_op\": %.1f, \"bytes_per_op\": %zu, "
+		       "\"mb_per_sec\": %.1f}\n",
+		       m->name, n, ns_per_op, bytes, mb_per_sec);
+	} else {
+		printf("%-32s %12lu %14.1f %12.1f\n", m->name, n, ns_per_op,
+		       mb_per_sec);
+	}
+	fflush(stdout);
+}
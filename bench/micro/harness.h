@@ -0,0 +1,67 @@
+/**
+ * Minimal harness for timing hot-path functions in isolation.
+ *
+ * A benchmark is a set of callbacks: setup() builds its input once and
+ * returns the number of bytes each iteration processes, run() performs the
+ * given number of iterations, and tear_down() releases the input. The harness
+ * first calibrates the number of iterations so that a run lasts long enough to
+ * be measured, then keeps the best of several runs.
+ */
+
+#ifndef MICRO_HARNESS_H_
+#define MICRO_HARNESS_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Build the input of a benchmark, given its argument, and set @bytes to the
+ * amount of data processed by a single iteration, or zero. */
+typedef void *(*micro_setup_cb)(unsigned long arg, size_t *bytes);
+
+/* Perform @n iterations. */
+typedef void (*micro_run_cb)(void *state, unsigned long n);
+
+/* Release the input of a benchmark. */
+typedef void (*micro_tear_down_cb)(void *state);
+
+struct micro
+{
+	const char *name;             /* Unique name, as "function/input" */
+	micro_setup_cb setup;         /* Build the input */
+	micro_run_cb run;             /* Run iterations */
+	micro_tear_down_cb tear_down; /* Release the input */
+	unsigned long arg;            /* Passed to setup() */
+};
+
+/* Terminate an array of benchmarks. */
+#define MICRO_END {NULL, NULL, NULL, NULL, 0}
+
+/* Abort the whole program if the given condition is false. Benchmarks don't
+ * deal with errors, since they'd make the numbers meaningless anyway. */
+#define MICRO_CHECK(COND)                                                \
+	if (!(COND)) {                                                   \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,   \
+			__LINE__, #COND);                                \
+		abort();                                                 \
+	}
+
+/* Options of a harness run. */
+struct micro_options
+{
+	unsigned target; /* Milliseconds each measured run should last */
+	unsigned runs;   /* Measured runs, keeping the best one */
+	int json;        /* Print results as JSON lines */
+};
+
+/**
+ * Run the given benchmark and print its results.
+ */
+void micro_run(const struct micro *m, const struct micro_options *options);
+
+/**
+ * Print the header of the results table, unless printing JSON.
+ */
+void micro_print_header(const struct micro_options *options);
+
+#endif /* MICRO_HARNESS_H_ */
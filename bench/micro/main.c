@@ -0,0 +1,84 @@
+#include <getopt.h>
+#include <string.h>
+
+#include "harness.h"
+
+extern struct micro micro_buffer[];
+extern struct micro micro_command[];
+extern struct micro micro_query[];
+extern struct micro micro_registry[];
+extern struct micro micro_tuple[];
+extern struct micro micro_vfs[];
+
+static struct micro *suites[] = {
+    micro_buffer, micro_command, micro_query, micro_registry,
+    micro_tuple,  micro_vfs,     NULL,
+};
+
+static void usage(const char *program)
+{
+	fprintf(stderr,
+		"usage: %s [-t MSECS] [-r RUNS] [-j] [FILTER...]\n"
+		"\n"
+		"  -t MSECS  target duration of each run (default 200)\n"
+		"  -r RUNS   number of runs, keeping the best (default 5)\n"
+		"  -j        print results as JSON lines\n"
+		"  FILTER    only run benchmarks whose name contains it\n",
+		program);
+}
+
+/* Return true if the benchmark name matches one of the filters, or if there
+ * are no filters. */
+static int match(const char *name, char **filters, int n)
+{
+	int i;
+	if (n == 0) {
+		return 1;
+	}
+	for (i = 0; i < n; i++) {
+		if (strstr(name, filters[i]) != NULL) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct micro_options options = {200, 5, 0};
+	struct micro **suite;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:r:jh")) != -1) {
+		switch (opt) {
+			case 't':
+				options.target = (unsigned)atoi(optarg);
+				break;
+			case 'r':
+				options.runs = (unsigned)atoi(optarg);
+				break;
+			case 'j':
+				options.json = 1;
+				break;
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (options.target == 0 || options.runs == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	micro_print_header(&options);
+	for (suite = suites; *suite != NULL; suite++) {
+		struct micro *m;
+		for (m = *suite; m->name != NULL; m++) {
+			if (match(m->name, argv + optind, argc - optind)) {
+				micro_run(m, &options);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,446 @@
+/**
+ * Measure replication and FSM-apply throughput on an in-process cluster of
+ * N_SERVERS nodes driven by the raft fixture, along with the time it takes to
+ * snapshot and restore databases of increasing size.
+ *
+ * There are no sockets and no disks involved: raft messages and log entries
+ * are handled by the fixture in memory and databases live in the dqlite VFS,
+ * so the numbers only reflect the cost of the leader transaction hooks,
+ * command encoding, raft bookkeeping and FSM apply. Results are printed as
+ * JSON lines on standard output.
+ */
+
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../test/lib/cluster.h"
+
+#include "../src/command.h"
+#include "../src/leader.h"
+#include "../src/metrics.h"
+
+struct options
+{
+	unsigned txs;                  /* Transactions to replicate */
+	unsigned rows;                 /* Rows inserted by each transaction */
+	unsigned value_size;           /* Bytes in each row's value */
+	unsigned page_size;            /* Database page size */
+	unsigned checkpoint_threshold; /* WAL frames before checkpointing */
+	unsigned max_size;             /* Largest snapshotted database, in MB */
+};
+
+static struct options options = {
+    .txs = 1000,
+    .rows = 10,
+    .value_size = 1000,
+    .page_size = 4096,
+    .checkpoint_threshold = 1000,
+    .max_size = 64,
+};
+
+struct fixture
+{
+	FIXTURE_CLUSTER;
+	struct leader leader;
+	sqlite3_stmt *stmt;
+	struct exec req;
+	bool invoked;
+	int status;
+	/* Original apply methods of the FSMs, wrapped by timedApply(). */
+	int (*apply[N_SERVERS])(struct raft_fsm *fsm,
+				const struct raft_buffer *buf,
+				void **result);
+	struct histogram apply_latency; /* FSM apply of every entry, in usecs */
+	unsigned long long apply_nsecs; /* Total FSM apply time */
+	unsigned long long entries;     /* Entries applied by the leader */
+	unsigned long long frames;      /* WAL frames applied by the leader */
+	unsigned long long bytes;       /* Bytes of entries applied by leader */
+};
+
+static struct fixture fixture;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: replication-bench [options]\n"
+		"  -t, --txs N                  "
+		"transactions to replicate (1000)\n"
+		"  -r, --rows N                 rows per transaction (10)\n"
+		"  -s, --value-size BYTES       size of row values (1000)\n"
+		"  -P, --page-size BYTES        database page size (4096)\n"
+		"  -C, --checkpoint-threshold N "
+		"WAL frames before checkpoint (1000)\n"
+		"  -m, --max-size MB            "
+		"largest database to snapshot, 0 to skip (64)\n");
+	exit(2);
+}
+
+static unsigned parseUnsigned(const char *name, const char *value)
+{
+	char *end;
+	unsigned long n = strtoul(value, &end, 10);
+	if (*value == '\0' || *end != '\0' || n > UINT_MAX) {
+		fprintf(stderr, "replication-bench: invalid %s: %s\n", name,
+			value);
+		exit(2);
+	}
+	return (unsigned)n;
+}
+
+static void parseOptions(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+	    {"txs", required_argument, NULL, 't'},
+	    {"rows", required_argument, NULL, 'r'},
+	    {"value-size", required_argument, NULL, 's'},
+	    {"page-size", required_argument, NULL, 'P'},
+	    {"checkpoint-threshold", required_argument, NULL, 'C'},
+	    {"max-size", required_argument, NULL, 'm'},
+	    {"help", no_argument, NULL, 'h'},
+	    {NULL, 0, NULL, 0},
+	};
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "t:r:s:P:C:m:h", long_options,
+				  NULL)) != -1) {
+		switch (opt) {
+			case 't':
+				options.txs = parseUnsigned("txs", optarg);
+				break;
+			case 'r':
+				options.rows = parseUnsigned("rows", optarg);
+				break;
+			case 's':
+				options.value_size =
+				    parseUnsigned("value size", optarg);
+				break;
+			case 'P':
+				options.page_size =
+				    parseUnsigned("page size", optarg);
+				break;
+			case 'C':
+				options.checkpoint_threshold =
+				    parseUnsigned("checkpoint threshold", optarg);
+				break;
+			case 'm':
+				options.max_size =
+				    parseUnsigned("max size", optarg);
+				break;
+			default:
+				usage();
+		}
+	}
+
+	if (optind != argc || options.txs == 0 || options.rows == 0) {
+		usage();
+	}
+}
+
+static unsigned long long nowNsecs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long)now.tv_sec * 1000000000ULL +
+	       (unsigned long long)now.tv_nsec;
+}
+
+/* Wrap the apply method of the FSMs, timing each call and counting the
+ * entries, frames and bytes applied by the leader. */
+static int timedApply(struct raft_fsm *fsm,
+		      const struct raft_buffer *buf,
+		      void **result)
+{
+	struct fixture *f = &fixture;
+	unsigned i = (unsigned)(fsm - f->fsms);
+	unsigned long long start;
+	unsigned long long elapsed;
+	int rv;
+
+	start = nowNsecs();
+	rv = f->apply[i](fsm, buf, result);
+	elapsed = nowNsecs() - start;
+
+	histogram__record(&f->apply_latency, elapsed / 1000);
+	f->apply_nsecs += elapsed;
+
+	if (i == 0) {
+		struct command_frames *c;
+		int type;
+		f->entries++;
+		f->bytes += buf->len;
+		if (command__decode(buf, &type, (void **)&c) == 0) {
+			if (type == COMMAND_FRAMES) {
+				f->frames += c->frames.n_pages;
+			}
+			raft_free(c);
+		}
+	}
+
+	return rv;
+}
+
+static void execCb(struct exec *req, int status)
+{
+	struct fixture *f = req->data;
+	f->invoked = true;
+	f->status = status;
+}
+
+/* Execute the given statement on the leader, stepping the cluster until all
+ * nodes have applied the resulting entries. */
+static void exec(struct fixture *f, sqlite3_stmt *stmt)
+{
+	int rv;
+	f->invoked = false;
+	rv = leader__exec(&f->leader, &f->req, stmt, execCb);
+	munit_assert_int(rv, ==, 0);
+	while (!f->invoked) {
+		CLUSTER_STEP;
+	}
+	munit_assert_int(f->status, ==, SQLITE_DONE);
+	CLUSTER_APPLIED(CLUSTER_LAST_INDEX(0));
+	rv = sqlite3_reset(stmt);
+	munit_assert_int(rv, ==, SQLITE_OK);
+}
+
+static void execSQL(struct fixture *f, const char *sql)
+{
+	sqlite3_stmt *stmt;
+	int rv;
+	rv = sqlite3_prepare_v2(f->leader.conn, sql, -1, &stmt, NULL);
+	munit_assert_int(rv, ==, SQLITE_OK);
+	exec(f, stmt);
+	sqlite3_finalize(stmt);
+}
+
+static void setUp(struct fixture *f)
+{
+	const MunitParameter *params = NULL;
+	void *user_data = NULL;
+	struct db *db;
+	unsigned i;
+	int rv;
+
+	memset(f, 0, sizeof *f);
+	SETUP_CLUSTER;
+
+	for (i = 0; i < N_SERVERS; i++) {
+		struct config *config = CLUSTER_CONFIG(i);
+		config->page_size = options.page_size;
+		config->checkpoint_threshold = options.checkpoint_threshold;
+		f->apply[i] = f->fsms[i].apply;
+		f->fsms[i].apply = timedApply;
+	}
+
+	rv = registry__db_get(CLUSTER_REGISTRY(0), "bench.db", &db);
+	munit_assert_int(rv, ==, 0);
+	rv = leader__init(&f->leader, db, CLUSTER_RAFT(0));
+	munit_assert_int(rv, ==, 0);
+	f->req.data = f;
+
+	CLUSTER_ELECT(0);
+	execSQL(f, "CREATE TABLE bench (id INTEGER PRIMARY KEY, v BLOB)");
+
+	/* Zero-filled values keep the cost of generating rows out of the
+	 * numbers, SQLite writes the pages all the same. */
+	rv = sqlite3_prepare_v2(
+	    f->leader.conn,
+	    "WITH RECURSIVE s(x) AS (SELECT 1 UNION ALL "
+	    "SELECT x + 1 FROM s WHERE x < ?1) "
+	    "INSERT INTO bench(v) SELECT zeroblob(?2) FROM s",
+	    -1, &f->stmt, NULL);
+	munit_assert_int(rv, ==, SQLITE_OK);
+	sqlite3_bind_int(f->stmt, 1, (int)options.rows);
+	sqlite3_bind_int(f->stmt, 2, (int)options.value_size);
+
+	memset(&f->apply_latency, 0, sizeof f->apply_latency);
+	f->apply_nsecs = 0;
+	f->entries = 0;
+	f->frames = 0;
+	f->bytes = 0;
+}
+
+static void tearDown(struct fixture *f)
+{
+	void *data = f;
+	sqlite3_finalize(f->stmt);
+	leader__close(&f->leader);
+	TEAR_DOWN_CLUSTER;
+}
+
+static void printLatency(const char *name, const struct histogram *h)
+{
+	printf("\"%s\": {\"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, "
+	       "\"p99\": %llu, \"max\": %llu}",
+	       name, h->count > 0 ? (double)h->sum / h->count : 0.0,
+	       (unsigned long long)histogram__percentile(h, 500),
+	       (unsigned long long)histogram__percentile(h, 900),
+	       (unsigned long long)histogram__percentile(h, 990),
+	       (unsigned long long)h->max);
+}
+
+/* Replicate the configured number of transactions and report throughput,
+ * end-to-end transaction latency and FSM apply latency. */
+static void runReplication(struct fixture *f)
+{
+	struct histogram latency;
+	unsigned long long start;
+	double seconds;
+	unsigned i;
+
+	memset(&latency, 0, sizeof latency);
+
+	start = nowNsecs();
+	for (i = 0; i < options.txs; i++) {
+		unsigned long long tx_start = nowNsecs();
+		exec(f, f->stmt);
+		histogram__record(&latency, (nowNsecs() - tx_start) / 1000);
+	}
+	seconds = (double)(nowNsecs() - start) / 1e9;
+
+	printf("{\"phase\": \"replication\", \"nodes\": %u, \"txs\": %u, "
+	       "\"rows\": %u, \"value_size\": %u, \"page_size\": %u, "
+	       "\"checkpoint_threshold\": %u, \"seconds\": %.3f, ",
+	       N_SERVERS, options.txs, options.rows, options.value_size,
+	       options.page_size, options.checkpoint_threshold, seconds);
+	printf("\"entries\": %llu, \"frames\": %llu, \"bytes\": %llu, "
+	       "\"frames_per_sec\": %.1f, \"bytes_per_sec\": %.1f, "
+	       "\"apply_secs\": %.3f, ",
+	       f->entries, f->frames, f->bytes, f->frames / seconds,
+	       f->bytes / seconds, (double)f->apply_nsecs / 1e9);
+	printLatency("tx_latency_us", &latency);
+	printf(", ");
+	printLatency("apply_latency_us", &f->apply_latency);
+	printf("}\n");
+}
+
+/* Return the size of the leader's database, in bytes. */
+static unsigned long long databaseSize(struct fixture *f)
+{
+	sqlite3_stmt *stmt;
+	unsigned long long pages;
+	int rv;
+	rv = sqlite3_prepare_v2(f->leader.conn, "PRAGMA page_count", -1, &stmt,
+				NULL);
+	munit_assert_int(rv, ==, SQLITE_OK);
+	rv = sqlite3_step(stmt);
+	munit_assert_int(rv, ==, SQLITE_ROW);
+	pages = (unsigned long long)sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+	return pages * options.page_size;
+}
+
+/* Take a snapshot of the leader's FSM and flatten it into a single buffer,
+ * like raft does when sending or loading it. */
+static void takeSnapshot(struct fixture *f,
+			 struct raft_buffer *snapshot,
+			 double *seconds)
+{
+	struct raft_fsm *fsm = &f->fsms[0];
+	struct raft_buffer *bufs;
+	unsigned long long start;
+	unsigned n;
+	unsigned i;
+	uint8_t *cursor;
+	int rv;
+
+	start = nowNsecs();
+	rv = fsm->snapshot(fsm, &bufs, &n);
+	munit_assert_int(rv, ==, 0);
+	rv = fsm->snapshot_async(fsm, &bufs, &n);
+	munit_assert_int(rv, ==, 0);
+	*seconds = (double)(nowNsecs() - start) / 1e9;
+
+	snapshot->len = 0;
+	for (i = 0; i < n; i++) {
+		snapshot->len += bufs[i].len;
+	}
+	snapshot->base = raft_malloc(snapshot->len);
+	munit_assert_ptr_not_null(snapshot->base);
+	cursor = snapshot->base;
+	for (i = 0; i < n; i++) {
+		memcpy(cursor, bufs[i].base, bufs[i].len);
+		cursor += bufs[i].len;
+	}
+
+	rv = fsm->snapshot_finalize(fsm, &bufs, &n);
+	munit_assert_int(rv, ==, 0);
+}
+
+/* Restore the given snapshot into the FSM of a new node outside the cluster,
+ * which takes ownership of the snapshot buffer. */
+static void restoreSnapshot(struct raft_buffer *snapshot, double *seconds)
+{
+	struct server s;
+	struct raft_fsm fsm;
+	unsigned long long start;
+	int rv;
+
+	rv = config__init(&s.config, N_SERVERS + 1, "restore");
+	munit_assert_int(rv, ==, 0);
+	s.config.page_size = options.page_size;
+	rv = vfsInit(&s.vfs, &s.config);
+	munit_assert_int(rv, ==, 0);
+	registry__init(&s.registry, &s.config);
+	rv = fsm__init(&fsm, &s.config, &s.registry);
+	munit_assert_int(rv, ==, 0);
+
+	start = nowNsecs();
+	rv = fsm.restore(&fsm, snapshot);
+	munit_assert_int(rv, ==, 0);
+	*seconds = (double)(nowNsecs() - start) / 1e9;
+
+	fsm__close(&fsm);
+	registry__close(&s.registry);
+	vfsClose(&s.vfs);
+	config__close(&s.config);
+}
+
+/* Grow the database by doubling its size up to the configured maximum, and
+ * report how long it takes to snapshot and restore it at each step. */
+static void runSnapshots(struct fixture *f)
+{
+	unsigned long long target;
+	unsigned long long max = (unsigned long long)options.max_size << 20;
+
+	for (target = 1 << 20; target <= max; target *= 2) {
+		struct raft_buffer snapshot;
+		unsigned long long size;
+		double snapshot_secs;
+		double restore_secs;
+
+		while (databaseSize(f) < target) {
+			exec(f, f->stmt);
+		}
+		size = databaseSize(f);
+
+		takeSnapshot(f, &snapshot, &snapshot_secs);
+		printf("{\"phase\": \"snapshot\", \"page_size\": %u, "
+		       "\"db_bytes\": %llu, \"snapshot_bytes\": %zu, ",
+		       options.page_size, size, snapshot.len);
+		restoreSnapshot(&snapshot, &restore_secs);
+		printf("\"snapshot_secs\": %.6f, \"restore_secs\": %.6f, "
+		       "\"restore_bytes_per_sec\": %.1f}\n",
+		       snapshot_secs, restore_secs,
+		       restore_secs > 0 ? size / restore_secs : 0.0);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct fixture *f = &fixture;
+
+	parseOptions(argc, argv);
+
+	setUp(f);
+	runReplication(f);
+	runSnapshots(f);
+	tearDown(f);
+
+	return 0;
+}
@@ -123,6 +123,135 @@ int dqlite_node_set_connect_func(dqlite_node *n,
 int dqlite_node_set_network_latency(dqlite_node *n,
 				    unsigned long long nanoseconds);
 
+/**
+ * Set the maximum time, expressed in milliseconds, that a write statement
+ * waits for the transaction of another connection against the same database
+ * to end. Waiting writers are served in FIFO order. When the timeout expires
+ * the statement fails with SQLITE_BUSY. A value of 0 disables waiting
+ * altogether, so that SQLITE_BUSY is returned right away.
+ *
+ * The default is 0.
+ *
+ * This function must be called before calling dqlite_node_start().
+ */
+int dqlite_node_set_write_timeout(dqlite_node *n, unsigned milliseconds);
+
+/**
+ * Set the maximum total size, expressed in bytes, of the write transactions
+ * that are grouped together into a single raft log entry. Transactions
+ * exceeding the budget are replicated on their own. A value of 0 disables
+ * grouping altogether.
+ *
+ * Grouped transactions are replicated using a log entry type that nodes
+ * running older versions of dqlite can't apply, so grouping should be enabled
+ * only once all nodes of the cluster have been upgraded.
+ *
+ * The default is 1 MiB.
+ *
+ * This function must be called before calling dqlite_node_start().
+ */
+int dqlite_node_set_group_commit_size(dqlite_node *n, unsigned size);
+
+/**
+ * Set the time window, expressed in milliseconds, during which write
+ * transactions are collected to be grouped together, see
+ * dqlite_node_set_group_commit_size(). A value of 0 means that transactions
+ * are only grouped while a previous group is being replicated, so that no
+ * extra latency is added when there is no concurrency.
+ *
+ * The default is 0.
+ *
+ * This function must be called before calling dqlite_node_start().
+ */
+int dqlite_node_set_group_commit_window(dqlite_node *n, unsigned milliseconds);
+
+/**
+ * Set the maximum number of statements that each client connection keeps
+ * prepared for reuse, when executing SQL text sent by clients directly (as
+ * opposed to preparing a statement explicitly). Statements are evicted in
+ * least-recently-used order. A value of 0 disables caching.
+ *
+ * The default is 128.
+ *
+ * This function must be called before calling dqlite_node_start().
+ */
+int dqlite_node_set_stmt_cache_size(dqlite_node *n, unsigned size);
+
+/**
+ * Configure the pool of leader connections of each database. When a client
+ * connection is closed, its leader connection is kept open for reuse by the
+ * next client opening the same database, as long as there are less than @max
+ * idle connections in the pool. Pooled connections that have been idle for
+ * more than @idle_timeout milliseconds are closed, unless that would leave
+ * less than @min of them. A value of 0 for @idle_timeout disables trimming.
+ * When this node is the leader, the pool of each open database is refilled
+ * with new connections up to @min.
+ *
+ * Note that session state such as pragmas or temporary tables set by a client
+ * is visible to the clients that reuse its connection.
+ *
+ * The default is a @max of 0, which disables pooling, a @min of 0 and an
+ * @idle_timeout of 60000 milliseconds.
+ *
+ * This function must be called before calling dqlite_node_start().
+ */
+int dqlite_node_set_connection_pool(dqlite_node *n,
+				    unsigned min,
+				    unsigned max,
+				    unsigned idle_timeout);
+
+/**
+ * Set the stack size, expressed in bytes, of the coroutines used to execute
+ * statements on the leader. Coroutines are shared by all client connections
+ * and only one is in use for each statement being executed, so the stack
+ * memory needed doesn't depend on the number of idle client connections. The
+ * size must be at least 64 KiB, and it's rounded up to a multiple of the page
+ * size. Each stack is followed by a guard page, so overflowing it crashes the
+ * process instead of corrupting memory.
+ *
+ * The default is 1 MiB.
+ *
+ * This function must be called before calling dqlite_node_start().
+ */
+int dqlite_node_set_stack_size(dqlite_node *n, unsigned size);
+
+/**
+ * Set the maximum number of milliseconds that a statement executed on the
+ * leader can run before being suspended, in order to let the node process
+ * raft heartbeats and requests from other clients. The statement is resumed
+ * at the next iteration of the event loop. A value of 0 disables suspending
+ * statements, so long queries block the node until they are done.
+ *
+ * The default is 10 milliseconds.
+ *
+ * This function must be called before calling dqlite_node_start().
+ */
+int dqlite_node_set_time_slice(dqlite_node *n, unsigned milliseconds);
+
+/**
+ * Set the number of threads used to execute read-only queries submitted as
+ * SQL text outside of an explicit transaction, each with its own connection
+ * to the database. A value of 0 means that all queries are executed by the
+ * node's main thread.
+ *
+ * The default is 0.
+ *
+ * This function must be called before calling dqlite_node_start().
+ */
+int dqlite_node_set_reader_threads(dqlite_node *n, unsigned threads);
+
+/**
+ * Set the number of milliseconds above which a write transaction committed by
+ * this node is considered slow. The most recent slow transactions are kept in
+ * memory, along with the time spent in each stage of replication, and can be
+ * retrieved by clients. A value of 0 disables tracking slow transactions.
+ *
+ * The default is 0.
+ *
+ * This function must be called before calling dqlite_node_start().
+ */
+int dqlite_node_set_slow_tx_threshold(dqlite_node *n, unsigned milliseconds);
+
 /**
  * Start a dqlite node.
  *
@@ -148,6 +277,78 @@ struct dqlite_node_info
 };
 typedef struct dqlite_node_info dqlite_node_info;
 
+/**
+ * Number of request types covered by #dqlite_metrics.
+ */
+#define DQLITE_METRICS_REQUEST_TYPES 22
+
+/**
+ * Summary of a latency distribution, in microseconds. Percentiles are upper
+ * bounds, accurate within 25% of their value.
+ */
+struct dqlite_latency
+{
+	unsigned long long count; /* Number of samples */
+	unsigned long long sum;   /* Sum of all samples */
+	unsigned long long max;   /* Highest sample */
+	unsigned long long p50;
+	unsigned long long p90;
+	unsigned long long p99;
+	unsigned long long p999;
+};
+
+/**
+ * Metrics of the requests of a single type.
+ */
+struct dqlite_request_metrics
+{
+	unsigned long long requests;  /* Number of requests handled */
+	unsigned long long failures;  /* Requests answered with a failure */
+	unsigned long long bytes_in;  /* Total size of request payloads */
+	unsigned long long bytes_out; /* Total size of response payloads */
+	struct dqlite_latency latency; /* From dispatch to the last response */
+};
+
+/**
+ * Performance metrics of a node, accumulated since it was created.
+ */
+struct dqlite_metrics
+{
+	/* Indexed by the request type code of the wire protocol. */
+	struct dqlite_request_metrics requests[DQLITE_METRICS_REQUEST_TYPES];
+	struct dqlite_latency barrier; /* Wait for raft barriers */
+	struct dqlite_latency apply;   /* Wait for raft to commit a command */
+	struct dqlite_latency step;    /* Leader statement steps, including any
+					  wait for raft */
+
+	/* Stages of the write transactions committed by this node, summed
+	 * over all the commands of each transaction. */
+	struct dqlite_latency tx_encode; /* Encoding commands */
+	struct dqlite_latency tx_raft;   /* From encoding to FSM apply */
+	struct dqlite_latency tx_fsm;    /* Applying commands to the FSM */
+	struct dqlite_latency tx_total;  /* From begin to end of transaction */
+
+	/* Execs waiting for the lock of a database held by the transaction of
+	 * another connection, across all databases. */
+	unsigned long long writers;         /* Currently waiting */
+	unsigned long long max_writers;     /* Most waiting on a database */
+	unsigned long long writer_timeouts; /* Gave up after write timeout */
+
+	/* Lookups in the statement caches of leader connections, used by
+	 * EXEC_SQL and QUERY_SQL requests. */
+	unsigned long long stmt_cache_hits;
+	unsigned long long stmt_cache_misses;
+};
+typedef struct dqlite_metrics dqlite_metrics;
+
+/**
+ * Fill @metrics with the current performance metrics of the node.
+ *
+ * This function can be called from any thread, at any time after the node has
+ * been created.
+ */
+int dqlite_node_get_metrics(dqlite_node *n, dqlite_metrics *metrics);
+
 /**
  * Force recovering a dqlite node which is part of a cluster whose majority of
  * nodes have died, and therefore has become unavailable.
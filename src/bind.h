@@ -9,9 +9,12 @@
 
 #include "lib/serialize.h"
 
+#include "tuple.h"
+
 /**
- * Bind the parameters of the given statement by decoding the given payload.
+ * Bind the parameters of the given statement by decoding the given payload,
+ * using the given tuple @format (either #TUPLE__PARAMS or #TUPLE__PARAMS32).
  */
-int bind__params(sqlite3_stmt *stmt, struct cursor *cursor);
+int bind__params(sqlite3_stmt *stmt, struct cursor *cursor, int format);
 
 #endif /* BIND_H_*/
@@ -14,6 +14,9 @@ int clientInit(struct client *c, int fd)
 {
 	int rv;
 	c->fd = fd;
+	c->pipeline = false;
+	c->next_id = 0;
+	c->last_id = 0;
 
 	rv = buffer__init(&c->read);
 	if (rv != 0) {
@@ -54,35 +57,78 @@ int clientSendHandshake(struct client *c)
 	return 0;
 }
 
+/* Read exactly @n bytes, since a single read() on a socket might return
+ * less. */
+static int readFull(int fd, void *buf, size_t n)
+{
+	size_t offset = 0;
+	while (offset < n) {
+		ssize_t rv = read(fd, (uint8_t *)buf + offset, n - offset);
+		if (rv <= 0) {
+			return DQLITE_ERROR;
+		}
+		offset += (size_t)rv;
+	}
+	return 0;
+}
+
+/* Encode a request into the write buffer, after room for the message
+ * header. */
+#define ENCODE(LOWER)                                                    \
+	{                                                                \
+		struct message message_;                                 \
+		size_t n1_ = message__sizeof(&message_);                 \
+		size_t n2_ = request_##LOWER##__sizeof(&request);        \
+		void *cursor_;                                           \
+		buffer__reset(&c->write);                                \
+		cursor_ = buffer__advance(&c->write, n1_ + n2_);         \
+		if (cursor_ == NULL) {                                   \
+			return DQLITE_NOMEM;                             \
+		}                                                        \
+		assert(n2_ % 8 == 0);                                    \
+		cursor_ = (uint8_t *)cursor_ + n1_;                      \
+		request_##LOWER##__encode(&request, &cursor_);           \
+	}
+
+/* Fill the header of the message in the write buffer and write it out. */
+static int sendMessage(struct client *c, int type)
+{
+	struct message message;
+	size_t n = buffer__offset(&c->write);
+	size_t n1 = message__sizeof(&message);
+	void *cursor;
+	int rv;
+	assert((n - n1) % 8 == 0);
+	message.type = (uint8_t)type;
+	message.words = (uint32_t)((n - n1) / 8);
+	message.flags = 0;
+	message.extra = 0;
+	if (c->pipeline) {
+		message.flags = DQLITE_MESSAGE_PIPELINE;
+		message.extra = c->next_id;
+		c->next_id++;
+	}
+	cursor = buffer__cursor(&c->write, 0);
+	message__encode(&message, &cursor);
+	rv = write(c->fd, buffer__cursor(&c->write, 0), n);
+	if (rv != (int)n) {
+		return DQLITE_ERROR;
+	}
+	return 0;
+}
+
 /* Write out a request. */
-#define REQUEST(LOWER, UPPER)                                       \
-	{                                                           \
-		struct message message;                             \
-		size_t n;                                           \
-		size_t n1;                                          \
-		size_t n2;                                          \
-		void *cursor;                                       \
-		int rv;                                             \
-		n1 = message__sizeof(&message);                     \
-		n2 = request_##LOWER##__sizeof(&request);           \
-		n = n1 + n2;                                        \
-		buffer__reset(&c->write);                           \
-		cursor = buffer__advance(&c->write, n);             \
-		if (cursor == NULL) {                               \
-			return DQLITE_NOMEM;                        \
-		}                                                   \
-		assert(n2 % 8 == 0);                                \
-		message.type = DQLITE_REQUEST_##UPPER;              \
-		message.words = n2 / 8;                             \
-		message__encode(&message, &cursor);                 \
-		request_##LOWER##__encode(&request, &cursor);       \
-		rv = write(c->fd, buffer__cursor(&c->write, 0), n); \
-		if (rv != (int)n) {                                 \
-			return DQLITE_ERROR;                        \
-		}                                                   \
+#define REQUEST(LOWER, UPPER)                                    \
+	ENCODE(LOWER);                                           \
+	{                                                        \
+		int rv_ = sendMessage(c, DQLITE_REQUEST_##UPPER); \
+		if (rv_ != 0) {                                  \
+			return rv_;                              \
+		}                                                \
 	}
 
-/* Read a response without decoding it. */
+/* Read a response without decoding it. A response of an unexpected type,
+ * typically a failure, is consumed anyway so the next one can be read. */
 #define READ(LOWER, UPPER)                                     \
 	{                                                      \
 		struct message message;                        \
@@ -94,16 +140,20 @@ int clientSendHandshake(struct client *c)
 		buffer__reset(&c->read);                       \
 		p = buffer__advance(&c->read, n);              \
 		assert(p != NULL);                             \
-		rv = read(c->fd, p, n);                        \
-		if (rv != (int)n) {                            \
+		rv = readFull(c->fd, p, n);                    \
+		if (rv != 0) {                                 \
 			return DQLITE_ERROR;                   \
 		}                                              \
 		cursor.p = p;                                  \
 		cursor.cap = n;                                \
 		rv = message__decode(&cursor, &message);       \
 		assert(rv == 0);                               \
-		if (message.type != DQLITE_RESPONSE_##UPPER) { \
-			return DQLITE_ERROR;                   \
+		if (c->pipeline) {                             \
+			if (!(message.flags &                  \
+			      DQLITE_MESSAGE_PIPELINE)) {      \
+				return DQLITE_ERROR;           \
+			}                                      \
+			c->last_id = message.extra;            \
 		}                                              \
 		buffer__reset(&c->read);                       \
 		n = message.words * 8;                         \
@@ -111,8 +161,11 @@ int clientSendHandshake(struct client *c)
 		if (p == NULL) {                               \
 			return DQLITE_ERROR;                   \
 		}                                              \
-		rv = read(c->fd, p, n);                        \
-		if (rv != (int)n) {                            \
+		rv = readFull(c->fd, p, n);                    \
+		if (rv != 0) {                                 \
+			return DQLITE_ERROR;                   \
+		}                                              \
+		if (message.type != DQLITE_RESPONSE_##UPPER) { \
 			return DQLITE_ERROR;                   \
 		}                                              \
 	}
@@ -170,13 +223,50 @@ int clientRecvStmt(struct client *c, unsigned *stmt_id)
 	return 0;
 }
 
+/* Append the given statement parameters to the request in the write
+ * buffer. */
+static int encodeParams(struct client *c, struct value *params, unsigned n)
+{
+	struct tuple_encoder encoder;
+	unsigned i;
+	int rv;
+
+	if (n == 0) {
+		return 0;
+	}
+	rv = tuple_encoder__init(&encoder, n, TUPLE__PARAMS, &c->write);
+	if (rv != 0) {
+		return rv;
+	}
+	for (i = 0; i < n; i++) {
+		rv = tuple_encoder__next(&encoder, &params[i]);
+		if (rv != 0) {
+			return rv;
+		}
+	}
+	return 0;
+}
+
 int clientSendExec(struct client *c, unsigned stmt_id)
+{
+	return clientSendExecParams(c, stmt_id, NULL, 0);
+}
+
+int clientSendExecParams(struct client *c,
+			 unsigned stmt_id,
+			 struct value *params,
+			 unsigned n)
 {
 	struct request_exec request;
+	int rv;
 	request.db_id = c->db_id;
 	request.stmt_id = stmt_id;
-	REQUEST(exec, EXEC);
-	return 0;
+	ENCODE(exec);
+	rv = encodeParams(c, params, n);
+	if (rv != 0) {
+		return rv;
+	}
+	return sendMessage(c, DQLITE_REQUEST_EXEC);
 }
 
 int clientRecvResult(struct client *c,
@@ -191,12 +281,25 @@ int clientRecvResult(struct client *c,
 }
 
 int clientSendQuery(struct client *c, unsigned stmt_id)
+{
+	return clientSendQueryParams(c, stmt_id, NULL, 0);
+}
+
+int clientSendQueryParams(struct client *c,
+			  unsigned stmt_id,
+			  struct value *params,
+			  unsigned n)
 {
 	struct request_query request;
+	int rv;
 	request.db_id = c->db_id;
 	request.stmt_id = stmt_id;
-	REQUEST(query, QUERY);
-	return 0;
+	ENCODE(query);
+	rv = encodeParams(c, params, n);
+	if (rv != 0) {
+		return rv;
+	}
+	return sendMessage(c, DQLITE_REQUEST_QUERY);
 }
 
 int clientRecvRows(struct client *c, struct rows *rows)
@@ -215,12 +318,14 @@ int clientRecvRows(struct client *c, struct rows *rows)
 		return DQLITE_ERROR;
 	}
 	rows->column_count = column_count;
+	rows->next = NULL;
+	rows->more = false;
+	rows->column_names =
+	    sqlite3_malloc(column_count * sizeof *rows->column_names);
+	if (rows->column_names == NULL) {
+		return DQLITE_ERROR;
+	}
 	for (i = 0; i < rows->column_count; i++) {
-		rows->column_names =
-		    sqlite3_malloc(column_count * sizeof *rows->column_names);
-		if (rows->column_names == NULL) {
-			return DQLITE_ERROR;
-		}
 		rv = text__decode(&cursor, &rows->column_names[i]);
 		if (rv != 0) {
 			return DQLITE_ERROR;
@@ -237,6 +342,7 @@ int clientRecvRows(struct client *c, struct rows *rows)
 		eof = byte__flip64(*(uint64_t *)cursor.p);
 		if (eof == DQLITE_RESPONSE_ROWS_DONE ||
 		    eof == DQLITE_RESPONSE_ROWS_PART) {
+			rows->more = eof == DQLITE_RESPONSE_ROWS_PART;
 			break;
 		}
 		row = sqlite3_malloc(sizeof *row);
@@ -249,7 +355,8 @@ int clientRecvRows(struct client *c, struct rows *rows)
 			return DQLITE_NOMEM;
 		}
 		row->next = NULL;
-		rv = tuple_decoder__init(&decoder, column_count, &cursor);
+		rv = tuple_decoder__init(&decoder, column_count, TUPLE__ROW,
+					 &cursor);
 		if (rv != 0) {
 			return DQLITE_ERROR;
 		}
@@ -5,6 +5,7 @@
 
 #include <raft.h>
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "lib/buffer.h"
@@ -17,6 +18,9 @@ struct client
 	unsigned db_id;      /* Database ID provided by the server */
 	struct buffer read;  /* Read buffer */
 	struct buffer write; /* Write buffer */
+	bool pipeline;       /* Whether to tag requests with an ID */
+	uint16_t next_id;    /* ID of the next pipelined request */
+	uint16_t last_id;    /* ID echoed by the last pipelined response */
 };
 
 struct row
@@ -30,6 +34,7 @@ struct rows
 	unsigned column_count;
 	const char **column_names;
 	struct row *next;
+	bool more; /* Whether another response with more rows follows */
 };
 
 /* Initialize a new client, writing requests to fd. */
@@ -57,6 +62,12 @@ int clientRecvStmt(struct client *c, unsigned *stmt_id);
 /* Send a request to execute a statement. */
 int clientSendExec(struct client *c, unsigned stmt_id);
 
+/* Send a request to execute a statement with the given parameters. */
+int clientSendExecParams(struct client *c,
+			 unsigned stmt_id,
+			 struct value *params,
+			 unsigned n);
+
 /* Receive the response to an exec request. */
 int clientRecvResult(struct client *c,
 			unsigned *last_insert_id,
@@ -65,7 +76,14 @@ int clientRecvResult(struct client *c,
 /* Send a request to perform a query. */
 int clientSendQuery(struct client *c, unsigned stmt_id);
 
-/* Receive the response of a query request. */
+/* Send a request to perform a query with the given parameters. */
+int clientSendQueryParams(struct client *c,
+			  unsigned stmt_id,
+			  struct value *params,
+			  unsigned n);
+
+/* Receive a response to a query request. If @rows->more is set, the next
+ * batch of rows must be received with another call. */
 int clientRecvRows(struct client *c, struct rows *rows);
 
 /* Send a raft connect request. */
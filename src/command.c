@@ -66,6 +66,84 @@ static int frames__decode(struct cursor *cursor, frames_t *frames)
 	return 0;
 }
 
+static size_t commands__sizeof(const commands_t *commands)
+{
+	const struct raft_buffer *bufs = commands->data;
+	size_t s = uint32__sizeof(&commands->n) +
+		   uint32__sizeof(&commands->__unused__) +
+		   uint64__sizeof(&commands->size);
+	unsigned i;
+	for (i = 0; i < commands->n; i++) {
+		s += sizeof(uint64_t) + bufs[i].len;
+	}
+	return s;
+}
+
+static void commands__encode(const commands_t *commands, void **cursor)
+{
+	const struct raft_buffer *bufs = commands->data;
+	uint64_t size = 0;
+	unsigned i;
+	for (i = 0; i < commands->n; i++) {
+		size += sizeof(uint64_t) + bufs[i].len;
+	}
+	uint32__encode(&commands->n, cursor);
+	uint32__encode(&commands->__unused__, cursor);
+	uint64__encode(&size, cursor);
+	for (i = 0; i < commands->n; i++) {
+		uint64_t len = bufs[i].len;
+		/* Encoded commands are made of whole words, so the next one
+		 * stays aligned. */
+		assert(len % SERIALIZE__WORD_SIZE == 0);
+		uint64__encode(&len, cursor);
+		memcpy(*cursor, bufs[i].base, bufs[i].len);
+		*cursor += bufs[i].len;
+	}
+}
+
+static int commands__decode(struct cursor *cursor, commands_t *commands)
+{
+	struct cursor commands_cursor;
+	unsigned i;
+	int rc;
+	rc = uint32__decode(cursor, &commands->n);
+	if (rc != 0) {
+		return rc;
+	}
+	rc = uint32__decode(cursor, &commands->__unused__);
+	if (rc != 0) {
+		return rc;
+	}
+	rc = uint64__decode(cursor, &commands->size);
+	if (rc != 0) {
+		return rc;
+	}
+	if (commands->size > cursor->cap) {
+		return DQLITE_PARSE;
+	}
+	commands->data = cursor->p;
+
+	/* Check that all commands are within bounds, so they can be iterated
+	 * safely. */
+	commands_cursor.p = cursor->p;
+	commands_cursor.cap = commands->size;
+	for (i = 0; i < commands->n; i++) {
+		uint64_t len;
+		rc = uint64__decode(&commands_cursor, &len);
+		if (rc != 0) {
+			return rc;
+		}
+		if (len > commands_cursor.cap ||
+		    len % SERIALIZE__WORD_SIZE != 0) {
+			return DQLITE_PARSE;
+		}
+		commands_cursor.p += len;
+		commands_cursor.cap -= len;
+	}
+
+	return 0;
+}
+
 #define COMMAND__IMPLEMENT(LOWER, UPPER, _) \
 	SERIALIZE__IMPLEMENT(command_##LOWER, COMMAND__##UPPER);
 
@@ -164,3 +242,21 @@ void command_frames__pages(const struct command_frames *c, void **pages)
 	*pages =
 	    (void *)(c->frames.data + (sizeof(uint64_t) * c->frames.n_pages));
 }
+
+void command_batch__cursor(const struct command_batch *c, struct cursor *cursor)
+{
+	cursor->p = c->commands.data;
+	cursor->cap = c->commands.size;
+}
+
+void command_batch__next(struct cursor *cursor, struct raft_buffer *buf)
+{
+	uint64_t len;
+	int rc;
+	rc = uint64__decode(cursor, &len);
+	assert(rc == 0); /* Checked by commands__decode() */
+	buf->base = (void *)cursor->p;
+	buf->len = len;
+	cursor->p += len;
+	cursor->cap -= len;
+}
@@ -10,7 +10,13 @@
 #include "lib/serialize.h"
 
 /* Command type codes */
-enum { COMMAND_OPEN = 1, COMMAND_FRAMES, COMMAND_UNDO, COMMAND_CHECKPOINT };
+enum {
+	COMMAND_OPEN = 1,
+	COMMAND_FRAMES,
+	COMMAND_UNDO,
+	COMMAND_CHECKPOINT,
+	COMMAND_BATCH
+};
 
 /* Hold information about an array of WAL frames. */
 struct frames
@@ -29,6 +35,21 @@ struct frames
 
 typedef struct frames frames_t;
 
+/* Hold a list of encoded commands, each preceded by its length. */
+struct commands
+{
+	uint32_t n;          /* Number of commands */
+	uint32_t __unused__;
+	uint64_t size;       /* Total size of the commands and their lengths */
+	/* Like for frames, the format differs between encode and decode. When
+	 * encoding data is expected to be a struct raft_buffer* array, and
+	 * when decoding it will be a pointer to raw memory which can be
+	 * iterated with command_batch__next(). */
+	const void *data;
+};
+
+typedef struct commands commands_t;
+
 /* Serialization definitions for a raft FSM command. */
 #define COMMAND__DEFINE(LOWER, UPPER, _) \
 	SERIALIZE__DEFINE_STRUCT(command_##LOWER, COMMAND__##UPPER);
@@ -44,12 +65,14 @@ typedef struct frames frames_t;
 	X(frames, frames, ##__VA_ARGS__)
 #define COMMAND__UNDO(X, ...) X(uint64, tx_id, ##__VA_ARGS__)
 #define COMMAND__CHECKPOINT(X, ...) X(text, filename, ##__VA_ARGS__)
+#define COMMAND__BATCH(X, ...) X(commands, commands, ##__VA_ARGS__)
 
-#define COMMAND__TYPES(X, ...)         \
-	X(open, OPEN, __VA_ARGS__)     \
-	X(frames, FRAMES, __VA_ARGS__) \
-	X(undo, UNDO, __VA_ARGS__)     \
-	X(checkpoint, CHECKPOINT, __VA_ARGS__)
+#define COMMAND__TYPES(X, ...)                 \
+	X(open, OPEN, __VA_ARGS__)             \
+	X(frames, FRAMES, __VA_ARGS__)         \
+	X(undo, UNDO, __VA_ARGS__)             \
+	X(checkpoint, CHECKPOINT, __VA_ARGS__) \
+	X(batch, BATCH, __VA_ARGS__)
 
 COMMAND__TYPES(COMMAND__DEFINE);
 
@@ -62,4 +85,12 @@ int command_frames__page_numbers(const struct command_frames *c,
 
 void command_frames__pages(const struct command_frames *c, void **pages);
 
+/* Initialize a cursor to iterate through the commands of a decoded batch. */
+void command_batch__cursor(const struct command_batch *c,
+			   struct cursor *cursor);
+
+/* Point @buf to the next encoded command of a batch, which can be decoded with
+ * command__decode(). */
+void command_batch__next(struct cursor *cursor, struct raft_buffer *buf);
+
 #endif /* COMMAND_H_*/
@@ -23,6 +23,49 @@
  * soon as possible. */
 #define DEFAULT_CHECKPOINT_THRESHOLD 1000
 
+/* Default time in milliseconds a write waits for the transaction of another
+ * connection to end, before failing with SQLITE_BUSY. Waiting is disabled by
+ * default, since clients might rely on getting SQLITE_BUSY right away to run
+ * their own retry logic. */
+#define DEFAULT_WRITE_TIMEOUT 0
+
+/* Default maximum total size in bytes of the Frames commands that can be
+ * grouped together into a single log entry. */
+#define DEFAULT_GROUP_COMMIT_SIZE (1024 * 1024)
+
+/* Default time in milliseconds Frames commands wait for others to be grouped
+ * with. By default they only wait while a previous group is in flight. */
+#define DEFAULT_GROUP_COMMIT_WINDOW 0
+
+/* Default number of statements prepared from the SQL text of exec_sql and
+ * query_sql requests that each connection keeps around for reuse. */
+#define DEFAULT_STMT_CACHE_SIZE 128
+
+/* Default bounds of the per-database pool of idle leader connections. Pooling
+ * is disabled by default, since session state like pragmas and temporary
+ * tables survives across clients. */
+#define DEFAULT_POOL_MIN 0
+#define DEFAULT_POOL_MAX 0
+
+/* Default number of milliseconds after which an idle pooled leader connection
+ * gets closed. */
+#define DEFAULT_POOL_IDLE_TIMEOUT 60000
+
+/* Default stack size of the coroutines stepping leader statements. */
+#define DEFAULT_STACK_SIZE (1024 * 1024)
+
+/* Default number of milliseconds that a leader statement can run before being
+ * suspended to let the event loop process other events. */
+#define DEFAULT_TIME_SLICE 10
+
+/* Default number of threads executing read-only queries. All queries run in
+ * the event loop thread by default. */
+#define DEFAULT_READERS 0
+
+/* Default threshold of slow transactions. Slow transactions are not tracked by
+ * default. */
+#define DEFAULT_SLOW_TX_THRESHOLD 0
+
 /* For generating unique replication/VFS registration names.
  *
  * TODO: make this thread safe. */
@@ -40,6 +83,17 @@ int config__init(struct config *c, dqlite_node_id id, const char *address)
 	c->heartbeat_timeout = DEFAULT_HEARTBEAT_TIMEOUT;
 	c->page_size = DEFAULT_PAGE_SIZE;
 	c->checkpoint_threshold = DEFAULT_CHECKPOINT_THRESHOLD;
+	c->write_timeout = DEFAULT_WRITE_TIMEOUT;
+	c->group_commit_size = DEFAULT_GROUP_COMMIT_SIZE;
+	c->group_commit_window = DEFAULT_GROUP_COMMIT_WINDOW;
+	c->stmt_cache_size = DEFAULT_STMT_CACHE_SIZE;
+	c->pool_min = DEFAULT_POOL_MIN;
+	c->pool_max = DEFAULT_POOL_MAX;
+	c->pool_idle_timeout = DEFAULT_POOL_IDLE_TIMEOUT;
+	c->stack_size = DEFAULT_STACK_SIZE;
+	c->time_slice = DEFAULT_TIME_SLICE;
+	c->readers = DEFAULT_READERS;
+	c->slow_tx_threshold = DEFAULT_SLOW_TX_THRESHOLD;
 	rv = snprintf(c->name, sizeof c->name, "dqlite-%u", serial);
 	assert(rv < (int)(sizeof c->name));
 	c->logger.data = NULL;
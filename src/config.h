@@ -13,6 +13,17 @@ struct config
 	unsigned heartbeat_timeout;    /* In milliseconds */
 	unsigned page_size;            /* Database page size */
 	unsigned checkpoint_threshold; /* In outstanding WAL frames */
+	unsigned write_timeout;        /* Max msecs writers wait for the lock */
+	unsigned group_commit_size;    /* Max bytes of commands in a group */
+	unsigned group_commit_window;  /* Msecs commits wait to be grouped */
+	unsigned stmt_cache_size;      /* Cached statements per connection */
+	unsigned pool_min;             /* Min idle leader connections per db */
+	unsigned pool_max;             /* Max idle leader connections per db */
+	unsigned pool_idle_timeout;    /* Msecs before closing idle connections */
+	unsigned stack_size;           /* Stack size of leader loop coroutines */
+	unsigned time_slice;           /* Msecs a statement runs before yielding */
+	unsigned readers;              /* Number of reader threads */
+	unsigned slow_tx_threshold;    /* Msecs above which a tx is slow */
 	struct logger logger;          /* Custom logger */
 	char name[256];                /* VFS/replication registriatio name */
 };
@@ -1,14 +1,23 @@
 #include "conn.h"
 #include "message.h"
+#include "metrics.h"
 #include "request.h"
 #include "transport.h"
 #include "protocol.h"
 
+/* States of a request in the ring. */
+enum {
+	CONN__QUEUED = 1, /* Waiting to be dispatched to the gateway */
+	CONN__RUNNING,    /* Being handled by the gateway */
+	CONN__READY,      /* Response encoded, waiting to be written */
+	CONN__WRITING     /* Response being written */
+};
+
 /* Initialize the given buffer for reading, ensure it has the given size. */
-static int init_read(struct conn *c, uv_buf_t *buf, size_t size)
+static int init_read(struct buffer *buffer, uv_buf_t *buf, size_t size)
 {
-	buffer__reset(&c->read);
-	buf->base = buffer__advance(&c->read, size);
+	buffer__reset(buffer);
+	buf->base = buffer__advance(buffer, size);
 	if (buf->base == NULL) {
 		return DQLITE_NOMEM;
 	}
@@ -16,64 +25,243 @@ static int init_read(struct conn *c, uv_buf_t *buf, size_t size)
 	return 0;
 }
 
-static int read_message(struct conn *c);
-static void write_cb(struct transport *transport, int status)
+/* Return the i'th request of the ring, starting from the oldest one. */
+static struct conn_request *request_at(struct conn *c, unsigned i)
 {
-	struct conn *c = transport->data;
-	bool finished;
+	return &c->requests[(c->first + i) % CONN__PIPELINE];
+}
+
+/* Reset the write buffer of the given request, leaving room for the header. */
+static void init_write(struct conn_request *r)
+{
+	buffer__reset(&r->write);
+	buffer__advance(&r->write, message__sizeof(&r->response)); /* Header */
+}
+
+static void write_cb(struct transport *transport, int status);
+
+/* Write out all responses that are ready, in request order, with a single
+ * vectored write. */
+static void flush(struct conn *c)
+{
+	uv_buf_t bufs[CONN__PIPELINE];
+	struct conn_request *r;
+	unsigned n = 0;
+	unsigned i;
 	int rv;
-	if (status != 0) {
-		goto abort;
-	}
 
-	buffer__reset(&c->write);
-	buffer__advance(&c->write, message__sizeof(&c->response)); /* Header */
+	if (c->writing || c->closed) {
+		return;
+	}
 
-	rv = gateway__resume(&c->gateway, &finished);
-	if (rv != 0) {
-		goto abort;
+	for (i = 0; i < c->n; i++) {
+		r = request_at(c, i);
+		if (r->state != CONN__READY) {
+			break;
+		}
+		r->state = CONN__WRITING;
+		bufs[n].base = buffer__cursor(&r->write, 0);
+		bufs[n].len = buffer__offset(&r->write);
+		n++;
+		if (r->partial) {
+			/* More rows will follow for this request. */
+			break;
+		}
 	}
-	if (!finished) {
+
+	if (n == 0) {
 		return;
 	}
 
-	/* Start reading the next request */
-	rv = read_message(c);
+	rv = transport__writev(&c->transport, bufs, n, write_cb);
 	if (rv != 0) {
+		conn__stop(c);
+		return;
+	}
+	c->writing = true;
+}
+
+static void gateway_handle_cb(struct handle *req, int status, int type)
+{
+	struct conn_request *r = req->data;
+	struct conn *c = r->conn;
+	struct cursor cursor;
+	uint64_t eof;
+	size_t n;
+	void *p;
+
+	if (status != 0) {
 		goto abort;
 	}
+
+	n = buffer__offset(&r->write) - message__sizeof(&r->response);
+	assert(n % 8 == 0);
+
+	r->response.type = type;
+	r->response.words = n / 8;
+	r->response.flags = 0;
+	r->response.extra = 0;
+
+	/* Echo the request ID back to clients that asked for pipelining. */
+	if (r->request.flags & DQLITE_MESSAGE_PIPELINE) {
+		r->response.flags = DQLITE_MESSAGE_PIPELINE;
+		r->response.extra = r->request.extra;
+	}
+
+	p = buffer__cursor(&r->write, 0);
+	message__encode(&r->response, &p);
+
+	/* A batch of rows ending with the part marker means that the gateway
+	 * holds on to the query, and will yield more rows once resumed. */
+	r->partial = false;
+	if (type == DQLITE_RESPONSE_ROWS && n >= 8) {
+		cursor.p = buffer__cursor(&r->write, buffer__offset(&r->write) - 8);
+		cursor.cap = 8;
+		uint64__decode(&cursor, &eof);
+		if (eof == DQLITE_RESPONSE_ROWS_PART) {
+			r->partial = true;
+			c->suspended = true;
+		}
+	}
+
+	metrics__response(&c->gateway.registry->metrics, r->request.type,
+			  buffer__offset(&r->write),
+			  type == DQLITE_RESPONSE_FAILURE, !r->partial, r->start);
+
+	r->state = CONN__READY;
+
+	/* When dispatching synchronously, responses get coalesced and written
+	 * once done. */
+	if (!c->processing) {
+		flush(c);
+	}
 	return;
 abort:
 	conn__stop(c);
 }
 
-static void gateway_handle_cb(struct handle *req, int status, int type)
+/* Whether an interrupt request is queued after the i'th request. */
+static bool interrupt_queued(struct conn *c, unsigned i)
 {
-	struct conn *c = req->data;
-	size_t n;
-	void *cursor;
-	uv_buf_t buf;
+	for (i++; i < c->n; i++) {
+		struct conn_request *r = request_at(c, i);
+		if (r->state == CONN__QUEUED &&
+		    r->request.type == DQLITE_REQUEST_INTERRUPT) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Hand queued requests to the gateway, one at a time and in order, then write
+ * out the responses that are ready.
+ *
+ * This must not be invoked from within a gateway callback, since the gateway
+ * finishes cleaning up a request only after its callback has returned. */
+static void process(struct conn *c)
+{
+	struct conn_request *r;
+	struct cursor cursor;
+	unsigned i;
+	int rv;
+
+	c->processing = true;
+
+	for (i = 0; i < c->n; i++) {
+		r = request_at(c, i);
+		if (r->state == CONN__RUNNING) {
+			/* Don't make the client wait for a request it has
+			 * given up on. */
+			if (!interrupt_queued(c, i)) {
+				break;
+			}
+			gateway__interrupt(&c->gateway);
+			if (r->state == CONN__RUNNING) {
+				break;
+			}
+			continue;
+		}
+		if (r->state != CONN__QUEUED) {
+			continue;
+		}
+		/* While a query is waiting to send more rows, only an interrupt
+		 * request can be handled. */
+		if (c->suspended && r->request.type != DQLITE_REQUEST_INTERRUPT) {
+			break;
+		}
+		cursor.p = buffer__cursor(&r->read, 0);
+		cursor.cap = buffer__offset(&r->read);
+		init_write(r);
+		r->state = CONN__RUNNING;
+		r->start = metrics__now();
+		rv = gateway__handle(&c->gateway, &r->handle, r->request.type,
+				     &cursor, &r->write, gateway_handle_cb);
+		if (rv != 0 || c->closed) {
+			c->processing = false;
+			conn__stop(c);
+			return;
+		}
+		if (r->state == CONN__RUNNING) {
+			/* Asynchronous request. */
+			break;
+		}
+	}
+
+	c->processing = false;
+
+	flush(c);
+}
+
+static int read_message(struct conn *c);
+static void write_cb(struct transport *transport, int status)
+{
+	struct conn *c = transport->data;
+	struct conn_request *r;
+	bool finished;
 	int rv;
 
+	c->writing = false;
+
 	if (status != 0) {
 		goto abort;
 	}
 
-	n = buffer__offset(&c->write) - message__sizeof(&c->response);
-	assert(n % 8 == 0);
-
-	c->response.type = type;
-	c->response.words = n / 8;
-	c->response.flags = 0;
-	c->response.extra = 0;
+	c->processing = true;
+	while (c->n > 0) {
+		r = request_at(c, 0);
+		if (r->state != CONN__WRITING) {
+			break;
+		}
+		if (r->partial) {
+			r->partial = false;
+			c->suspended = false;
+			init_write(r);
+			r->state = CONN__RUNNING;
+			rv = gateway__resume(&c->gateway, &finished);
+			if (rv != 0) {
+				c->processing = false;
+				goto abort;
+			}
+			if (!finished) {
+				break;
+			}
+		}
+		r->state = 0;
+		c->first = (c->first + 1) % CONN__PIPELINE;
+		c->n--;
+	}
+	c->processing = false;
 
-	cursor = buffer__cursor(&c->write, 0);
-	message__encode(&c->response, &cursor);
+	/* Keep using the same requests, and hence the same buffers, when the
+	 * client doesn't pipeline. */
+	if (c->n == 0 && !c->reading_req) {
+		c->first = 0;
+	}
 
-	buf.base = buffer__cursor(&c->write, 0);
-	buf.len = buffer__offset(&c->write);
+	process(c);
 
-	rv = transport__write(&c->transport, &buf, write_cb);
+	/* Start reading again if the ring was full. */
+	rv = read_message(c);
 	if (rv != 0) {
 		goto abort;
 	}
@@ -85,9 +273,16 @@ abort:
 static void close_cb(struct transport *transport)
 {
 	struct conn *c = transport->data;
+	unsigned i;
 	c->closed = true;
 	gateway__close(&c->gateway);
-	buffer__close(&c->write);
+	for (i = 0; i < CONN__PIPELINE; i++) {
+		struct conn_request *r = &c->requests[i];
+		if (r->initialized) {
+			buffer__close(&r->write);
+			buffer__close(&r->read);
+		}
+	}
 	buffer__close(&c->read);
 	if (c->close_cb != NULL) {
 		c->close_cb(c);
@@ -113,29 +308,35 @@ static void raft_connect(struct conn *c, struct cursor *cursor)
 static void read_request_cb(struct transport *transport, int status)
 {
 	struct conn *c = transport->data;
+	struct conn_request *r;
 	struct cursor cursor;
 	int rv;
 
+	c->reading = false;
+	c->reading_req = false;
+
 	if (status != 0) {
 		// errorf(c->logger, "read error");
 		conn__stop(c);
 		return;
 	}
 
-	cursor.p = buffer__cursor(&c->read, 0);
-	cursor.cap = buffer__offset(&c->read);
+	r = request_at(c, c->n);
 
-	buffer__reset(&c->write);
-	buffer__advance(&c->write, message__sizeof(&c->response)); /* Header */
-
-	switch (c->request.type) {
+	switch (r->request.type) {
 		case DQLITE_REQUEST_CONNECT:
+			cursor.p = buffer__cursor(&r->read, 0);
+			cursor.cap = buffer__offset(&r->read);
 			raft_connect(c, &cursor);
 			return;
 	}
 
-	rv = gateway__handle(&c->gateway, &c->handle, c->request.type, &cursor,
-			     &c->write, gateway_handle_cb);
+	r->state = CONN__QUEUED;
+	c->n++;
+
+	process(c);
+
+	rv = read_message(c);
 	if (rv != 0) {
 		conn__stop(c);
 	}
@@ -144,9 +345,23 @@ static void read_request_cb(struct transport *transport, int status)
 /* Start reading the body of the next request */
 static int read_request(struct conn *c)
 {
+	struct conn_request *r = request_at(c, c->n);
 	uv_buf_t buf;
 	int rv;
-	rv = init_read(c, &buf, c->request.words * 8);
+	if (!r->initialized) {
+		rv = buffer__init(&r->read);
+		if (rv != 0) {
+			return rv;
+		}
+		rv = buffer__init(&r->write);
+		if (rv != 0) {
+			buffer__close(&r->read);
+			return rv;
+		}
+		r->initialized = true;
+	}
+	r->request = c->request;
+	rv = init_read(&r->read, &buf, r->request.words * 8);
 	if (rv != 0) {
 		return rv;
 	}
@@ -154,6 +369,8 @@ static int read_request(struct conn *c)
 	if (rv != 0) {
 		return rv;
 	}
+	c->reading = true;
+	c->reading_req = true;
 	return 0;
 }
 
@@ -163,6 +380,8 @@ static void read_message_cb(struct transport *transport, int status)
 	struct cursor cursor;
 	int rv;
 
+	c->reading = false;
+
 	if (status != 0) {
 		// errorf(c->logger, "read error");
 		conn__stop(c);
@@ -182,12 +401,16 @@ static void read_message_cb(struct transport *transport, int status)
 	}
 }
 
-/* Start reading metadata about the next message */
+/* Start reading metadata about the next message, unless a message is already
+ * being read or the requests ring is full. */
 static int read_message(struct conn *c)
 {
 	uv_buf_t buf;
 	int rv;
-	rv = init_read(c, &buf, message__sizeof(&c->request));
+	if (c->closed || c->reading || c->n == CONN__PIPELINE) {
+		return 0;
+	}
+	rv = init_read(&c->read, &buf, message__sizeof(&c->request));
 	if (rv != 0) {
 		return rv;
 	}
@@ -195,6 +418,7 @@ static int read_message(struct conn *c)
 	if (rv != 0) {
 		return rv;
 	}
+	c->reading = true;
 	return 0;
 }
 
@@ -239,7 +463,7 @@ static int read_protocol(struct conn *c)
 {
 	uv_buf_t buf;
 	int rv;
-	rv = init_read(c, &buf, sizeof c->protocol);
+	rv = init_read(&c->read, &buf, sizeof c->protocol);
 	if (rv != 0) {
 		return rv;
 	}
@@ -259,6 +483,7 @@ int conn__start(struct conn *c,
 		struct raft_uv_transport *uv_transport,
 		conn_close_cb close_cb)
 {
+	unsigned i;
 	int rv;
 	(void)loop;
 	rv = transport__init(&c->transport, stream);
@@ -274,21 +499,29 @@ int conn__start(struct conn *c,
 	if (rv != 0) {
 		goto err_after_transport_init;
 	}
-	rv = buffer__init(&c->write);
-	if (rv != 0) {
-		goto err_after_read_buffer_init;
+	for (i = 0; i < CONN__PIPELINE; i++) {
+		struct conn_request *r = &c->requests[i];
+		r->conn = c;
+		r->state = 0;
+		r->partial = false;
+		r->initialized = false;
+		r->handle.data = r;
 	}
-	c->handle.data = c;
+	c->first = 0;
+	c->n = 0;
+	c->reading = false;
+	c->reading_req = false;
+	c->writing = false;
+	c->processing = false;
+	c->suspended = false;
 	c->closed = false;
 	/* First, we expect the client to send us the protocol version. */
 	rv = read_protocol(c);
 	if (rv != 0) {
-		goto err_after_write_buffer_init;
+		goto err_after_read_buffer_init;
 	}
 	return 0;
 
-err_after_write_buffer_init:
-	buffer__close(&c->write);
 err_after_read_buffer_init:
 	buffer__close(&c->read);
 err_after_transport_init:
@@ -14,12 +14,36 @@
 #include "gateway.h"
 #include "message.h"
 
+/**
+ * Maximum number of requests that a client can send without waiting for their
+ * responses. Once the limit is reached the connection stops reading from the
+ * socket until a response has been written.
+ */
+#define CONN__PIPELINE 16
+
 /**
  * Callbacks.
  */
 struct conn;
 typedef void (*conn_close_cb)(struct conn *c);
 
+/**
+ * A request received from the client, along with its response.
+ */
+struct conn_request
+{
+	struct conn *conn;        /* Connection the request was received on */
+	int state;                /* Queued, running, ready or writing */
+	bool partial;             /* Whether the response is a partial batch */
+	bool initialized;         /* Whether the buffers have been initialized */
+	unsigned long long start; /* When dispatched to the gateway */
+	struct message request;   /* Request message meta data */
+	struct message response;  /* Response message meta data */
+	struct buffer read;       /* Request payload */
+	struct buffer write;      /* Response header and payload */
+	struct handle handle;     /* Gateway request */
+};
+
 struct conn
 {
 	struct config *config;
@@ -28,11 +52,16 @@ struct conn
 	struct transport transport;             /* Async network read/write */
 	struct gateway gateway;                 /* Request handler */
 	struct buffer read;                     /* Read buffer */
-	struct buffer write;                    /* Write buffer */
 	uint64_t protocol;                      /* Protocol format version */
 	struct message request;                 /* Request message meta data */
-	struct message response;                /* Response message meta data */
-	struct handle handle;
+	struct conn_request requests[CONN__PIPELINE]; /* Ring of requests */
+	unsigned first;    /* Index of the oldest request in the ring */
+	unsigned n;        /* Number of requests in the ring */
+	bool reading;      /* Whether a message is being read */
+	bool reading_req;  /* Whether a request payload is being read */
+	bool writing;      /* Whether responses are being written */
+	bool processing;   /* Whether requests are being dispatched */
+	bool suspended;    /* Whether a query has more rows to send */
 	bool closed;
 	queue queue;
 };
@@ -21,18 +21,37 @@ void db__init(struct db *db, struct config *config, const char *filename)
 	db->opening = false;
 	db->follower = NULL;
 	db->tx = NULL;
+	db->txs = NULL;
+	db->lease = NULL;
+	db->coros = NULL;
+	db->slices = NULL;
+	db->metrics = NULL;
+	db->readers = NULL;
+	db->checkpointing = false;
 	QUEUE__INIT(&db->leaders);
+	QUEUE__INIT(&db->pool);
+	db->n_pool = 0;
+	QUEUE__INIT(&db->writers);
+	db->n_writers = 0;
+	db->max_writers = 0;
+	db->writer_timeouts = 0;
+	db->waking = false;
 }
 
 void db__close(struct db *db)
 {
 	assert(QUEUE__IS_EMPTY(&db->leaders));
+	assert(QUEUE__IS_EMPTY(&db->pool));
+	assert(QUEUE__IS_EMPTY(&db->writers));
 	if (db->follower != NULL) {
 		int rc;
 		rc = sqlite3_close(db->follower);
 		assert(rc == SQLITE_OK);
 	}
 	if (db->tx != NULL) {
+		if (db->txs != NULL) {
+			hash__remove(db->txs, &db->by_tx);
+		}
 		sqlite3_free(db->tx);
 	}
 	sqlite3_free(db->filename);
@@ -58,11 +77,23 @@ int db__create_tx(struct db *db, unsigned long long id, sqlite3 *conn)
 		return DQLITE_NOMEM;
 	}
 	tx__init(db->tx, id, conn);
+	if (db->txs != NULL) {
+		int rv;
+		rv = hash__insert(db->txs, &db->by_tx, id);
+		if (rv != 0) {
+			sqlite3_free(db->tx);
+			db->tx = NULL;
+			return rv;
+		}
+	}
 	return 0;
 }
 
 void db__delete_tx(struct db *db)
 {
+	if (db->txs != NULL) {
+		hash__remove(db->txs, &db->by_tx);
+	}
 	tx__close(db->tx);
 	sqlite3_free(db->tx);
 	db->tx = NULL;
@@ -5,20 +5,43 @@
 #ifndef DB_H_
 #define DB_H_
 
+#include "lib/coro.h"
+#include "lib/hash.h"
 #include "lib/queue.h"
 
 #include "config.h"
+#include "lease.h"
 #include "tx.h"
 
+struct metrics;
+struct readers;
+struct slices;
+
 struct db
 {
-	struct config *config; /* Dqlite configuration */
-	char *filename;        /* Database filename */
-	bool opening;          /* Whether an Open request is in progress */
-	sqlite3 *follower;     /* Follower connection */
-	queue leaders;         /* Open leader connections */
-	struct tx *tx;         /* Current ongoing transaction, if any */
-	queue queue;           /* Prev/next database, used by the registry */
+	struct config *config;    /* Dqlite configuration */
+	char *filename;           /* Database filename */
+	bool opening;             /* Whether an Open request is in progress */
+	sqlite3 *follower;        /* Follower connection */
+	queue leaders;            /* Open leader connections */
+	queue pool;               /* Idle leader connections, oldest first */
+	unsigned n_pool;          /* Number of leader connections in @pool */
+	struct tx *tx;            /* Current ongoing transaction, if any */
+	queue queue;              /* Prev/next database, used by the registry */
+	struct hash_item by_name; /* Link in the registry filename index */
+	struct hash_item by_tx;   /* Link in the transaction index */
+	struct hash *txs;         /* Transaction index to add @tx to, if any */
+	struct lease *lease;      /* Leader lease of this node, if any */
+	struct coro_pool *coros;  /* Loop coroutines of leader connections */
+	struct slices *slices;    /* Suspended leader connections, if any */
+	struct metrics *metrics;  /* Metrics to update, if any */
+	struct readers *readers;  /* Reader threads of the node, if any */
+	bool checkpointing;       /* Whether a checkpoint command is in flight */
+	queue writers;            /* Leader execs waiting for @tx to end */
+	unsigned n_writers;       /* Number of execs in @writers */
+	unsigned max_writers;     /* Highest value reached by @n_writers */
+	unsigned long long writer_timeouts; /* Execs that gave up waiting */
+	bool waking;              /* Whether waiting execs are being started */
 };
 
 /**
@@ -46,6 +69,9 @@ int db__open_follower(struct db *db);
  *
  * The given conn @conn can be either a leader or a follower transaction. There
  * must be no ongoing write transaction for this database.
+ *
+ * If the database has a transaction index, the transaction is added to it
+ * until it gets deleted.
  */
 int db__create_tx(struct db *db, unsigned long long id, sqlite3 *conn);
 
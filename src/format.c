@@ -47,6 +47,16 @@ void format__get_mx_frame(const uint8_t *buf, uint32_t *mx_frame) {
 	*mx_frame = ((uint32_t *)buf)[4];
 }
 
+void format__get_frame_pgno(const uint8_t *buf, uint32_t *pgno) {
+	assert(buf != NULL);
+	assert(pgno != NULL);
+
+	/* The page number is stored in the first 4 bytes of the frame header
+	 * (big-endian). */
+	*pgno = ((uint32_t)buf[0] << 24) + (buf[1] << 16) + (buf[2] << 8) +
+		buf[3];
+}
+
 void format__get_read_marks(const uint8_t *buf,
                                    uint32_t read_marks[FORMAT__WAL_NREADER]) {
 	uint32_t *idx;
@@ -43,6 +43,12 @@
  */
 #define FORMAT__WAL_NREADER 5
 
+/**
+ * Index of the lock held by the WAL writer. See the equivalent WAL_WRITE_LOCK
+ * definition in the wal.c file of the SQLite source code.
+ */
+#define FORMAT__WAL_WRITE_LOCK 0
+
 /**
  * Lock index given the offset I in the aReadMark array. See the equivalent
  * WAL_READ_LOCK definition in the wal.c file of the SQLite source code.
@@ -91,6 +97,11 @@ int format__get_page_size(int type,
  */
 void format__get_mx_frame(const uint8_t *buf, uint32_t *mx_frame);
 
+/**
+ * Extract the database page number from the header of a WAL frame.
+ */
+void format__get_frame_pgno(const uint8_t *buf, uint32_t *pgno);
+
 /**
  * Extract the read marks array from the WAL index header stored in the given
  * buffer.
@@ -4,13 +4,20 @@
 #include "lib/serialize.h"
 
 #include "command.h"
+#include "format.h"
 #include "fsm.h"
+#include "metrics.h"
 #include "vfs.h"
 
 struct fsm
 {
 	struct logger *logger;
 	struct registry *registry;
+	struct
+	{
+		struct snapshotCapture *captures; /* Captured databases */
+		unsigned n;                       /* Number of captures */
+	} snapshot;                               /* Snapshot in progress */
 };
 
 static int apply_open(struct fsm *f, const struct command_open *c)
@@ -37,6 +44,8 @@ static int apply_frames(struct fsm *f, const struct command_frames *c)
 	unsigned *page_numbers;
 	void *pages;
 	bool is_begin = true;
+	bool is_leader = false;
+	unsigned long long start = 0;
 	int rc;
 
 	rc = registry__db_get(f->registry, c->filename, &db);
@@ -58,6 +67,7 @@ static int apply_frames(struct fsm *f, const struct command_frames *c)
 				/* We're executing this FSM command in during
 				 * the execution of the replication->frames()
 				 * hook. */
+				is_leader = true;
 			}
 		} else {
 			/* We're executing the Frames command as followers. The
@@ -75,6 +85,13 @@ static int apply_frames(struct fsm *f, const struct command_frames *c)
 		tx = db->tx;
 	}
 
+	if (is_leader) {
+		/* The leader submitted the command: from now on the time is
+		 * spent by the FSM. */
+		start = metrics__now();
+		tx->timing.raft += start - tx->timing.submit;
+	}
+
 	rc = command_frames__page_numbers(c, &page_numbers);
 	if (rc != 0) {
 		return rc;
@@ -91,6 +108,11 @@ static int apply_frames(struct fsm *f, const struct command_frames *c)
 		return rc;
 	}
 
+	if (is_leader) {
+		tx->timing.fsm += metrics__now() - start;
+		tx->timing.n++;
+	}
+
 	/* If the commit flag is on, this is the final write of a transaction,
 	 */
 	if (c->is_commit) {
@@ -173,11 +195,30 @@ static int apply_checkpoint(struct fsm *f, const struct command_checkpoint *c)
 	return 0;
 }
 
-static int fsm__apply(struct raft_fsm *fsm,
-		      const struct raft_buffer *buf,
-		      void **result)
+static int apply_command(struct fsm *f, const struct raft_buffer *buf);
+
+/* Apply the commands of a batch in order, as if each had its own entry. */
+static int apply_batch(struct fsm *f, const struct command_batch *c)
+{
+	struct cursor cursor;
+	struct raft_buffer buf;
+	unsigned i;
+	int rc;
+
+	command_batch__cursor(c, &cursor);
+	for (i = 0; i < c->commands.n; i++) {
+		command_batch__next(&cursor, &buf);
+		rc = apply_command(f, &buf);
+		if (rc != 0) {
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+static int apply_command(struct fsm *f, const struct raft_buffer *buf)
 {
-	struct fsm *f = fsm->data;
 	int type;
 	void *command;
 	int rc;
@@ -199,14 +240,15 @@ static int fsm__apply(struct raft_fsm *fsm,
 		case COMMAND_CHECKPOINT:
 			rc = apply_checkpoint(f, command);
 			break;
+		case COMMAND_BATCH:
+			rc = apply_batch(f, command);
+			break;
 		default:
 			rc = RAFT_MALFORMED;
 			goto err_after_command_decode;
 	}
 	raft_free(command);
 
-	*result = NULL;
-
 	return 0;
 
 err_after_command_decode:
@@ -215,7 +257,23 @@ err:
 	return rc;
 }
 
-#define SNAPSHOT_FORMAT 1
+static int fsm__apply(struct raft_fsm *fsm,
+		      const struct raft_buffer *buf,
+		      void **result)
+{
+	struct fsm *f = fsm->data;
+	int rc;
+	rc = apply_command(f, buf);
+	if (rc != 0) {
+		return rc;
+	}
+
+	*result = NULL;
+
+	return 0;
+}
+
+#define SNAPSHOT_FORMAT 2
 
 #define SNAPSHOT_HEADER(X, ...)          \
 	X(uint64, format, ##__VA_ARGS__) \
@@ -230,6 +288,24 @@ SERIALIZE__IMPLEMENT(snapshotHeader, SNAPSHOT_HEADER);
 SERIALIZE__DEFINE(snapshotDatabase, SNAPSHOT_DATABASE);
 SERIALIZE__IMPLEMENT(snapshotDatabase, SNAPSHOT_DATABASE);
 
+/* Write transaction in progress, following the database header since format
+ * 2. Its uncommitted WAL frames follow the WAL content. */
+#define SNAPSHOT_TX(X, ...)                 \
+	X(uint64, id, ##__VA_ARGS__)        \
+	X(uint64, page_size, ##__VA_ARGS__) \
+	X(uint64, n_frames, ##__VA_ARGS__)
+SERIALIZE__DEFINE(snapshotTx, SNAPSHOT_TX);
+SERIALIZE__IMPLEMENT(snapshotTx, SNAPSHOT_TX);
+
+/* Database captured by the snapshot in progress. */
+struct snapshotCapture
+{
+	struct snapshotDatabase database; /* Database header */
+	struct snapshotTx tx;             /* Transaction in progress, if any */
+	unsigned n;                       /* Number of page buffers */
+	void *image;                      /* Pages referenced by the buffers */
+};
+
 /* Encode the global snapshot header. */
 static int encodeSnapshotHeader(unsigned n, struct raft_buffer *buf)
 {
@@ -247,187 +323,390 @@ static int encodeSnapshotHeader(unsigned n, struct raft_buffer *buf)
 	return 0;
 }
 
-/* Generate the WAL filename associated with the given main database
- * filename. */
-static char *generateWalFilename(const char *filename)
+/* Capture the given database, without copying its content.
+ *
+ * The first buffer is reserved for the database header, which gets encoded
+ * later by encodeDatabase(), and the following buffers are filled with
+ * pointers to the pages of the database and of its WAL, as returned by
+ * vfsShallowSnapshot(). */
+static int captureDatabase(struct db *db,
+			   struct snapshotCapture *capture,
+			   struct raft_buffer bufs[])
 {
-	char *out;
-	out = sqlite3_malloc(strlen(filename) + strlen("-wal") + 1);
-	if (out == NULL) {
-		return out;
+	struct vfsSnapshotInfo info;
+	struct tx *tx = db->tx;
+	int rv;
+
+	bufs[0].base = NULL;
+	bufs[0].len = 0;
+
+	rv = vfsShallowSnapshot(db->config->name, db->filename, &bufs[1],
+				capture->n, &info);
+	if (rv != 0) {
+		goto err;
 	}
-	sprintf(out, "%s-wal", filename);
-	return out;
+
+	/* A transaction that has written frames gets captured along with its
+	 * uncommitted frames. If we can't tell them apart (e.g. a zombie
+	 * transaction was already rolled back locally but not yet undone by
+	 * the new leader) the snapshot has to be postponed. */
+	if (tx != NULL && tx->state == TX__WRITING) {
+		if (info.n_pending == 0) {
+			rv = RAFT_BUSY;
+			goto err_after_shallow_snapshot;
+		}
+		capture->tx.id = tx->id;
+	} else if (tx == NULL || tx->state == TX__PENDING) {
+		if (info.n_pending > 0) {
+			rv = RAFT_BUSY;
+			goto err_after_shallow_snapshot;
+		}
+		capture->tx.id = 0;
+	} else {
+		rv = RAFT_BUSY;
+		goto err_after_shallow_snapshot;
+	}
+
+	capture->database.filename = db->filename;
+	capture->database.main_size = info.main_size;
+	capture->database.wal_size = info.wal_size;
+	capture->tx.page_size = info.page_size;
+	capture->tx.n_frames = info.n_pending;
+	capture->image = info.image;
+
+	return 0;
+
+err_after_shallow_snapshot:
+	vfsShallowSnapshotRelease(db->config->name, info.image);
+err:
+	assert(rv != 0);
+	return rv;
 }
 
-/* Encode the given database. */
-static int encodeDatabase(struct db *db, struct raft_buffer bufs[3])
+/* Encode the header of a database captured with captureDatabase(). */
+static int encodeDatabase(const struct snapshotCapture *capture,
+			  struct raft_buffer *buf)
 {
-	struct snapshotDatabase header;
-	char *walFilename;
 	void *cursor;
+
+	buf->len = snapshotDatabase__sizeof(&capture->database) +
+		   snapshotTx__sizeof(&capture->tx);
+	buf->base = raft_malloc(buf->len);
+	if (buf->base == NULL) {
+		return RAFT_NOMEM;
+	}
+	cursor = buf->base;
+	snapshotDatabase__encode(&capture->database, &cursor);
+	snapshotTx__encode(&capture->tx, &cursor);
+
+	return 0;
+}
+
+/* Release the buffers of a database captured with captureDatabase(). */
+static void releaseDatabase(struct fsm *f,
+			    const struct snapshotCapture *capture,
+			    struct raft_buffer bufs[])
+{
+	vfsShallowSnapshotRelease(f->registry->config->name, capture->image);
+	raft_free(bufs[0].base);
+}
+
+/* Release all buffers of the snapshot in progress. */
+static void releaseSnapshot(struct fsm *f,
+			    struct raft_buffer bufs[],
+			    unsigned n_captures)
+{
+	unsigned i;
+	unsigned j;
+
+	i = 1;
+	for (j = 0; j < n_captures; j++) {
+		releaseDatabase(f, &f->snapshot.captures[j], &bufs[i]);
+		i += 1 + f->snapshot.captures[j].n;
+	}
+
+	raft_free(bufs[0].base);
+	raft_free(bufs);
+	raft_free(f->snapshot.captures);
+
+	f->snapshot.captures = NULL;
+	f->snapshot.n = 0;
+}
+
+/* Re-create the write transaction that was in progress when the snapshot was
+ * taken, writing its uncommitted frames like apply_frames() would have
+ * done. */
+static int restoreTx(struct db *db,
+		     const struct snapshotTx *header,
+		     struct cursor *cursor)
+{
+	size_t frame_size = format__wal_calc_frame_size(header->page_size);
+	const uint8_t *frame = cursor->p;
+	unsigned *page_numbers;
+	uint8_t *pages;
+	uint32_t pgno;
+	unsigned i;
 	int rv;
 
-	walFilename = generateWalFilename(db->filename);
-	if (walFilename == NULL) {
+	if (cursor->cap / frame_size < header->n_frames) {
+		rv = RAFT_MALFORMED;
+		goto err;
+	}
+
+	page_numbers =
+	    sqlite3_malloc64(header->n_frames * sizeof *page_numbers);
+	if (page_numbers == NULL) {
 		rv = RAFT_NOMEM;
 		goto err;
 	}
+	pages = sqlite3_malloc64(header->n_frames * header->page_size);
+	if (pages == NULL) {
+		rv = RAFT_NOMEM;
+		goto err_after_page_numbers_alloc;
+	}
 
-	header.filename = db->filename;
+	for (i = 0; i < header->n_frames; i++) {
+		format__get_frame_pgno(frame, &pgno);
+		page_numbers[i] = pgno;
+		memcpy(pages + i * header->page_size,
+		       frame + FORMAT__WAL_FRAME_HDR_SIZE, header->page_size);
+		frame += frame_size;
+	}
 
-	/* Main database file. */
-	rv = vfsFileRead(db->config->name, db->filename, &bufs[1].base,
-			 &bufs[1].len);
+	rv = db__create_tx(db, header->id, db->follower);
 	if (rv != 0) {
-		goto err_after_wal_filename_alloc;
+		goto err_after_pages_alloc;
 	}
-	header.main_size = bufs[1].len;
 
-	/* WAL file. */
-	rv = vfsFileRead(db->config->name, walFilename, &bufs[2].base,
-			 &bufs[2].len);
+	rv = tx__frames(db->tx, true, header->page_size, header->n_frames,
+			page_numbers, pages, 0, false);
 	if (rv != 0) {
-		goto err_after_main_file_read;
+		goto err_after_create_tx;
 	}
-	header.wal_size = bufs[2].len;
 
-	/* Database header. */
-	bufs[0].len = snapshotDatabase__sizeof(&header);
-	bufs[0].base = raft_malloc(bufs[0].len);
-	if (bufs[0].base == NULL) {
-		rv = RAFT_NOMEM;
-		goto err_after_wal_file_read;
-	}
-	cursor = bufs[0].base;
-	snapshotDatabase__encode(&header, &cursor);
+	sqlite3_free(pages);
+	sqlite3_free(page_numbers);
 
-	sqlite3_free(walFilename);
+	cursor->cap -= (const uint8_t *)frame - (const uint8_t *)cursor->p;
+	cursor->p = frame;
 
 	return 0;
 
-err_after_wal_file_read:
-	sqlite3_free(bufs[2].base);
-err_after_main_file_read:
-	sqlite3_free(bufs[1].base);
-err_after_wal_filename_alloc:
-	sqlite3_free(walFilename);
+err_after_create_tx:
+	db__delete_tx(db);
+err_after_pages_alloc:
+	sqlite3_free(pages);
+err_after_page_numbers_alloc:
+	sqlite3_free(page_numbers);
 err:
 	assert(rv != 0);
 	return rv;
 }
 
-/* Decode the database contained in a snapshot. */
-static int decodeDatabase(struct fsm *f, struct cursor *cursor)
+/* Decode the database contained in a snapshot, pointing its pages directly
+ * into the snapshot buffer. */
+static int decodeDatabase(struct fsm *f,
+			  struct cursor *cursor,
+			  int format,
+			  struct vfsBacking *backing)
 {
 	struct snapshotDatabase header;
+	struct snapshotTx tx;
 	struct db *db;
-	char *walFilename;
+	size_t size;
 	int rv;
 
 	rv = snapshotDatabase__decode(cursor, &header);
 	if (rv != 0) {
 		return rv;
 	}
+	if (format >= 2) {
+		rv = snapshotTx__decode(cursor, &tx);
+		if (rv != 0) {
+			return rv;
+		}
+	} else {
+		tx.id = 0;
+		tx.page_size = 0;
+		tx.n_frames = 0;
+	}
 	rv = registry__db_get(f->registry, header.filename, &db);
 	if (rv != 0) {
 		return rv;
 	}
-	rv = vfsFileWrite(db->config->name, db->filename, cursor->p,
-			  header.main_size);
+	size = header.main_size + header.wal_size;
+	if (size < header.main_size || size > cursor->cap) {
+		return RAFT_MALFORMED;
+	}
+	rv = vfsRestore(db->config->name, db->filename, cursor->p,
+			header.main_size, header.wal_size, backing);
 	if (rv != 0) {
 		return rv;
 	}
-	walFilename = generateWalFilename(db->filename);
-	if (walFilename == NULL) {
-		return RAFT_NOMEM;
-	}
-	cursor->p += header.main_size;
-	if (header.wal_size > 0) {
-		rv = vfsFileWrite(db->config->name, walFilename, cursor->p,
-				  header.wal_size);
-		if (rv != 0) {
-			sqlite3_free(walFilename);
-			return rv;
-		}
-	}
-	cursor->p += header.wal_size;
-	sqlite3_free(walFilename);
+	cursor->p += size;
+	cursor->cap -= size;
 
 	rv = db__open_follower(db);
 	if (rv != 0) {
 		return rv;
 	}
 
+	if (tx.n_frames > 0) {
+		rv = restoreTx(db, &tx, cursor);
+		if (rv != 0) {
+			return rv;
+		}
+	}
+
 	return 0;
 }
 
+/* Capture a consistent image of all databases as of the last applied index,
+ * including the transactions in progress. This runs in the main loop thread,
+ * but only takes references to the database pages, without copying them, and
+ * only the pages written since the previous snapshot need to be looked at.
+ * The headers are encoded later by fsm__snapshot_async. */
 static int fsm__snapshot(struct raft_fsm *fsm,
 			 struct raft_buffer *bufs[],
 			 unsigned *n_bufs)
 {
 	struct fsm *f = fsm->data;
+	struct snapshotCapture *captures;
 	queue *head;
 	struct db *db;
 	unsigned n = 0;
 	unsigned i;
+	unsigned j;
 	int rv;
 
-	/* First count how many databases we have and check that no transaction
-	 * is in progress. */
+	assert(f->snapshot.captures == NULL);
+
+	/* First count how many databases we have. */
+	QUEUE__FOREACH(head, &f->registry->dbs)
+	{
+		n++;
+	}
+
+	captures = raft_malloc((n + 1) * sizeof *captures);
+	if (captures == NULL) {
+		rv = RAFT_NOMEM;
+		goto err;
+	}
+
+	/* Then count how many pages each database has. */
+	*n_bufs = 1; /* Snapshot header */
+	j = 0;
 	QUEUE__FOREACH(head, &f->registry->dbs)
 	{
 		db = QUEUE__DATA(head, struct db, queue);
-		if (db->tx != NULL) {
-			return RAFT_BUSY;
+		rv = vfsShallowSnapshotLen(db->config->name, db->filename,
+					   &captures[j].n);
+		if (rv != 0) {
+			goto err_after_captures_alloc;
 		}
-		n++;
+		*n_bufs += 1 + captures[j].n; /* Database header and pages */
+		j++;
 	}
 
-	*n_bufs = 1;      /* Snapshot header */
-	*n_bufs += n * 3; /* Database header, main and wal */
 	*bufs = raft_malloc(*n_bufs * sizeof **bufs);
 	if (*bufs == NULL) {
 		rv = RAFT_NOMEM;
-		goto err;
+		goto err_after_captures_alloc;
 	}
 
-	rv = encodeSnapshotHeader(n, &(*bufs)[0]);
-	if (rv != 0) {
-		goto err_after_bufs_alloc;
-	}
+	/* The snapshot header is encoded by fsm__snapshot_async too. */
+	(*bufs)[0].base = NULL;
+	(*bufs)[0].len = 0;
+
+	f->snapshot.captures = captures;
 
-	/* Encode individual databases. */
 	i = 1;
+	j = 0;
 	QUEUE__FOREACH(head, &f->registry->dbs)
 	{
 		db = QUEUE__DATA(head, struct db, queue);
-		rv = encodeDatabase(db, &(*bufs)[i]);
+		rv = captureDatabase(db, &captures[j], &(*bufs)[i]);
 		if (rv != 0) {
-			goto err_after_encode_header;
+			goto err_after_capture;
 		}
-		i += 3;
+		i += 1 + captures[j].n;
+		j++;
 	}
 
+	assert(i == *n_bufs);
+
+	f->snapshot.n = n;
+
 	return 0;
 
-err_after_encode_header:
-	do {
-		raft_free((*bufs)[i].base);
-		i--;
-	} while (i > 0);
-err_after_bufs_alloc:
-	raft_free(*bufs);
+err_after_capture:
+	releaseSnapshot(f, *bufs, j);
+	goto err;
+err_after_captures_alloc:
+	raft_free(captures);
 err:
 	assert(rv != 0);
 	return rv;
 }
 
+/* Encode the headers of the snapshot captured by fsm__snapshot. This runs in
+ * a thread pool, while the main loop keeps applying commands: the captured
+ * pages can't change, since any write to them is done on a copy. */
+static int fsm__snapshot_async(struct raft_fsm *fsm,
+			       struct raft_buffer *bufs[],
+			       unsigned *n_bufs)
+{
+	struct fsm *f = fsm->data;
+	unsigned i;
+	unsigned j;
+	int rv;
+
+	rv = encodeSnapshotHeader(f->snapshot.n, &(*bufs)[0]);
+	if (rv != 0) {
+		return rv;
+	}
+
+	i = 1;
+	for (j = 0; j < f->snapshot.n; j++) {
+		rv = encodeDatabase(&f->snapshot.captures[j], &(*bufs)[i]);
+		if (rv != 0) {
+			return rv;
+		}
+		i += 1 + f->snapshot.captures[j].n;
+	}
+
+	assert(i == *n_bufs);
+
+	return 0;
+}
+
+/* Release the snapshot buffers returned by fsm__snapshot, once raft has
+ * persisted them. Database pages captured by the snapshot can be modified or
+ * freed again after this point. */
+static int fsm__snapshot_finalize(struct raft_fsm *fsm,
+				  struct raft_buffer *bufs[],
+				  unsigned *n_bufs)
+{
+	struct fsm *f = fsm->data;
+
+	if (*bufs == NULL) {
+		return 0;
+	}
+
+	releaseSnapshot(f, *bufs, f->snapshot.n);
+
+	*bufs = NULL;
+	*n_bufs = 0;
+
+	return 0;
+}
+
 static int fsm__restore(struct raft_fsm *fsm, struct raft_buffer *buf)
 {
 	struct fsm *f = fsm->data;
 	struct cursor cursor = {buf->base, buf->len};
 	struct snapshotHeader header;
+	struct vfsBacking *backing;
 	unsigned i;
 	int rv;
 
@@ -435,20 +714,35 @@ static int fsm__restore(struct raft_fsm *fsm, struct raft_buffer *buf)
 	if (rv != 0) {
 		return rv;
 	}
-	if (header.format != SNAPSHOT_FORMAT) {
+	if (header.format < 1 || header.format > SNAPSHOT_FORMAT) {
 		return RAFT_MALFORMED;
 	}
 
+	/* The restored pages point into the snapshot buffer, which is released
+	 * once none of them is used anymore. */
+	backing = vfsBackingCreate(buf->base);
+	if (backing == NULL) {
+		return RAFT_NOMEM;
+	}
+
 	for (i = 0; i < header.n; i++) {
-		rv = decodeDatabase(f, &cursor);
+		rv = decodeDatabase(f, &cursor, (int)header.format, backing);
 		if (rv != 0) {
-			return rv;
+			goto err;
 		}
 	}
 
-	raft_free(buf->base);
+	vfsBackingRelease(f->registry->config->name, backing);
 
 	return 0;
+
+err:
+	/* Some pages might be pointing into the buffer already, so we keep
+	 * owning it and raft must not free it. */
+	vfsBackingRelease(f->registry->config->name, backing);
+	buf->base = NULL;
+	buf->len = 0;
+	return rv;
 }
 
 int fsm__init(struct raft_fsm *fsm,
@@ -463,12 +757,16 @@ int fsm__init(struct raft_fsm *fsm,
 
 	f->logger = &config->logger;
 	f->registry = registry;
+	f->snapshot.captures = NULL;
+	f->snapshot.n = 0;
 
-	fsm->version = 1;
+	fsm->version = 3;
 	fsm->data = f;
 	fsm->apply = fsm__apply;
 	fsm->snapshot = fsm__snapshot;
 	fsm->restore = fsm__restore;
+	fsm->snapshot_finalize = fsm__snapshot_finalize;
+	fsm->snapshot_async = fsm__snapshot_async;
 
 	return 0;
 }
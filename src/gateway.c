@@ -1,12 +1,19 @@
 #include "gateway.h"
 
 #include "bind.h"
+#include "metrics.h"
 #include "protocol.h"
 #include "query.h"
 #include "request.h"
 #include "response.h"
 #include "vfs.h"
 
+/* Maximum size of the result of a query_stale request served by a non-leader
+ * node, which must be sent in a single response. */
+#define QUERY_STALE_MAX_SIZE (16 * 1024 * 1024)
+
+static void batchReset(struct gateway *g);
+
 void gateway__init(struct gateway *g,
 		   struct config *config,
 		   struct registry *registry,
@@ -23,15 +30,30 @@ void gateway__init(struct gateway *g,
 	g->sql = NULL;
 	stmt__registry_init(&g->stmts);
 	g->barrier.data = g;
+	g->read = NULL;
+	g->interrupted = false;
+	memset(&g->batch, 0, sizeof g->batch);
 	g->protocol = DQLITE_PROTOCOL_VERSION;
 }
 
 void gateway__close(struct gateway *g)
 {
+	/* Drop any batch in progress first, so the exec callback fired by
+	 * leader__close() is ignored. */
+	batchReset(g);
 	stmt__registry_close(&g->stmts);
+	if (g->read != NULL) {
+		readers__release(g->registry->readers, g->read);
+		g->read = NULL;
+	}
 	if (g->leader != NULL) {
-		leader__close(g->leader);
-		sqlite3_free(g->leader);
+		/* A query still running in the leader is failed, and its
+		 * statement released, by leader__close(). */
+		if (g->stmt != NULL && g->stmt_finalize &&
+		    g->leader->exec == NULL) {
+			stmt__cache_release(&g->leader->stmts, g->stmt);
+		}
+		leader__release(g->leader);
 	}
 }
 
@@ -155,14 +177,11 @@ static int handle_open(struct handle *req, struct cursor *cursor)
 	if (rc != 0) {
 		return rc;
 	}
-	g->leader = sqlite3_malloc(sizeof *g->leader);
-	if (g->leader == NULL) {
-		return DQLITE_NOMEM;
-	}
-	rc = leader__init(g->leader, db, g->raft);
+	rc = leader__acquire(db, g->raft, &g->leader);
 	if (rc != 0) {
 		return rc;
 	}
+	leader__fill_pool(db, g->raft);
 	response.id = 0;
 	SUCCESS(db, DB);
 	return 0;
@@ -202,6 +221,27 @@ static void fill_result(struct gateway *g, struct response_result *response)
 	response->rows_affected = sqlite3_changes(g->leader->conn);
 }
 
+/* Encode a result response followed by the read token, and invoke the request
+ * callback. Legacy clients don't know about the token, so it's omitted. */
+static void result_success(struct handle *req, struct response_result *response)
+{
+	bool with_token = req->gateway->protocol == DQLITE_PROTOCOL_VERSION;
+	uint64_t token = raft_last_applied(req->gateway->raft);
+	size_t n = response_result__sizeof(response);
+	void *cursor;
+	if (with_token) {
+		n += uint64__sizeof(&token);
+	}
+	cursor = buffer__advance(req->buffer, n);
+	/* Like in SUCCESS, this can't fail. */
+	assert(cursor != NULL);
+	response_result__encode(response, &cursor);
+	if (with_token) {
+		uint64__encode(&token, &cursor);
+	}
+	req->cb(req, 0, DQLITE_RESPONSE_RESULT);
+}
+
 static void leader_exec_cb(struct exec *exec, int status)
 {
 	struct gateway *g = exec->data;
@@ -214,7 +254,7 @@ static void leader_exec_cb(struct exec *exec, int status)
 
 	if (status == SQLITE_DONE) {
 		fill_result(g, &response);
-		SUCCESS(result, RESULT);
+		result_success(req, &response);
 	} else {
 		failure(req, status, sqlite3_errmsg(g->leader->conn));
 		sqlite3_reset(stmt);
@@ -230,7 +270,7 @@ static int handle_exec(struct handle *req, struct cursor *cursor)
 	LOOKUP_DB(request.db_id);
 	LOOKUP_STMT(request.stmt_id);
 	(void)response;
-	rv = bind__params(stmt->stmt, cursor);
+	rv = bind__params(stmt->stmt, cursor, TUPLE__PARAMS);
 	if (rv != 0) {
 		failure(req, rv, "bind parameters");
 		return 0;
@@ -244,17 +284,319 @@ static int handle_exec(struct handle *req, struct cursor *cursor)
 	return 0;
 }
 
-/* Step through the given statement and populate the response buffer of the
- * given request with a single batch of rows.
- *
- * A single batch of rows is typically about the size of a memory page. */
-static void query_batch(sqlite3_stmt *stmt, struct handle *req)
+/* Phases of an exec_batch request. */
+enum {
+	BATCH__NONE = 0,
+	BATCH__ROWS,     /* Executing the statement once per tuple */
+	BATCH__COMMIT,   /* Committing the transaction started by the batch */
+	BATCH__ROLLBACK, /* Rolling back the transaction after a failure */
+	BATCH__DONE      /* Ready to send the response */
+};
+
+static void batchReset(struct gateway *g)
+{
+	struct batch *b = &g->batch;
+	if (b->stmt != NULL) {
+		sqlite3_reset(b->stmt);
+	}
+	if (b->tx != NULL) {
+		sqlite3_finalize(b->tx);
+	}
+	sqlite3_free(b->results);
+	sqlite3_free(b->message);
+	memset(b, 0, sizeof *b);
+}
+
+/* Record a failure. If the batch started its own transaction and it's still
+ * open, roll it back before reporting the failure. */
+static void batchFail(struct gateway *g, int code, const char *message)
+{
+	struct batch *b = &g->batch;
+	b->code = code;
+	b->message = sqlite3_mprintf("%s", message);
+	sqlite3_reset(b->stmt);
+	if (b->begun && !sqlite3_get_autocommit(g->leader->conn)) {
+		b->phase = BATCH__ROLLBACK;
+	} else {
+		b->phase = BATCH__DONE;
+	}
+}
+
+static void batchExecCb(struct exec *exec, int status);
+
+/* Start the step for the current phase. Return 0 if a step was started (it
+ * might have completed already), or an error if the phase got updated
+ * instead. */
+static int batchSubmit(struct gateway *g)
+{
+	struct batch *b = &g->batch;
+	sqlite3_stmt *stmt;
+	const char *sql;
+	int rv;
+
+	if (b->phase == BATCH__ROWS) {
+		sqlite3_reset(b->stmt);
+		/* Tuples might carry fewer parameters than the previous one, so
+		 * make sure none of its bindings is left in place. */
+		sqlite3_clear_bindings(b->stmt);
+		/* An empty cursor would be silently accepted by bind__params(),
+		 * executing the statement with no parameter at all. */
+		if (b->cursor.cap == 0) {
+			rv = DQLITE_PARSE;
+		} else {
+			rv = bind__params(b->stmt, &b->cursor, TUPLE__PARAMS32);
+		}
+		if (rv != 0) {
+			batchFail(g, rv, "bind parameters");
+			return rv;
+		}
+		stmt = b->stmt;
+	} else {
+		assert(b->tx == NULL);
+		sql = b->phase == BATCH__COMMIT ? "COMMIT" : "ROLLBACK";
+		rv = sqlite3_prepare_v2(g->leader->conn, sql, -1, &b->tx, NULL);
+		if (rv != SQLITE_OK) {
+			goto err;
+		}
+		stmt = b->tx;
+	}
+
+	rv = leader__exec(g->leader, &g->exec, stmt, batchExecCb);
+	if (rv != 0) {
+		goto err;
+	}
+
+	return 0;
+
+err:
+	if (b->tx != NULL) {
+		sqlite3_finalize(b->tx);
+		b->tx = NULL;
+	}
+	if (b->phase == BATCH__ROLLBACK) {
+		warnf(&g->config->logger, "exec batch: rollback failed: %s",
+		      sqlite3_errmsg(g->leader->conn));
+		b->phase = BATCH__DONE;
+	} else {
+		batchFail(g, rv, sqlite3_errmsg(g->leader->conn));
+	}
+	return rv;
+}
+
+/* Process the outcome of the step that just completed. */
+static void batchStepped(struct gateway *g)
+{
+	struct batch *b = &g->batch;
+	sqlite3 *conn = g->leader->conn;
+
+	switch (b->phase) {
+		case BATCH__ROWS:
+			if (b->status != SQLITE_DONE) {
+				batchFail(g, b->status, sqlite3_errmsg(conn));
+				break;
+			}
+			if (g->interrupted) {
+				/* Don't execute the remaining tuples. */
+				batchFail(g, SQLITE_INTERRUPT, "interrupted");
+				break;
+			}
+			b->results[b->i].last_insert_id =
+			    sqlite3_last_insert_rowid(conn);
+			b->results[b->i].rows_affected = sqlite3_changes(conn);
+			b->i++;
+			if (b->i == b->n) {
+				b->phase =
+				    b->begun ? BATCH__COMMIT : BATCH__DONE;
+			}
+			break;
+		case BATCH__COMMIT:
+			if (b->status != SQLITE_DONE) {
+				batchFail(g, b->status, sqlite3_errmsg(conn));
+			} else {
+				b->phase = BATCH__DONE;
+			}
+			sqlite3_finalize(b->tx);
+			b->tx = NULL;
+			break;
+		case BATCH__ROLLBACK:
+			if (b->status != SQLITE_DONE) {
+				warnf(&g->config->logger,
+				      "exec batch: rollback failed: %s",
+				      sqlite3_errmsg(conn));
+			}
+			sqlite3_finalize(b->tx);
+			b->tx = NULL;
+			b->phase = BATCH__DONE;
+			break;
+		default:
+			assert(0);
+	}
+}
+
+/* Encode the response of a completed batch and invoke the request
+ * callback. */
+static void batchFinish(struct gateway *g)
+{
+	struct batch *b = &g->batch;
+	struct handle *req = g->req;
+	struct response_results response;
+	char *message;
+	void *cursor;
+	uint64_t i;
+	size_t n;
+	int code;
+
+	if (b->code != 0) {
+		goto err;
+	}
+
+	response.last_insert_id = b->results[b->n - 1].last_insert_id;
+	response.rows_affected = 0;
+	response.token = raft_last_applied(g->raft);
+	response.n = b->n;
+	for (i = 0; i < b->n; i++) {
+		response.rows_affected += b->results[i].rows_affected;
+	}
+
+	n = response_results__sizeof(&response) +
+	    b->n * response_result__sizeof(&b->results[0]);
+	cursor = buffer__advance(req->buffer, n);
+	if (cursor == NULL) {
+		b->code = DQLITE_NOMEM;
+		goto err;
+	}
+	response_results__encode(&response, &cursor);
+	for (i = 0; i < b->n; i++) {
+		response_result__encode(&b->results[i], &cursor);
+	}
+
+	batchReset(g);
+	g->req = NULL;
+	req->cb(req, 0, DQLITE_RESPONSE_RESULTS);
+	return;
+
+err:
+	code = b->code;
+	message = b->message;
+	b->message = NULL;
+	batchReset(g);
+	g->req = NULL;
+	failure(req, code, message != NULL ? message : "exec batch");
+	sqlite3_free(message);
+}
+
+/* Keep submitting steps until one completes asynchronously or the batch is
+ * done. Looping instead of recursing from the exec callback keeps the stack
+ * flat when leader__exec() completes synchronously. */
+static void batchRun(struct gateway *g)
+{
+	struct batch *b = &g->batch;
+	int rv;
+
+	while (b->phase != BATCH__DONE) {
+		b->pending = true;
+		b->submitting = true;
+		rv = batchSubmit(g);
+		b->submitting = false;
+		if (rv != 0) {
+			b->pending = false;
+			continue;
+		}
+		if (b->pending) {
+			return;
+		}
+		batchStepped(g);
+	}
+
+	batchFinish(g);
+}
+
+static void batchExecCb(struct exec *exec, int status)
+{
+	struct gateway *g = exec->data;
+	struct batch *b = &g->batch;
+
+	if (b->phase == BATCH__NONE) {
+		/* The gateway is being closed. */
+		return;
+	}
+
+	b->pending = false;
+	b->status = status;
+	if (b->submitting) {
+		return;
+	}
+
+	batchStepped(g);
+	batchRun(g);
+}
+
+static int handle_exec_batch(struct handle *req, struct cursor *cursor)
 {
 	struct gateway *g = req->gateway;
+	struct batch *b = &g->batch;
+	struct stmt *stmt;
+	int rv;
+	START(exec_batch, results);
+	LOOKUP_DB(request.db_id);
+	LOOKUP_STMT(request.stmt_id);
+
+	if (request.n == 0) {
+		response.last_insert_id = 0;
+		response.rows_affected = 0;
+		response.token = raft_last_applied(g->raft);
+		response.n = 0;
+		SUCCESS(results, RESULTS);
+		return 0;
+	}
+
+	/* Each tuple takes at least one word. */
+	if (request.n > cursor->cap / 8) {
+		return DQLITE_PARSE;
+	}
+
+	assert(b->phase == BATCH__NONE);
+	b->results = sqlite3_malloc64(request.n * sizeof *b->results);
+	if (b->results == NULL) {
+		return DQLITE_NOMEM;
+	}
+
+	/* Unless the client already opened a transaction, wrap the whole batch
+	 * in one, so all changes get replicated by a single raft entry at
+	 * COMMIT time. */
+	if (sqlite3_get_autocommit(g->leader->conn)) {
+		rv = sqlite3_exec(g->leader->conn, "BEGIN", NULL, NULL, NULL);
+		if (rv != SQLITE_OK) {
+			batchReset(g);
+			failure(req, rv, sqlite3_errmsg(g->leader->conn));
+			return 0;
+		}
+		b->begun = true;
+	}
+
+	b->stmt = stmt->stmt;
+	b->cursor = *cursor;
+	b->n = request.n;
+	b->phase = BATCH__ROWS;
+	g->req = req;
+	batchRun(g);
+
+	return 0;
+}
+
+/* Give back a statement prepared from the SQL text of a one-shot request. */
+static void release_stmt(struct gateway *g, sqlite3_stmt *stmt)
+{
+	stmt__cache_release(&g->leader->stmts, stmt);
+}
+
+static void query_batch_cb(struct exec *exec, int rc)
+{
+	struct gateway *g = exec->data;
+	struct handle *req = g->req;
+	sqlite3_stmt *stmt = g->stmt;
 	struct response_rows response;
-	int rc;
 
-	rc = query__batch(stmt, req->buffer);
 	if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
 		sqlite3_reset(stmt);
 		failure(req, rc, sqlite3_errmsg(g->leader->conn));
@@ -263,8 +605,6 @@ static void query_batch(sqlite3_stmt *stmt, struct handle *req)
 
 	if (rc == SQLITE_ROW) {
 		response.eof = DQLITE_RESPONSE_ROWS_PART;
-		g->req = req;
-		g->stmt = stmt;
 		SUCCESS(rows, ROWS);
 		return;
 	} else {
@@ -274,14 +614,39 @@ static void query_batch(sqlite3_stmt *stmt, struct handle *req)
 
 done:
 	if (g->stmt_finalize) {
-		/* TODO: do we care about errors? */
-		sqlite3_finalize(stmt);
+		release_stmt(g, stmt);
 		g->stmt_finalize = false;
 	}
 	g->stmt = NULL;
 	g->req = NULL;
 }
 
+/* Step through the given statement and populate the response buffer of the
+ * given request with a single batch of rows.
+ *
+ * A single batch of rows is typically about the size of a memory page. The
+ * statement is stepped by the leader loop coroutine, so a long query might
+ * get suspended and the response sent only later. */
+static void query_batch(sqlite3_stmt *stmt, struct handle *req)
+{
+	struct gateway *g = req->gateway;
+	int rv;
+
+	g->req = req;
+	g->stmt = stmt;
+	rv = leader__query(g->leader, &g->exec, stmt, req->buffer,
+			   query_batch_cb);
+	if (rv != 0) {
+		g->req = NULL;
+		g->stmt = NULL;
+		if (g->stmt_finalize) {
+			release_stmt(g, stmt);
+			g->stmt_finalize = false;
+		}
+		failure(req, rv, "query in progress");
+	}
+}
+
 static void query_barrier_cb(struct barrier *barrier, int status)
 {
 	struct gateway *g = barrier->data;
@@ -294,8 +659,18 @@ static void query_barrier_cb(struct barrier *barrier, int status)
 	g->stmt = NULL;
 	g->req = NULL;
 
-	if (status != 0) {
-		failure(handle, status, "barrier error");
+	if (status != 0 || g->interrupted) {
+		if (g->stmt_finalize) {
+			release_stmt(g, stmt);
+			g->stmt_finalize = false;
+		} else {
+			sqlite3_reset(stmt);
+		}
+		if (status != 0) {
+			failure(handle, status, "barrier error");
+		} else {
+			failure(handle, SQLITE_INTERRUPT, "interrupted");
+		}
 		return;
 	}
 
@@ -312,14 +687,14 @@ static int handle_query(struct handle *req, struct cursor *cursor)
 	LOOKUP_DB(request.db_id);
 	LOOKUP_STMT(request.stmt_id);
 	(void)response;
-	rv = bind__params(stmt->stmt, cursor);
+	rv = bind__params(stmt->stmt, cursor, TUPLE__PARAMS);
 	if (rv != 0) {
 		failure(req, rv, sqlite3_errmsg(g->leader->conn));
 		return 0;
 	}
 	g->req = req;
 	g->stmt = stmt->stmt;
-	rv = leader__barrier(g->leader, &g->barrier, query_barrier_cb);
+	rv = leader__read_barrier(g->leader, &g->barrier, query_barrier_cb);
 	if (rv != 0) {
 		g->req = NULL;
 		g->stmt = NULL;
@@ -351,12 +726,18 @@ static void handle_exec_sql_cb(struct exec *exec, int status)
 	struct gateway *g = exec->data;
 	struct handle *req = g->req;
 
-	if (status == SQLITE_DONE) {
+	if (status == SQLITE_DONE && g->interrupted) {
+		/* Don't run the remaining statements. */
+		failure(req, SQLITE_INTERRUPT, "interrupted");
+		release_stmt(g, g->stmt);
+		g->req = NULL;
+		g->stmt = NULL;
+		g->sql = NULL;
+	} else if (status == SQLITE_DONE) {
 		handle_exec_sql_next(req, NULL);
 	} else {
 		failure(req, status, sqlite3_errmsg(g->leader->conn));
-		sqlite3_reset(g->stmt);
-		sqlite3_finalize(g->stmt);
+		release_stmt(g, g->stmt);
 		g->req = NULL;
 		g->stmt = NULL;
 		g->sql = NULL;
@@ -375,12 +756,8 @@ static void handle_exec_sql_next(struct handle *req, struct cursor *cursor)
 		goto success;
 	}
 
-	if (g->stmt != NULL) {
-		sqlite3_finalize(g->stmt);
-		g->stmt = NULL;
-	}
-
-	rv = sqlite3_prepare_v2(g->leader->conn, g->sql, -1, &stmt, &tail);
+	rv = stmt__cache_prepare(&g->leader->stmts, g->leader->conn, g->sql,
+				 &stmt, &tail);
 	if (rv != SQLITE_OK) {
 		failure(req, rv, sqlite3_errmsg(g->leader->conn));
 		goto done;
@@ -390,23 +767,27 @@ static void handle_exec_sql_next(struct handle *req, struct cursor *cursor)
 		goto success;
 	}
 
+	if (g->stmt != NULL) {
+		release_stmt(g, g->stmt);
+	}
+	g->stmt = stmt;
+
 	/* TODO: what about bindings for multi-statement SQL text? */
 	if (cursor != NULL) {
-		rv = bind__params(stmt, cursor);
+		rv = bind__params(stmt, cursor, TUPLE__PARAMS);
 		if (rv != SQLITE_OK) {
 			failure(req, rv, sqlite3_errmsg(g->leader->conn));
-			goto done_after_prepare;
+			goto done;
 		}
 	}
 
 	g->sql = tail;
 	g->req = req;
-	g->stmt = stmt;
 
 	rv = leader__exec(g->leader, &g->exec, g->stmt, handle_exec_sql_cb);
 	if (rv != SQLITE_OK) {
 		failure(req, rv, sqlite3_errmsg(g->leader->conn));
-		goto done_after_prepare;
+		goto done;
 	}
 
 	return;
@@ -414,14 +795,16 @@ static void handle_exec_sql_next(struct handle *req, struct cursor *cursor)
 success:
 	if (g->stmt != NULL) {
 		fill_result(g, &response);
+	} else {
+		response.last_insert_id = 0;
+		response.rows_affected = 0;
 	}
-	SUCCESS(result, RESULT);
+	result_success(req, &response);
 
-done_after_prepare:
+done:
 	if (g->stmt != NULL) {
-		sqlite3_finalize(g->stmt);
+		release_stmt(g, g->stmt);
 	}
-done:
 	g->req = NULL;
 	g->stmt = NULL;
 	g->sql = NULL;
@@ -441,30 +824,186 @@ static int handle_exec_sql(struct handle *req, struct cursor *cursor)
 	return 0;
 }
 
+static void read_done(struct gateway *g)
+{
+	readers__release(g->registry->readers, g->read);
+	g->read = NULL;
+	g->req = NULL;
+}
+
+/* Run the query of the current read on the leader connection instead, which
+ * produces its rows in batches, in the event loop thread. */
+static void read_fallback(struct gateway *g)
+{
+	struct handle *req = g->req;
+	struct read *read = g->read;
+	struct cursor cursor;
+	sqlite3_stmt *stmt;
+	const char *tail;
+	int rv;
+
+	rv = stmt__cache_prepare(&g->leader->stmts, g->leader->conn, read->sql,
+				 &stmt, &tail);
+	if (rv != SQLITE_OK) {
+		read_done(g);
+		failure(req, rv, sqlite3_errmsg(g->leader->conn));
+		return;
+	}
+	cursor.p = read->params;
+	cursor.cap = read->params_len;
+	rv = bind__params(stmt, &cursor, TUPLE__PARAMS);
+	read_done(g);
+	if (rv != 0) {
+		failure(req, rv, sqlite3_errmsg(g->leader->conn));
+		release_stmt(g, stmt);
+		return;
+	}
+	g->stmt_finalize = true;
+	query_batch(stmt, req);
+}
+
+/* Copy the rows encoded by a reader thread into the response. */
+static void read_rows_cb(struct read *read)
+{
+	struct gateway *g = read->data;
+	struct handle *req = g->req;
+	struct response_rows response;
+	size_t n = buffer__offset(&read->rows);
+	void *cursor;
+
+	assert(req != NULL);
+
+	if (g->interrupted) {
+		failure(req, SQLITE_INTERRUPT, "interrupted");
+		read_done(g);
+		return;
+	}
+
+	/* The reader thread gave up on a large result. */
+	if (read->status == SQLITE_TOOBIG) {
+		read_fallback(g);
+		return;
+	}
+
+	if (read->status != SQLITE_DONE) {
+		failure(req, read->status, read->message);
+		read_done(g);
+		return;
+	}
+
+	cursor = buffer__advance(req->buffer, n);
+	if (cursor == NULL) {
+		failure(req, DQLITE_NOMEM, "can't allocate rows");
+		read_done(g);
+		return;
+	}
+	memcpy(cursor, buffer__cursor(&read->rows, 0), n);
+
+	read_done(g);
+	response.eof = DQLITE_RESPONSE_ROWS_DONE;
+	SUCCESS(rows, ROWS);
+}
+
+static void read_barrier_cb(struct barrier *barrier, int status)
+{
+	struct gateway *g = barrier->data;
+	struct handle *req = g->req;
+
+	assert(req != NULL);
+	assert(g->read != NULL);
+
+	if (status != 0) {
+		read_done(g);
+		failure(req, status, "barrier error");
+		return;
+	}
+	if (g->interrupted) {
+		read_done(g);
+		failure(req, SQLITE_INTERRUPT, "interrupted");
+		return;
+	}
+
+	/* The leader checked that no reader thread was busy with the database
+	 * before submitting the checkpoint command, keep it that way until the
+	 * command is applied. */
+	if (g->leader->db->checkpointing) {
+		read_fallback(g);
+		return;
+	}
+
+	readers__submit(g->registry->readers, g->read, read_rows_cb);
+}
+
+/* Run the given query in a reader thread, if possible.
+ *
+ * Only statements that can't write and that are not part of an explicit
+ * transaction qualify, since reader connections see only committed data. */
+static bool maybe_offload(struct handle *req,
+			  sqlite3_stmt *stmt,
+			  struct cursor *cursor,
+			  int *rv)
+{
+	struct gateway *g = req->gateway;
+	struct read *read;
+
+	*rv = 0;
+
+	if (g->registry->readers == NULL || !sqlite3_stmt_readonly(stmt) ||
+	    !sqlite3_get_autocommit(g->leader->conn)) {
+		return false;
+	}
+
+	read = readers__read_create(g->leader->db->filename, sqlite3_sql(stmt),
+				    cursor->p, cursor->cap);
+	release_stmt(g, stmt);
+	if (read == NULL) {
+		*rv = DQLITE_NOMEM;
+		return true;
+	}
+	read->data = g;
+	g->read = read;
+	g->req = req;
+	*rv = leader__read_barrier(g->leader, &g->barrier, read_barrier_cb);
+	if (*rv != 0) {
+		readers__release(g->registry->readers, read);
+		g->read = NULL;
+		g->req = NULL;
+	}
+	return true;
+}
+
 static int handle_query_sql(struct handle *req, struct cursor *cursor)
 {
 	struct gateway *g = req->gateway;
+	sqlite3_stmt *stmt;
 	const char *tail;
 	int rv;
 	START(query_sql, rows);
 	CHECK_LEADER(req);
 	LOOKUP_DB(request.db_id);
 	(void)response;
-	rv = sqlite3_prepare_v2(g->leader->conn, request.sql, -1, &g->stmt,
-				&tail);
+	rv = stmt__cache_prepare(&g->leader->stmts, g->leader->conn,
+				 request.sql, &stmt, &tail);
 	if (rv != SQLITE_OK) {
 		failure(req, rv, sqlite3_errmsg(g->leader->conn));
 		return 0;
 	}
-	rv = bind__params(g->stmt, cursor);
+	if (maybe_offload(req, stmt, cursor, &rv)) {
+		return rv;
+	}
+	rv = bind__params(stmt, cursor, TUPLE__PARAMS);
 	if (rv != 0) {
 		failure(req, rv, sqlite3_errmsg(g->leader->conn));
+		release_stmt(g, stmt);
 		return 0;
 	}
+	g->stmt = stmt;
 	g->stmt_finalize = true;
 	g->req = req;
-	rv = leader__barrier(g->leader, &g->barrier, query_barrier_cb);
+	rv = leader__read_barrier(g->leader, &g->barrier, query_barrier_cb);
 	if (rv != 0) {
+		release_stmt(g, stmt);
+		g->stmt_finalize = false;
 		g->req = NULL;
 		g->stmt = NULL;
 		return rv;
@@ -472,18 +1011,134 @@ static int handle_query_sql(struct handle *req, struct cursor *cursor)
 	return 0;
 }
 
+/* Check whether the local FSM is fresh enough to serve a query_stale request
+ * with the given staleness @mode and @bound. */
+static int check_staleness(struct gateway *g,
+			   uint64_t mode,
+			   uint64_t bound,
+			   const char **message)
+{
+	struct raft *raft = g->raft;
+	switch (mode) {
+		case DQLITE_STALE_ANY:
+			return 0;
+		case DQLITE_STALE_MIN_INDEX:
+			if (raft_last_applied(raft) < bound) {
+				*message = "requested index not applied yet";
+				return SQLITE_BUSY;
+			}
+			return 0;
+		case DQLITE_STALE_MAX_LAG:
+			/* Our commit index is the one the leader had when we
+			 * last heard from it, which also restarted our
+			 * election timer. */
+			if (raft_state(raft) != RAFT_FOLLOWER ||
+			    raft_last_applied(raft) < raft->commit_index ||
+			    lease__now(raft) - raft->election_timer_start >
+				bound) {
+				*message = "lagging behind the leader";
+				return SQLITE_BUSY;
+			}
+			return 0;
+		default:
+			*message = "unknown staleness mode";
+			return SQLITE_ERROR;
+	}
+}
+
+static int handle_query_stale(struct handle *req, struct cursor *cursor)
+{
+	struct gateway *g = req->gateway;
+	sqlite3_stmt *stmt;
+	const char *message;
+	const char *tail;
+	size_t offset;
+	int rv;
+	START(query_stale, rows);
+	LOOKUP_DB(request.db_id);
+	rv = stmt__cache_prepare(&g->leader->stmts, g->leader->conn,
+				 request.sql, &stmt, &tail);
+	if (rv != SQLITE_OK) {
+		failure(req, rv, sqlite3_errmsg(g->leader->conn));
+		return 0;
+	}
+	rv = bind__params(stmt, cursor, TUPLE__PARAMS);
+	if (rv != 0) {
+		failure(req, rv, sqlite3_errmsg(g->leader->conn));
+		release_stmt(g, stmt);
+		return 0;
+	}
+
+	/* Reads on the leader are never stale, serve them as usual. */
+	if (raft_state(g->raft) == RAFT_LEADER) {
+		g->stmt = stmt;
+		g->stmt_finalize = true;
+		g->req = req;
+		rv = leader__read_barrier(g->leader, &g->barrier,
+					  query_barrier_cb);
+		if (rv != 0) {
+			release_stmt(g, stmt);
+			g->stmt_finalize = false;
+			g->req = NULL;
+			g->stmt = NULL;
+			return rv;
+		}
+		return 0;
+	}
+
+	rv = check_staleness(g, request.mode, request.bound, &message);
+	if (rv != 0) {
+		failure(req, rv, message);
+		release_stmt(g, stmt);
+		return 0;
+	}
+
+	/* Produce all rows at once: a read transaction left open across loop
+	 * iterations would prevent the next checkpoint command from truncating
+	 * the WAL of this node. */
+	offset = buffer__offset(req->buffer);
+	rv = query__batch_max(stmt, req->buffer, QUERY_STALE_MAX_SIZE);
+	if (rv != SQLITE_DONE) {
+		req->buffer->offset = offset;
+		if (rv == SQLITE_ROW) {
+			failure(req, SQLITE_TOOBIG, "result too large");
+		} else {
+			failure(req, rv, sqlite3_errmsg(g->leader->conn));
+		}
+		release_stmt(g, stmt);
+		return 0;
+	}
+	release_stmt(g, stmt);
+	response.eof = DQLITE_RESPONSE_ROWS_DONE;
+	SUCCESS(rows, ROWS);
+	return 0;
+}
+
 static int handle_interrupt(struct handle *req, struct cursor *cursor)
 {
 	struct gateway *g = req->gateway;
 	START(interrupt, empty);
 
-	/* Take appropriate action depending on the cleanup code. */
-	if (g->stmt_finalize) {
-		sqlite3_finalize(g->stmt);
-		g->stmt_finalize = false;
+	/* Any request still in progress at this point is a query with more
+	 * rows to send: drop it. */
+	if (g->read != NULL) {
+		readers__release(g->registry->readers, g->read);
+		g->read = NULL;
+	}
+
+	/* Reset the statement, so it doesn't hold on to its read transaction,
+	 * which would prevent checkpoints. */
+	if (g->stmt != NULL) {
+		if (g->stmt_finalize) {
+			release_stmt(g, g->stmt);
+			g->stmt_finalize = false;
+		} else {
+			sqlite3_reset(g->stmt);
+		}
 	}
 	g->stmt = NULL;
 	g->req = NULL;
+	g->interrupted = false;
 
 	SUCCESS(empty, EMPTY);
 
@@ -833,6 +1488,10 @@ static int handle_transfer(struct handle *req, struct cursor *cursor)
 	}
 	r->data = g;
 
+	/* Voters grant their vote to the transferee right away, without waiting
+	 * for an election timeout, so our lease can't be trusted anymore. */
+	lease__init(&g->registry->lease);
+
 	rv = raft_transfer(g->raft, r, request.id, raftTransferCb);
 	if (rv != 0) {
 		sqlite3_free(r);
@@ -844,6 +1503,128 @@ static int handle_transfer(struct handle *req, struct cursor *cursor)
 	return 0;
 }
 
+static void encodeLatency(const struct dqlite_latency *latency, void **cursor)
+{
+	struct response_latency response;
+	response.count = latency->count;
+	response.sum = latency->sum;
+	response.max = latency->max;
+	response.p50 = latency->p50;
+	response.p90 = latency->p90;
+	response.p99 = latency->p99;
+	response.p999 = latency->p999;
+	response_latency__encode(&response, cursor);
+}
+
+static int handle_metrics(struct handle *req, struct cursor *cursor)
+{
+	struct gateway *g = req->gateway;
+	struct dqlite_metrics metrics;
+	struct response_request_metrics entry;
+	struct response_latency latency;
+	struct response_metrics_counters counters;
+	size_t entry_size;
+	size_t latency_size;
+	void *cur;
+	int i;
+	START(metrics, metrics);
+
+	metrics__get(&g->registry->metrics, &metrics);
+
+	response.n = 0;
+	for (i = 0; i < DQLITE_METRICS_REQUEST_TYPES; i++) {
+		if (metrics.requests[i].requests > 0) {
+			response.n++;
+		}
+	}
+
+	entry_size = response_request_metrics__sizeof(&entry);
+	latency_size = response_latency__sizeof(&latency);
+	cur = buffer__advance(req->buffer,
+			      response_metrics__sizeof(&response) +
+				  response.n * (entry_size + latency_size) +
+				  7 * latency_size +
+				  response_metrics_counters__sizeof(&counters));
+	if (cur == NULL) {
+		return DQLITE_NOMEM;
+	}
+	response_metrics__encode(&response, &cur);
+
+	for (i = 0; i < DQLITE_METRICS_REQUEST_TYPES; i++) {
+		struct dqlite_request_metrics *r = &metrics.requests[i];
+		if (r->requests == 0) {
+			continue;
+		}
+		entry.type = (uint64_t)i;
+		entry.requests = r->requests;
+		entry.failures = r->failures;
+		entry.bytes_in = r->bytes_in;
+		entry.bytes_out = r->bytes_out;
+		response_request_metrics__encode(&entry, &cur);
+		encodeLatency(&r->latency, &cur);
+	}
+	encodeLatency(&metrics.barrier, &cur);
+	encodeLatency(&metrics.apply, &cur);
+	encodeLatency(&metrics.step, &cur);
+	encodeLatency(&metrics.tx_encode, &cur);
+	encodeLatency(&metrics.tx_raft, &cur);
+	encodeLatency(&metrics.tx_fsm, &cur);
+	encodeLatency(&metrics.tx_total, &cur);
+
+	counters.writers = metrics.writers;
+	counters.max_writers = metrics.max_writers;
+	counters.writer_timeouts = metrics.writer_timeouts;
+	counters.stmt_cache_hits = metrics.stmt_cache_hits;
+	counters.stmt_cache_misses = metrics.stmt_cache_misses;
+	response_metrics_counters__encode(&counters, &cur);
+
+	req->cb(req, 0, DQLITE_RESPONSE_METRICS);
+
+	return 0;
+}
+
+static int handle_slow_txs(struct handle *req, struct cursor *cursor)
+{
+	struct gateway *g = req->gateway;
+	const struct metrics_slow_tx *tx;
+	struct response_slow_tx entry;
+	size_t size;
+	unsigned i;
+	void *cur;
+	START(slow_txs, slow_txs);
+
+	response.n = g->registry->metrics.n_slow_txs;
+
+	size = response_slow_txs__sizeof(&response);
+	for (i = 0; (tx = metrics__slow_tx(&g->registry->metrics, i)) != NULL;
+	     i++) {
+		entry.filename = tx->filename;
+		size += response_slow_tx__sizeof(&entry);
+	}
+	cur = buffer__advance(req->buffer, size);
+	if (cur == NULL) {
+		return DQLITE_NOMEM;
+	}
+	response_slow_txs__encode(&response, &cur);
+
+	for (i = 0; (tx = metrics__slow_tx(&g->registry->metrics, i)) != NULL;
+	     i++) {
+		entry.filename = tx->filename;
+		entry.id = tx->id;
+		entry.time = tx->time;
+		entry.n = tx->n;
+		entry.total = tx->total;
+		entry.encode = tx->encode;
+		entry.raft = tx->raft;
+		entry.fsm = tx->fsm;
+		response_slow_tx__encode(&entry, &cur);
+	}
+
+	req->cb(req, 0, DQLITE_RESPONSE_SLOW_TXS);
+
+	return 0;
+}
+
 int gateway__handle(struct gateway *g,
 		    struct handle *req,
 		    int type,
@@ -856,19 +1637,24 @@ int gateway__handle(struct gateway *g,
 	/* Check if there is a request in progress. */
 	if (g->req != NULL && type != DQLITE_REQUEST_HEARTBEAT) {
 		if (g->req->type == DQLITE_REQUEST_QUERY ||
-		    g->req->type == DQLITE_REQUEST_QUERY_SQL) {
-			/* TODO: handle interrupt requests */
+		    g->req->type == DQLITE_REQUEST_QUERY_SQL ||
+		    g->req->type == DQLITE_REQUEST_QUERY_STALE) {
+			/* The query has more rows to send, the client can
+			 * only interrupt it. */
 			assert(type == DQLITE_REQUEST_INTERRUPT);
 			goto handle;
 		}
 		if (g->req->type == DQLITE_REQUEST_EXEC ||
-		    g->req->type == DQLITE_REQUEST_EXEC_SQL) {
+		    g->req->type == DQLITE_REQUEST_EXEC_SQL ||
+		    g->req->type == DQLITE_REQUEST_EXEC_BATCH) {
 			return SQLITE_BUSY;
 		}
 		assert(0);
 	}
 
 handle:
+	metrics__request(&g->registry->metrics, type, cursor->cap);
+
 	req->type = type;
 	req->gateway = g;
 	req->cb = cb;
@@ -885,10 +1671,25 @@ handle:
 	return rc;
 }
 
+void gateway__interrupt(struct gateway *g)
+{
+	if (g->req == NULL || g->interrupted) {
+		return;
+	}
+	g->interrupted = true;
+
+	/* Queries run by a reader thread, or waiting for a barrier, notice the
+	 * flag when their callback fires. */
+	if (g->leader != NULL && g->leader->exec == &g->exec) {
+		leader__interrupt(g->leader);
+	}
+}
+
 int gateway__resume(struct gateway *g, bool *finished)
 {
 	if (g->req == NULL || (g->req->type != DQLITE_REQUEST_QUERY &&
-			       g->req->type != DQLITE_REQUEST_QUERY_SQL)) {
+			       g->req->type != DQLITE_REQUEST_QUERY_SQL &&
+			       g->req->type != DQLITE_REQUEST_QUERY_STALE)) {
 		*finished = true;
 		return 0;
 	}
@@ -18,6 +18,29 @@
 #include "stmt.h"
 
 struct handle;
+struct response_result;
+
+/**
+ * State of an exec_batch request, which executes the same statement once for
+ * each of the parameter tuples of the request, all within a single write
+ * transaction.
+ */
+struct batch
+{
+	int phase;                       /* Current phase, see gateway.c */
+	sqlite3_stmt *stmt;              /* Statement to execute for each tuple */
+	sqlite3_stmt *tx;                /* COMMIT or ROLLBACK statement */
+	struct cursor cursor;            /* Parameter tuples not yet bound */
+	uint64_t n;                      /* Number of parameter tuples */
+	uint64_t i;                      /* Index of the next tuple to execute */
+	struct response_result *results; /* Results of executed tuples */
+	bool begun;                      /* Whether the batch issued BEGIN */
+	bool pending;                    /* Whether a step is in progress */
+	bool submitting;                 /* Whether leader__exec is running */
+	int status;                      /* Status of the last step */
+	int code;                        /* Error code to return, if any */
+	char *message;                   /* Error message to return, if any */
+};
 
 /**
  * Handle requests from a single connected client and forward them to
@@ -36,6 +59,9 @@ struct gateway
 	const char *sql;             /* SQL query for exec_sql requests */
 	struct stmt__registry stmts; /* Registry of prepared statements */
 	struct barrier barrier;      /* Barrier for query requests */
+	struct read *read;           /* Query offloaded to a reader thread */
+	bool interrupted;            /* Whether gateway__interrupt() was called */
+	struct batch batch;          /* State of exec_batch requests */
 	uint64_t protocol;           /* Protocol format version */
 };
 
@@ -84,4 +110,15 @@ int gateway__handle(struct gateway *g,
  */
 int gateway__resume(struct gateway *g, bool *finished);
 
+/**
+ * Stop the request in progress, if any, because the client sent an interrupt
+ * request that is queued behind it.
+ *
+ * The callback of the interrupted request gets invoked with a failure response
+ * carrying SQLITE_INTERRUPT, either before this function returns or as soon
+ * as the step in flight completes. A transaction that is already being
+ * replicated can't be stopped and completes normally.
+ */
+void gateway__interrupt(struct gateway *g);
+
 #endif /* DQLITE_GATEWAY_H_ */
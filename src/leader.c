@@ -7,25 +7,54 @@
 #include "command.h"
 #include "format.h"
 #include "leader.h"
+#include "metrics.h"
+#include "query.h"
+#include "readers.h"
 
-#define LOOP_CORO_STACK_SIZE 1024 * 1024 /* TODO: make this configurable? */
+/* Memory-mapping limit for leader connections. Since database pages already
+ * live in memory, "mapping" them just means letting SQLite use the pages of
+ * the VFS directly instead of copying them into its page cache, so there's no
+ * reason to use a small limit. SQLite caps this at SQLITE_MAX_MMAP_SIZE. */
+#define MMAP_SIZE (1ULL << 40)
+
+/* Number of virtual machine instructions between checks of whether the
+ * statement being executed has used up its time slice. */
+#define SLICE_CHECK_OPS 1000
+
+static void startWriters(struct db *db);
+static void dequeueWriter(struct db *db, bool timeout);
 
 static void maybeExecDone(struct exec *req)
 {
+	struct leader *l = req->leader;
+	struct db *db = l->db;
 	if (!req->done) {
 		return;
 	}
-	req->leader->exec = NULL;
+	/* The loop coroutine is back at the top of its loop, let the next
+	 * statement of any connection use it. */
+	if (l->loop != NULL) {
+		coro_pool__put(db->coros, l->loop);
+		l->loop = NULL;
+	}
+	l->exec = NULL;
 	if (req->cb != NULL) {
 		req->cb(req, req->status);
 	}
+	startWriters(db);
+}
+
+void leader__exec_done(struct exec *req)
+{
+	maybeExecDone(req);
 }
 
 static void checkpointApplyCb(struct raft_apply *req, int status, void *result)
 {
 	struct leader *l = req->data;
 	(void)result;
-	(void)status;       /* TODO: log a warning in case of errors. */
+	(void)status; /* TODO: log a warning in case of errors. */
+	l->db->checkpointing = false;
 	co_switch(l->loop); /* Resume apply() */
 	maybeExecDone(l->exec);
 }
@@ -53,6 +82,15 @@ static int maybeCheckpoint(void *ctx,
 		return SQLITE_OK;
 	}
 
+	/* Queries of reader threads might be about to start a read transaction,
+	 * which would prevent the checkpoint from truncating the WAL once it
+	 * gets applied. No new query is handed to reader threads while the
+	 * checkpoint command is in flight, see the gateway. */
+	if (l->db->readers != NULL &&
+	    readers__busy(l->db->readers, l->db->filename)) {
+		return SQLITE_OK;
+	}
+
 	/* Get the database file associated with this connection */
 	rv = sqlite3_file_control(l->conn, "main", SQLITE_FCNTL_FILE_POINTER,
 				  &file);
@@ -99,6 +137,7 @@ static int maybeCheckpoint(void *ctx,
 	if (rv != 0) {
 		goto abort_after_command_encode;
 	}
+	l->db->checkpointing = true;
 	co_switch(l->main);
 
 	return SQLITE_OK;
@@ -154,6 +193,13 @@ static int openConnection(const char *filename,
 		goto err_after_open;
 	}
 
+	/* Read database pages straight from the VFS. */
+	sprintf(pragma, "PRAGMA mmap_size=%llu", MMAP_SIZE);
+	rc = sqlite3_exec(*conn, pragma, NULL, NULL, &msg);
+	if (rc != SQLITE_OK) {
+		goto err_after_open;
+	}
+
 	/* Set WAL replication. */
 	rc = sqlite3_wal_replication_leader(*conn, "main", replication,
 					    replication_arg);
@@ -179,34 +225,96 @@ err:
 	return rc;
 }
 
-static struct leader *loop_arg_leader; /* For initializing the loop coroutine */
-static struct exec *loop_arg_exec;     /* Next exec request to execute */
+static struct exec *loop_arg_exec; /* Next exec request to execute */
 
+/* Entry point of the loop coroutines, which are shared by all connections and
+ * only attached to one of them while stepping one of its statements. */
 static void loop()
 {
-	struct leader *l = loop_arg_leader;
-	co_switch(l->main);
 	while (1) {
 		struct exec *req = loop_arg_exec;
+		struct leader *l = req->leader;
+		unsigned long long start = metrics__now();
 		int rc;
-		rc = sqlite3_step(req->stmt);
+		/* The raft clock can't be used to measure time slices, since
+		 * it only advances between event loop iterations. */
+		l->slice_start = start;
+		if (req->rows != NULL) {
+			rc = query__batch(req->stmt, req->rows);
+		} else {
+			rc = sqlite3_step(req->stmt);
+		}
+		if (l->db->metrics != NULL) {
+			histogram__record(&l->db->metrics->step,
+					  metrics__now() - start);
+		}
 		req->done = true;
 		req->status = rc;
 		co_switch(l->main);
 	};
 }
 
-static int initLoopCoroutine(struct leader *l)
+/* Progress handler suspending the statement being executed by the loop
+ * coroutine once it has run for longer than the configured time slice, so
+ * the event loop gets a chance to process other events. */
+static int maybeYield(void *arg)
 {
-	l->loop = co_create(LOOP_CORO_STACK_SIZE, loop);
-	if (l->loop == NULL) {
-		return DQLITE_NOMEM;
+	struct leader *l = arg;
+	struct slices *s = l->db->slices;
+	unsigned long long slice = l->db->config->time_slice * 1000ULL;
+
+	if (slice == 0 || s == NULL || s->wakeup == NULL) {
+		return 0;
 	}
-	loop_arg_leader = l;
-	co_switch(l->loop);
+	if (l->loop == NULL || co_active() != l->loop) {
+		return 0;
+	}
+	if (l->exec != NULL && l->exec->interrupted) {
+		/* Make the statement fail with SQLITE_INTERRUPT. */
+		return 1;
+	}
+	if (metrics__now() - l->slice_start < slice) {
+		return 0;
+	}
+
+	QUEUE__PUSH(&s->leaders, &l->slice);
+	s->n++;
+	s->n_yields++;
+	if (s->n == 1) {
+		s->wakeup(s);
+	}
+	co_switch(l->main);
+
+	/* Resumed by leader__resume_slices(). */
+	l->slice_start = metrics__now();
 	return 0;
 }
 
+void leader__slices_init(struct slices *s)
+{
+	QUEUE__INIT(&s->leaders);
+	s->n = 0;
+	s->n_yields = 0;
+	s->data = NULL;
+	s->wakeup = NULL;
+}
+
+void leader__resume_slices(struct slices *s)
+{
+	unsigned n = s->n;
+	while (n > 0 && !QUEUE__IS_EMPTY(&s->leaders)) {
+		queue *head = QUEUE__HEAD(&s->leaders);
+		struct leader *l = QUEUE__DATA(head, struct leader, slice);
+		struct exec *req = l->exec;
+		QUEUE__REMOVE(head);
+		QUEUE__INIT(head);
+		s->n--;
+		n--;
+		co_switch(l->loop);
+		maybeExecDone(req);
+	}
+}
+
 /* Whether we need to submit a barrier request because there is no transaction
  * in progress in the underlying database and the FSM is behind the last log
  * index. */
@@ -222,26 +330,22 @@ int leader__init(struct leader *l, struct db *db, struct raft *raft)
 	l->db = db;
 	l->raft = raft;
 	l->main = co_active();
-	rc = initLoopCoroutine(l);
-	if (rc != 0) {
-		goto err;
-	}
+	l->loop = NULL;
 	rc = openConnection(db->filename, db->config->name, db->config->name, l,
 			    db->config->page_size, &l->conn);
 	if (rc != 0) {
-		goto err_after_loop_create;
+		return rc;
 	}
 	sqlite3_wal_hook(l->conn, maybeCheckpoint, l);
+	sqlite3_progress_handler(l->conn, SLICE_CHECK_OPS, maybeYield, l);
+	QUEUE__INIT(&l->slice);
 
 	l->exec = NULL;
 	l->apply.data = l;
+	stmt__cache_init(&l->stmts, db->config->stmt_cache_size);
+	l->stmts.metrics = db->metrics;
 	QUEUE__PUSH(&db->leaders, &l->queue);
 	return 0;
-
-err_after_loop_create:
-	co_delete(l->loop);
-err:
-	return rc;
 }
 
 void leader__close(struct leader *l)
@@ -249,10 +353,25 @@ void leader__close(struct leader *l)
 	int rc;
 	/* TODO: there shouldn't be any ongoing exec request. */
 	if (l->exec != NULL) {
+		/* A statement suspended halfway can't be resumed anymore, so
+		 * its coroutine can't be reused either. */
+		if (l->loop != NULL) {
+			coro_pool__discard(l->db->coros, l->loop);
+			l->loop = NULL;
+		}
+		if (!QUEUE__IS_EMPTY(&l->slice)) {
+			QUEUE__REMOVE(&l->slice);
+			l->db->slices->n--;
+		}
+		if (!QUEUE__IS_EMPTY(&l->exec->queue)) {
+			QUEUE__REMOVE(&l->exec->queue);
+			dequeueWriter(l->db, false);
+		}
 		l->exec->done = true;
 		l->exec->status = SQLITE_ERROR;
 		maybeExecDone(l->exec);
 	}
+	stmt__cache_close(&l->stmts);
 	rc = sqlite3_close(l->conn);
 	assert(rc == 0);
 
@@ -262,22 +381,274 @@ void leader__close(struct leader *l)
 		db__delete_tx(l->db);
 	}
 
-	co_delete(l->loop);
 	QUEUE__REMOVE(&l->queue);
+
+	startWriters(l->db);
+}
+
+int leader__acquire(struct db *db, struct raft *raft, struct leader **l)
+{
+	int rv;
+	if (!QUEUE__IS_EMPTY(&db->pool)) {
+		queue *tail = QUEUE__TAIL(&db->pool);
+		QUEUE__REMOVE(tail);
+		db->n_pool--;
+		*l = QUEUE__DATA(tail, struct leader, pool);
+		return 0;
+	}
+	*l = sqlite3_malloc(sizeof **l);
+	if (*l == NULL) {
+		return DQLITE_NOMEM;
+	}
+	rv = leader__init(*l, db, raft);
+	if (rv != 0) {
+		sqlite3_free(*l);
+		*l = NULL;
+		return rv;
+	}
+	return 0;
+}
+
+void leader__fill_pool(struct db *db, struct raft *raft)
+{
+	struct leader *l;
+	int rv;
+	while (db->n_pool < db->config->pool_min) {
+		l = sqlite3_malloc(sizeof *l);
+		if (l == NULL) {
+			return;
+		}
+		rv = leader__init(l, db, raft);
+		if (rv != 0) {
+			sqlite3_free(l);
+			return;
+		}
+		l->idle_since = lease__now(raft);
+		QUEUE__PUSH(&db->pool, &l->pool);
+		db->n_pool++;
+	}
+}
+
+/* Whether the given connection can be reused by another client as is. */
+static bool canPool(struct leader *l)
+{
+	struct db *db = l->db;
+	return l->exec == NULL && db->n_pool < db->config->pool_max &&
+	       sqlite3_get_autocommit(l->conn) &&
+	       !(db->tx != NULL && db->tx->conn == l->conn) &&
+	       QUEUE__IS_EMPTY(&l->stmts.used);
+}
+
+void leader__release(struct leader *l)
+{
+	struct db *db = l->db;
+	if (!canPool(l)) {
+		leader__close(l);
+		sqlite3_free(l);
+		return;
+	}
+	l->idle_since = lease__now(l->raft);
+	QUEUE__PUSH(&db->pool, &l->pool);
+	db->n_pool++;
+}
+
+/* Close the oldest connection in the pool of the given database. */
+static void closeOldest(struct db *db)
+{
+	queue *head = QUEUE__HEAD(&db->pool);
+	struct leader *l = QUEUE__DATA(head, struct leader, pool);
+	QUEUE__REMOVE(head);
+	db->n_pool--;
+	leader__close(l);
+	sqlite3_free(l);
+}
+
+void leader__trim_pool(struct db *db, raft_time now)
+{
+	struct config *config = db->config;
+	while (db->n_pool > config->pool_min && config->pool_idle_timeout > 0) {
+		struct leader *l = QUEUE__DATA(QUEUE__HEAD(&db->pool),
+					       struct leader, pool);
+		if (now - l->idle_since < config->pool_idle_timeout) {
+			break;
+		}
+		closeOldest(db);
+	}
+}
+
+void leader__close_pool(struct db *db)
+{
+	while (!QUEUE__IS_EMPTY(&db->pool)) {
+		closeOldest(db);
+	}
+}
+
+/* Whether the given statement can wait in the queue of writers.
+ *
+ * Only writes run in autocommit mode can wait, since they take a fresh read
+ * snapshot when they get resumed. Statements within an explicit transaction
+ * would fail with SQLITE_BUSY_SNAPSHOT anyway. */
+static bool canWait(struct leader *l, sqlite3_stmt *stmt)
+{
+	return l->db->config->write_timeout > 0 &&
+	       sqlite3_get_autocommit(l->conn) && !sqlite3_stmt_readonly(stmt);
+}
+
+/* Whether the database lock is held by another connection. In that case
+ * starting a write would just fail with SQLITE_BUSY, see
+ * maybeHandleInProgressTx() in replication.c. */
+static bool isLocked(struct leader *l)
+{
+	struct tx *tx = l->db->tx;
+	return tx != NULL && tx__is_leader(tx) && tx->conn != l->conn;
+}
+
+static void enqueueWriter(struct leader *l, struct exec *req)
+{
+	struct db *db = l->db;
+	QUEUE__PUSH(&db->writers, &req->queue);
+	db->n_writers++;
+	if (db->n_writers > db->max_writers) {
+		db->max_writers = db->n_writers;
+	}
+	if (db->metrics != NULL) {
+		metrics__writer_wait(db->metrics, db->n_writers);
+	}
+}
+
+/* Account for a writer removed from the queue of the given database. */
+static void dequeueWriter(struct db *db, bool timeout)
+{
+	db->n_writers--;
+	if (timeout) {
+		db->writer_timeouts++;
+	}
+	if (db->metrics != NULL) {
+		metrics__writer_done(db->metrics, timeout);
+	}
+}
+
+static void execBarrierCb(struct barrier *barrier, int status);
+
+/* Start the writers waiting for the database lock, in FIFO order, until one of
+ * them takes it. */
+static void startWriters(struct db *db)
+{
+	/* Starting a writer might complete it synchronously, which calls us
+	 * again. */
+	if (db->waking) {
+		return;
+	}
+	db->waking = true;
+	while (db->tx == NULL && !QUEUE__IS_EMPTY(&db->writers)) {
+		struct exec *req;
+		queue *head;
+		int rv;
+		head = QUEUE__HEAD(&db->writers);
+		QUEUE__REMOVE(head);
+		QUEUE__INIT(head);
+		dequeueWriter(db, false);
+		req = QUEUE__DATA(head, struct exec, queue);
+		rv = leader__barrier(req->leader, &req->barrier, execBarrierCb);
+		if (rv != 0) {
+			req->done = true;
+			req->status = rv;
+			maybeExecDone(req);
+		}
+	}
+	db->waking = false;
+}
+
+void leader__interrupt(struct leader *l)
+{
+	struct exec *req = l->exec;
+	struct db *db = l->db;
+
+	if (req == NULL) {
+		return;
+	}
+	req->interrupted = true;
+
+	/* Waiting for the database lock. */
+	if (!QUEUE__IS_EMPTY(&req->queue)) {
+		QUEUE__REMOVE(&req->queue);
+		QUEUE__INIT(&req->queue);
+		dequeueWriter(db, false);
+		req->done = true;
+		req->status = SQLITE_INTERRUPT;
+		maybeExecDone(req);
+		return;
+	}
+
+	/* Suspended by maybeYield(). Resume it right away instead of waiting
+	 * for its turn, the VDBE will notice the interruption and bail out. */
+	if (!QUEUE__IS_EMPTY(&l->slice)) {
+		QUEUE__REMOVE(&l->slice);
+		QUEUE__INIT(&l->slice);
+		db->slices->n--;
+		sqlite3_interrupt(l->conn);
+		co_switch(l->loop);
+		maybeExecDone(req);
+	}
+}
+
+void leader__expire_writers(struct db *db, raft_time now)
+{
+	/* All writers wait for the same timeout, so deadlines are sorted. */
+	while (!QUEUE__IS_EMPTY(&db->writers)) {
+		struct exec *req;
+		queue *head;
+		head = QUEUE__HEAD(&db->writers);
+		req = QUEUE__DATA(head, struct exec, queue);
+		if (req->deadline > now) {
+			break;
+		}
+		QUEUE__REMOVE(head);
+		QUEUE__INIT(head);
+		dequeueWriter(db, true);
+		req->done = true;
+		req->status = SQLITE_BUSY;
+		maybeExecDone(req);
+	}
+	startWriters(db);
+}
+
+/* Attach a loop coroutine to the given leader and start executing its current
+ * exec request. */
+static void run(struct leader *l)
+{
+	l->loop = coro_pool__get(l->db->coros, l->db->config->stack_size, loop);
+	if (l->loop == NULL) {
+		l->exec->done = true;
+		l->exec->status = SQLITE_NOMEM;
+		maybeExecDone(l->exec);
+		return;
+	}
+	loop_arg_exec = l->exec;
+	co_switch(l->loop);
+	maybeExecDone(l->exec);
 }
 
 static void execBarrierCb(struct barrier *barrier, int status)
 {
 	struct exec *req = barrier->data;
 	struct leader *l = req->leader;
+	if (status == 0 && req->interrupted) {
+		status = SQLITE_INTERRUPT;
+	}
 	if (status != 0) {
 		l->exec->done = true;
+		l->exec->status = status;
 		maybeExecDone(l->exec);
 		return;
 	}
-	loop_arg_exec = l->exec;
-	co_switch(l->loop);
-	maybeExecDone(l->exec);
+	/* Another connection might have taken the lock while the barrier was
+	 * in flight. */
+	if (canWait(l, req->stmt) && isLocked(l)) {
+		enqueueWriter(l, req);
+		return;
+	}
+	run(l);
 }
 
 int leader__exec(struct leader *l,
@@ -293,20 +664,56 @@ int leader__exec(struct leader *l,
 
 	req->leader = l;
 	req->stmt = stmt;
+	req->rows = NULL;
 	req->cb = cb;
 	req->done = false;
+	req->interrupted = false;
 	req->barrier.data = req;
+	req->deadline = lease__now(l->raft) + l->db->config->write_timeout;
+	QUEUE__INIT(&req->queue);
+
+	/* Also wait behind the writers already queued, to be fair. */
+	if (canWait(l, stmt) &&
+	    (isLocked(l) || !QUEUE__IS_EMPTY(&l->db->writers))) {
+		enqueueWriter(l, req);
+		return 0;
+	}
 
 	rv = leader__barrier(l, &req->barrier, execBarrierCb);
 	if (rv != 0) {
+		l->exec = NULL;
 		return rv;
 	}
 	return 0;
 }
 
+int leader__query(struct leader *l,
+		  struct exec *req,
+		  sqlite3_stmt *stmt,
+		  struct buffer *rows,
+		  exec_cb cb)
+{
+	if (l->exec != NULL) {
+		return SQLITE_BUSY;
+	}
+	l->exec = req;
+
+	req->leader = l;
+	req->stmt = stmt;
+	req->rows = rows;
+	req->cb = cb;
+	req->done = false;
+	req->interrupted = false;
+	QUEUE__INIT(&req->queue);
+
+	run(l);
+	return 0;
+}
+
 static void raftBarrierCb(struct raft_barrier *req, int status)
 {
 	struct barrier *barrier = req->data;
+	struct leader *l = barrier->leader;
 	int rv = 0;
 	if (status != 0) {
 		if (status == RAFT_LEADERSHIPLOST) {
@@ -314,6 +721,12 @@ static void raftBarrierCb(struct raft_barrier *req, int status)
 		} else {
 			rv = SQLITE_ERROR;
 		}
+	} else if (l->db->lease != NULL) {
+		lease__extend(l->db->lease, l->raft, barrier->start);
+	}
+	if (l->db->metrics != NULL) {
+		histogram__record(&l->db->metrics->barrier,
+				  metrics__now() - barrier->submitted);
 	}
 	barrier->cb(barrier, rv);
 }
@@ -328,9 +741,22 @@ int leader__barrier(struct leader *l, struct barrier *barrier, barrier_cb cb)
 	barrier->cb = cb;
 	barrier->leader = l;
 	barrier->req.data = barrier;
+	barrier->start = lease__now(l->raft);
+	barrier->submitted = metrics__now();
 	rv = raft_barrier(l->raft, &barrier->req, raftBarrierCb);
 	if (rv != 0) {
 		return rv;
 	}
 	return 0;
 }
+
+int leader__read_barrier(struct leader *l,
+			 struct barrier *barrier,
+			 barrier_cb cb)
+{
+	if (l->db->lease != NULL && lease__valid(l->db->lease, l->raft)) {
+		cb(barrier, 0);
+		return 0;
+	}
+	return leader__barrier(l, barrier, cb);
+}
@@ -11,9 +11,11 @@
 #include <raft.h>
 #include <sqlite3.h>
 
+#include "./lib/buffer.h"
 #include "./lib/queue.h"
 
 #include "db.h"
+#include "stmt.h"
 
 struct exec;
 struct barrier;
@@ -24,14 +26,36 @@ typedef void (*barrier_cb)(struct barrier *req, int status);
 
 struct leader
 {
-	struct db *db;           /* Database the connection. */
-	cothread_t main;         /* Main coroutine. */
-	cothread_t loop;         /* Loop coroutine, executing statements. */
-	sqlite3 *conn;           /* Underlying SQLite connection. */
-	struct raft *raft;       /* Raft instance. */
-	struct exec *exec;       /* Exec request in progress, if any. */
-	struct raft_apply apply; /* To apply checkpoint commands */
-	queue queue;             /* Prev/next leader, used by struct db. */
+	struct db *db;            /* Database the connection. */
+	cothread_t main;          /* Main coroutine. */
+	cothread_t loop;          /* Loop coroutine, while executing a stmt. */
+	sqlite3 *conn;            /* Underlying SQLite connection. */
+	struct raft *raft;        /* Raft instance. */
+	struct exec *exec;        /* Exec request in progress, if any. */
+	struct raft_apply apply;  /* To apply checkpoint commands */
+	struct stmt__cache stmts; /* Statements of one-shot requests. */
+	queue queue;              /* Prev/next leader, used by struct db. */
+	queue pool;               /* Link in the pool of idle connections. */
+	raft_time idle_since;     /* When the connection was pooled. */
+	queue slice;              /* Link in the queue of yielded leaders. */
+	unsigned long long slice_start; /* When the current slice began. */
+};
+
+/**
+ * Leader connections whose statement used up its time slice and got
+ * suspended, waiting to be resumed at the next event loop iteration.
+ *
+ * Statements are suspended only if the @wakeup callback is set, which gets
+ * invoked whenever the queue becomes non-empty and must arrange for
+ * leader__resume_slices() to be called.
+ */
+struct slices
+{
+	queue leaders;                      /* Suspended leader connections */
+	unsigned n;                         /* Number of items in @leaders */
+	unsigned long long n_yields;        /* Times a statement was suspended */
+	void *data;                         /* User data for @wakeup */
+	void (*wakeup)(struct slices *s);   /* Schedule resuming @leaders */
 };
 
 struct barrier
@@ -39,6 +63,8 @@ struct barrier
 	void *data;
 	struct leader *leader;
 	struct raft_barrier req;
+	raft_time start; /* When the raft barrier was submitted */
+	unsigned long long submitted; /* Same, in microseconds */
 	barrier_cb cb;
 };
 
@@ -51,23 +77,59 @@ struct exec
 	struct leader *leader;
 	struct barrier barrier;
 	sqlite3_stmt *stmt;
+	struct buffer *rows;  /* Encode a batch of rows, instead of one step */
 	bool done;
 	int status;
-	queue queue;
+	queue queue;          /* Link in the queue of waiting writers */
+	raft_time deadline;   /* When to stop waiting in the queue */
+	bool interrupted;     /* Whether leader__interrupt() was called */
 	exec_cb cb;
 };
 
 /**
  * Initialize a new leader connection.
  *
- * This function will start the leader loop coroutine and pause it immediately,
- * transfering control back to main coroutine and then opening a new leader
- * connection against the given database.
+ * This function will open a new leader connection against the given database.
+ * No loop coroutine is attached to the connection until it starts executing a
+ * statement, at which point one is taken from the pool of the database.
  */
 int leader__init(struct leader *l, struct db *db, struct raft *raft);
 
 void leader__close(struct leader *l);
 
+/**
+ * Get a leader connection against the given database, either by taking the
+ * most recently used one from its pool of idle connections or by allocating
+ * and initializing a new one.
+ */
+int leader__acquire(struct db *db, struct raft *raft, struct leader **l);
+
+/**
+ * Put the given leader connection back into the pool of its database, if
+ * pooling is enabled, the pool is not full and the connection is idle and not
+ * in a transaction. Otherwise close it and release its memory.
+ */
+void leader__release(struct leader *l);
+
+/**
+ * Open new connections against the given database and put them into its pool,
+ * until the pool holds the configured minimum number of idle connections. This
+ * is a best effort, and errors are ignored.
+ */
+void leader__fill_pool(struct db *db, struct raft *raft);
+
+/**
+ * Close the pooled connections of the given database that have been idle
+ * since before @now minus the configured idle timeout, keeping at least the
+ * configured minimum number of them.
+ */
+void leader__trim_pool(struct db *db, raft_time now);
+
+/**
+ * Close all pooled connections of the given database.
+ */
+void leader__close_pool(struct db *db);
+
 /**
  * Submit a request to step a SQLite statement.
  *
@@ -82,12 +144,72 @@ void leader__close(struct leader *l);
  * stack will rewind back to the @sqlite_step() call, returning to the leader
  * loop which will then have completed the request and transfer control back to
  * the main coroutine, pausing until the next request.
+ *
+ * If the statement would start a write transaction while another connection
+ * holds the database lock, the request is queued and only dispatched once that
+ * transaction ends, or failed with SQLITE_BUSY once the configured write
+ * timeout expires.
  */
 int leader__exec(struct leader *l,
 		 struct exec *req,
 		 sqlite3_stmt *stmt,
 		 exec_cb cb);
 
+/**
+ * Step through the given query statement encoding a single batch of rows into
+ * the given @rows buffer, like query__batch(), and invoke the given @cb with
+ * its result when done.
+ *
+ * Like for leader__exec(), the statement is executed by a loop coroutine, so
+ * it can be suspended if it runs for longer than the configured time slice.
+ * No barrier is submitted, the caller is expected to have done that before.
+ */
+int leader__query(struct leader *l,
+		  struct exec *req,
+		  sqlite3_stmt *stmt,
+		  struct buffer *rows,
+		  exec_cb cb);
+
+/**
+ * Initialize an empty queue of suspended leader connections, with no @wakeup
+ * callback.
+ */
+void leader__slices_init(struct slices *s);
+
+/**
+ * Resume the statements of all leader connections that were suspended before
+ * calling this function. The ones suspending again will be resumed at the
+ * next call.
+ */
+void leader__resume_slices(struct slices *s);
+
+/**
+ * Stop the exec request in progress on the given connection, if any.
+ *
+ * A request waiting for the database lock is failed right away, and a
+ * statement suspended after using up its time slice is interrupted with
+ * sqlite3_interrupt() and resumed so it unwinds. In both cases the request
+ * callback is invoked with SQLITE_INTERRUPT before this function returns.
+ *
+ * A request waiting for a barrier fails with SQLITE_INTERRUPT once the
+ * barrier completes, while a transaction that is being replicated can't be
+ * stopped anymore and completes normally.
+ */
+void leader__interrupt(struct leader *l);
+
+/**
+ * Fail all execs queued against the given database whose deadline is before
+ * @now, and start the first remaining one if the database is not locked
+ * anymore.
+ */
+void leader__expire_writers(struct db *db, raft_time now);
+
+/**
+ * Invoke the callback of the given exec request if it's done, and then start
+ * the next writer waiting for the database lock, if any.
+ */
+void leader__exec_done(struct exec *req);
+
 /**
  * Submit a raft barrier request if there is no transaction in progress in the
  * underlying database and the FSM is behind the last log index.
@@ -96,4 +218,16 @@ int leader__exec(struct leader *l,
  */
 int leader__barrier(struct leader *l, struct barrier *barrier, barrier_cb cb);
 
+/**
+ * Like leader__barrier(), but meant for read-only statements: if this node
+ * holds a valid leader lease, invoke the given @cb immediately without
+ * submitting anything to raft.
+ *
+ * Write transactions can't use this shortcut, since their IDs are derived from
+ * the last applied index, which only a barrier is guaranteed to advance.
+ */
+int leader__read_barrier(struct leader *l,
+			 struct barrier *barrier,
+			 barrier_cb cb);
+
 #endif /* LEADER_H_*/
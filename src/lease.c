@@ -0,0 +1,39 @@
+#include "lease.h"
+
+void lease__init(struct lease *l)
+{
+	l->term = 0;
+	l->expiry = 0;
+}
+
+raft_time lease__now(struct raft *raft)
+{
+	return raft->io->time(raft->io);
+}
+
+void lease__extend(struct lease *l, struct raft *raft, raft_time start)
+{
+	raft_time expiry;
+
+	if (raft_state(raft) != RAFT_LEADER) {
+		return;
+	}
+
+	expiry = start + raft->election_timeout * (100 - LEASE__DRIFT) / 100;
+	if (l->term == raft->current_term && l->expiry >= expiry) {
+		return;
+	}
+	l->term = raft->current_term;
+	l->expiry = expiry;
+}
+
+bool lease__valid(struct lease *l, struct raft *raft)
+{
+	/* Committing an entry of the current term implies that all entries of
+	 * previous terms are committed too, but not necessarily applied. During
+	 * a leadership transfer the transferee may get elected at any time. */
+	return raft_state(raft) == RAFT_LEADER && raft_transferee(raft) == 0 &&
+	       l->term == raft->current_term &&
+	       raft->commit_index == raft_last_applied(raft) &&
+	       lease__now(raft) < l->expiry;
+}
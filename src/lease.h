@@ -0,0 +1,48 @@
+/**
+ * Leader lease, used to serve reads without going through the raft log.
+ *
+ * Every time a log entry submitted by this node at time T gets committed, a
+ * quorum of voters must have heard from us after T. None of them will grant
+ * its vote to another candidate before an election timeout has elapsed since
+ * then, so no other leader can exist and commit writes until roughly
+ * T + election_timeout. Shortening that interval by a drift margin accounts
+ * for clocks not running at exactly the same rate across nodes.
+ */
+
+#ifndef LEASE_H_
+#define LEASE_H_
+
+#include <stdbool.h>
+
+#include <raft.h>
+
+/* Percentage of the election timeout not covered by the lease, to account for
+ * clock drift between nodes. */
+#define LEASE__DRIFT 10
+
+struct lease
+{
+	raft_term term;   /* Term the lease was obtained in */
+	raft_time expiry; /* Time at which the lease expires */
+};
+
+void lease__init(struct lease *l);
+
+/**
+ * Return the current time, as seen by the raft I/O backend.
+ */
+raft_time lease__now(struct raft *raft);
+
+/**
+ * Extend the lease after a log entry submitted at time @start was committed.
+ */
+void lease__extend(struct lease *l, struct raft *raft, raft_time start);
+
+/**
+ * Whether reads can be served locally: this node is the leader holding a
+ * lease for the current term, it's not transferring leadership, and its FSM
+ * has applied every committed entry.
+ */
+bool lease__valid(struct lease *l, struct raft *raft);
+
+#endif /* LEASE_H_ */
@@ -38,6 +38,7 @@ static bool ensure(struct buffer *b, size_t size)
 		b->n_pages *= 2;
 		data = realloc(b->data, SIZE(b));
 		if (data == NULL) {
+			b->n_pages /= 2;
 			return false;
 		}
 		b->data = data;
@@ -0,0 +1,106 @@
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "coro.h"
+
+/* Create a coroutine whose stack is mapped right above a guard page, so that
+ * a stack overflow crashes right away instead of corrupting the memory that
+ * happens to be below it. Stacks grow downward on all supported platforms. */
+static cothread_t create(struct coro_pool *p,
+			 unsigned stack_size,
+			 void (*entry)(void))
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t size = ((size_t)stack_size + page - 1) / page * page;
+	cothread_t coro;
+	char *base;
+	int rv;
+
+	/* All coroutines of a pool are created with the same stack size. */
+	assert(p->size == 0 || p->size == page + size);
+
+	base = mmap(NULL, page + size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+	rv = mprotect(base, page, PROT_NONE);
+	if (rv != 0) {
+		goto err;
+	}
+	coro = co_derive(base + page, (unsigned)size, entry);
+	if (coro == NULL) {
+		goto err;
+	}
+	/* The handle of a derived coroutine is the memory it was given, which
+	 * is what we rely upon to find the mapping back when deleting it. */
+	assert(coro == (cothread_t)(base + page));
+	p->size = page + size;
+	return coro;
+
+err:
+	munmap(base, page + size);
+	return NULL;
+}
+
+static void delete(struct coro_pool *p, cothread_t coro)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	munmap((char *)coro - page, p->size);
+}
+
+void coro_pool__init(struct coro_pool *p)
+{
+	p->n_idle = 0;
+	p->n_busy = 0;
+	p->n_created = 0;
+	p->size = 0;
+}
+
+void coro_pool__close(struct coro_pool *p)
+{
+	assert(p->n_busy == 0);
+	while (p->n_idle > 0) {
+		p->n_idle--;
+		delete(p, p->idle[p->n_idle]);
+	}
+}
+
+cothread_t coro_pool__get(struct coro_pool *p,
+			  unsigned stack_size,
+			  void (*entry)(void))
+{
+	cothread_t coro;
+	if (p->n_idle > 0) {
+		p->n_idle--;
+		coro = p->idle[p->n_idle];
+	} else {
+		coro = create(p, stack_size, entry);
+		if (coro == NULL) {
+			return NULL;
+		}
+		p->n_created++;
+	}
+	p->n_busy++;
+	return coro;
+}
+
+void coro_pool__put(struct coro_pool *p, cothread_t coro)
+{
+	assert(p->n_busy > 0);
+	p->n_busy--;
+	if (p->n_idle == CORO__POOL_MAX_IDLE) {
+		delete(p, coro);
+		return;
+	}
+	p->idle[p->n_idle] = coro;
+	p->n_idle++;
+}
+
+void coro_pool__discard(struct coro_pool *p, cothread_t coro)
+{
+	assert(p->n_busy > 0);
+	p->n_busy--;
+	delete(p, coro);
+}
@@ -0,0 +1,66 @@
+/**
+ * Pool of coroutines.
+ *
+ * Creating a coroutine allocates its whole stack upfront, so objects that only
+ * need one while some work is suspended in it should borrow it from a pool
+ * rather than owning it. Coroutines given back to the pool must have returned
+ * control to their caller from the top of their entry point's main loop, so
+ * that the next user can resume them from a clean state. For the same reason
+ * all coroutines of a pool must have the same entry point, and they must also
+ * have the same stack size.
+ *
+ * Stacks are mapped with a guard page below them, so a coroutine overflowing
+ * its stack crashes with a segmentation fault.
+ */
+
+#ifndef LIB_CORO_H_
+#define LIB_CORO_H_
+
+#include <stddef.h>
+
+#include <libco.h>
+
+/* Maximum number of idle coroutines kept around for reuse. */
+#define CORO__POOL_MAX_IDLE 16
+
+struct coro_pool
+{
+	cothread_t idle[CORO__POOL_MAX_IDLE]; /* Coroutines ready for reuse */
+	unsigned n_idle;                      /* Number of items in @idle */
+	unsigned n_busy;                      /* Coroutines given out */
+	unsigned long long n_created;         /* Coroutines created so far */
+	size_t size;                          /* Stack mapping size, with guard */
+};
+
+/**
+ * Initialize an empty pool of coroutines.
+ */
+void coro_pool__init(struct coro_pool *p);
+
+/**
+ * Delete all idle coroutines. There must be no coroutine given out.
+ */
+void coro_pool__close(struct coro_pool *p);
+
+/**
+ * Return an idle coroutine, or create a new one with the given stack size and
+ * entry point if there is none. Return #NULL if the coroutine can't be
+ * created.
+ */
+cothread_t coro_pool__get(struct coro_pool *p,
+			  unsigned stack_size,
+			  void (*entry)(void));
+
+/**
+ * Give a coroutine obtained with coro_pool__get() back to the pool, deleting
+ * it if the pool has already enough idle coroutines.
+ */
+void coro_pool__put(struct coro_pool *p, cothread_t coro);
+
+/**
+ * Delete a coroutine obtained with coro_pool__get() which can't be reused,
+ * because its execution was abandoned halfway.
+ */
+void coro_pool__discard(struct coro_pool *p, cothread_t coro);
+
+#endif /* LIB_CORO_H_ */
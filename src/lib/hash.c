@@ -0,0 +1,135 @@
+#include <string.h>
+
+#include <sqlite3.h>
+
+#include "../../include/dqlite.h"
+
+#include "assert.h"
+#include "hash.h"
+
+/* Initial number of buckets. */
+#define HASH__MIN_BUCKETS 16
+
+/* Spread the bits of the key, so sequential keys like transaction IDs don't
+ * end up in adjacent buckets only by virtue of their low bits. */
+static unsigned bucket_index(struct hash *h, uint64_t key)
+{
+	key *= 0x9E3779B97F4A7C15ULL;
+	return (unsigned)(key >> 32) & (h->n_buckets - 1);
+}
+
+void hash__init(struct hash *h)
+{
+	h->buckets = NULL;
+	h->n_buckets = 0;
+	h->len = 0;
+}
+
+void hash__close(struct hash *h)
+{
+	sqlite3_free(h->buckets);
+}
+
+/* FNV-1a */
+uint64_t hash__string(const char *s)
+{
+	uint64_t key = 0xcbf29ce484222325ULL;
+	for (; *s != '\0'; s++) {
+		key ^= (unsigned char)*s;
+		key *= 0x100000001b3ULL;
+	}
+	return key;
+}
+
+/* Re-link all items into a bucket array of the given size. */
+static int grow(struct hash *h, unsigned n_buckets)
+{
+	struct hash_item **buckets = h->buckets;
+	unsigned n = h->n_buckets;
+	unsigned i;
+
+	h->buckets = sqlite3_malloc64((sizeof *h->buckets) * n_buckets);
+	if (h->buckets == NULL) {
+		h->buckets = buckets;
+		return DQLITE_NOMEM;
+	}
+	memset(h->buckets, 0, (sizeof *h->buckets) * n_buckets);
+	h->n_buckets = n_buckets;
+
+	for (i = 0; i < n; i++) {
+		while (buckets[i] != NULL) {
+			struct hash_item *item = buckets[i];
+			struct hash_item **head;
+			buckets[i] = item->next;
+			head = &h->buckets[bucket_index(h, item->key)];
+			item->next = *head;
+			*head = item;
+		}
+	}
+
+	sqlite3_free(buckets);
+
+	return 0;
+}
+
+int hash__insert(struct hash *h, struct hash_item *item, uint64_t key)
+{
+	struct hash_item **head;
+
+	if (h->n_buckets == 0) {
+		int rv;
+		rv = grow(h, HASH__MIN_BUCKETS);
+		if (rv != 0) {
+			return rv;
+		}
+	} else if (h->len >= h->n_buckets) {
+		/* Not being able to grow just makes chains longer. */
+		grow(h, h->n_buckets * 2);
+	}
+
+	item->key = key;
+	head = &h->buckets[bucket_index(h, key)];
+	item->next = *head;
+	*head = item;
+	h->len++;
+
+	return 0;
+}
+
+void hash__remove(struct hash *h, struct hash_item *item)
+{
+	struct hash_item **cursor;
+
+	assert(h->len > 0);
+
+	cursor = &h->buckets[bucket_index(h, item->key)];
+	while (*cursor != item) {
+		assert(*cursor != NULL);
+		cursor = &(*cursor)->next;
+	}
+	*cursor = item->next;
+	item->next = NULL;
+	h->len--;
+}
+
+/* Return the given item or the first one following it with the given key. */
+static struct hash_item *match(struct hash_item *item, uint64_t key)
+{
+	while (item != NULL && item->key != key) {
+		item = item->next;
+	}
+	return item;
+}
+
+struct hash_item *hash__first(struct hash *h, uint64_t key)
+{
+	if (h->n_buckets == 0) {
+		return NULL;
+	}
+	return match(h->buckets[bucket_index(h, key)], key);
+}
+
+struct hash_item *hash__next(struct hash_item *item)
+{
+	return match(item->next, item->key);
+}
@@ -0,0 +1,93 @@
+/**
+ * Intrusive hash table with separate chaining.
+ *
+ * Items embed a struct hash_item and are linked into the bucket selected by
+ * their 64-bit key. The table doesn't know how to compare items: keys that
+ * are not unique by themselves (e.g. hashes of strings) must be checked by
+ * the caller while walking the items having the same key.
+ *
+ * The number of buckets doubles whenever the table holds more items than
+ * buckets, so lookups take constant time on average regardless of the number
+ * of items.
+ */
+
+#ifndef LIB_HASH_H_
+#define LIB_HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct hash_item
+{
+	struct hash_item *next; /* Next item in the same bucket. */
+	uint64_t key;           /* Key of the item. */
+};
+
+struct hash
+{
+	struct hash_item **buckets; /* Heads of the bucket lists. */
+	unsigned n_buckets;         /* Number of buckets, a power of two. */
+	unsigned len;               /* Number of items. */
+};
+
+/**
+ * Initialize an empty hash table. No memory is allocated until the first item
+ * gets inserted.
+ */
+void hash__init(struct hash *h);
+
+/**
+ * Release the memory used by the table. The items themselves are not touched.
+ */
+void hash__close(struct hash *h);
+
+/**
+ * Return the key to use for the given string.
+ */
+uint64_t hash__string(const char *s);
+
+/**
+ * Link the given item into the table, using the given key.
+ *
+ * This fails only if the table has no bucket at all yet and they can't be
+ * allocated. If growing the table fails, the item is inserted anyway.
+ */
+int hash__insert(struct hash *h, struct hash_item *item, uint64_t key);
+
+/**
+ * Unlink the given item, which must be in the table.
+ */
+void hash__remove(struct hash *h, struct hash_item *item);
+
+/**
+ * Return the first item with the given key, or NULL if there's none.
+ */
+struct hash_item *hash__first(struct hash *h, uint64_t key);
+
+/**
+ * Return the next item with the same key as the given one, or NULL if there's
+ * none.
+ */
+struct hash_item *hash__next(struct hash_item *item);
+
+/**
+ * Iterate over all items with the given key.
+ */
+#define HASH__FOREACH(item, h, key) \
+	for (item = hash__first(h, key); item != NULL; item = hash__next(item))
+
+/**
+ * Iterate over all items of the table. The current item must not be removed.
+ */
+#define HASH__FOREACH_ALL(item, h, i)                           \
+	for (i = 0; i < (h)->n_buckets; i++)                    \
+		for (item = (h)->buckets[i]; item != NULL; \
+		     item = item->next)
+
+/**
+ * Return a pointer to the struct embedding the given item.
+ */
+#define HASH__DATA(item, type, field) \
+	((type *)((char *)(item)-offsetof(type, field)))
+
+#endif /* LIB_HASH_H_ */
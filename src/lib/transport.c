@@ -171,12 +171,21 @@ static void write_cb(uv_write_t *req, int status)
 }
 
 int transport__write(struct transport *t, uv_buf_t *buf, transport_write_cb cb)
+{
+	return transport__writev(t, buf, 1, cb);
+}
+
+int transport__writev(struct transport *t,
+		      uv_buf_t bufs[],
+		      unsigned n,
+		      transport_write_cb cb)
 {
 	int rv;
 	assert(t->write_cb == NULL);
 	t->write_cb = cb;
-	rv = uv_write(&t->write, t->stream, buf, 1, write_cb);
+	rv = uv_write(&t->write, t->stream, bufs, n, write_cb);
 	if (rv != 0) {
+		t->write_cb = NULL;
 		return rv;
 	}
 	return 0;
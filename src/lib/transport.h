@@ -53,6 +53,14 @@ int transport__read(struct transport *t, uv_buf_t *buf, transport_read_cb cb);
  */
 int transport__write(struct transport *t, uv_buf_t *buf, transport_write_cb cb);
 
+/**
+ * Write the given buffers to the transport, in order, as a single write.
+ */
+int transport__writev(struct transport *t,
+		      uv_buf_t bufs[],
+		      unsigned n,
+		      transport_write_cb cb);
+
 /* Create an UV stream object from the given fd. */
 int transport__stream(struct uv_loop_s *loop, int fd, struct uv_stream_s **stream);
 
@@ -24,6 +24,12 @@ struct logger
 void loggerDefaultEmit(void *data, int level, const char *fmt, va_list args);
 
 /* Emit a log message with a certain level. */
+void logger__emit(struct logger *l, int level, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#define warnf(L, FORMAT, ...) \
+	logger__emit(L, DQLITE_WARN, FORMAT, ##__VA_ARGS__)
+
 /* #define debugf(L, FORMAT, ...) \ */
 /* 	logger__emit(L, DQLITE_DEBUG, FORMAT, ##__VA_ARGS__) */
 #define debugf(C, FORMAT, ...)                                             \
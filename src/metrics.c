@@ -1,12 +1,250 @@
-#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "./lib/assert.h"
 
 #include "metrics.h"
 
-void dqlite__metrics_init(struct dqlite__metrics *m) {
-	assert(m != NULL);
+/* Relaxed atomic accessors. There's a single writer, the event loop thread,
+ * so read-modify-write operations don't need to be atomic as a whole. */
+#define LOAD(P) __atomic_load_n(P, __ATOMIC_RELAXED)
+#define STORE(P, V) __atomic_store_n(P, V, __ATOMIC_RELAXED)
+#define ADD(P, V) STORE(P, LOAD(P) + (V))
 
-	m->requests = 0;
-	m->duration = 0;
+void metrics__init(struct metrics *m)
+{
+	memset(m, 0, sizeof *m);
+}
+
+unsigned long long metrics__now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long)now.tv_sec * 1000000 +
+	       (unsigned long long)now.tv_nsec / 1000;
+}
+
+/* Index of the bucket holding the given value. */
+static unsigned bucketIndex(uint64_t value)
+{
+	unsigned msb;
+	unsigned sub;
+	unsigned i;
+
+	if (value < 2 * METRICS__SUB_BUCKETS) {
+		return (unsigned)value;
+	}
+
+	msb = 63 - (unsigned)__builtin_clzll(value);
+	sub = (unsigned)(value >> (msb - METRICS__SUB_BITS)) &
+	      (METRICS__SUB_BUCKETS - 1);
+	i = 2 * METRICS__SUB_BUCKETS +
+	    (msb - METRICS__SUB_BITS - 1) * METRICS__SUB_BUCKETS + sub;
+
+	return i < METRICS__BUCKETS ? i : METRICS__BUCKETS - 1;
+}
+
+/* Highest value falling into the bucket with the given index. */
+static uint64_t bucketUpperBound(unsigned i)
+{
+	unsigned msb;
+	unsigned sub;
+	uint64_t width;
+
+	if (i < 2 * METRICS__SUB_BUCKETS) {
+		return i;
+	}
+
+	i -= 2 * METRICS__SUB_BUCKETS;
+	msb = i / METRICS__SUB_BUCKETS + METRICS__SUB_BITS + 1;
+	sub = i % METRICS__SUB_BUCKETS;
+	width = (uint64_t)1 << (msb - METRICS__SUB_BITS);
+
+	return (METRICS__SUB_BUCKETS + sub) * width + width - 1;
+}
+
+void histogram__record(struct histogram *h, uint64_t value)
+{
+	ADD(&h->buckets[bucketIndex(value)], 1);
+	ADD(&h->sum, value);
+	if (value > LOAD(&h->max)) {
+		STORE(&h->max, value);
+	}
+	/* Update the count last, so readers seeing it see the value too. */
+	__atomic_store_n(&h->count, LOAD(&h->count) + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t histogram__percentile(const struct histogram *h, unsigned permille)
+{
+	uint64_t count = __atomic_load_n(&h->count, __ATOMIC_ACQUIRE);
+	uint64_t max = LOAD(&h->max);
+	uint64_t rank;
+	uint64_t seen = 0;
+	unsigned i;
+
+	assert(permille <= 1000);
+
+	if (count == 0) {
+		return 0;
+	}
+
+	/* Rank of the value we're looking for, rounding up. */
+	rank = (count * permille + 999) / 1000;
+	if (rank == 0) {
+		rank = 1;
+	}
+
+	for (i = 0; i < METRICS__BUCKETS; i++) {
+		seen += LOAD(&h->buckets[i]);
+		if (seen >= rank) {
+			uint64_t bound = bucketUpperBound(i);
+			/* The last bucket has no upper bound. */
+			if (i == METRICS__BUCKETS - 1 || bound > max) {
+				return max;
+			}
+			return bound;
+		}
+	}
+
+	return max;
+}
+
+void metrics__request(struct metrics *m, int type, size_t size)
+{
+	struct metrics_request *r;
+
+	if (type < 0 || type >= DQLITE_METRICS_REQUEST_TYPES) {
+		return;
+	}
+	r = &m->requests[type];
+
+	ADD(&r->requests, 1);
+	ADD(&r->bytes_in, size);
+}
+
+void metrics__response(struct metrics *m,
+		       int type,
+		       size_t size,
+		       bool failure,
+		       bool last,
+		       unsigned long long start)
+{
+	struct metrics_request *r;
+
+	if (type < 0 || type >= DQLITE_METRICS_REQUEST_TYPES) {
+		return;
+	}
+	r = &m->requests[type];
+
+	ADD(&r->bytes_out, size);
+	if (failure) {
+		ADD(&r->failures, 1);
+	}
+	if (last) {
+		histogram__record(&r->latency, metrics__now() - start);
+	}
+}
+
+void metrics__writer_wait(struct metrics *m, unsigned n)
+{
+	ADD(&m->writers, 1);
+	if (n > LOAD(&m->max_writers)) {
+		STORE(&m->max_writers, n);
+	}
+}
+
+void metrics__writer_done(struct metrics *m, bool timeout)
+{
+	STORE(&m->writers, LOAD(&m->writers) - 1);
+	if (timeout) {
+		ADD(&m->writer_timeouts, 1);
+	}
+}
+
+void metrics__stmt_cache(struct metrics *m, bool hit)
+{
+	if (hit) {
+		ADD(&m->stmt_cache_hits, 1);
+	} else {
+		ADD(&m->stmt_cache_misses, 1);
+	}
+}
+
+void metrics__tx(struct metrics *m,
+		 const char *filename,
+		 struct metrics_slow_tx *tx,
+		 uint64_t threshold)
+{
+	struct timespec now;
+
+	histogram__record(&m->tx_encode, tx->encode);
+	histogram__record(&m->tx_raft, tx->raft);
+	histogram__record(&m->tx_fsm, tx->fsm);
+	histogram__record(&m->tx_total, tx->total);
+
+	if (threshold == 0 || tx->total < threshold) {
+		return;
+	}
+
+	strncpy(tx->filename, filename, METRICS__SLOW_TX_FILENAME - 1);
+	tx->filename[METRICS__SLOW_TX_FILENAME - 1] = '\0';
+	clock_gettime(CLOCK_REALTIME, &now);
+	tx->time = (uint64_t)now.tv_sec * 1000000 +
+		   (uint64_t)now.tv_nsec / 1000;
+
+	m->slow_txs[m->next_slow_tx] = *tx;
+	m->next_slow_tx = (m->next_slow_tx + 1) % METRICS__SLOW_TXS;
+	if (m->n_slow_txs < METRICS__SLOW_TXS) {
+		m->n_slow_txs++;
+	}
+}
+
+const struct metrics_slow_tx *metrics__slow_tx(const struct metrics *m,
+					       unsigned i)
+{
+	if (i >= m->n_slow_txs) {
+		return NULL;
+	}
+	i = (m->next_slow_tx + METRICS__SLOW_TXS - 1 - i) % METRICS__SLOW_TXS;
+	return &m->slow_txs[i];
+}
+
+static void getLatency(const struct histogram *h, struct dqlite_latency *out)
+{
+	out->count = __atomic_load_n(&h->count, __ATOMIC_ACQUIRE);
+	out->sum = LOAD(&h->sum);
+	out->max = LOAD(&h->max);
+	out->p50 = histogram__percentile(h, 500);
+	out->p90 = histogram__percentile(h, 900);
+	out->p99 = histogram__percentile(h, 990);
+	out->p999 = histogram__percentile(h, 999);
+}
+
+void metrics__get(const struct metrics *m, struct dqlite_metrics *out)
+{
+	int i;
+
+	for (i = 0; i < DQLITE_METRICS_REQUEST_TYPES; i++) {
+		const struct metrics_request *r = &m->requests[i];
+		struct dqlite_request_metrics *o = &out->requests[i];
+		o->requests = LOAD(&r->requests);
+		o->failures = LOAD(&r->failures);
+		o->bytes_in = LOAD(&r->bytes_in);
+		o->bytes_out = LOAD(&r->bytes_out);
+		getLatency(&r->latency, &o->latency);
+	}
+
+	getLatency(&m->barrier, &out->barrier);
+	getLatency(&m->apply, &out->apply);
+	getLatency(&m->step, &out->step);
+	getLatency(&m->tx_encode, &out->tx_encode);
+	getLatency(&m->tx_raft, &out->tx_raft);
+	getLatency(&m->tx_fsm, &out->tx_fsm);
+	getLatency(&m->tx_total, &out->tx_total);
+
+	out->writers = LOAD(&m->writers);
+	out->max_writers = LOAD(&m->max_writers);
+	out->writer_timeouts = LOAD(&m->writer_timeouts);
+	out->stmt_cache_hits = LOAD(&m->stmt_cache_hits);
+	out->stmt_cache_misses = LOAD(&m->stmt_cache_misses);
 }
@@ -1,19 +1,169 @@
-/******************************************************************************
+/**
+ * Collect performance metrics of a node.
  *
- * Collect various performance metrics.
+ * Metrics are updated only by the event loop thread, without taking any lock,
+ * and can be read at any time from other threads: every field is accessed
+ * with relaxed atomic operations, so readers see consistent values for each
+ * single counter, although not necessarily across counters.
  *
- *****************************************************************************/
+ * Latencies are recorded in microseconds into histograms whose buckets get
+ * exponentially wider, like HDR histograms: each power of two is split into
+ * METRICS__SUB_BUCKETS linear buckets, so percentiles are accurate within
+ * 1/METRICS__SUB_BUCKETS of their value, whatever its magnitude.
+ *
+ * The transactions that took longer than the configured threshold are also
+ * saved in a ring of fixed size, which is only accessed by the event loop
+ * thread.
+ */
 
-#ifndef DQLITE_METRICS_H
-#define DQLITE_METRICS_H
+#ifndef METRICS_H_
+#define METRICS_H_
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-struct dqlite__metrics {
-	uint64_t requests; /* Total number of requests served. */
-	uint64_t duration; /* Total time spent to server requests. */
+#include "../include/dqlite.h"
+
+/* Number of linear buckets each power of two is split into. */
+#define METRICS__SUB_BITS 2
+#define METRICS__SUB_BUCKETS (1 << METRICS__SUB_BITS)
+
+/* Number of buckets of a histogram. Values of 2^36 microseconds (about 19
+ * hours) and above all fall into the last one. */
+#define METRICS__BUCKETS \
+	(2 * METRICS__SUB_BUCKETS + (36 - METRICS__SUB_BITS - 1) * METRICS__SUB_BUCKETS)
+
+/* Number of slow transactions that are remembered. */
+#define METRICS__SLOW_TXS 64
+
+/* Maximum length of the database name of a slow transaction. */
+#define METRICS__SLOW_TX_FILENAME 64
+
+struct histogram
+{
+	uint64_t count;                     /* Number of recorded values */
+	uint64_t sum;                       /* Sum of recorded values */
+	uint64_t max;                       /* Highest recorded value */
+	uint64_t buckets[METRICS__BUCKETS]; /* Number of values per bucket */
+};
+
+/* Metrics of a single request type. */
+struct metrics_request
+{
+	uint64_t requests;        /* Requests handled */
+	uint64_t failures;        /* Requests answered with a failure */
+	uint64_t bytes_in;        /* Size of request payloads */
+	uint64_t bytes_out;       /* Size of response payloads */
+	struct histogram latency; /* From dispatch to the last response */
+};
+
+/* A transaction that took longer than the slow transaction threshold. All
+ * durations are in microseconds. */
+struct metrics_slow_tx
+{
+	char filename[METRICS__SLOW_TX_FILENAME]; /* Database, maybe truncated */
+	uint64_t id;                              /* Transaction ID */
+	uint64_t time;                            /* End, in usecs since epoch */
+	uint64_t n;                               /* Frames commands */
+	uint64_t total;                           /* From begin to end hook */
+	uint64_t encode;                          /* Encoding commands */
+	uint64_t raft;                            /* Replication and commit */
+	uint64_t fsm;                             /* Applying to the FSM */
+};
+
+struct metrics
+{
+	struct metrics_request requests[DQLITE_METRICS_REQUEST_TYPES];
+	struct histogram barrier;   /* Wait for raft barriers */
+	struct histogram apply;     /* Wait for raft to commit a command */
+	struct histogram step;      /* Leader statement steps, wall clock */
+	struct histogram tx_encode; /* Transactions encoding commands */
+	struct histogram tx_raft;   /* Transactions waiting for raft */
+	struct histogram tx_fsm;    /* Transactions applying to the FSM */
+	struct histogram tx_total;  /* Transactions, from begin to end hook */
+	uint64_t writers;           /* Execs waiting for a database lock */
+	uint64_t max_writers;       /* Most execs waiting on a database */
+	uint64_t writer_timeouts;   /* Execs that gave up waiting */
+	uint64_t stmt_cache_hits;   /* Statement cache lookups that hit */
+	uint64_t stmt_cache_misses; /* Statement cache lookups that missed */
+	struct metrics_slow_tx slow_txs[METRICS__SLOW_TXS]; /* Ring */
+	unsigned n_slow_txs;        /* Number of entries of the ring in use */
+	unsigned next_slow_tx;      /* Entry to overwrite next */
 };
 
-void dqlite__metrics_init(struct dqlite__metrics *m);
+void metrics__init(struct metrics *m);
+
+/**
+ * Return the current time in microseconds, from a monotonic clock.
+ */
+unsigned long long metrics__now(void);
+
+/**
+ * Record the given value.
+ */
+void histogram__record(struct histogram *h, uint64_t value);
+
+/**
+ * Return an upper bound of the value below which the given fraction of the
+ * recorded values fall, expressed in thousandths.
+ */
+uint64_t histogram__percentile(const struct histogram *h, unsigned permille);
+
+/**
+ * Account for a new request of the given type, whose payload has the given
+ * size.
+ */
+void metrics__request(struct metrics *m, int type, size_t size);
+
+/**
+ * Account for a response to a request of the given type. If @last is true,
+ * the request is complete and its latency since @start gets recorded.
+ */
+void metrics__response(struct metrics *m,
+		       int type,
+		       size_t size,
+		       bool failure,
+		       bool last,
+		       unsigned long long start);
+
+/**
+ * Account for an exec starting to wait for the lock of a database, whose queue
+ * of waiting execs is now @n long.
+ */
+void metrics__writer_wait(struct metrics *m, unsigned n);
+
+/**
+ * Account for an exec no longer waiting for the lock of a database, either
+ * because it got started or failed, or because it timed out.
+ */
+void metrics__writer_done(struct metrics *m, bool timeout);
+
+/**
+ * Account for a lookup in the statement cache of a leader connection.
+ */
+void metrics__stmt_cache(struct metrics *m, bool hit);
+
+/**
+ * Record the stage durations of a committed leader transaction against the
+ * given database, and save it in the ring of slow transactions if it took at
+ * least @threshold microseconds. A @threshold of zero disables the ring. The
+ * @filename and @time fields of @tx are filled by this function.
+ */
+void metrics__tx(struct metrics *m,
+		 const char *filename,
+		 struct metrics_slow_tx *tx,
+		 uint64_t threshold);
+
+/**
+ * Return the i'th most recent slow transaction, or #NULL if there's none.
+ */
+const struct metrics_slow_tx *metrics__slow_tx(const struct metrics *m,
+					       unsigned i);
+
+/**
+ * Fill the given public metrics object with the current values.
+ */
+void metrics__get(const struct metrics *m, struct dqlite_metrics *out);
 
-#endif /* DQLITE_METRICS_H */
+#endif /* METRICS_H_ */
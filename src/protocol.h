@@ -19,6 +19,15 @@
 /* Legacly pre-1.0 version. */
 #define DQLITE_PROTOCOL_VERSION_LEGACY 0x86104dd760433fe5
 
+/* Message flags.
+ *
+ * A client sets DQLITE_MESSAGE_PIPELINE on a request to tag it with an ID
+ * stored in the extra field of the message header. The server echoes both the
+ * flag and the ID in the response, which tells the client that it can send
+ * further requests without waiting for the responses of the previous ones.
+ * Responses are always sent in the same order as requests. */
+#define DQLITE_MESSAGE_PIPELINE 1
+
 /* Special value indicating that a batch of rows is over, but there are more. */
 #define DQLITE_RESPONSE_ROWS_PART 0xeeeeeeeeeeeeeeee
 
@@ -44,10 +53,19 @@
 #define DQLITE_REQUEST_DUMP 15
 #define DQLITE_REQUEST_CLUSTER 16
 #define DQLITE_REQUEST_TRANSFER 17
+#define DQLITE_REQUEST_EXEC_BATCH 18
+#define DQLITE_REQUEST_QUERY_STALE 19
+#define DQLITE_REQUEST_METRICS 20
+#define DQLITE_REQUEST_SLOW_TXS 21
 
 #define DQLITE_REQUEST_CLUSTER_FORMAT_V0 0 /* ID and address */
 #define DQLITE_REQUEST_CLUSTER_FORMAT_V1 1 /* ID, address and role */
 
+/* Staleness modes of query_stale requests */
+#define DQLITE_STALE_ANY 0       /* Whatever the local FSM has applied */
+#define DQLITE_STALE_MIN_INDEX 1 /* Applied at least the given raft index */
+#define DQLITE_STALE_MAX_LAG 2   /* At most the given msecs behind the leader */
+
 /* Response types */
 #define DQLITE_RESPONSE_FAILURE 0
 #define DQLITE_RESPONSE_SERVER 1
@@ -60,5 +78,8 @@
 #define DQLITE_RESPONSE_ROWS 7
 #define DQLITE_RESPONSE_EMPTY 8
 #define DQLITE_RESPONSE_FILES 9
+#define DQLITE_RESPONSE_RESULTS 10
+#define DQLITE_RESPONSE_METRICS 11
+#define DQLITE_RESPONSE_SLOW_TXS 12
 
 #endif /* DQLITE_PROTOCOL_H_ */
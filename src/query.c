@@ -98,6 +98,10 @@ static int encode_row(sqlite3_stmt *stmt, struct buffer *buffer, int n)
 }
 
 int query__batch(sqlite3_stmt *stmt, struct buffer *buffer) {
+	return query__batch_max(stmt, buffer, buffer->page_size);
+}
+
+int query__batch_max(sqlite3_stmt *stmt, struct buffer *buffer, size_t max) {
 	int n; /* Column count */
 	int i;
 	uint64_t n64;
@@ -126,7 +130,7 @@ int query__batch(sqlite3_stmt *stmt, struct buffer *buffer) {
 
 	/* Insert the rows. */
 	do {
-		if (buffer__offset(buffer) >= buffer->page_size) {
+		if (buffer__offset(buffer) >= max) {
 			/* If we are already filled a memory page, let's break
 			 * for now, we'll send more rows in a separate
 			 * response. */
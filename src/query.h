@@ -17,4 +17,10 @@
  */
 int query__batch(sqlite3_stmt *stmt, struct buffer *buffer);
 
+/**
+ * Like query__batch(), but keep stepping until the buffer holds at least @max
+ * bytes instead of a single page.
+ */
+int query__batch_max(sqlite3_stmt *stmt, struct buffer *buffer, size_t max);
+
 #endif /* QUERY_H_*/
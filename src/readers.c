@@ -0,0 +1,451 @@
+#include <string.h>
+
+#include "../include/dqlite.h"
+
+#include "./lib/assert.h"
+
+#include "bind.h"
+#include "query.h"
+#include "readers.h"
+
+/* States of a query. */
+enum {
+	READ__IDLE = 0, /* Owned by the event loop thread */
+	READ__QUEUED,   /* In the queue of a reader thread, or running */
+	READ__DONE      /* In the queue of batches to deliver */
+};
+
+/* Connection of a reader thread to a single database. */
+struct reader_conn
+{
+	char *filename;
+	sqlite3 *conn;
+	struct reader_conn *next;
+};
+
+/* A single reader thread. */
+struct reader
+{
+	struct readers *pool;      /* Pool the thread belongs to */
+	pthread_t thread;          /* Thread handle */
+	pthread_cond_t cond;       /* Signaled when @queue gets a query */
+	queue queue;               /* Queries to run */
+	struct read *running;      /* Query being run, if any */
+	struct reader_conn *conns; /* Open connections */
+};
+
+struct read *readers__read_create(const char *filename,
+				  const char *sql,
+				  const void *params,
+				  size_t params_len)
+{
+	struct read *read;
+	int rv;
+
+	read = sqlite3_malloc(sizeof *read);
+	if (read == NULL) {
+		goto err;
+	}
+	read->filename = sqlite3_mprintf("%s", filename);
+	if (read->filename == NULL) {
+		goto err_after_read_alloc;
+	}
+	read->sql = sqlite3_mprintf("%s", sql);
+	if (read->sql == NULL) {
+		goto err_after_filename_alloc;
+	}
+	read->params = sqlite3_malloc64(params_len > 0 ? params_len : 1);
+	if (read->params == NULL) {
+		goto err_after_sql_alloc;
+	}
+	memcpy(read->params, params, params_len);
+	read->params_len = params_len;
+	rv = buffer__init(&read->rows);
+	if (rv != 0) {
+		goto err_after_params_alloc;
+	}
+	read->status = 0;
+	read->message[0] = '\0';
+	read->state = READ__IDLE;
+	read->canceled = false;
+	read->cb = NULL;
+	QUEUE__INIT(&read->queue);
+	return read;
+
+err_after_params_alloc:
+	sqlite3_free(read->params);
+err_after_sql_alloc:
+	sqlite3_free(read->sql);
+err_after_filename_alloc:
+	sqlite3_free(read->filename);
+err_after_read_alloc:
+	sqlite3_free(read);
+err:
+	return NULL;
+}
+
+static void readDestroy(struct read *read)
+{
+	buffer__close(&read->rows);
+	sqlite3_free(read->params);
+	sqlite3_free(read->sql);
+	sqlite3_free(read->filename);
+	sqlite3_free(read);
+}
+
+/* Open a reader connection to the given database. */
+static int openConn(const char *filename, const char *vfs, sqlite3 **conn)
+{
+	int flags = SQLITE_OPEN_READWRITE;
+	int rc;
+
+	rc = sqlite3_open_v2(filename, conn, flags, vfs);
+	if (rc != SQLITE_OK) {
+		goto err;
+	}
+
+	rc = sqlite3_extended_result_codes(*conn, 1);
+	if (rc != SQLITE_OK) {
+		goto err;
+	}
+
+	/* Make sure nothing gets written through this connection, since it's
+	 * not hooked into replication. */
+	rc = sqlite3_exec(*conn, "PRAGMA query_only=1", NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err;
+	}
+
+	return 0;
+
+err:
+	sqlite3_close(*conn);
+	*conn = NULL;
+	return rc;
+}
+
+/* Get the connection of the given thread to the given database, opening it if
+ * needed. */
+static int getConn(struct reader *t, const char *filename, sqlite3 **conn)
+{
+	struct reader_conn *c;
+	int rc;
+
+	for (c = t->conns; c != NULL; c = c->next) {
+		if (strcmp(c->filename, filename) == 0) {
+			*conn = c->conn;
+			return 0;
+		}
+	}
+
+	c = sqlite3_malloc(sizeof *c);
+	if (c == NULL) {
+		return SQLITE_NOMEM;
+	}
+	c->filename = sqlite3_mprintf("%s", filename);
+	if (c->filename == NULL) {
+		sqlite3_free(c);
+		return SQLITE_NOMEM;
+	}
+	rc = openConn(filename, t->pool->config->name, &c->conn);
+	if (rc != 0) {
+		sqlite3_free(c->filename);
+		sqlite3_free(c);
+		return rc;
+	}
+	c->next = t->conns;
+	t->conns = c;
+	*conn = c->conn;
+	return 0;
+}
+
+/* Save the error message of the given connection into the given query. */
+static void setMessage(struct read *read, sqlite3 *conn)
+{
+	strncpy(read->message, sqlite3_errmsg(conn), READERS__MAX_MESSAGE - 1);
+	read->message[READERS__MAX_MESSAGE - 1] = '\0';
+}
+
+/* Encode all the rows of the given query. The statement is finalized before
+ * returning, which ends its read transaction. */
+static void step(struct reader *t, struct read *read)
+{
+	struct cursor cursor;
+	sqlite3_stmt *stmt;
+	sqlite3 *conn;
+	int rc;
+
+	rc = getConn(t, read->filename, &conn);
+	if (rc != 0) {
+		read->status = rc;
+		strcpy(read->message, "can't open reader connection");
+		return;
+	}
+	rc = sqlite3_prepare_v2(conn, read->sql, -1, &stmt, NULL);
+	if (rc != SQLITE_OK) {
+		read->status = rc;
+		setMessage(read, conn);
+		return;
+	}
+	cursor.p = read->params;
+	cursor.cap = read->params_len;
+	rc = bind__params(stmt, &cursor, TUPLE__PARAMS);
+	if (rc != 0) {
+		read->status = rc;
+		setMessage(read, conn);
+		goto out;
+	}
+
+	rc = query__batch_max(stmt, &read->rows, READERS__MAX_ROWS);
+	read->status = rc;
+	if (rc == SQLITE_ROW) {
+		read->status = SQLITE_TOOBIG;
+		strcpy(read->message, "result too large");
+	} else if (rc != SQLITE_DONE) {
+		setMessage(read, conn);
+	}
+
+out:
+	sqlite3_finalize(stmt);
+}
+
+static void *run(void *arg)
+{
+	struct reader *t = arg;
+	struct readers *r = t->pool;
+
+	pthread_mutex_lock(&r->mutex);
+	while (1) {
+		struct read *read;
+		queue *head;
+
+		while (QUEUE__IS_EMPTY(&t->queue) && !r->exiting) {
+			pthread_cond_wait(&t->cond, &r->mutex);
+		}
+		if (QUEUE__IS_EMPTY(&t->queue)) {
+			break;
+		}
+		head = QUEUE__HEAD(&t->queue);
+		QUEUE__REMOVE(head);
+		read = QUEUE__DATA(head, struct read, queue);
+
+		if (!read->canceled) {
+			t->running = read;
+			pthread_mutex_unlock(&r->mutex);
+			step(t, read);
+			pthread_mutex_lock(&r->mutex);
+			t->running = NULL;
+		}
+
+		/* The user might have released the query while it was
+		 * running. */
+		if (read->canceled) {
+			readDestroy(read);
+			continue;
+		}
+
+		read->state = READ__DONE;
+		QUEUE__PUSH(&r->done, &read->queue);
+		if (!r->stopping) {
+			uv_async_send(&r->async);
+		}
+	}
+	pthread_mutex_unlock(&r->mutex);
+
+	return NULL;
+}
+
+/* Deliver the batches that are ready. */
+static void asyncCb(uv_async_t *async)
+{
+	struct readers *r = async->data;
+	queue done;
+
+	QUEUE__INIT(&done);
+	pthread_mutex_lock(&r->mutex);
+	while (!QUEUE__IS_EMPTY(&r->done)) {
+		queue *head = QUEUE__HEAD(&r->done);
+		struct read *read = QUEUE__DATA(head, struct read, queue);
+		QUEUE__REMOVE(head);
+		read->state = READ__IDLE;
+		QUEUE__PUSH(&done, head);
+	}
+	pthread_mutex_unlock(&r->mutex);
+
+	while (!QUEUE__IS_EMPTY(&done)) {
+		queue *head = QUEUE__HEAD(&done);
+		struct read *read = QUEUE__DATA(head, struct read, queue);
+		QUEUE__REMOVE(head);
+		QUEUE__INIT(head);
+		if (read->canceled) {
+			readers__release(r, read);
+			continue;
+		}
+		read->cb(read);
+	}
+}
+
+int readers__init(struct readers *r,
+		  struct config *config,
+		  struct uv_loop_s *loop,
+		  unsigned n)
+{
+	unsigned i;
+	int rv;
+
+	assert(n > 0);
+
+	r->config = config;
+	r->threads = sqlite3_malloc64(n * sizeof *r->threads);
+	if (r->threads == NULL) {
+		rv = DQLITE_NOMEM;
+		goto err;
+	}
+	r->n = 0;
+	r->next = 0;
+	pthread_mutex_init(&r->mutex, NULL);
+	QUEUE__INIT(&r->done);
+	r->stopping = false;
+	r->exiting = false;
+
+	r->async.data = r;
+	rv = uv_async_init(loop, &r->async, asyncCb);
+	if (rv != 0) {
+		rv = DQLITE_ERROR;
+		goto err_after_threads_alloc;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct reader *t = &r->threads[i];
+		t->pool = r;
+		t->running = NULL;
+		t->conns = NULL;
+		QUEUE__INIT(&t->queue);
+		pthread_cond_init(&t->cond, NULL);
+		rv = pthread_create(&t->thread, NULL, run, t);
+		if (rv != 0) {
+			pthread_cond_destroy(&t->cond);
+			rv = DQLITE_ERROR;
+			goto err_after_threads_start;
+		}
+		r->n++;
+	}
+
+	return 0;
+
+err_after_threads_start:
+	readers__stop(r);
+	readers__close(r);
+	return rv;
+
+err_after_threads_alloc:
+	pthread_mutex_destroy(&r->mutex);
+	sqlite3_free(r->threads);
+err:
+	return rv;
+}
+
+void readers__stop(struct readers *r)
+{
+	pthread_mutex_lock(&r->mutex);
+	r->stopping = true;
+	pthread_mutex_unlock(&r->mutex);
+	uv_close((struct uv_handle_s *)&r->async, NULL);
+}
+
+void readers__close(struct readers *r)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&r->mutex);
+	r->exiting = true;
+	for (i = 0; i < r->n; i++) {
+		pthread_cond_signal(&r->threads[i].cond);
+	}
+	pthread_mutex_unlock(&r->mutex);
+
+	for (i = 0; i < r->n; i++) {
+		pthread_join(r->threads[i].thread, NULL);
+	}
+
+	/* Queries whose rows were never delivered. */
+	while (!QUEUE__IS_EMPTY(&r->done)) {
+		queue *head = QUEUE__HEAD(&r->done);
+		QUEUE__REMOVE(head);
+		readDestroy(QUEUE__DATA(head, struct read, queue));
+	}
+
+	for (i = 0; i < r->n; i++) {
+		struct reader *t = &r->threads[i];
+		while (t->conns != NULL) {
+			struct reader_conn *c = t->conns;
+			t->conns = c->next;
+			sqlite3_close(c->conn);
+			sqlite3_free(c->filename);
+			sqlite3_free(c);
+		}
+		pthread_cond_destroy(&t->cond);
+	}
+
+	pthread_mutex_destroy(&r->mutex);
+	sqlite3_free(r->threads);
+}
+
+void readers__submit(struct readers *r, struct read *read, read_cb cb)
+{
+	struct reader *t;
+
+	assert(read->state == READ__IDLE);
+	assert(!read->canceled);
+
+	pthread_mutex_lock(&r->mutex);
+	read->cb = cb;
+	t = &r->threads[r->next];
+	r->next = (r->next + 1) % r->n;
+	read->state = READ__QUEUED;
+	QUEUE__PUSH(&t->queue, &read->queue);
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&r->mutex);
+}
+
+void readers__release(struct readers *r, struct read *read)
+{
+	pthread_mutex_lock(&r->mutex);
+	read->canceled = true;
+	if (read->state != READ__IDLE) {
+		/* The thread or asyncCb() will take care of it. */
+		pthread_mutex_unlock(&r->mutex);
+		return;
+	}
+	pthread_mutex_unlock(&r->mutex);
+	readDestroy(read);
+}
+
+bool readers__busy(struct readers *r, const char *filename)
+{
+	bool busy = false;
+	unsigned i;
+
+	pthread_mutex_lock(&r->mutex);
+	for (i = 0; i < r->n && !busy; i++) {
+		struct reader *t = &r->threads[i];
+		queue *head;
+		if (t->running != NULL &&
+		    strcmp(t->running->filename, filename) == 0) {
+			busy = true;
+			break;
+		}
+		QUEUE__FOREACH(head, &t->queue)
+		{
+			struct read *read = QUEUE__DATA(head, struct read, queue);
+			if (!read->canceled &&
+			    strcmp(read->filename, filename) == 0) {
+				busy = true;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&r->mutex);
+
+	return busy;
+}
@@ -0,0 +1,122 @@
+/**
+ * Pool of threads executing read-only queries against dedicated reader
+ * connections, so reads on the leader can use more than one core.
+ *
+ * Each thread lazily opens its own connection to each database it's asked to
+ * query. Results are encoded by the thread into a buffer owned by the query
+ * and handed back to the event loop thread, which invokes the query callback.
+ *
+ * Each query is run to completion in one go, so reader connections never hold
+ * a read transaction while the event loop is running: that would prevent the
+ * next checkpoint from truncating the WAL. Queries whose rows don't fit in
+ * READERS__MAX_ROWS bytes fail with SQLITE_TOOBIG instead.
+ */
+
+#ifndef READERS_H_
+#define READERS_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include <sqlite3.h>
+#include <uv.h>
+
+#include "lib/buffer.h"
+#include "lib/queue.h"
+
+#include "config.h"
+
+/* Maximum length of the error messages of failed queries. */
+#define READERS__MAX_MESSAGE 256
+
+/* Maximum size of the encoded rows of a single query. */
+#define READERS__MAX_ROWS (16 * 1024 * 1024)
+
+struct reader;
+struct read;
+
+typedef void (*read_cb)(struct read *read);
+
+/**
+ * A read-only query to run in a reader thread.
+ */
+struct read
+{
+	void *data;                          /* User data */
+	char *filename;                      /* Database to query */
+	char *sql;                           /* SQL text of the statement */
+	void *params;                        /* Encoded statement parameters */
+	size_t params_len;                   /* Size of @params */
+	struct buffer rows;                  /* Encoded rows of the query */
+	int status;                          /* SQLITE_DONE or error code */
+	char message[READERS__MAX_MESSAGE];  /* Error message, if any */
+	int state;                           /* Where the query is, see readers.c */
+	bool canceled;                       /* Whether the user is gone */
+	read_cb cb;                          /* Invoked when the query is done */
+	queue queue;                         /* Link in the reader or done queue */
+};
+
+/**
+ * A pool of reader threads.
+ */
+struct readers
+{
+	struct config *config;    /* Dqlite configuration */
+	struct reader *threads;   /* Reader threads */
+	unsigned n;               /* Number of reader threads */
+	unsigned next;            /* Next thread to assign a query to */
+	pthread_mutex_t mutex;    /* Serialize access to the fields below */
+	queue done;               /* Queries whose batch is ready */
+	bool stopping;            /* Whether the event loop is going away */
+	bool exiting;             /* Whether the threads should exit */
+	struct uv_async_s async;  /* Wake up the event loop thread */
+};
+
+/**
+ * Start @n reader threads, delivering results to the given loop.
+ */
+int readers__init(struct readers *r,
+		  struct config *config,
+		  struct uv_loop_s *loop,
+		  unsigned n);
+
+/**
+ * Close the handle used to wake up the event loop. Results of queries
+ * completing from now on are not delivered anymore.
+ */
+void readers__stop(struct readers *r);
+
+/**
+ * Stop the reader threads, waiting for them to finish, and release all
+ * resources. Must be called after the loop handle got closed.
+ */
+void readers__close(struct readers *r);
+
+/**
+ * Create a new query against the given database, copying all the given
+ * arguments. Return #NULL if memory is exhausted.
+ */
+struct read *readers__read_create(const char *filename,
+				  const char *sql,
+				  const void *params,
+				  size_t params_len);
+
+/**
+ * Submit a query for execution. The given @cb will be invoked in the event
+ * loop thread once the rows are ready.
+ */
+void readers__submit(struct readers *r, struct read *read, read_cb cb);
+
+/**
+ * Release the given query. If it's still in progress, its callback won't be
+ * invoked anymore and the pool will release it later.
+ */
+void readers__release(struct readers *r, struct read *read);
+
+/**
+ * Whether any query against the given database is queued or running, and
+ * might therefore hold a read transaction.
+ */
+bool readers__busy(struct readers *r, const char *filename);
+
+#endif /* READERS_H_ */
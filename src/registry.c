@@ -10,6 +10,13 @@ void registry__init(struct registry *r, struct config *config)
 {
 	r->config = config;
 	QUEUE__INIT(&r->dbs);
+	hash__init(&r->by_filename);
+	hash__init(&r->by_tx_id);
+	lease__init(&r->lease);
+	coro_pool__init(&r->coros);
+	leader__slices_init(&r->slices);
+	r->readers = NULL;
+	metrics__init(&r->metrics);
 }
 
 void registry__close(struct registry *r)
@@ -20,17 +27,23 @@ void registry__close(struct registry *r)
 		head = QUEUE__HEAD(&r->dbs);
 		QUEUE__REMOVE(head);
 		db = QUEUE__DATA(head, struct db, queue);
+		leader__close_pool(db);
 		db__close(db);
 		sqlite3_free(db);
 	}
+	hash__close(&r->by_filename);
+	hash__close(&r->by_tx_id);
+	coro_pool__close(&r->coros);
 }
 
 int registry__db_get(struct registry *r, const char *filename, struct db **db)
 {
-	queue *head;
-	QUEUE__FOREACH(head, &r->dbs)
+	struct hash_item *item;
+	uint64_t key = hash__string(filename);
+	int rv;
+	HASH__FOREACH(item, &r->by_filename, key)
 	{
-		*db = QUEUE__DATA(head, struct db, queue);
+		*db = HASH__DATA(item, struct db, by_name);
 		if (strcmp((*db)->filename, filename) == 0) {
 			return 0;
 		}
@@ -40,17 +53,30 @@ int registry__db_get(struct registry *r, const char *filename, struct db **db)
 		return DQLITE_NOMEM;
 	}
 	db__init(*db, r->config, filename);
+	rv = hash__insert(&r->by_filename, &(*db)->by_name, key);
+	if (rv != 0) {
+		db__close(*db);
+		sqlite3_free(*db);
+		return rv;
+	}
+	(*db)->txs = &r->by_tx_id;
+	(*db)->lease = &r->lease;
+	(*db)->coros = &r->coros;
+	(*db)->slices = &r->slices;
+	(*db)->metrics = &r->metrics;
+	(*db)->readers = r->readers;
 	QUEUE__PUSH(&r->dbs, &(*db)->queue);
 	return 0;
 }
 
 void registry__db_by_tx_id(struct registry *r, size_t id, struct db **db)
 {
-	queue *head;
-	QUEUE__FOREACH(head, &r->dbs)
+	struct hash_item *item;
+	HASH__FOREACH(item, &r->by_tx_id, id)
 	{
-		*db = QUEUE__DATA(head, struct db, queue);
-		if ((*db)->tx != NULL && (*db)->tx->id == id) {
+		*db = HASH__DATA(item, struct db, by_tx);
+		assert((*db)->tx != NULL);
+		if ((*db)->tx->id == id) {
 			return;
 		}
 	}
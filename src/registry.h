@@ -5,14 +5,25 @@
 
 #include <sqlite3.h>
 
+#include "lib/hash.h"
 #include "lib/queue.h"
 
 #include "db.h"
+#include "leader.h"
+#include "metrics.h"
+#include "readers.h"
 
 struct registry
 {
 	struct config *config;
 	queue dbs;
+	struct hash by_filename; /* Index of dbs by filename */
+	struct hash by_tx_id;    /* Index of dbs by ongoing transaction ID */
+	struct lease lease;      /* Leader lease, shared by all dbs */
+	struct coro_pool coros;  /* Leader loop coroutines, shared by all dbs */
+	struct slices slices;    /* Suspended leader statements of all dbs */
+	struct readers *readers; /* Reader threads, if enabled */
+	struct metrics metrics;  /* Performance metrics of the node */
 };
 
 void registry__init(struct registry *r, struct config *config);
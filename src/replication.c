@@ -7,6 +7,7 @@
 #include "command.h"
 #include "leader.h"
 #include "lib/assert.h"
+#include "metrics.h"
 
 /* Set to 1 to enable tracing. */
 #if 0
@@ -19,18 +20,24 @@
 struct replication
 {
 	struct logger *logger;
+	struct config *config;
 	struct raft *raft;
-	queue apply_reqs;
+	queue pending;       /* Frames commands waiting for the next group */
+	unsigned n_pending;  /* Number of commands in the pending queue */
+	size_t pending_size; /* Total size of the pending commands */
+	unsigned n_groups;   /* Groups of Frames commands not yet applied */
 };
 
-/* Wrapper around raft_apply, saving context information. */
+/* A command to be applied, saving context information. */
 struct apply
 {
-	struct raft_apply req; /* Raft apply request */
-	int status;            /* Raft apply result */
-	struct leader *leader; /* Leader connection that triggered the hook */
-	int type;              /* Command type */
-	union {                /* Command-specific data */
+	struct raft_buffer buf; /* Encoded command */
+	queue queue;            /* Pending queue or group */
+	int status;             /* Raft apply result */
+	int rc;                 /* SQLite error if submission failed */
+	struct leader *leader;  /* Leader connection that triggered the hook */
+	int type;               /* Command type */
+	union {                 /* Command-specific data */
 		struct
 		{
 			bool is_commit;
@@ -38,6 +45,16 @@ struct apply
 	};
 };
 
+/* A group of commands submitted as a single log entry. */
+struct group
+{
+	struct raft_apply req;  /* Raft apply request */
+	struct replication *r;  /* Replication object the group belongs to */
+	raft_time start;        /* When the group was submitted */
+	queue applies;          /* Commands in the group, in submission order */
+	bool frames;            /* Whether the group holds Frames commands */
+};
+
 static void framesAbortBecauseLeadershipLost(struct leader *leader,
 					     int is_commit)
 {
@@ -119,25 +136,233 @@ static void framesAbortBecauseLeadershipLost(struct leader *leader,
 	}
 }
 
+/* Frames commands are not submitted right away, but queued and replicated in
+ * groups: all commands of a group are encoded in a single Batch command, which
+ * takes a single log entry and a single raft_apply request. Once the entry gets
+ * applied each leader of the group is resumed in turn.
+ *
+ * If a group window is configured, the pending queue is flushed periodically
+ * by the server. Otherwise commands are only queued while a previous group is
+ * in flight, and flushed as soon as it gets applied, so that a lone commit
+ * doesn't pay any extra latency. In both cases a command that would make the
+ * pending queue exceed the configured group size gets submitted on its
+ * own. */
+
+/* Resume the coroutine of the leader that submitted the given command. */
+static void wake(struct apply *apply)
+{
+	struct leader *leader = apply->leader;
+	struct exec *r = leader->exec;
+
+	co_switch(leader->loop); /* Resume apply() */
+
+	if (r != NULL) {
+		leader__exec_done(r);
+	}
+}
+
+/* Resume the leader that submitted the given command, after it got applied
+ * with the given raft status. */
+static void resume(struct apply *apply, int status, raft_time start)
+{
+	struct leader *leader = apply->leader;
+
+	apply->status = status;
+
+	if (status == 0 && leader->db->lease != NULL) {
+		lease__extend(leader->db->lease, leader->raft, start);
+	}
+
+	wake(apply);
+}
+
+/* Convert an error returned by raft_apply() to a SQLite error code. */
+static int submitErrorCode(int rv)
+{
+	switch (rv) {
+		case RAFT_TOOBIG:
+			return SQLITE_TOOBIG;
+		default:
+			return SQLITE_ERROR;
+	}
+}
+
+/* Move all the commands of the @from queue to the tail of the @to one. */
+static void moveApplies(queue *from, queue *to)
+{
+	queue *head;
+	while (!QUEUE__IS_EMPTY(from)) {
+		head = QUEUE__HEAD(from);
+		QUEUE__REMOVE(head);
+		QUEUE__PUSH(to, head);
+	}
+}
+
+static void applyCb(struct raft_apply *req, int status, void *result);
+
+/* Submit the given @n commands as a single log entry. A lone command is
+ * submitted as is, while multiple ones are wrapped in a Batch command, in which
+ * case their individual buffers are released. If the submission fails, the
+ * buffers are left untouched and the commands stay in the @applies queue. */
+static int submit(struct replication *r,
+		  queue *applies,
+		  unsigned n,
+		  bool frames)
+{
+	struct command_batch c;
+	struct raft_buffer *bufs = NULL;
+	struct raft_buffer buf;
+	struct group *group;
+	struct apply *apply;
+	queue *head;
+	unsigned i;
+	int rv;
+
+	assert(n > 0);
+
+	group = raft_malloc(sizeof *group);
+	if (group == NULL) {
+		rv = RAFT_NOMEM;
+		goto err;
+	}
+	group->req.data = group;
+	group->r = r;
+	group->start = lease__now(r->raft);
+	group->frames = frames;
+	QUEUE__INIT(&group->applies);
+
+	if (n == 1) {
+		head = QUEUE__HEAD(applies);
+		apply = QUEUE__DATA(head, struct apply, queue);
+		buf = apply->buf;
+	} else {
+		bufs = raft_malloc(n * sizeof *bufs);
+		if (bufs == NULL) {
+			rv = RAFT_NOMEM;
+			goto err_after_group_alloc;
+		}
+		i = 0;
+		QUEUE__FOREACH(head, applies)
+		{
+			apply = QUEUE__DATA(head, struct apply, queue);
+			bufs[i] = apply->buf;
+			i++;
+		}
+		assert(i == n);
+		c.commands.n = n;
+		c.commands.__unused__ = 0;
+		c.commands.size = 0;
+		c.commands.data = bufs;
+		rv = command__encode(COMMAND_BATCH, &c, &buf);
+		if (rv != 0) {
+			rv = RAFT_NOMEM;
+			goto err_after_bufs_alloc;
+		}
+	}
+
+	rv = raft_apply(r->raft, &group->req, &buf, 1, applyCb);
+	if (rv != 0) {
+		goto err_after_batch_encode;
+	}
+
+	/* The batch holds its own copy of the commands. */
+	if (n > 1) {
+		QUEUE__FOREACH(head, applies)
+		{
+			apply = QUEUE__DATA(head, struct apply, queue);
+			raft_free(apply->buf.base);
+		}
+		raft_free(bufs);
+	}
+
+	moveApplies(applies, &group->applies);
+	if (frames) {
+		r->n_groups++;
+	}
+
+	return 0;
+
+err_after_batch_encode:
+	if (n > 1) {
+		raft_free(buf.base);
+	}
+err_after_bufs_alloc:
+	if (bufs != NULL) {
+		raft_free(bufs);
+	}
+err_after_group_alloc:
+	raft_free(group);
+err:
+	return rv;
+}
+
+/* Submit the pending commands as a group, failing them if the group can't be
+ * submitted. Since the leaders of failed commands get resumed, this must not be
+ * called from within a leader coroutine. */
+static void flush(struct replication *r)
+{
+	struct apply *apply;
+	queue applies;
+	queue *head;
+	unsigned n;
+	int rv;
+
+	if (r->n_pending == 0) {
+		return;
+	}
+
+	/* Leaders resumed because of a failure might queue new commands, so
+	 * detach the current ones first. */
+	QUEUE__INIT(&applies);
+	moveApplies(&r->pending, &applies);
+	n = r->n_pending;
+	r->n_pending = 0;
+	r->pending_size = 0;
+
+	rv = submit(r, &applies, n, true);
+	if (rv == 0) {
+		return;
+	}
+
+	tracef("failed to submit group of %u commands: %d", n, rv);
+	while (!QUEUE__IS_EMPTY(&applies)) {
+		head = QUEUE__HEAD(&applies);
+		QUEUE__REMOVE(head);
+		apply = QUEUE__DATA(head, struct apply, queue);
+		raft_free(apply->buf.base);
+		apply->rc = submitErrorCode(rv);
+		wake(apply);
+	}
+}
+
 static void applyCb(struct raft_apply *req, int status, void *result)
 {
+	struct group *group = req->data;
+	struct replication *r = group->r;
 	struct apply *apply;
-	struct leader *leader;
-	struct exec *r;
+	queue *head;
 	(void)result;
-	apply = req->data;
-	leader = apply->leader;
-	r = leader->exec;
-	apply->status = status;
-
-	co_switch(leader->loop); /* Resume apply() */
 
-	if (r != NULL && r->done) {
-		leader->exec = NULL;
-		if (r->cb != NULL) {
-			r->cb(r, r->status);
+	if (group->frames) {
+		assert(r->n_groups > 0);
+		r->n_groups--;
+		/* Without a window, the commands queued while this group was in
+		 * flight form the next one. Get it going before resuming the
+		 * leaders of this group, since they might want to submit
+		 * further commands. */
+		if (r->config->group_commit_window == 0) {
+			flush(r);
 		}
 	}
+
+	while (!QUEUE__IS_EMPTY(&group->applies)) {
+		head = QUEUE__HEAD(&group->applies);
+		QUEUE__REMOVE(head);
+		apply = QUEUE__DATA(head, struct apply, queue);
+		resume(apply, status, group->start);
+	}
+
+	raft_free(group);
 }
 
 /* Handle xFrames failures due to this server not not being the leader. */
@@ -172,33 +397,59 @@ static int apply(struct replication *r,
 		 int type,
 		 const void *command)
 {
-	struct raft_buffer buf;
+	unsigned long long start = metrics__now();
+	queue applies;
 	int rc;
 
 	apply->leader = leader;
-	apply->req.data = apply;
 	apply->type = type;
+	apply->rc = SQLITE_OK;
 
-	rc = command__encode(type, command, &buf);
+	rc = command__encode(type, command, &apply->buf);
 	if (rc != 0) {
 		goto err;
 	}
 
-	rc = raft_apply(r->raft, &apply->req, &buf, 1, applyCb);
-	if (rc != 0) {
-		switch (rc) {
-			case RAFT_TOOBIG:
-				rc = SQLITE_TOOBIG;
-				break;
-			default:
-				rc = SQLITE_ERROR;
-				break;
+	if (type == COMMAND_FRAMES) {
+		struct tx_timing *timing = &leader->db->tx->timing;
+		timing->submit = metrics__now();
+		timing->encode += timing->submit - start;
+	}
+
+	/* Frames commands wait in the pending queue to be submitted with the
+	 * next group, as long as the group stays within the configured size.
+	 * Without a window there's nothing to wait for unless another group is
+	 * in flight. Anything else is submitted right away. */
+	if (type == COMMAND_FRAMES && r->config->group_commit_size > 0 &&
+	    (r->config->group_commit_window > 0 || r->n_groups > 0) &&
+	    r->pending_size + apply->buf.len <= r->config->group_commit_size) {
+		QUEUE__PUSH(&r->pending, &apply->queue);
+		r->n_pending++;
+		r->pending_size += apply->buf.len;
+	} else {
+		QUEUE__INIT(&applies);
+		QUEUE__PUSH(&applies, &apply->queue);
+		rc = submit(r, &applies, 1, type == COMMAND_FRAMES);
+		if (rc != 0) {
+			rc = submitErrorCode(rc);
+			goto err_after_command_encode;
 		}
-		goto err_after_command_encode;
 	}
 
 	co_switch(leader->main);
 
+	if (leader->db->metrics != NULL) {
+		histogram__record(&leader->db->metrics->apply,
+				  metrics__now() - start);
+	}
+
+	/* The command was queued and could not be submitted later on. Its
+	 * buffer has already been released. */
+	if (apply->rc != SQLITE_OK) {
+		rc = apply->rc;
+		goto err;
+	}
+
 	if (apply->status != 0) {
 		switch (apply->status) {
 			case RAFT_LEADERSHIPLOST:
@@ -240,7 +491,7 @@ static int apply(struct replication *r,
 	return rc;
 
 err_after_command_encode:
-	raft_free(buf.base);
+	raft_free(apply->buf.base);
 err:
 	raft_free(apply);
 	return rc;
@@ -423,6 +674,7 @@ static int methodBegin(sqlite3_wal_replication *replication, void *arg)
 	if (rc != 0) {
 		return rc;
 	}
+	leader->db->tx->timing.begin = metrics__now();
 
 	return SQLITE_OK;
 }
@@ -551,6 +803,27 @@ static int methodUndo(sqlite3_wal_replication *replication, void *arg)
 	return SQLITE_OK;
 }
 
+/* Record the stage durations of a committed transaction. */
+static void recordTx(struct leader *leader, struct tx *tx)
+{
+	struct db *db = leader->db;
+	struct metrics_slow_tx timing;
+
+	if (db->metrics == NULL) {
+		return;
+	}
+
+	timing.id = tx->id;
+	timing.n = tx->timing.n;
+	timing.total = metrics__now() - tx->timing.begin;
+	timing.encode = tx->timing.encode;
+	timing.raft = tx->timing.raft;
+	timing.fsm = tx->timing.fsm;
+
+	metrics__tx(db->metrics, db->filename, &timing,
+		    (uint64_t)db->config->slow_tx_threshold * 1000);
+}
+
 static int methodEnd(sqlite3_wal_replication *replication, void *arg)
 {
 	struct leader *leader = arg;
@@ -571,6 +844,10 @@ static int methodEnd(sqlite3_wal_replication *replication, void *arg)
 		return 0;
 	}
 
+	if (tx->state == TX__WRITTEN) {
+		recordTx(leader, tx);
+	}
+
 	db__delete_tx(leader->db);
 
 	return SQLITE_OK;
@@ -587,8 +864,12 @@ int replication__init(struct sqlite3_wal_replication *replication,
 	}
 
 	r->logger = &config->logger;
+	r->config = config;
 	r->raft = raft;
-	QUEUE__INIT(&r->apply_reqs);
+	QUEUE__INIT(&r->pending);
+	r->n_pending = 0;
+	r->pending_size = 0;
+	r->n_groups = 0;
 
 	replication->iVersion = 1;
 	replication->pAppData = r;
@@ -604,9 +885,16 @@ int replication__init(struct sqlite3_wal_replication *replication,
 	return 0;
 }
 
+void replication__flush(struct sqlite3_wal_replication *replication)
+{
+	struct replication *r = replication->pAppData;
+	flush(r);
+}
+
 void replication__close(struct sqlite3_wal_replication *replication)
 {
 	struct replication *r = replication->pAppData;
+	assert(QUEUE__IS_EMPTY(&r->pending));
 	sqlite3_wal_replication_unregister(replication);
 	sqlite3_free(r);
 }
@@ -21,6 +21,14 @@ int replication__init(struct sqlite3_wal_replication *replication,
 		      struct config *config,
 		      struct raft *raft);
 
+/**
+ * Submit the Frames commands waiting to be grouped, if any.
+ *
+ * This must be called from the main loop, and not from within a leader
+ * coroutine.
+ */
+void replication__flush(struct sqlite3_wal_replication *replication);
+
 /**
  * Release all memory associated with the given dqlite raft's based replication
  * implementation.
@@ -31,6 +31,11 @@
 #define REQUEST_QUERY_SQL(X, ...)       \
 	X(uint64, db_id, ##__VA_ARGS__) \
 	X(text, sql, ##__VA_ARGS__)
+#define REQUEST_QUERY_STALE(X, ...)     \
+	X(uint64, db_id, ##__VA_ARGS__) \
+	X(uint64, mode, ##__VA_ARGS__)  \
+	X(uint64, bound, ##__VA_ARGS__) \
+	X(text, sql, ##__VA_ARGS__)
 #define REQUEST_INTERRUPT(X, ...) X(uint64, db_id, ##__VA_ARGS__)
 #define REQUEST_ADD(X, ...)         \
 	X(uint64, id, ##__VA_ARGS__) \
@@ -40,6 +45,12 @@
 #define REQUEST_DUMP(X, ...) X(text, filename, ##__VA_ARGS__)
 #define REQUEST_CLUSTER(X, ...) X(uint64, format, ##__VA_ARGS__)
 #define REQUEST_TRANSFER(X, ...) X(uint64, id, ##__VA_ARGS__)
+#define REQUEST_EXEC_BATCH(X, ...)       \
+	X(uint32, db_id, ##__VA_ARGS__)   \
+	X(uint32, stmt_id, ##__VA_ARGS__) \
+	X(uint64, n, ##__VA_ARGS__)
+#define REQUEST_METRICS(X, ...) X(uint64, __unused__, ##__VA_ARGS__)
+#define REQUEST_SLOW_TXS(X, ...) X(uint64, __unused__, ##__VA_ARGS__)
 
 #define REQUEST__DEFINE(LOWER, UPPER, _) \
 	SERIALIZE__DEFINE(request_##LOWER, REQUEST_##UPPER);
@@ -60,7 +71,11 @@
 	X(remove, REMOVE, __VA_ARGS__)       \
 	X(dump, DUMP, __VA_ARGS__)           \
 	X(cluster, CLUSTER, __VA_ARGS__) \
-	X(transfer, TRANSFER, __VA_ARGS__)
+	X(transfer, TRANSFER, __VA_ARGS__) \
+	X(exec_batch, EXEC_BATCH, __VA_ARGS__) \
+	X(query_stale, QUERY_STALE, __VA_ARGS__) \
+	X(metrics, METRICS, __VA_ARGS__) \
+	X(slow_txs, SLOW_TXS, __VA_ARGS__)
 
 REQUEST__TYPES(REQUEST__DEFINE);
 
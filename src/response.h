@@ -22,29 +22,84 @@
 	X(uint32, db_id, ##__VA_ARGS__) \
 	X(uint32, id, ##__VA_ARGS__)    \
 	X(uint64, params, ##__VA_ARGS__)
+/* With protocol version 1, a result response is followed by a uint64 read
+ * token: the last raft index applied when the change completed, which clients
+ * can pass to query_stale requests in order to read their own writes. Legacy
+ * clients don't get it. See doc/protocol.md. */
 #define RESPONSE_RESULT(X, ...)                  \
 	X(uint64, last_insert_id, ##__VA_ARGS__) \
 	X(uint64, rows_affected, ##__VA_ARGS__)
+#define RESPONSE_RESULTS(X, ...)                 \
+	X(uint64, last_insert_id, ##__VA_ARGS__) \
+	X(uint64, rows_affected, ##__VA_ARGS__)  \
+	X(uint64, token, ##__VA_ARGS__)          \
+	X(uint64, n, ##__VA_ARGS__)
 #define RESPONSE_ROWS(X, ...) X(uint64, eof, ##__VA_ARGS__)
 #define RESPONSE_EMPTY(X, ...) X(uint64, __unused__, ##__VA_ARGS__)
 #define RESPONSE_FILES(X, ...) X(uint64, n, ##__VA_ARGS__)
 #define RESPONSE_SERVERS(X, ...) X(uint64, n, ##__VA_ARGS__)
+/* A metrics response is followed by @n request_metrics entries, each followed
+ * by the latency of its requests, then by the latencies of raft barriers,
+ * raft applies, leader steps, and of the encode, raft, fsm and total stages of
+ * write transactions, and finally by a metrics_counters entry. Only request
+ * types that have been seen at least once are included. Latencies are in
+ * microseconds. */
+#define RESPONSE_METRICS(X, ...) X(uint64, n, ##__VA_ARGS__)
+#define RESPONSE_REQUEST_METRICS(X, ...)    \
+	X(uint64, type, ##__VA_ARGS__)      \
+	X(uint64, requests, ##__VA_ARGS__)  \
+	X(uint64, failures, ##__VA_ARGS__)  \
+	X(uint64, bytes_in, ##__VA_ARGS__)  \
+	X(uint64, bytes_out, ##__VA_ARGS__)
+#define RESPONSE_METRICS_COUNTERS(X, ...)         \
+	X(uint64, writers, ##__VA_ARGS__)         \
+	X(uint64, max_writers, ##__VA_ARGS__)     \
+	X(uint64, writer_timeouts, ##__VA_ARGS__) \
+	X(uint64, stmt_cache_hits, ##__VA_ARGS__) \
+	X(uint64, stmt_cache_misses, ##__VA_ARGS__)
+#define RESPONSE_LATENCY(X, ...)        \
+	X(uint64, count, ##__VA_ARGS__) \
+	X(uint64, sum, ##__VA_ARGS__)   \
+	X(uint64, max, ##__VA_ARGS__)   \
+	X(uint64, p50, ##__VA_ARGS__)   \
+	X(uint64, p90, ##__VA_ARGS__)   \
+	X(uint64, p99, ##__VA_ARGS__)   \
+	X(uint64, p999, ##__VA_ARGS__)
+/* A slow transactions response is followed by @n slow_tx entries, most recent
+ * first. Times are in microseconds. */
+#define RESPONSE_SLOW_TXS(X, ...) X(uint64, n, ##__VA_ARGS__)
+#define RESPONSE_SLOW_TX(X, ...)           \
+	X(text, filename, ##__VA_ARGS__)   \
+	X(uint64, id, ##__VA_ARGS__)       \
+	X(uint64, time, ##__VA_ARGS__)     \
+	X(uint64, n, ##__VA_ARGS__)        \
+	X(uint64, total, ##__VA_ARGS__)    \
+	X(uint64, encode, ##__VA_ARGS__)   \
+	X(uint64, raft, ##__VA_ARGS__)     \
+	X(uint64, fsm, ##__VA_ARGS__)
 
 #define RESPONSE__DEFINE(LOWER, UPPER, _) \
 	SERIALIZE__DEFINE(response_##LOWER, RESPONSE_##UPPER);
 
-#define RESPONSE__TYPES(X, ...)                      \
-	X(server, SERVER, __VA_ARGS__)               \
-	X(server_legacy, SERVER_LEGACY, __VA_ARGS__) \
-	X(welcome, WELCOME, __VA_ARGS__)             \
-	X(failure, FAILURE, __VA_ARGS__)             \
-	X(db, DB, __VA_ARGS__)                       \
-	X(stmt, STMT, __VA_ARGS__)                   \
-	X(result, RESULT, __VA_ARGS__)               \
-	X(rows, ROWS, __VA_ARGS__)                   \
-	X(empty, EMPTY, __VA_ARGS__)                 \
-	X(files, FILES, __VA_ARGS__)                 \
-	X(servers, SERVERS, __VA_ARGS__)
+#define RESPONSE__TYPES(X, ...)                            \
+	X(server, SERVER, __VA_ARGS__)                     \
+	X(server_legacy, SERVER_LEGACY, __VA_ARGS__)       \
+	X(welcome, WELCOME, __VA_ARGS__)                   \
+	X(failure, FAILURE, __VA_ARGS__)                   \
+	X(db, DB, __VA_ARGS__)                             \
+	X(stmt, STMT, __VA_ARGS__)                         \
+	X(result, RESULT, __VA_ARGS__)                     \
+	X(results, RESULTS, __VA_ARGS__)                   \
+	X(rows, ROWS, __VA_ARGS__)                         \
+	X(empty, EMPTY, __VA_ARGS__)                       \
+	X(files, FILES, __VA_ARGS__)                       \
+	X(servers, SERVERS, __VA_ARGS__)                   \
+	X(metrics, METRICS, __VA_ARGS__)                   \
+	X(request_metrics, REQUEST_METRICS, __VA_ARGS__)   \
+	X(metrics_counters, METRICS_COUNTERS, __VA_ARGS__) \
+	X(latency, LATENCY, __VA_ARGS__)                   \
+	X(slow_txs, SLOW_TXS, __VA_ARGS__)                 \
+	X(slow_tx, SLOW_TX, __VA_ARGS__)
 
 RESPONSE__TYPES(RESPONSE__DEFINE);
 
@@ -7,6 +7,7 @@
 #include "../include/dqlite.h"
 #include "conn.h"
 #include "fsm.h"
+#include "leader.h"
 #include "lib/assert.h"
 #include "logger.h"
 #include "replication.h"
@@ -16,6 +17,21 @@
 /* Special ID for the bootstrap node. Equals to raft_digest("1", 0). */
 #define BOOTSTRAP_ID 0x2dc171858c3155be
 
+/* Number of times per write timeout period that waiting writers are checked
+ * for expiration. */
+#define WRITERS_CHECKS 10
+
+/* Number of times per idle timeout period that pooled leader connections are
+ * checked for expiration. */
+#define POOL_CHECKS 2
+
+/* Interval in milliseconds between refills of the pools of leader connections,
+ * when idle connections are never closed. */
+#define POOL_FILL_INTERVAL 1000
+
+/* Minimum stack size of leader loop coroutines. */
+#define MIN_STACK_SIZE (64 * 1024)
+
 int dqlite__init(struct dqlite_node *d,
 		 dqlite_node_id id,
 		 const char *address,
@@ -296,6 +312,92 @@ int dqlite_node_set_network_latency(dqlite_node *t,
 	return 0;
 }
 
+int dqlite_node_set_write_timeout(dqlite_node *t, unsigned milliseconds)
+{
+	if (t->running) {
+		return DQLITE_MISUSE;
+	}
+	t->config.write_timeout = milliseconds;
+	return 0;
+}
+
+int dqlite_node_set_group_commit_size(dqlite_node *t, unsigned size)
+{
+	if (t->running) {
+		return DQLITE_MISUSE;
+	}
+	t->config.group_commit_size = size;
+	return 0;
+}
+
+int dqlite_node_set_group_commit_window(dqlite_node *t, unsigned milliseconds)
+{
+	if (t->running) {
+		return DQLITE_MISUSE;
+	}
+	t->config.group_commit_window = milliseconds;
+	return 0;
+}
+
+int dqlite_node_set_stmt_cache_size(dqlite_node *t, unsigned size)
+{
+	if (t->running) {
+		return DQLITE_MISUSE;
+	}
+	t->config.stmt_cache_size = size;
+	return 0;
+}
+
+int dqlite_node_set_connection_pool(dqlite_node *t,
+				    unsigned min,
+				    unsigned max,
+				    unsigned idle_timeout)
+{
+	if (t->running || min > max) {
+		return DQLITE_MISUSE;
+	}
+	t->config.pool_min = min;
+	t->config.pool_max = max;
+	t->config.pool_idle_timeout = idle_timeout;
+	return 0;
+}
+
+int dqlite_node_set_stack_size(dqlite_node *t, unsigned size)
+{
+	if (t->running || size < MIN_STACK_SIZE) {
+		return DQLITE_MISUSE;
+	}
+	t->config.stack_size = size;
+	return 0;
+}
+
+int dqlite_node_set_time_slice(dqlite_node *t, unsigned milliseconds)
+{
+	if (t->running) {
+		return DQLITE_MISUSE;
+	}
+	t->config.time_slice = milliseconds;
+	return 0;
+}
+
+int dqlite_node_set_reader_threads(dqlite_node *t, unsigned threads)
+{
+	if (t->running) {
+		return DQLITE_MISUSE;
+	}
+	t->config.readers = threads;
+	return 0;
+}
+
+int dqlite_node_set_slow_tx_threshold(dqlite_node *t, unsigned milliseconds)
+{
+	if (t->running) {
+		return DQLITE_MISUSE;
+	}
+	t->config.slow_tx_threshold = milliseconds;
+	return 0;
+}
+
 static int maybeBootstrap(dqlite_node *d,
 			  dqlite_node_id id,
 			  const char *address)
@@ -338,6 +440,13 @@ static void raftCloseCb(struct raft *raft)
 	raft_uv_close(&s->raft_io);
 	uv_close((struct uv_handle_s *)&s->stop, NULL);
 	uv_close((struct uv_handle_s *)&s->startup, NULL);
+	uv_close((struct uv_handle_s *)&s->writers, NULL);
+	uv_close((struct uv_handle_s *)&s->pool, NULL);
+	uv_close((struct uv_handle_s *)&s->group_commit, NULL);
+	uv_close((struct uv_handle_s *)&s->slices, NULL);
+	if (s->registry.readers != NULL) {
+		readers__stop(s->registry.readers);
+	}
 	uv_close((struct uv_handle_s *)s->listener, NULL);
 }
 
@@ -362,6 +471,8 @@ static void stop_cb(uv_async_t *stop)
 		conn = QUEUE__DATA(head, struct conn, queue);
 		conn__stop(conn);
 	}
+	/* Don't leave commands behind waiting for the group window. */
+	replication__flush(&d->replication);
 	raft_close(&d->raft, raftCloseCb);
 }
 
@@ -378,6 +489,69 @@ static void startup_cb(uv_timer_t *startup)
 	assert(rv == 0); /* No reason for which posting should fail */
 }
 
+/* Callback invoked periodically to fail writers that have been waiting for
+ * the lock of a database for too long. */
+static void writers_cb(uv_timer_t *writers)
+{
+	struct dqlite_node *d = writers->data;
+	raft_time now = lease__now(&d->raft);
+	queue *head;
+	QUEUE__FOREACH(head, &d->registry.dbs)
+	{
+		struct db *db = QUEUE__DATA(head, struct db, queue);
+		if (db->n_writers > 0) {
+			leader__expire_writers(db, now);
+		}
+	}
+}
+
+/* Callback invoked periodically to close pooled leader connections that have
+ * been idle for too long and, if this node is the leader, to open new ones in
+ * place of the connections taken by clients. */
+static void pool_cb(uv_timer_t *pool)
+{
+	struct dqlite_node *d = pool->data;
+	raft_time now = lease__now(&d->raft);
+	bool leader = raft_state(&d->raft) == RAFT_LEADER;
+	queue *head;
+	QUEUE__FOREACH(head, &d->registry.dbs)
+	{
+		struct db *db = QUEUE__DATA(head, struct db, queue);
+		leader__trim_pool(db, now);
+		if (leader) {
+			leader__fill_pool(db, &d->raft);
+		}
+	}
+}
+
+/* Callback invoked at the end of each group commit window, to submit the
+ * commands collected in the meantime. */
+static void group_commit_cb(uv_timer_t *group_commit)
+{
+	struct dqlite_node *d = group_commit->data;
+	replication__flush(&d->replication);
+}
+
+/* Callback invoked at the next loop iteration after a leader statement got
+ * suspended because it used up its time slice. */
+static void slices_cb(uv_idle_t *slices)
+{
+	struct dqlite_node *d = slices->data;
+	uv_idle_stop(slices);
+	leader__resume_slices(&d->registry.slices);
+}
+
+/* Arrange for slices_cb() to be invoked. The idle handle keeps the loop from
+ * blocking for I/O, so it's active only while there are suspended
+ * statements. */
+static void slices_wakeup(struct slices *s)
+{
+	struct dqlite_node *d = s->data;
+	int rv;
+	rv = uv_idle_start(&d->slices, slices_cb);
+	assert(rv == 0);
+}
+
 static void listenCb(uv_stream_t *listener, int status)
 {
 	struct dqlite_node *t = listener->data;
@@ -480,11 +654,74 @@ static int taskRun(struct dqlite_node *d)
 	rv = uv_timer_start(&d->startup, startup_cb, 0, 0);
 	assert(rv == 0);
 
+	d->writers.data = d;
+	rv = uv_timer_init(&d->loop, &d->writers);
+	assert(rv == 0);
+	if (d->config.write_timeout > 0) {
+		unsigned interval = d->config.write_timeout / WRITERS_CHECKS;
+		if (interval == 0) {
+			interval = 1;
+		}
+		rv = uv_timer_start(&d->writers, writers_cb, interval,
+				    interval);
+		assert(rv == 0);
+	}
+
+	d->pool.data = d;
+	rv = uv_timer_init(&d->loop, &d->pool);
+	assert(rv == 0);
+	if (d->config.pool_max > 0 &&
+	    (d->config.pool_idle_timeout > 0 || d->config.pool_min > 0)) {
+		unsigned interval = d->config.pool_idle_timeout / POOL_CHECKS;
+		if (d->config.pool_idle_timeout == 0) {
+			interval = POOL_FILL_INTERVAL;
+		}
+		if (interval == 0) {
+			interval = 1;
+		}
+		rv = uv_timer_start(&d->pool, pool_cb, interval, interval);
+		assert(rv == 0);
+	}
+
+	d->group_commit.data = d;
+	rv = uv_timer_init(&d->loop, &d->group_commit);
+	assert(rv == 0);
+	if (d->config.group_commit_size > 0 &&
+	    d->config.group_commit_window > 0) {
+		unsigned interval = d->config.group_commit_window;
+		rv = uv_timer_start(&d->group_commit, group_commit_cb, interval,
+				    interval);
+		assert(rv == 0);
+	}
+
+	d->slices.data = d;
+	rv = uv_idle_init(&d->loop, &d->slices);
+	assert(rv == 0);
+	d->registry.slices.data = d;
+	d->registry.slices.wakeup = slices_wakeup;
+
+	if (d->config.readers > 0) {
+		rv = readers__init(&d->readers, &d->config, &d->loop,
+				   d->config.readers);
+		if (rv != 0) {
+			snprintf(d->errmsg, RAFT_ERRMSG_BUF_SIZE,
+				 "can't start reader threads");
+			/* Unblock any client of taskReady */
+			sem_post(&d->ready);
+			return rv;
+		}
+		d->registry.readers = &d->readers;
+	}
+
 	d->raft.data = d;
 	rv = raft_start(&d->raft);
 	if (rv != 0) {
 		snprintf(d->errmsg, RAFT_ERRMSG_BUF_SIZE, "raft_start(): %s",
 			 raft_errmsg(&d->raft));
+		if (d->registry.readers != NULL) {
+			readers__close(d->registry.readers);
+			d->registry.readers = NULL;
+		}
 		/* Unblock any client of taskReady */
 		sem_post(&d->ready);
 		return rv;
@@ -493,6 +730,11 @@ static int taskRun(struct dqlite_node *d)
 	rv = uv_run(&d->loop, UV_RUN_DEFAULT);
 	assert(rv == 0);
 
+	if (d->registry.readers != NULL) {
+		readers__close(d->registry.readers);
+		d->registry.readers = NULL;
+	}
+
 	/* Unblock any client of taskReady */
 	rv = sem_post(&d->ready);
 	assert(rv == 0); /* no reason for which posting should fail */
@@ -588,6 +830,12 @@ int dqlite_node_stop(dqlite_node *d)
 	return (uintptr_t)result;
 }
 
+int dqlite_node_get_metrics(dqlite_node *n, dqlite_metrics *metrics)
+{
+	metrics__get(&n->registry.metrics, metrics);
+	return 0;
+}
+
 int dqlite_node_recover(dqlite_node *n,
 			struct dqlite_node_info infos[],
 			int n_info)
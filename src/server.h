@@ -31,6 +31,11 @@ struct dqlite_node
 	struct uv_stream_s *listener;               /* Listening socket */
 	struct uv_async_s stop;                     /* Trigger UV loop stop */
 	struct uv_timer_s startup;                  /* Unblock ready sem */
+	struct uv_timer_s writers;                  /* Expire waiting writers */
+	struct uv_timer_s pool;                     /* Trim idle leader conns */
+	struct uv_timer_s group_commit;             /* Flush grouped commits */
+	struct uv_idle_s slices;                    /* Resume suspended stmts */
+	struct readers readers;                     /* Read-only query threads */
 	char *bind_address;                         /* Listen address */
 	char errmsg[RAFT_ERRMSG_BUF_SIZE];          /* Last error occurred */
 };
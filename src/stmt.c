@@ -1,8 +1,12 @@
+#include <ctype.h>
+#include <string.h>
+
 #include <sqlite3.h>
 
 #include "./lib/assert.h"
 #include "./tuple.h"
 
+#include "metrics.h"
 #include "stmt.h"
 
 /* The maximum number of columns we expect (for bindings or rows) is 255, which
@@ -30,3 +34,169 @@ const char *stmt__hash(struct stmt *stmt)
 }
 
 REGISTRY_METHODS(stmt__registry, stmt);
+
+void stmt__cache_init(struct stmt__cache *c, unsigned capacity)
+{
+	c->capacity = capacity;
+	hash__init(&c->table);
+	QUEUE__INIT(&c->lru);
+	QUEUE__INIT(&c->used);
+	c->n = 0;
+	c->hits = 0;
+	c->misses = 0;
+	c->metrics = NULL;
+}
+
+static void entryDelete(struct stmt__cache *c, struct stmt__cache_entry *e)
+{
+	hash__remove(&c->table, &e->link);
+	QUEUE__REMOVE(&e->queue);
+	sqlite3_finalize(e->stmt);
+	sqlite3_free(e->sql);
+	sqlite3_free(e);
+}
+
+void stmt__cache_invalidate(struct stmt__cache *c)
+{
+	struct stmt__cache_entry *e;
+	while (!QUEUE__IS_EMPTY(&c->lru)) {
+		e = QUEUE__DATA(QUEUE__HEAD(&c->lru), struct stmt__cache_entry,
+				queue);
+		entryDelete(c, e);
+	}
+	c->n = 0;
+}
+
+void stmt__cache_close(struct stmt__cache *c)
+{
+	struct stmt__cache_entry *e;
+	stmt__cache_invalidate(c);
+	while (!QUEUE__IS_EMPTY(&c->used)) {
+		e = QUEUE__DATA(QUEUE__HEAD(&c->used), struct stmt__cache_entry,
+				queue);
+		entryDelete(c, e);
+	}
+	hash__close(&c->table);
+}
+
+/* Whether the given text contains only white space. */
+static bool isBlank(const char *s)
+{
+	for (; *s != '\0'; s++) {
+		if (!isspace((unsigned char)*s)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int stmt__cache_prepare(struct stmt__cache *c,
+			sqlite3 *conn,
+			const char *sql,
+			sqlite3_stmt **stmt,
+			const char **tail)
+{
+	struct stmt__cache_entry *e;
+	struct hash_item *item;
+	uint64_t key;
+	int rv;
+
+	if (c->capacity == 0) {
+		return sqlite3_prepare_v2(conn, sql, -1, stmt, tail);
+	}
+
+	key = hash__string(sql);
+	HASH__FOREACH(item, &c->table, key)
+	{
+		e = HASH__DATA(item, struct stmt__cache_entry, link);
+		if (e->used || strcmp(e->sql, sql) != 0) {
+			continue;
+		}
+		QUEUE__REMOVE(&e->queue);
+		c->n--;
+		e->used = true;
+		QUEUE__PUSH(&c->used, &e->queue);
+		c->hits++;
+		if (c->metrics != NULL) {
+			metrics__stmt_cache(c->metrics, true);
+		}
+		*stmt = e->stmt;
+		*tail = sql + strlen(sql);
+		return SQLITE_OK;
+	}
+
+	c->misses++;
+	if (c->metrics != NULL) {
+		metrics__stmt_cache(c->metrics, false);
+	}
+	rv = sqlite3_prepare_v2(conn, sql, -1, stmt, tail);
+	if (rv != SQLITE_OK || *stmt == NULL || !isBlank(*tail)) {
+		return rv;
+	}
+
+	/* Failing to cache the statement is not an error, it will just get
+	 * finalized when released. */
+	e = sqlite3_malloc(sizeof *e);
+	if (e == NULL) {
+		goto out;
+	}
+	e->sql = sqlite3_malloc((int)strlen(sql) + 1);
+	if (e->sql == NULL) {
+		goto out_after_entry_alloc;
+	}
+	strcpy(e->sql, sql);
+	rv = hash__insert(&c->table, &e->link, key);
+	if (rv != 0) {
+		goto out_after_sql_alloc;
+	}
+	e->stmt = *stmt;
+	e->used = true;
+	QUEUE__PUSH(&c->used, &e->queue);
+	return SQLITE_OK;
+
+out_after_sql_alloc:
+	sqlite3_free(e->sql);
+out_after_entry_alloc:
+	sqlite3_free(e);
+out:
+	return SQLITE_OK;
+}
+
+void stmt__cache_release(struct stmt__cache *c, sqlite3_stmt *stmt)
+{
+	struct stmt__cache_entry *e;
+	queue *head;
+
+	QUEUE__FOREACH(head, &c->used)
+	{
+		e = QUEUE__DATA(head, struct stmt__cache_entry, queue);
+		if (e->stmt != stmt) {
+			continue;
+		}
+		QUEUE__REMOVE(&e->queue);
+		e->used = false;
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+
+		/* SQLite transparently re-prepares statements whose schema has
+		 * changed: if that happened, the other cached statements are
+		 * most probably stale as well. */
+		if (sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_REPREPARE, 1) >
+		    0) {
+			stmt__cache_invalidate(c);
+		}
+
+		QUEUE__PUSH(&c->lru, &e->queue);
+		c->n++;
+		while (c->n > c->capacity) {
+			e = QUEUE__DATA(QUEUE__HEAD(&c->lru),
+					struct stmt__cache_entry, queue);
+			entryDelete(c, e);
+			c->n--;
+		}
+		return;
+	}
+
+	/* Not cached. */
+	sqlite3_finalize(stmt);
+}
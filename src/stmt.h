@@ -45,10 +45,17 @@
 #ifndef DQLITE_STMT_H
 #define DQLITE_STMT_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include <sqlite3.h>
 
+#include "lib/hash.h"
+#include "lib/queue.h"
 #include "lib/registry.h"
 
+struct metrics;
+
 /* Hold state for a single open SQLite database */
 struct stmt
 {
@@ -73,4 +80,55 @@ const char *stmt__hash(struct stmt *stmt);
 
 REGISTRY(stmt__registry, stmt);
 
+/**
+ * Cache of statements prepared from the SQL text of one-shot requests, keyed by
+ * that text and evicted in least-recently-used order.
+ *
+ * Only SQL text consisting of a single statement gets cached. A statement
+ * taken from the cache is in use until it gets released, and it's not handed
+ * out again in the meantime.
+ */
+struct stmt__cache_entry
+{
+	sqlite3_stmt *stmt;    /* Prepared statement */
+	char *sql;             /* SQL text the statement was prepared from */
+	bool used;             /* Whether the statement is in use */
+	struct hash_item link; /* Link in the table of cached statements */
+	queue queue;           /* Link in the LRU or in the used queue */
+};
+
+struct stmt__cache
+{
+	unsigned capacity;       /* Max number of unused statements to keep */
+	struct hash table;       /* Cached statements, keyed by SQL text */
+	queue lru;               /* Unused statements, in LRU order */
+	queue used;              /* Statements currently in use */
+	unsigned n;              /* Number of unused statements */
+	uint64_t hits;           /* Lookups that found a cached statement */
+	uint64_t misses;         /* Lookups that prepared a new statement */
+	struct metrics *metrics; /* Node metrics to update, if any */
+};
+
+/* Initialize an empty cache. A @capacity of 0 disables caching. */
+void stmt__cache_init(struct stmt__cache *c, unsigned capacity);
+
+/* Finalize all statements in the cache, including the ones in use. */
+void stmt__cache_close(struct stmt__cache *c);
+
+/* Return a statement for the first statement in @sql, either cached or freshly
+ * prepared against @conn, like sqlite3_prepare_v2() would. The statement must
+ * be given back with stmt__cache_release() once done. */
+int stmt__cache_prepare(struct stmt__cache *c,
+			sqlite3 *conn,
+			const char *sql,
+			sqlite3_stmt **stmt,
+			const char **tail);
+
+/* Give back a statement returned by stmt__cache_prepare(). Cached statements
+ * are reset and have their bindings cleared, others are finalized. */
+void stmt__cache_release(struct stmt__cache *c, sqlite3_stmt *stmt);
+
+/* Finalize all unused statements, e.g. because the schema has changed. */
+void stmt__cache_invalidate(struct stmt__cache *c);
+
 #endif /* DQLITE_STMT_H */
@@ -4,7 +4,8 @@
 #include "assert.h"
 
 /* True if a tuple decoder or decoder is using parameter format. */
-#define HAS_PARAMS_FORMAT(P) (P->format == TUPLE__PARAMS)
+#define HAS_PARAMS_FORMAT(P) \
+	(P->format == TUPLE__PARAMS || P->format == TUPLE__PARAMS32)
 
 /* True if a tuple decoder or decoder is using row format. */
 #define HAS_ROW_FORMAT(P) (P->format == TUPLE__ROW)
@@ -23,13 +24,18 @@ static size_t calc_header_size(unsigned n, int format)
 			size += sizeof(uint8_t);
 		}
 		size = byte__pad64(size);
-	} else {
-		assert(format == TUPLE__PARAMS);
+	} else if (format == TUPLE__PARAMS) {
 		 /* Include params count for the purpose of calculating possible
 		  * padding, but then exclude it as we have already read it. */
 		size = sizeof(uint8_t) + n * sizeof(uint8_t);
 		size = byte__pad64(size);
 		size -= sizeof(uint8_t); 
+	} else {
+		assert(format == TUPLE__PARAMS32);
+		/* Same as above, with a 32-bit params count. */
+		size = sizeof(uint32_t) + n * sizeof(uint8_t);
+		size = byte__pad64(size);
+		size -= sizeof(uint32_t);
 	}
 
 	return size;
@@ -37,24 +43,34 @@ static size_t calc_header_size(unsigned n, int format)
 
 int tuple_decoder__init(struct tuple_decoder *d,
 			unsigned n,
+			int format,
 			struct cursor *cursor)
 {
 	size_t header_size;
 	int rc;
 
-	d->format = n == 0 ? TUPLE__PARAMS : TUPLE__ROW;
+	assert(format == TUPLE__ROW || n == 0);
+
+	d->format = format;
 
 	/* When using row format the number of values is the given one,
 	 * otherwise we have to read it from the header. */
 	if (HAS_ROW_FORMAT(d)) {
 		d->n = n;
-	} else {
+	} else if (format == TUPLE__PARAMS) {
 		uint8_t byte;
 		rc = uint8__decode(cursor, &byte);
 		if (rc != 0) {
 			return rc;
 		}
 		d->n = byte;
+	} else {
+		uint32_t word;
+		rc = uint32__decode(cursor, &word);
+		if (rc != 0) {
+			return rc;
+		}
+		d->n = word;
 	}
 
 	d->i = 0;
@@ -159,14 +175,21 @@ int tuple_encoder__init(struct tuple_encoder *e,
 	e->buffer = buffer;
 	e->i = 0;
 
-	/* With params format we need to fill the first byte of the header with
-	 * the params count. */
-	if (HAS_PARAMS_FORMAT(e)) {
+	/* With params format we need to fill the first byte (or 32-bit word)
+	 * of the header with the params count. */
+	if (format == TUPLE__PARAMS) {
 		uint8_t *header = buffer__advance(buffer, 1);
 		if (header == NULL) {
 			return DQLITE_NOMEM;
 		}
 		header[0] = n;
+	} else if (format == TUPLE__PARAMS32) {
+		void *header = buffer__advance(buffer, sizeof(uint32_t));
+		uint32_t count = n;
+		if (header == NULL) {
+			return DQLITE_NOMEM;
+		}
+		uint32__encode(&count, &header);
 	}
 
 	e->header = buffer__offset(buffer);
@@ -21,6 +21,15 @@
  * parameters followed by a sequence of zero bits, until word boundary is
  * reached.
  *
+ * Since the 8-bit count limits the tuple to 255 parameters, there's also a wide
+ * variant of the parameters format, used only by EXEC_BATCH requests (EXEC and
+ * QUERY keep the 8-bit count, so existing clients don't break). Its header is
+ * the same except that the number of values is held by a 32-bit word:
+ *
+ * 32 bits: Number of values in the tuple.
+ *  8 bits: Type code of the 1st value of the tuple.
+ *  ...
+ *
  * For a tuple of row values the format of the header is:
  *
  *  4 bits: Type code of the 1st value of the tuple.
@@ -49,7 +58,7 @@
 
 #include "protocol.h"
 
-enum { TUPLE__ROW = 1, TUPLE__PARAMS };
+enum { TUPLE__ROW = 1, TUPLE__PARAMS, TUPLE__PARAMS32 };
 
 /**
  * Hold a single database value.
@@ -85,20 +94,22 @@ struct tuple_decoder
  * Initialize the state of the decoder, before starting to decode a new
  * tuple.
  *
- * If @n is zero, it means that the tuple is a sequence of statement
- * parameters. In that case the d->n field will be read from the first byte of
- * @cursor.
+ * If @format is #TUPLE__ROW, @n is the number of values in the tuple. Otherwise
+ * the tuple is a sequence of statement parameters, @n must be zero and the d->n
+ * field will be read from the first byte (or 32-bit word, for
+ * #TUPLE__PARAMS32) of @cursor.
  */
 int tuple_decoder__init(struct tuple_decoder *d,
 			unsigned n,
+			int format,
 			struct cursor *cursor);
 
 /**
  * Return the number of values in the tuple being decoded.
  *
  * In row format this will be the same @n passed to the constructor. In
- * parameters format this is the value contained in the first byte of the tuple
- * header.
+ * parameters format this is the value contained in the first byte (or 32-bit
+ * word) of the tuple header.
  */
 unsigned tuple_decoder__n(struct tuple_decoder *d);
 
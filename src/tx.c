@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <string.h>
 
 #include <sqlite3.h>
 
@@ -13,6 +14,7 @@ void tx__init(struct tx *tx, unsigned long long id, sqlite3 *conn)
 	tx->is_zombie = false;
 	tx->state = TX__PENDING;
 	tx->dry_run = tx__is_leader(tx);
+	memset(&tx->timing, 0, sizeof tx->timing);
 }
 
 void tx__close(struct tx *tx)
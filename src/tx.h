@@ -12,13 +12,28 @@ enum { TX__PENDING = 0, /* Initial state right after creation */
        TX__UNDONE,      /* After an undo command has been executed. */
        TX__DOOMED       /* The transaction has errored. */
 };
+
+/* Time spent by a leader transaction in each stage of the replication
+ * pipeline, in microseconds. Durations are summed over all the Frames
+ * commands of the transaction. */
+struct tx_timing
+{
+	unsigned long long begin;  /* When the begin hook fired */
+	unsigned long long submit; /* When the last command was encoded */
+	unsigned long long encode; /* Encoding commands */
+	unsigned long long raft;   /* From encoding to FSM apply */
+	unsigned long long fsm;    /* Applying commands to the FSM */
+	unsigned n;                /* Number of Frames commands applied */
+};
+
 struct tx
 {
-	size_t id;      /* Transaction ID. */
-	sqlite3 *conn;  /* Underlying SQLite connection */
-	bool is_zombie; /* Whether this is a zombie transaction */
-	bool dry_run;   /* Don't invoke actual SQLite hooks. */
-	int state;      /* Current state */
+	size_t id;               /* Transaction ID. */
+	sqlite3 *conn;           /* Underlying SQLite connection */
+	bool is_zombie;          /* Whether this is a zombie transaction */
+	bool dry_run;            /* Don't invoke actual SQLite hooks. */
+	int state;               /* Current state */
+	struct tx_timing timing; /* Stage durations, for leader transactions */
 };
 
 void tx__init(struct tx *tx, unsigned long long id, sqlite3 *conn);
@@ -1,5 +1,6 @@
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include <errno.h>
 #include <pthread.h>
 
@@ -10,6 +11,8 @@
 #include "../include/dqlite.h"
 
 #include "lib/assert.h"
+#include "lib/hash.h"
+#include "lib/queue.h"
 
 #include "format.h"
 #include "vfs.h"
@@ -17,74 +20,405 @@
 /* Maximum pathname length supported by this VFS. */
 #define VFS__MAX_PATHNAME 512
 
-/* Maximum number of files this VFS can create. */
-#define VFS__MAX_FILES 64
+/* Size of a CPU cache line. Page buffers handed out by the slab allocator are
+ * aligned to this boundary. */
+#define VFS__CACHE_LINE 64
 
-/* Hold content for a single page or frame in a volatile file. */
+/* Target size of a single slab. Each slab holds as many pages as fit in this
+ * size, and at least one. */
+#define VFS__SLAB_SIZE (256 * 1024)
+
+/* Number of supported page sizes, i.e. all powers of two between
+ * FORMAT__PAGE_SIZE_MIN and FORMAT__PAGE_SIZE_MAX. */
+#define VFS__N_PAGE_SIZES 8
+
+/* Round the given size up to a multiple of the cache line size. */
+#define VFS__CACHE_ALIGN(SIZE) \
+	(((SIZE) + VFS__CACHE_LINE - 1) & ~((size_t)VFS__CACHE_LINE - 1))
+
+/* Hold content for a single page or frame in a volatile file.
+ *
+ * Pages are carved out of slabs, and each page object lives in a single block
+ * which is laid out as follows:
+ *
+ *   [struct page][padding][frame header][page buffer][padding]
+ *
+ * The page buffer starts at a cache line boundary and the WAL frame header
+ * (only used by WAL pages) immediately precedes it, so a whole WAL frame is
+ * contiguous in memory.
+ *
+ * Pages are reference counted: the page directory of the file holding the
+ * page owns one reference, and pointers to the page buffer handed out via
+ * xFetch or included in shallow snapshots own one reference each. A page is
+ * returned to its slab only when its last reference is released.
+ *
+ * A page with more than one reference is shared, and is copied on write: the
+ * file gets a fresh private copy of the page, while other holders keep seeing
+ * the old content.
+ *
+ * Fetched pages are released by the threads of the connections that fetched
+ * them, without holding the lock of their file, so reference counts are
+ * updated atomically.
+ *
+ * Pages restored by vfsRestore() from a memory block adopted by the VFS are
+ * not allocated from a slab: their buffers point directly into the adopted
+ * block and their page objects are allocated together in a single array. */
 struct page
 {
-	void *buf; /* Content of the page. */
-	void *hdr; /* Page header (only for WAL pages). */
+	void *buf;         /* Content of the page. */
+	void *hdr;         /* Page header (only for WAL pages). */
+	struct slab *slab; /* Slab this page was allocated from, if any. */
+	union {
+		struct page *next;         /* Next free page in the slab. */
+		struct adoption *adoption; /* Adoption this page belongs to. */
+	};
+	unsigned refs; /* Number of references to this page. */
 };
 
+/* Offset of the page buffer from the start of a page block. */
+#define VFS__PAGE_BUF_OFFSET \
+	VFS__CACHE_ALIGN(sizeof(struct page) + FORMAT__WAL_FRAME_HDR_SIZE)
+
+/* Allocator handing out pages of a single page size. Memory is obtained in
+ * slabs of several pages at once and recycled through per-slab free lists. */
+struct slab_cache
+{
+	unsigned page_size;    /* Size of the page buffers of this cache. */
+	size_t block_size;     /* Size of a single page block. */
+	unsigned n_blocks;     /* Number of page blocks in each slab. */
+	unsigned n_slabs;      /* Number of slabs currently allocated. */
+	unsigned n_empty;      /* Allocated slabs with no page in use. */
+	queue partial;         /* Slabs with at least one free page. */
+	pthread_mutex_t mutex; /* Pages can be released by any thread. */
+};
+
+/* A contiguous chunk of memory holding several page blocks. */
+struct slab
+{
+	struct slab_cache *cache; /* Cache this slab belongs to. */
+	struct page *free;        /* Free list of unused pages. */
+	unsigned n_used;          /* Number of pages currently in use. */
+	queue queue;              /* Link in the cache's partial list. */
+};
+
+/* Memory block whose ownership was transferred to the VFS. */
+struct vfsBacking
+{
+	void *base;    /* Memory block, allocated with raft_malloc(). */
+	unsigned refs; /* The handle itself plus one for each adoption. */
+};
+
+/* Page objects of the pages of a file that point into a backing block. */
+struct adoption
+{
+	struct vfsBacking *backing; /* Block holding the page buffers. */
+	unsigned n_pages;           /* Number of pages added so far. */
+	unsigned refs;              /* Pages in use, plus one for the creator. */
+	struct page pages[];        /* Adopted pages. */
+};
+
+static void backing_unref(struct vfsBacking *b)
+{
+	assert(b->refs > 0);
+	b->refs--;
+	if (b->refs == 0) {
+		raft_free(b->base);
+		sqlite3_free(b);
+	}
+}
+
+/* Create an adoption for at most @n pages from the given block. */
+static struct adoption *adoption_create(struct vfsBacking *b, int n)
+{
+	struct adoption *a;
+
+	a = sqlite3_malloc64(sizeof *a + (sizeof *a->pages) * (size_t)n);
+	if (a == NULL) {
+		return NULL;
+	}
+	a->backing = b;
+	a->n_pages = 0;
+	a->refs = 1;
+	b->refs++;
+
+	return a;
+}
+
+/* Add a page pointing to the given frame header (only for WAL pages) and
+ * page buffer to an adoption. */
+static struct page *adoption_page(struct adoption *a, void *hdr, void *buf)
+{
+	struct page *p = &a->pages[a->n_pages];
+
+	p->buf = buf;
+	p->hdr = hdr;
+	p->slab = NULL;
+	p->adoption = a;
+	p->refs = 1;
+	a->n_pages++;
+	a->refs++;
+
+	return p;
+}
+
+static void adoption_unref(struct adoption *a)
+{
+	assert(a->refs > 0);
+	a->refs--;
+	if (a->refs == 0) {
+		backing_unref(a->backing);
+		sqlite3_free(a);
+	}
+}
+
+/* Initialize a slab cache for pages of the given size. */
+static void slab_cache_init(struct slab_cache *c, unsigned page_size)
+{
+	c->page_size = page_size;
+	c->block_size = VFS__CACHE_ALIGN(VFS__PAGE_BUF_OFFSET + page_size);
+	c->n_blocks = VFS__SLAB_SIZE / c->block_size;
+	if (c->n_blocks == 0) {
+		c->n_blocks = 1;
+	}
+	c->n_slabs = 0;
+	c->n_empty = 0;
+	QUEUE__INIT(&c->partial);
+	pthread_mutex_init(&c->mutex, NULL);
+}
+
+/* Release all slabs of a cache. All pages must have been destroyed. */
+static void slab_cache_close(struct slab_cache *c)
+{
+	struct slab *s;
+	queue *head;
+
+	while (!QUEUE__IS_EMPTY(&c->partial)) {
+		head = QUEUE__HEAD(&c->partial);
+		s = QUEUE__DATA(head, struct slab, queue);
+		assert(s->n_used == 0);
+		QUEUE__REMOVE(head);
+		sqlite3_free(s);
+		c->n_slabs--;
+	}
+
+	assert(c->n_slabs == 0);
+	pthread_mutex_destroy(&c->mutex);
+}
+
+/* Return the first page block of a slab. */
+static uint8_t *slab_blocks(struct slab *s)
+{
+	uintptr_t start = (uintptr_t)(s + 1);
+	return (uint8_t *)VFS__CACHE_ALIGN(start);
+}
+
+/* Allocate a new slab and thread all its page blocks onto its free list. */
+static struct slab *slab_create(struct slab_cache *c)
+{
+	struct slab *s;
+	uint8_t *block;
+	unsigned i;
+
+	s = sqlite3_malloc(sizeof *s + VFS__CACHE_LINE +
+			   c->n_blocks * c->block_size);
+	if (s == NULL) {
+		return NULL;
+	}
+
+	s->cache = c;
+	s->free = NULL;
+	s->n_used = 0;
+
+	/* Push the blocks in reverse order, so pages are handed out in
+	 * ascending memory order. */
+	block = slab_blocks(s) + c->n_blocks * c->block_size;
+	for (i = 0; i < c->n_blocks; i++) {
+		struct page *p;
+		block -= c->block_size;
+		p = (struct page *)block;
+		p->buf = block + VFS__PAGE_BUF_OFFSET;
+		p->slab = s;
+		p->next = s->free;
+		s->free = p;
+	}
+
+	QUEUE__PUSH(&c->partial, &s->queue);
+	c->n_slabs++;
+	c->n_empty++;
+
+	return s;
+}
+
+/* Return the slab cache to use for the given page size. */
+static struct slab_cache *slab_cache_lookup(struct slab_cache *caches,
+					    unsigned page_size)
+{
+	unsigned i;
+
+	assert(page_size >= FORMAT__PAGE_SIZE_MIN &&
+	       page_size <= FORMAT__PAGE_SIZE_MAX);
+	assert(((page_size - 1) & page_size) == 0);
+
+	i = __builtin_ctz(page_size) - __builtin_ctz(FORMAT__PAGE_SIZE_MIN);
+	assert(i < VFS__N_PAGE_SIZES);
+
+	return &caches[i];
+}
+
 /* Create a new volatile page for a database or WAL file.
  *
- * If it's a page for a WAL file, the WAL header will also be allocated. */
-static struct page *page_create(int size, int wal)
+ * If it's a page for a WAL file, the frame header is set as well. */
+static struct page *page_create(struct slab_cache *c, int wal)
 {
+	struct slab *s;
 	struct page *p;
 
-	assert(size > 0);
 	assert(wal == 0 || wal == 1);
 
-	p = sqlite3_malloc(sizeof *p);
-	if (p == NULL) {
-		goto oom;
+	pthread_mutex_lock(&c->mutex);
+
+	if (QUEUE__IS_EMPTY(&c->partial)) {
+		s = slab_create(c);
+		if (s == NULL) {
+			pthread_mutex_unlock(&c->mutex);
+			return NULL;
+		}
+	} else {
+		s = QUEUE__DATA(QUEUE__HEAD(&c->partial), struct slab, queue);
 	}
 
-	p->buf = sqlite3_malloc(size);
-	if (p->buf == NULL) {
-		goto oom_after_page_alloc;
+	assert(s->free != NULL);
+
+	p = s->free;
+	s->free = p->next;
+	p->next = NULL;
+
+	if (s->n_used == 0) {
+		assert(c->n_empty > 0);
+		c->n_empty--;
 	}
-	memset(p->buf, 0, size);
+	s->n_used++;
+
+	/* If the slab is now full, it's not eligible for allocations
+	 * anymore. */
+	if (s->free == NULL) {
+		QUEUE__REMOVE(&s->queue);
+	}
+
+	pthread_mutex_unlock(&c->mutex);
+
+	memset(p->buf, 0, c->page_size);
+	p->refs = 1;
 
 	if (wal) {
-		p->hdr = sqlite3_malloc(FORMAT__WAL_FRAME_HDR_SIZE);
-		if (p->hdr == NULL) {
-			goto oom_after_buf_malloc;
-		}
+		p->hdr = (uint8_t *)p->buf - FORMAT__WAL_FRAME_HDR_SIZE;
 		memset(p->hdr, 0, FORMAT__WAL_FRAME_HDR_SIZE);
 	} else {
 		p->hdr = NULL;
 	}
 
 	return p;
-
-oom_after_buf_malloc:
-	sqlite3_free(p->buf);
-
-oom_after_page_alloc:
-	sqlite3_free(p);
-
-oom:
-	return NULL;
 }
 
-/* Destroy a volatile page */
+/* Destroy a volatile page, returning it to its slab. */
 static void page_destroy(struct page *p)
 {
+	struct slab *s;
+	struct slab_cache *c;
+
 	assert(p != NULL);
 	assert(p->buf != NULL);
+	assert(p->refs == 0);
+
+	/* Adopted pages go away along with their adoption. */
+	if (p->slab == NULL) {
+		adoption_unref(p->adoption);
+		return;
+	}
+
+	s = p->slab;
+	c = s->cache;
+
+	pthread_mutex_lock(&c->mutex);
+
+	assert(s->n_used > 0);
+
+	/* If the slab was full, it becomes eligible for allocations again. */
+	if (s->free == NULL) {
+		QUEUE__PUSH(&c->partial, &s->queue);
+	}
 
-	sqlite3_free(p->buf);
+	p->next = s->free;
+	s->free = p;
+	s->n_used--;
 
-	if (p->hdr != NULL) {
-		sqlite3_free(p->hdr);
+	if (s->n_used > 0) {
+		goto out;
+	}
+
+	/* Keep at most one empty slab around, to avoid thrashing the allocator
+	 * when a file repeatedly grows and shrinks around a slab boundary
+	 * (e.g. the WAL being reset after a checkpoint). */
+	if (c->n_empty == 0) {
+		c->n_empty++;
+		goto out;
 	}
 
-	sqlite3_free(p);
+	QUEUE__REMOVE(&s->queue);
+	sqlite3_free(s);
+	c->n_slabs--;
+
+out:
+	pthread_mutex_unlock(&c->mutex);
 }
 
+/* Return the page whose buffer is the given one. */
+static struct page *page_from_buf(void *buf)
+{
+	struct page *p;
+	p = (struct page *)((uint8_t *)buf - VFS__PAGE_BUF_OFFSET);
+	assert(p->buf == buf);
+	return p;
+}
+
+/* Acquire a new reference to a page. */
+static void page_ref(struct page *p)
+{
+	unsigned refs = __atomic_fetch_add(&p->refs, 1, __ATOMIC_RELAXED);
+	assert(refs > 0);
+	(void)refs;
+}
+
+/* Release a reference to a page, destroying it if it was the last one. */
+static void page_unref(struct page *p)
+{
+	unsigned refs = __atomic_fetch_sub(&p->refs, 1, __ATOMIC_ACQ_REL);
+	assert(refs > 0);
+	if (refs == 1) {
+		page_destroy(p);
+	}
+}
+
+/* Return 1 if the page has other holders besides its file. */
+static int page_is_shared(struct page *p)
+{
+	return __atomic_load_n(&p->refs, __ATOMIC_ACQUIRE) > 1;
+}
+
+/* Number of page pointers in a single chunk of a page directory. Must be a
+ * power of two. */
+#define VFS__CHUNK_SHIFT 9
+#define VFS__CHUNK_PAGES (1 << VFS__CHUNK_SHIFT)
+#define VFS__CHUNK_MASK (VFS__CHUNK_PAGES - 1)
+
+/* Return the chunk and slot holding the given page number in a page
+ * directory. */
+#define VFS__CHUNK_INDEX(PGNO) (((PGNO)-1) >> VFS__CHUNK_SHIFT)
+#define VFS__CHUNK_SLOT(PGNO) (((PGNO)-1) & VFS__CHUNK_MASK)
+
+/* Return the number of chunks needed to hold the given number of pages. */
+#define VFS__CHUNKS_FOR(N) (((N) + VFS__CHUNK_PAGES - 1) >> VFS__CHUNK_SHIFT)
+
 /* Hold content for a shared memory mapping. */
 struct shm
 {
@@ -148,21 +482,32 @@ struct content
 {
 	char *filename;         /* Name of the file. */
 	void *hdr;              /* File header (for WAL files). */
-	struct page **pages;    /* All pages in the file. */
+	struct page ***chunks;  /* Page directory, split in fixed-size chunks. */
+	int chunks_cap;         /* Number of slots in the chunks array. */
 	int pages_len;          /* Number of pages in the file. */
 	unsigned int page_size; /* Page size of each page. */
+	int tx_last_frame;      /* Last frame written by the WAL writer. */
+	uint64_t *dirty;        /* Pages written since the last snapshot. */
+	int dirty_len;          /* Number of pages tracked by the bitmap. */
 
 	int refcount; /* Number of open FDs referencing this file. */
 	int type;     /* Content type (either main db or WAL). */
 
-	struct shm *shm;       /* Shared memory (for db files). */
-	struct content *wal;   /* WAL file content (for db files). */
-	struct logger *logger; /* For error messages. */
+	struct shm *shm;            /* Shared memory (for db files). */
+	struct content *wal;        /* WAL file content (for db files). */
+	struct image *image;        /* Last snapshot image (for db files). */
+	struct slab_cache *caches;  /* Page allocators, one per page size. */
+	struct logger *logger;      /* For error messages. */
+	struct hash_item link;      /* Link in the root's file table. */
+
+	pthread_rwlock_t rwlock; /* Lock of the file (and of its WAL, if any) */
+	pthread_rwlock_t *lock;  /* Lock to hold, the database's one for WALs */
 };
 
 /* Create the content structure for a new volatile file. */
 static struct content *content_create(const char *name,
 				      int type,
+				      struct slab_cache *caches,
 				      struct logger *logger)
 {
 	struct content *c;
@@ -176,6 +521,7 @@ static struct content *content_create(const char *name,
 		goto oom;
 	}
 
+	c->caches = caches;
 	c->logger = logger;
 
 	// Copy the name, since when called from Go, the pointer will be freed.
@@ -196,13 +542,21 @@ static struct content *content_create(const char *name,
 		c->hdr = NULL;
 	}
 
-	c->pages = 0;
+	c->chunks = NULL;
+	c->chunks_cap = 0;
 	c->pages_len = 0;
 	c->page_size = 0;
+	c->tx_last_frame = 0;
+	c->dirty = NULL;
+	c->dirty_len = 0;
 	c->refcount = 0;
 	c->type = type;
 	c->shm = NULL;
 	c->wal = NULL;
+	c->image = NULL;
+
+	pthread_rwlock_init(&c->rwlock, NULL);
+	c->lock = &c->rwlock;
 
 	return c;
 
@@ -216,12 +570,44 @@ oom:
 	return NULL;
 }
 
-/* Destroy the content of a volatile file. */
-static void content_destroy(struct content *c)
+/* Return a pointer to the directory slot holding the given page. */
+static struct page **content_page_slot(struct content *c, int pgno)
+{
+	assert(pgno > 0 && pgno <= c->pages_len);
+	return &c->chunks[VFS__CHUNK_INDEX(pgno)][VFS__CHUNK_SLOT(pgno)];
+}
+
+/* Destroy all pages beyond the given number of pages, and release the chunks
+ * of the page directory that are not needed anymore. */
+static void content_pages_release(struct content *c, int pages_len)
 {
+	int n_chunks = VFS__CHUNKS_FOR(pages_len);
 	int i;
-	struct page *page;
 
+	assert(pages_len <= c->pages_len);
+
+	for (i = pages_len + 1; i <= c->pages_len; i++) {
+		page_unref(*content_page_slot(c, i));
+	}
+
+	for (i = n_chunks; i < VFS__CHUNKS_FOR(c->pages_len); i++) {
+		sqlite3_free(c->chunks[i]);
+	}
+
+	if (pages_len == 0) {
+		sqlite3_free(c->chunks);
+		c->chunks = NULL;
+		c->chunks_cap = 0;
+	}
+
+	c->pages_len = pages_len;
+}
+
+static void image_unref(struct image *i);
+
+/* Destroy the content of a volatile file. */
+static void content_destroy(struct content *c)
+{
 	assert(c != NULL);
 	assert(c->filename != NULL);
 
@@ -236,16 +622,13 @@ static void content_destroy(struct content *c)
 		assert(c->hdr == NULL);
 	}
 
-	/* Free all pages. */
-	for (i = 0; i < c->pages_len; i++) {
-		page = *(c->pages + i);
-		assert(page != NULL);
-		page_destroy(page);
-	}
+	/* Free all pages and the page directory. */
+	content_pages_release(c, 0);
+	sqlite3_free(c->dirty);
 
-	/* Free the page array. */
-	if (c->pages != NULL) {
-		sqlite3_free(c->pages);
+	/* Drop the snapshot image, unless a snapshot is still using it. */
+	if (c->image != NULL) {
+		image_unref(c->image);
 	}
 
 	/* Free the SHM mappping */
@@ -254,6 +637,8 @@ static void content_destroy(struct content *c)
 		shm_destroy(c->shm);
 	}
 
+	pthread_rwlock_destroy(&c->rwlock);
+
 	sqlite3_free(c);
 }
 
@@ -263,17 +648,57 @@ static int content_is_empty(struct content *c)
 	assert(c != NULL);
 
 	if (c->pages_len == 0) {
-		assert(c->pages == NULL);
+		assert(c->chunks == NULL);
 		return 1;
 	}
 
 	// If it was written, a page list and a page size must have been set.
-	assert(c->pages != NULL && c->pages_len > 0 && c->page_size > 0);
+	assert(c->chunks != NULL && c->pages_len > 0 && c->page_size > 0);
 
 	return 0;
 }
 
-// Get a page from this file, possibly creating a new one.
+/* Number of words needed by a dirty bitmap tracking the given number of
+ * pages. */
+#define VFS__DIRTY_WORDS(N) (((N) + 63) / 64)
+
+/* Mark a page as written since the last snapshot. */
+static void content_page_dirty(struct content *c, int pgno)
+{
+	/* Pages beyond the tracked ones are always considered dirty. */
+	if (pgno > c->dirty_len) {
+		return;
+	}
+	c->dirty[(pgno - 1) / 64] |= (uint64_t)1 << ((pgno - 1) % 64);
+}
+
+/* Replace a shared page of this file with a private copy, so it can be
+ * modified without affecting the other holders of the page. */
+static int content_page_unshare(struct content *c, int pgno, struct page **page)
+{
+	struct page *shared = *page;
+	struct page *copy;
+
+	copy = page_create(slab_cache_lookup(c->caches, c->page_size),
+			   shared->hdr != NULL);
+	if (copy == NULL) {
+		return SQLITE_NOMEM;
+	}
+
+	memcpy(copy->buf, shared->buf, c->page_size);
+	if (shared->hdr != NULL) {
+		memcpy(copy->hdr, shared->hdr, FORMAT__WAL_FRAME_HDR_SIZE);
+	}
+
+	*content_page_slot(c, pgno) = copy;
+	page_unref(shared);
+
+	*page = copy;
+
+	return SQLITE_OK;
+}
+
+// Get a page from this file for writing, possibly creating a new one.
 static int content_page_get(struct content *c, int pgno, struct page **page)
 {
 	int rc;
@@ -292,9 +717,10 @@ static int content_page_get(struct content *c, int pgno, struct page **page)
 	}
 
 	if (pgno == (c->pages_len + 1)) {
-		/* Create a new page, grow the page array, and append the
-		 * new page to it. */
-		struct page **pages; /* New page array. */
+		/* Create a new page and append it to the page directory,
+		 * possibly adding a new chunk to it. */
+		int index = VFS__CHUNK_INDEX(pgno);
+		struct page **chunk;
 
 		/* We assume that the page size has been set, either by
 		 * intercepting the first main database file write, or by
@@ -303,34 +729,61 @@ static int content_page_get(struct content *c, int pgno, struct page **page)
 		 * vfs__write(). */
 		assert(c->page_size > 0);
 
-		*page = page_create(c->page_size, is_wal);
+		*page = page_create(
+		    slab_cache_lookup(c->caches, c->page_size), is_wal);
 		if (*page == NULL) {
 			rc = SQLITE_NOMEM;
 			goto err;
 		}
 
-		pages = sqlite3_realloc(c->pages, (sizeof *pages) * pgno);
-		if (pages == NULL) {
-			rc = SQLITE_NOMEM;
-			goto err_after_page_create;
-		}
+		if (VFS__CHUNK_SLOT(pgno) == 0) {
+			/* The last chunk is full, grow the directory if
+			 * needed, doubling its capacity. */
+			if (index == c->chunks_cap) {
+				struct page ***chunks;
+				int cap = c->chunks_cap == 0 ? 1
+							      : c->chunks_cap * 2;
+				chunks = sqlite3_realloc(c->chunks,
+							 (sizeof *chunks) * cap);
+				if (chunks == NULL) {
+					rc = SQLITE_NOMEM;
+					goto err_after_page_create;
+				}
+				c->chunks = chunks;
+				c->chunks_cap = cap;
+			}
 
-		/* Append the new page to the new page array. */
-		*(pages + pgno - 1) = *page;
+			chunk = sqlite3_malloc((sizeof *chunk) *
+					       VFS__CHUNK_PAGES);
+			if (chunk == NULL) {
+				rc = SQLITE_NOMEM;
+				goto err_after_page_create;
+			}
+			c->chunks[index] = chunk;
+		}
 
-		/* Update the page array. */
-		c->pages = pages;
+		/* Append the new page to the directory. */
 		c->pages_len = pgno;
+		*content_page_slot(c, pgno) = *page;
 	} else {
-		/* Return the existing page. */
-		assert(c->pages != NULL);
-		*page = *(c->pages + pgno - 1);
+		/* Return the existing page, making sure it's not shared since
+		 * the caller is going to modify it. */
+		assert(c->chunks != NULL);
+		*page = *content_page_slot(c, pgno);
+		if (page_is_shared(*page)) {
+			rc = content_page_unshare(c, pgno, page);
+			if (rc != SQLITE_OK) {
+				goto err;
+			}
+		}
 	}
 
+	content_page_dirty(c, pgno);
+
 	return SQLITE_OK;
 
 err_after_page_create:
-	page_destroy(*page);
+	page_unref(*page);
 
 err:
 	*page = NULL;
@@ -351,7 +804,7 @@ static struct page *content_page_lookup(struct content *c, int pgno)
 		return NULL;
 	}
 
-	page = *(c->pages + pgno - 1);
+	page = *content_page_slot(c, pgno);
 
 	assert(page != NULL);
 
@@ -365,23 +818,17 @@ static struct page *content_page_lookup(struct content *c, int pgno)
 /* Truncate the file to be exactly the given number of pages. */
 static void content_truncate(struct content *content, int pages_len)
 {
-	struct page **cursor;
-	int i;
-
 	/* We expect callers to only invoke us if some actual content has been
 	 * written already. */
 	assert(content->pages_len > 0);
 
 	/* Truncate should always shrink a file. */
 	assert(pages_len <= content->pages_len);
-	assert(content->pages != NULL);
+	assert(content->chunks != NULL);
 
-	/* Destroy pages beyond pages_len. */
-	cursor = content->pages + pages_len;
-	for (i = 0; i < (content->pages_len - pages_len); i++) {
-		page_destroy(*cursor);
-		cursor++;
-	}
+	/* Destroy pages beyond pages_len, along with the chunks holding
+	 * them. */
+	content_pages_release(content, pages_len);
 
 	/* Reset the file header (for WAL files). */
 	if (content->type == FORMAT__WAL) {
@@ -392,15 +839,304 @@ static void content_truncate(struct content *content, int pages_len)
 	} else {
 		assert(content->hdr == NULL);
 	}
+}
 
-	/* Shrink the page array, possibly to 0.
-	 *
-	 * TODO: in principle realloc could fail also when shrinking. */
-	content->pages = sqlite3_realloc(
-	    content->pages, (sizeof *(content->pages)) * pages_len);
+/* Replace the content of a file with the given image of it, copying its pages
+ * or, if @backing is not NULL, pointing them directly into the image, which
+ * must then be part of the backing block. */
+static int content_restore(struct content *c,
+			   const uint8_t *buf,
+			   size_t size,
+			   struct vfsBacking *backing)
+{
+	struct adoption *adoption = NULL;
+	struct page *page;
+	unsigned page_size;
+	size_t frame_size;
+	size_t hdr_size;
+	int is_wal = c->type == FORMAT__WAL;
+	int n;
+	int pgno;
+	int rc;
+
+	/* Drop the current content. Since every page changes, stop tracking
+	 * writes for the next snapshot. */
+	content_pages_release(c, 0);
+	if (is_wal) {
+		memset(c->hdr, 0, FORMAT__WAL_HDR_SIZE);
+	}
+	c->dirty_len = 0;
+	c->tx_last_frame = 0;
+
+	if (size == 0) {
+		return SQLITE_OK;
+	}
+
+	if (is_wal) {
+		if (size < FORMAT__WAL_HDR_SIZE) {
+			return SQLITE_CORRUPT;
+		}
+		rc = format__get_page_size(FORMAT__WAL, buf, &page_size);
+		hdr_size = FORMAT__WAL_FRAME_HDR_SIZE;
+	} else {
+		if (size < FORMAT__DB_HDR_SIZE) {
+			return SQLITE_CORRUPT;
+		}
+		rc = format__get_page_size(FORMAT__DB, buf, &page_size);
+		hdr_size = 0;
+	}
+	if (rc != SQLITE_OK) {
+		return SQLITE_CORRUPT;
+	}
+	if (c->page_size > 0 && c->page_size != page_size) {
+		return SQLITE_CORRUPT;
+	}
+	if (is_wal) {
+		memcpy(c->hdr, buf, FORMAT__WAL_HDR_SIZE);
+		buf += FORMAT__WAL_HDR_SIZE;
+		size -= FORMAT__WAL_HDR_SIZE;
+	}
+	frame_size = hdr_size + page_size;
+	if ((size % frame_size) != 0) {
+		return SQLITE_CORRUPT;
+	}
+	n = size / frame_size;
+	c->page_size = page_size;
+
+	/* Pre-size the page directory. */
+	c->chunks = sqlite3_malloc((sizeof *c->chunks) * VFS__CHUNKS_FOR(n));
+	if (c->chunks == NULL && n > 0) {
+		return SQLITE_NOMEM;
+	}
+	c->chunks_cap = VFS__CHUNKS_FOR(n);
+
+	if (backing != NULL) {
+		adoption = adoption_create(backing, n);
+		if (adoption == NULL) {
+			rc = SQLITE_NOMEM;
+			goto err;
+		}
+	}
+
+	for (pgno = 1; pgno <= n; pgno++) {
+		const uint8_t *frame = buf + (size_t)(pgno - 1) * frame_size;
+
+		if (adoption != NULL) {
+			page = adoption_page(adoption,
+					     is_wal ? (void *)frame : NULL,
+					     (void *)(frame + hdr_size));
+		} else {
+			page = page_create(
+			    slab_cache_lookup(c->caches, page_size), is_wal);
+			if (page == NULL) {
+				rc = SQLITE_NOMEM;
+				goto err;
+			}
+			memcpy(page->buf, frame + hdr_size, page_size);
+			if (is_wal) {
+				memcpy(page->hdr, frame, hdr_size);
+			}
+		}
+
+		if (VFS__CHUNK_SLOT(pgno) == 0) {
+			struct page **chunk;
+			chunk = sqlite3_malloc((sizeof *chunk) *
+					       VFS__CHUNK_PAGES);
+			if (chunk == NULL) {
+				page_unref(page);
+				rc = SQLITE_NOMEM;
+				goto err;
+			}
+			c->chunks[VFS__CHUNK_INDEX(pgno)] = chunk;
+		}
+
+		c->pages_len = pgno;
+		*content_page_slot(c, pgno) = page;
+	}
+
+	if (adoption != NULL) {
+		adoption_unref(adoption);
+	}
+
+	return SQLITE_OK;
+
+err:
+	content_pages_release(c, 0);
+	if (adoption != NULL) {
+		adoption_unref(adoption);
+	}
+	if (is_wal) {
+		memset(c->hdr, 0, FORMAT__WAL_HDR_SIZE);
+	}
+	assert(rc != SQLITE_OK);
+	return rc;
+}
+
+/* Buffers pointing to the pages of a file as of the last snapshot, each
+ * holding a reference to its page. */
+struct image_file
+{
+	struct raft_buffer *bufs; /* One buffer per page or WAL frame. */
+	struct page **pages;      /* Pages referenced by the buffers. */
+	int len;                  /* Number of buffers. */
+};
+
+/* Image of a database and of its WAL as of the last shallow snapshot.
+ *
+ * The image is kept after the snapshot gets released and is used as base for
+ * the next one: only the pages that were written in the meantime (as tracked
+ * by the dirty bitmaps of the files) need to be replaced, so the cost of a
+ * snapshot is proportional to the amount of data written since the previous
+ * one, rather than to the size of the database. */
+struct image
+{
+	struct image_file main;                /* Main database pages. */
+	struct image_file wal;                 /* WAL frames. */
+	uint8_t wal_hdr[FORMAT__WAL_HDR_SIZE]; /* Copy of the WAL header. */
+	int refs; /* The database file plus a snapshot in progress. */
+};
 
-	/* Update the page count. */
-	content->pages_len = pages_len;
+static struct image *image_create(void)
+{
+	struct image *i;
+
+	i = sqlite3_malloc(sizeof *i);
+	if (i == NULL) {
+		return NULL;
+	}
+	i->main.bufs = NULL;
+	i->main.pages = NULL;
+	i->main.len = 0;
+	i->wal.bufs = NULL;
+	i->wal.pages = NULL;
+	i->wal.len = 0;
+	memset(i->wal_hdr, 0, sizeof i->wal_hdr);
+	i->refs = 1;
+
+	return i;
+}
+
+/* Release the page referenced by the buffer at the given index. */
+static void image_file_page_unref(struct image_file *f, int i)
+{
+	page_unref(f->pages[i]);
+}
+
+/* Point the buffer at the given index to the current version of the
+ * corresponding page of @c. */
+static void image_file_page_ref(struct image_file *f,
+				struct content *c,
+				int i)
+{
+	struct page *page = content_page_lookup(c, i + 1);
+
+	page_ref(page);
+	f->pages[i] = page;
+	if (c->type == FORMAT__WAL) {
+		f->bufs[i].base = page->hdr;
+		f->bufs[i].len = format__wal_calc_frame_size(c->page_size);
+	} else {
+		f->bufs[i].base = page->buf;
+		f->bufs[i].len = c->page_size;
+	}
+}
+
+/* Update an image file so that it holds the first @len pages of @c, which
+ * might be NULL if @len is 0, replacing the pages written since the last
+ * update. */
+static int image_file_update(struct image_file *f, struct content *c, int len)
+{
+	int n = f->len < len ? f->len : len;
+	int tracked;
+	int i;
+
+	/* Allocate everything upfront, so nothing can fail afterwards. */
+	if (len > f->len) {
+		struct raft_buffer *bufs;
+		struct page **pages;
+		bufs = sqlite3_realloc(f->bufs, (sizeof *bufs) * len);
+		if (bufs == NULL) {
+			return SQLITE_NOMEM;
+		}
+		f->bufs = bufs;
+		pages = sqlite3_realloc(f->pages, (sizeof *pages) * len);
+		if (pages == NULL) {
+			return SQLITE_NOMEM;
+		}
+		f->pages = pages;
+	}
+	if (c != NULL &&
+	    VFS__DIRTY_WORDS(len) != VFS__DIRTY_WORDS(c->dirty_len)) {
+		uint64_t *dirty;
+		dirty = sqlite3_realloc(c->dirty,
+					(sizeof *dirty) * VFS__DIRTY_WORDS(len));
+		if (dirty == NULL && len > 0) {
+			return SQLITE_NOMEM;
+		}
+		c->dirty = dirty;
+	}
+
+	/* Replace the pages that were written since the last update. */
+	tracked = c != NULL && c->dirty_len < n ? c->dirty_len : n;
+	for (i = 0; i < VFS__DIRTY_WORDS(tracked); i++) {
+		uint64_t word = c->dirty[i];
+		while (word != 0) {
+			int j = i * 64 + __builtin_ctzll(word);
+			word &= word - 1;
+			if (j >= tracked) {
+				break;
+			}
+			image_file_page_unref(f, j);
+			image_file_page_ref(f, c, j);
+		}
+	}
+	for (i = tracked; i < n; i++) {
+		image_file_page_unref(f, i);
+		image_file_page_ref(f, c, i);
+	}
+
+	/* Drop pages that were truncated and add new ones. */
+	for (i = len; i < f->len; i++) {
+		image_file_page_unref(f, i);
+	}
+	for (i = f->len; i < len; i++) {
+		image_file_page_ref(f, c, i);
+	}
+	f->len = len;
+
+	/* Start tracking writes again. */
+	if (c != NULL) {
+		if (len > 0) {
+			memset(c->dirty, 0,
+			       (sizeof *c->dirty) * VFS__DIRTY_WORDS(len));
+		}
+		c->dirty_len = len;
+	}
+
+	return SQLITE_OK;
+}
+
+static void image_unref(struct image *i)
+{
+	int j;
+
+	assert(i->refs > 0);
+	i->refs--;
+	if (i->refs > 0) {
+		return;
+	}
+
+	for (j = 0; j < i->main.len; j++) {
+		image_file_page_unref(&i->main, j);
+	}
+	for (j = 0; j < i->wal.len; j++) {
+		image_file_page_unref(&i->wal, j);
+	}
+	sqlite3_free(i->main.bufs);
+	sqlite3_free(i->main.pages);
+	sqlite3_free(i->wal.bufs);
+	sqlite3_free(i->wal.pages);
+	sqlite3_free(i);
 }
 
 /* Implementation of the abstract sqlite3_file base class. */
@@ -417,47 +1153,40 @@ struct vfs__file
  * of all files that were created. */
 struct root
 {
-	struct logger *logger;     /* Send log messages here. */
-	struct content **contents; /* Files content */
-	int contents_len;          /* Number of files */
-	pthread_mutex_t mutex;     /* Serialize to access */
+	struct logger *logger;  /* Send log messages here. */
+	struct hash contents;   /* Files content, indexed by filename. */
+	pthread_mutex_t mutex;  /* Serialize to access */
 	int error;                 /* Last error occurred. */
+	struct slab_cache caches[VFS__N_PAGE_SIZES]; /* Page allocators */
 };
 
 /* Create a new root object. */
 static struct root *root_create(struct logger *logger)
 {
 	struct root *r;
-	int contents_size;
+	unsigned page_size;
+	int i;
 	int err;
 
 	r = sqlite3_malloc(sizeof *r);
 	if (r == NULL) {
-		goto oom;
+		return NULL;
 	}
 
 	r->logger = logger;
-	r->contents_len = VFS__MAX_FILES;
-
-	contents_size = r->contents_len * sizeof *r->contents;
+	hash__init(&r->contents);
 
-	r->contents = sqlite3_malloc(contents_size);
-	if (r->contents == NULL) {
-		goto oom_after_root_alloc;
+	page_size = FORMAT__PAGE_SIZE_MIN;
+	for (i = 0; i < VFS__N_PAGE_SIZES; i++) {
+		slab_cache_init(&r->caches[i], page_size);
+		page_size *= 2;
 	}
-
-	memset(r->contents, 0, contents_size);
+	assert(page_size / 2 == FORMAT__PAGE_SIZE_MAX);
 
 	err = pthread_mutex_init(&r->mutex, NULL);
 	assert(err == 0); /* Docs say that pthread_mutex_init can't fail */
 
 	return r;
-
-oom_after_root_alloc:
-	sqlite3_free(r);
-
-oom:
-	return NULL;
 }
 
 /* Release the memory used internally by root object.
@@ -467,73 +1196,63 @@ oom:
  */
 static void root_destroy(struct root *r)
 {
-	struct content **cursor; /* Iterator for r->contents */
-	int i;
+	unsigned i;
 
 	assert(r != NULL);
-	assert(r->contents != NULL);
-
-	cursor = r->contents;
-
-	/* The content array has been allocated and has at least one slot. */
-	assert(cursor != NULL);
-	assert(r->contents_len > 0);
 
-	for (i = 0; i < r->contents_len; i++) {
-		struct content *content = *cursor;
-		if (content != NULL) {
-			content_destroy(content);
+	for (i = 0; i < r->contents.n_buckets; i++) {
+		struct hash_item *item = r->contents.buckets[i];
+		while (item != NULL) {
+			struct hash_item *next = item->next;
+			content_destroy(HASH__DATA(item, struct content, link));
+			item = next;
 		}
-		cursor++;
 	}
 
-	sqlite3_free(r->contents);
+	hash__close(&r->contents);
+
+	for (i = 0; i < VFS__N_PAGE_SIZES; i++) {
+		slab_cache_close(&r->caches[i]);
+	}
 }
 
-/* Find a content object by name.
- *
- * Fill out and return its index if found, otherwise return the index
- * of a free slot (or -1, if there are no free slots).
- */
-static int root_content_lookup(
+/* Find a content object by name. */
+static void root_content_lookup(
     struct root *r,
     const char *filename,
     struct content **out  // OUT: content object or NULL
 )
 {
-	struct content **cursor; /* Iterator for r->contents */
-	int i;
-
-	/* Index of the content or of a free slot in the contents array. */
-	int free_slot = -1;
+	struct hash_item *item;
 
 	assert(r != NULL);
 	assert(filename != NULL);
 
-	cursor = r->contents;
-
-	// The content array has been allocated and has at least one slot.
-	assert(cursor != NULL);
-	assert(r->contents_len > 0);
-
-	for (i = 0; i < r->contents_len; i++) {
-		struct content *content = *cursor;
-		if (content && strcmp(content->filename, filename) == 0) {
-			// Found matching file.
+	HASH__FOREACH(item, &r->contents, hash__string(filename))
+	{
+		struct content *content;
+		content = HASH__DATA(item, struct content, link);
+		if (strcmp(content->filename, filename) == 0) {
 			*out = content;
-			return i;
-		}
-		if (content == NULL && free_slot == -1) {
-			// Keep track of the index of this empty slot.
-			free_slot = i;
+			return;
 		}
-		cursor++;
 	}
 
-	// No matching content object.
-	*out = 0;
+	*out = NULL;
+}
+
+/* Add a new content object to the file table. */
+static int root_content_add(struct root *r, struct content *content)
+{
+	int rv;
+
+	rv = hash__insert(&r->contents, &content->link,
+			  hash__string(content->filename));
+	if (rv != 0) {
+		return SQLITE_NOMEM;
+	}
 
-	return free_slot;
+	return SQLITE_OK;
 }
 
 /* Find the database content object associated with the given WAL file name. */
@@ -605,11 +1324,10 @@ static int root_database_page_size(struct root *r,
 static int vfs__delete_content(struct root *root, const char *filename)
 {
 	struct content *content;
-	int content_index;
 	int rc;
 
 	/* Check if the file exists. */
-	content_index = root_content_lookup(root, filename, &content);
+	root_content_lookup(root, filename, &content);
 	if (content == NULL) {
 		root->error = ENOENT;
 		rc = SQLITE_IOERR_DELETE_NOENT;
@@ -623,11 +1341,24 @@ static int vfs__delete_content(struct root *root, const char *filename)
 		goto err;
 	}
 
-	/* Free all memory allocated for this file. */
-	content_destroy(content);
+	/* Unlink a WAL file from its database. */
+	if (content->type == FORMAT__WAL) {
+		struct content *database;
+		root_database_content_lookup(root, filename, &database);
+		if (database != NULL && database->wal == content) {
+			database->wal = NULL;
+		}
+	}
 
-	/* Reset the file content slot. */
-	*(root->contents + content_index) = NULL;
+	/* A WAL file that outlives its database gets back its own lock. */
+	if (content->wal != NULL) {
+		content->wal->lock = &content->wal->rwlock;
+	}
+
+	/* Remove the file from the table and free all memory allocated for
+	 * it. */
+	hash__remove(&root->contents, &content->link);
+	content_destroy(content);
 
 	return SQLITE_OK;
 
@@ -693,7 +1424,6 @@ static int vfs__read(sqlite3_file *file,
 
 	assert(f->content != NULL);
 	assert(f->content->filename != NULL);
-	assert(f->content->refcount > 0);
 
 	/* From SQLite docs:
 	 *
@@ -760,17 +1490,10 @@ static int vfs__read(sqlite3_file *file,
 		case FORMAT__WAL:
 			/* WAL file */
 
-			if (f->content->page_size == 0) {
-				/* If the page size hasn't been set yet, set it
-				 * by copy the one from the associated main
-				 * database file. */
-				int err = root_database_page_size(
-				    f->root, f->content->filename,
-				    &f->content->page_size);
-				if (err != 0) {
-					return err;
-				}
-			}
+			/* The WAL is not empty, so its page size was set when
+			 * it got written. Reads only hold the file's lock in
+			 * shared mode and must not touch the root. */
+			assert(f->content->page_size > 0);
 
 			if (offset == 0) {
 				/* Read the header. */
@@ -868,7 +1591,6 @@ static int vfs__write(sqlite3_file *file,
 
 	assert(f->content != NULL);
 	assert(f->content->filename != NULL);
-	assert(f->content->refcount > 0);
 
 	switch (f->content->type) {
 		case FORMAT__DB:
@@ -941,10 +1663,16 @@ static int vfs__write(sqlite3_file *file,
 			if (f->content->page_size == 0) {
 				/* If the page size hasn't been set yet, set it
 				 * by copy the one from the associated main
-				 * database file. */
-				int err = root_database_page_size(
+				 * database file. Writes only happen on the
+				 * event loop thread, which is also the only one
+				 * taking file locks while holding the root
+				 * mutex, so this can't deadlock. */
+				int err;
+				pthread_mutex_lock(&f->root->mutex);
+				err = root_database_page_size(
 				    f->root, f->content->filename,
 				    &f->content->page_size);
+				pthread_mutex_unlock(&f->root->mutex);
 				if (err != 0) {
 					return err;
 				}
@@ -994,6 +1722,10 @@ static int vfs__write(sqlite3_file *file,
 					return SQLITE_NOMEM;
 				}
 				memcpy(page->hdr, buf, amount);
+
+				if ((int)pgno > f->content->tx_last_frame) {
+					f->content->tx_last_frame = pgno;
+				}
 			} else {
 				/* Frame page write. */
 				assert(amount == (int)f->content->page_size);
@@ -1007,9 +1739,11 @@ static int vfs__write(sqlite3_file *file,
 
 				// The header for the this frame must already
 				// have been written, so the page is there.
-				page = content_page_lookup(f->content, pgno);
-
-				assert(page != NULL);
+				assert(pgno <= (unsigned)f->content->pages_len);
+				rc = content_page_get(f->content, pgno, &page);
+				if (rc != SQLITE_OK) {
+					return rc;
+				}
 
 				memcpy(page->buf, buf, amount);
 			}
@@ -1376,6 +2110,13 @@ static int shm_lock(sqlite3_file *file, int ofst, int n, int flags)
 				assert(f->content->shm->exclusive[i] == 0);
 				f->content->shm->exclusive[i] = 1;
 			}
+
+			/* A new write transaction is starting, reset the
+			 * tracking of the WAL frames it writes. */
+			if (ofst == FORMAT__WAL_WRITE_LOCK &&
+			    f->content->wal != NULL) {
+				f->content->wal->tx_last_frame = 0;
+			}
 		} else {
 			/* No exclusive lock must be held in the region. */
 			for (i = ofst; i < ofst + n; i++) {
@@ -1384,61 +2125,249 @@ static int shm_lock(sqlite3_file *file, int ofst, int n, int flags)
 				}
 			}
 
-			for (i = ofst; i < ofst + n; i++) {
-				f->content->shm->shared[i]++;
-			}
-		}
+			for (i = ofst; i < ofst + n; i++) {
+				f->content->shm->shared[i]++;
+			}
+		}
+	}
+
+	return SQLITE_OK;
+}
+
+static void shm_barrier(sqlite3_file *file)
+{
+	(void)file;
+	/* Connections in other threads might be reading the WAL index, see
+	 * readers.c. */
+	__sync_synchronize();
+}
+
+static int shm_unmap(sqlite3_file *file, int delete_flag)
+{
+	struct vfs__file *f;
+
+	assert(file != NULL);
+
+	(void)delete_flag;
+
+	f = (struct vfs__file *)file;
+
+	// If the shm pointer is NULL no shared memory mapping is set.
+	if (f->content->shm == NULL) {
+		return SQLITE_OK;
+	}
+
+	return SQLITE_OK;
+}
+
+/* Return a pointer to the buffer of the requested database page, so SQLite can
+ * use it directly instead of copying it into its page cache. This is what
+ * SQLite normally does with memory-mapped files. */
+static int vfs__fetch(sqlite3_file *file,
+		      sqlite3_int64 offset,
+		      int amount,
+		      void **out)
+{
+	struct vfs__file *f = (struct vfs__file *)file;
+	struct page *page;
+	int pgno;
+
+	*out = NULL;
+
+	if (f->temp != NULL) {
+		/* Fetching from temporary files is not supported. */
+		return SQLITE_OK;
+	}
+
+	assert(f->content != NULL);
+
+	/* Only full pages of the main database can be fetched. Returning a
+	 * NULL pointer makes SQLite fall back to xRead. */
+	if (f->content->type != FORMAT__DB || content_is_empty(f->content)) {
+		return SQLITE_OK;
+	}
+	if (amount != (int)f->content->page_size ||
+	    (offset % f->content->page_size) != 0) {
+		return SQLITE_OK;
+	}
+
+	pgno = (offset / f->content->page_size) + 1;
+	page = content_page_lookup(f->content, pgno);
+	if (page == NULL) {
+		return SQLITE_OK;
+	}
+
+	/* The buffers of adopted pages can't be mapped back to their page
+	 * object in xUnfetch, so let SQLite read them. */
+	if (page->slab == NULL) {
+		return SQLITE_OK;
 	}
 
+	/* Make sure the page stays alive until SQLite is done with it, even if
+	 * the file gets truncated in the meantime. */
+	page_ref(page);
+	*out = page->buf;
+
 	return SQLITE_OK;
 }
 
-static void shm_barrier(sqlite3_file *file)
+/* Release a page buffer previously obtained with vfs__fetch. */
+static int vfs__unfetch(sqlite3_file *file, sqlite3_int64 offset, void *buf)
 {
 	(void)file;
-	/* This is a no-op since we expect SQLite to be compiled with mutex
-	 * support (i.e. SQLITE_MUTEX_OMIT or SQLITE_MUTEX_NOOP are *not*
-	 * defined, see sqliteInt.h). */
+	(void)offset;
+
+	/* A NULL buffer is just a hint that no more fetched pages beyond the
+	 * given offset will be used, there's nothing to unmap. */
+	if (buf == NULL) {
+		return SQLITE_OK;
+	}
+
+	page_unref(page_from_buf(buf));
+
+	return SQLITE_OK;
 }
 
-static int shm_unmap(sqlite3_file *file, int delete_flag)
+/* The same file contents can be accessed by connections living in different
+ * threads (see readers.c), so the methods below hold the lock of the file
+ * while calling the actual implementations. WAL files share the lock of their
+ * database, which also covers its shared memory. Reads only take it in shared
+ * mode, so readers of the same database run in parallel, and readers of
+ * different databases never contend. Temporary files have no content and are
+ * private to their connection. */
+static void file_rdlock(sqlite3_file *file)
 {
-	struct vfs__file *f;
+	struct content *content = ((struct vfs__file *)file)->content;
+	if (content != NULL) {
+		pthread_rwlock_rdlock(content->lock);
+	}
+}
 
-	assert(file != NULL);
+static void file_wrlock(sqlite3_file *file)
+{
+	struct content *content = ((struct vfs__file *)file)->content;
+	if (content != NULL) {
+		pthread_rwlock_wrlock(content->lock);
+	}
+}
 
-	(void)delete_flag;
+static void file_unlock(sqlite3_file *file)
+{
+	struct content *content = ((struct vfs__file *)file)->content;
+	if (content != NULL) {
+		pthread_rwlock_unlock(content->lock);
+	}
+}
 
-	f = (struct vfs__file *)file;
+static int locked_read(sqlite3_file *file,
+		       void *buf,
+		       int amount,
+		       sqlite_int64 offset)
+{
+	int rc;
+	file_rdlock(file);
+	rc = vfs__read(file, buf, amount, offset);
+	file_unlock(file);
+	return rc;
+}
 
-	// If the shm pointer is NULL no shared memory mapping is set.
-	if (f->content->shm == NULL) {
-		return SQLITE_OK;
+static int locked_write(sqlite3_file *file,
+			const void *buf,
+			int amount,
+			sqlite_int64 offset)
+{
+	int rc;
+	file_wrlock(file);
+	rc = vfs__write(file, buf, amount, offset);
+	file_unlock(file);
+	return rc;
+}
+
+static int locked_truncate(sqlite3_file *file, sqlite_int64 size)
+{
+	int rc;
+	file_wrlock(file);
+	rc = vfs__truncate(file, size);
+	file_unlock(file);
+	return rc;
+}
+
+static int locked_file_size(sqlite3_file *file, sqlite_int64 *size)
+{
+	int rc;
+	file_rdlock(file);
+	rc = vfs__file_size(file, size);
+	file_unlock(file);
+	return rc;
+}
+
+/* Only pragmas modify the file, other file controls are no-ops. */
+static int locked_file_control(sqlite3_file *file, int op, void *arg)
+{
+	int rc;
+	if (op != SQLITE_FCNTL_PRAGMA) {
+		return vfs__file_control(file, op, arg);
 	}
+	file_wrlock(file);
+	rc = vfs__file_control(file, op, arg);
+	file_unlock(file);
+	return rc;
+}
 
-	return SQLITE_OK;
+static int locked_shm_map(sqlite3_file *file,
+			  int region_index,
+			  int region_size,
+			  int extend,
+			  void volatile **out)
+{
+	int rc;
+	file_wrlock(file);
+	rc = shm_map(file, region_index, region_size, extend, out);
+	file_unlock(file);
+	return rc;
+}
+
+static int locked_shm_lock(sqlite3_file *file, int ofst, int n, int flags)
+{
+	int rc;
+	file_wrlock(file);
+	rc = shm_lock(file, ofst, n, flags);
+	file_unlock(file);
+	return rc;
+}
+
+static int locked_fetch(sqlite3_file *file,
+			sqlite3_int64 offset,
+			int amount,
+			void **out)
+{
+	int rc;
+	file_rdlock(file);
+	rc = vfs__fetch(file, offset, amount, out);
+	file_unlock(file);
+	return rc;
 }
 
 static const sqlite3_io_methods io_methods = {
-    2,                            // iVersion
+    3,                            // iVersion
     vfs__x_close,                 // xClose
-    vfs__read,                    // xRead
-    vfs__write,                   // xWrite
-    vfs__truncate,                // xTruncate
+    locked_read,                  // xRead
+    locked_write,                 // xWrite
+    locked_truncate,              // xTruncate
     vfs__sync,                    // xSync
-    vfs__file_size,               // xFileSize
+    locked_file_size,             // xFileSize
     vfs__lock,                    // xLock
     vfs__unlock,                  // xUnlock
     vfs__check_reserved_lock,     // xCheckReservedLock
-    vfs__file_control,            // xFileControl
+    locked_file_control,          // xFileControl
     vfs__sector_size,             // xSectorSize
     vfs__device_characteristics,  // xDeviceCharacteristics
-    shm_map,                      // xShmMap
-    shm_lock,                     // xShmLock
+    locked_shm_map,               // xShmMap
+    locked_shm_lock,              // xShmLock
     shm_barrier,                  // xShmBarrier
     shm_unmap,                    // xShmUnmap
-    0,
-    0,
+    locked_fetch,                 // xFetch
+    vfs__unfetch,                 // xUnfetch
 };
 
 static int vfs__open(sqlite3_vfs *vfs,
@@ -1450,9 +2379,9 @@ static int vfs__open(sqlite3_vfs *vfs,
 	struct root *root;
 	struct vfs__file *f;
 	struct content *content;
+	struct content *database = NULL; /* Database of a new WAL file. */
 
-	int free_slot = -1; /* Index of a free slot in root->acontent. */
-	int exists = 0;     /* Whether the file exists already. */
+	int exists = 0; /* Whether the file exists already. */
 
 	int type; /* File content type (e.g. database or WAL). */
 	int rc;   /* Return code. */
@@ -1512,9 +2441,8 @@ static int vfs__open(sqlite3_vfs *vfs,
 
 	pthread_mutex_lock(&root->mutex);
 
-	/* Search if the file exists already, and (if it doesn't) if there are
-	 * free slots. */
-	free_slot = root_content_lookup(root, filename, &content);
+	/* Search if the file exists already. */
+	root_content_lookup(root, filename, &content);
 	exists = content != NULL;
 
 	/* If file exists, and the exclusive flag is on, then return an error.
@@ -1544,14 +2472,6 @@ static int vfs__open(sqlite3_vfs *vfs,
 			goto err;
 		}
 
-		/* This is a new file, so try to create a new entry. */
-		if (free_slot == -1) {
-			/* No more file content slots available. */
-			root->error = ENFILE;
-			rc = SQLITE_CANTOPEN;
-			goto err;
-		}
-
 		if (flags & SQLITE_OPEN_MAIN_DB) {
 			type = FORMAT__DB;
 		} else if (flags & SQLITE_OPEN_WAL) {
@@ -1560,7 +2480,8 @@ static int vfs__open(sqlite3_vfs *vfs,
 			type = FORMAT__OTHER;
 		}
 
-		content = content_create(filename, type, root->logger);
+		content = content_create(filename, type, root->caches,
+					 root->logger);
 		if (content == NULL) {
 			root->error = ENOMEM;
 			rc = SQLITE_NOMEM;
@@ -1569,19 +2490,25 @@ static int vfs__open(sqlite3_vfs *vfs,
 
 		if (type == FORMAT__WAL) {
 			/* An associated database file must have been opened. */
-			struct content *database;
 			rc = root_database_content_lookup(root, filename,
 							  &database);
 			if (rc != SQLITE_OK) {
 				root->error = ENOMEM;
 				goto err_after_content_create;
 			}
-			database->wal = content;
 		}
 
-		/* Save the new file content in a free entry of the root file
-		 * content array. */
-		*(root->contents + free_slot) = content;
+		/* Save the new file content in the root file table. */
+		rc = root_content_add(root, content);
+		if (rc != SQLITE_OK) {
+			root->error = ENOMEM;
+			goto err_after_content_create;
+		}
+
+		if (database != NULL) {
+			database->wal = content;
+			content->lock = database->lock;
+		}
 	}
 
 	// Populate the new file handle.
@@ -1716,9 +2643,17 @@ static int vfs__randomness(sqlite3_vfs *vfs, int nByte, char *zByte)
 
 static int vfs__sleep(sqlite3_vfs *vfs, int microseconds)
 {
+	struct timespec ts;
+
 	(void)vfs;
 
-	/* TODO (is this needed?) */
+	/* SQLite backs off with this method when connections race on the WAL
+	 * index, which happens for real with reader threads (see readers.c):
+	 * returning right away would make it give up with SQLITE_PROTOCOL. */
+	ts.tv_sec = microseconds / 1000000;
+	ts.tv_nsec = (microseconds % 1000000) * 1000;
+	nanosleep(&ts, NULL);
+
 	return microseconds;
 }
 
@@ -1800,6 +2735,22 @@ void vfsClose(struct sqlite3_vfs *vfs)
 	sqlite3_free(root);
 }
 
+unsigned vfsSlabCount(struct sqlite3_vfs *vfs)
+{
+	struct root *root = (struct root *)(vfs->pAppData);
+	unsigned n = 0;
+	int i;
+
+	for (i = 0; i < VFS__N_PAGE_SIZES; i++) {
+		struct slab_cache *c = &root->caches[i];
+		pthread_mutex_lock(&c->mutex);
+		n += c->n_slabs;
+		pthread_mutex_unlock(&c->mutex);
+	}
+
+	return n;
+}
+
 /* Guess the file type by looking the filename. */
 static int guess_file_type(const char *filename)
 {
@@ -2061,3 +3012,348 @@ err:
 
 	return rc;
 }
+
+/* Return the root object of the VFS registered under the given name. */
+static struct root *root_lookup(const char *vfs_name)
+{
+	sqlite3_vfs *vfs;
+
+	vfs = sqlite3_vfs_find(vfs_name);
+	if (vfs == NULL) {
+		return NULL;
+	}
+
+	return vfs->pAppData;
+}
+
+/* Fill @info with the layout of a shallow snapshot of the given database
+ * content, returning the number of buffers it needs: one for each database
+ * page, one for the WAL header and one for each WAL frame. */
+static unsigned shallow_snapshot_layout(struct content *content,
+					struct vfsSnapshotInfo *info)
+{
+	struct content *wal = content->wal;
+	uint32_t mx_frame;
+	unsigned n_frames;
+	unsigned n;
+
+	info->main_size = (size_t)content->pages_len * content->page_size;
+	info->wal_size = 0;
+	info->page_size = content->page_size;
+	info->n_pending = 0;
+
+	n = content->pages_len;
+
+	if (wal == NULL || content_is_empty(wal)) {
+		return n;
+	}
+
+	info->page_size = wal->page_size;
+
+	/* Only the frames up to the last commit are part of the WAL: they are
+	 * the ones that the WAL index header knows about. If no connection
+	 * has the WAL index mapped, the WAL has been written as a whole by
+	 * vfsFileWrite() and every frame is committed. */
+	if (content->shm != NULL && content->shm->regions_len > 0) {
+		format__get_mx_frame(content->shm->regions[0], &mx_frame);
+		if (mx_frame > (uint32_t)wal->pages_len) {
+			mx_frame = wal->pages_len;
+		}
+	} else {
+		mx_frame = wal->pages_len;
+	}
+
+	n_frames = mx_frame;
+	if (n_frames > 0) {
+		info->wal_size =
+		    FORMAT__WAL_HDR_SIZE +
+		    (size_t)n_frames *
+			format__wal_calc_frame_size(wal->page_size);
+		n += 1 + n_frames;
+	}
+
+	/* The frames following the last commit belong to the write
+	 * transaction in progress, if any. Frames beyond the ones it wrote are
+	 * leftovers of rolled back transactions. */
+	if (content->shm != NULL &&
+	    content->shm->exclusive[FORMAT__WAL_WRITE_LOCK] > 0 &&
+	    wal->tx_last_frame > (int)mx_frame) {
+		info->n_pending = wal->tx_last_frame - mx_frame;
+		n += info->n_pending;
+	}
+
+	return n;
+}
+
+int vfsShallowSnapshotLen(const char *vfs_name,
+			  const char *filename,
+			  unsigned *n)
+{
+	struct root *root;
+	struct content *content;
+	struct vfsSnapshotInfo info;
+
+	root = root_lookup(vfs_name);
+	if (root == NULL) {
+		return SQLITE_ERROR;
+	}
+
+	pthread_mutex_lock(&root->mutex);
+
+	root_content_lookup(root, filename, &content);
+	if (content == NULL) {
+		pthread_mutex_unlock(&root->mutex);
+		return SQLITE_CANTOPEN;
+	}
+
+	pthread_rwlock_rdlock(content->lock);
+	*n = shallow_snapshot_layout(content, &info);
+	pthread_rwlock_unlock(content->lock);
+
+	pthread_mutex_unlock(&root->mutex);
+
+	return SQLITE_OK;
+}
+
+int vfsShallowSnapshot(const char *vfs_name,
+		       const char *filename,
+		       struct raft_buffer bufs[],
+		       unsigned n,
+		       struct vfsSnapshotInfo *info)
+{
+	struct root *root;
+	struct content *content;
+	struct content *wal;
+	struct image *image;
+	int n_frames;
+	unsigned i;
+	int rc;
+
+	root = root_lookup(vfs_name);
+	if (root == NULL) {
+		return SQLITE_ERROR;
+	}
+
+	pthread_mutex_lock(&root->mutex);
+
+	root_content_lookup(root, filename, &content);
+	if (content == NULL) {
+		rc = SQLITE_CANTOPEN;
+		goto err;
+	}
+	wal = content->wal;
+
+	/* The image and the dirty bitmap of the file get updated below, so
+	 * exclude connections of reader threads, which only take the lock in
+	 * shared mode. */
+	pthread_rwlock_wrlock(content->lock);
+
+	if (shallow_snapshot_layout(content, info) != n) {
+		rc = SQLITE_MISUSE;
+		goto err_after_lock;
+	}
+
+	if (content->image == NULL) {
+		content->image = image_create();
+		if (content->image == NULL) {
+			rc = SQLITE_NOMEM;
+			goto err_after_lock;
+		}
+	}
+	image = content->image;
+
+	/* The image of the previous snapshot gets updated in place, so it
+	 * must have been released. */
+	if (image->refs > 1) {
+		rc = SQLITE_BUSY;
+		goto err_after_lock;
+	}
+
+	n_frames = n - content->pages_len - (info->wal_size > 0 ? 1 : 0);
+
+	rc = image_file_update(&image->main, content, content->pages_len);
+	if (rc != SQLITE_OK) {
+		goto err_after_lock;
+	}
+	rc = image_file_update(&image->wal, n_frames > 0 ? wal : NULL,
+			       n_frames);
+	if (rc != SQLITE_OK) {
+		goto err_after_lock;
+	}
+
+	/* Main database file, one buffer per page. */
+	i = 0;
+	if (image->main.len > 0) {
+		memcpy(&bufs[i], image->main.bufs,
+		       (sizeof *bufs) * image->main.len);
+		i += image->main.len;
+	}
+
+	/* The WAL header gets rewritten in place when the WAL is restarted,
+	 * so copy it. */
+	if (info->wal_size > 0) {
+		memcpy(image->wal_hdr, wal->hdr, FORMAT__WAL_HDR_SIZE);
+		bufs[i].base = image->wal_hdr;
+		bufs[i].len = FORMAT__WAL_HDR_SIZE;
+		i++;
+	}
+
+	/* WAL frames, first the committed ones and then the ones of the write
+	 * transaction in progress, which follow them. One buffer per frame,
+	 * since the frame header immediately precedes the page buffer. */
+	if (image->wal.len > 0) {
+		memcpy(&bufs[i], image->wal.bufs,
+		       (sizeof *bufs) * image->wal.len);
+		i += image->wal.len;
+	}
+
+	assert(i == n);
+
+	image->refs++;
+	info->image = image;
+
+	pthread_rwlock_unlock(content->lock);
+	pthread_mutex_unlock(&root->mutex);
+
+	return SQLITE_OK;
+
+err_after_lock:
+	pthread_rwlock_unlock(content->lock);
+err:
+	assert(rc != SQLITE_OK);
+	pthread_mutex_unlock(&root->mutex);
+	return rc;
+}
+
+void vfsShallowSnapshotRelease(const char *vfs_name, void *image)
+{
+	struct root *root;
+
+	root = root_lookup(vfs_name);
+	assert(root != NULL);
+
+	pthread_mutex_lock(&root->mutex);
+	image_unref(image);
+	pthread_mutex_unlock(&root->mutex);
+}
+
+struct vfsBacking *vfsBackingCreate(void *base)
+{
+	struct vfsBacking *b;
+
+	b = sqlite3_malloc(sizeof *b);
+	if (b == NULL) {
+		return NULL;
+	}
+	b->base = base;
+	b->refs = 1;
+
+	return b;
+}
+
+void vfsBackingRelease(const char *vfs_name, struct vfsBacking *backing)
+{
+	struct root *root;
+
+	root = root_lookup(vfs_name);
+	assert(root != NULL);
+
+	pthread_mutex_lock(&root->mutex);
+	backing_unref(backing);
+	pthread_mutex_unlock(&root->mutex);
+}
+
+/* Lookup the content of the given file, creating it if it doesn't exist. */
+static int root_content_get(struct root *root,
+			    const char *filename,
+			    int type,
+			    struct content **out)
+{
+	int rc;
+
+	root_content_lookup(root, filename, out);
+	if (*out != NULL) {
+		return SQLITE_OK;
+	}
+
+	*out = content_create(filename, type, root->caches, root->logger);
+	if (*out == NULL) {
+		root->error = ENOMEM;
+		return SQLITE_NOMEM;
+	}
+	rc = root_content_add(root, *out);
+	if (rc != SQLITE_OK) {
+		content_destroy(*out);
+		*out = NULL;
+		root->error = ENOMEM;
+		return rc;
+	}
+
+	return SQLITE_OK;
+}
+
+int vfsRestore(const char *vfs_name,
+	       const char *filename,
+	       const void *buf,
+	       size_t main_size,
+	       size_t wal_size,
+	       struct vfsBacking *backing)
+{
+	struct root *root;
+	struct content *content;
+	struct content *wal;
+	char *wal_filename;
+	int rc;
+
+	root = root_lookup(vfs_name);
+	if (root == NULL) {
+		return SQLITE_ERROR;
+	}
+
+	wal_filename = sqlite3_mprintf("%s-wal", filename);
+	if (wal_filename == NULL) {
+		return SQLITE_NOMEM;
+	}
+
+	pthread_mutex_lock(&root->mutex);
+
+	rc = root_content_get(root, filename, FORMAT__DB, &content);
+	if (rc != SQLITE_OK) {
+		goto out;
+	}
+	pthread_rwlock_wrlock(content->lock);
+	rc = content_restore(content, buf, main_size, backing);
+	if (rc != SQLITE_OK) {
+		goto out_after_lock;
+	}
+
+	/* Create the WAL only if there's something to put in it, otherwise
+	 * just empty any existing one. */
+	wal = content->wal;
+	if (wal == NULL && wal_size > 0) {
+		rc = root_content_get(root, wal_filename, FORMAT__WAL, &wal);
+		if (rc != SQLITE_OK) {
+			goto out_after_lock;
+		}
+		content->wal = wal;
+		wal->lock = content->lock;
+	}
+	if (wal != NULL) {
+		/* The WAL must use the same page size as the database. */
+		if (content->page_size > 0) {
+			wal->page_size = content->page_size;
+		}
+		rc = content_restore(wal, (const uint8_t *)buf + main_size,
+				     wal_size, backing);
+		if (rc != SQLITE_OK) {
+			goto out_after_lock;
+		}
+	}
+
+out_after_lock:
+	pthread_rwlock_unlock(content->lock);
+out:
+	pthread_mutex_unlock(&root->mutex);
+	sqlite3_free(wal_filename);
+	return rc;
+}
@@ -1,6 +1,8 @@
 #ifndef VFS_H_
 #define VFS_H_
 
+#include <raft.h>
+
 #include "config.h"
 
 /* Initialize the given SQLite VFS interface with dqlite's in-memory
@@ -17,6 +19,11 @@ int vfsInit(struct sqlite3_vfs *vfs, struct config *config);
  * SQLite global registry. */
 void vfsClose(struct sqlite3_vfs *vfs);
 
+/* Return the number of page slabs currently allocated by the given dqlite
+ * in-memory VFS implementation. Pages of database and WAL files are carved out
+ * of slabs shared by all files with the same page size. */
+unsigned vfsSlabCount(struct sqlite3_vfs *vfs);
+
 /* Read the content of a file, using the VFS implementation registered under the
  * given name. Used to take database snapshots using the dqlite in-memory
  * VFS. */
@@ -33,4 +40,77 @@ int vfsFileWrite(const char *vfs_name,
 		 const void *buf,
 		 size_t len);
 
+/* Handle to a memory block whose ownership is transferred to the VFS, so that
+ * pages restored from it can point directly into it. */
+struct vfsBacking;
+
+/* Take ownership of the given memory block, allocated with raft_malloc().
+ *
+ * The block gets released with raft_free() once vfsBackingRelease() has been
+ * called and no page restored from it by vfsRestore() is in use anymore. */
+struct vfsBacking *vfsBackingCreate(void *base);
+
+/* Release the handle returned by vfsBackingCreate(). */
+void vfsBackingRelease(const char *vfs_name, struct vfsBacking *backing);
+
+/* Replace the content of the given database file and of its WAL with the
+ * given image, consisting of @main_size bytes of database pages followed by
+ * @wal_size bytes of WAL.
+ *
+ * This bypasses the regular file API: the page directories are sized upfront
+ * and filled in a single pass. If @backing is not NULL, @buf must point into
+ * its block and no page is copied: the restored pages use the image memory
+ * directly. Otherwise each page is copied. */
+int vfsRestore(const char *vfs_name,
+	       const char *filename,
+	       const void *buf,
+	       size_t main_size,
+	       size_t wal_size,
+	       struct vfsBacking *backing);
+
+/* Return in @n the number of buffers that vfsShallowSnapshot() needs in order
+ * to hold a snapshot of the given database file and of its WAL. */
+int vfsShallowSnapshotLen(const char *vfs_name,
+			  const char *filename,
+			  unsigned *n);
+
+/* Layout of a snapshot taken with vfsShallowSnapshot(). */
+struct vfsSnapshotInfo
+{
+	size_t main_size;   /* Size of the main database file */
+	size_t wal_size;    /* Size of the committed part of the WAL */
+	unsigned page_size; /* Size of database pages */
+	unsigned n_pending; /* Frames written by the transaction in progress */
+	void *image;        /* To be passed to vfsShallowSnapshotRelease() */
+};
+
+/* Take a zero-copy snapshot of the given database file and of its WAL.
+ *
+ * The given buffers are filled with pointers to the content of each database
+ * page, followed (if the WAL has committed frames) by a copy of the WAL header
+ * and by pointers to each committed WAL frame. Their concatenation is equal to
+ * the content of the main database file followed by the committed content of
+ * the WAL file, whose sizes are returned in @info.
+ *
+ * If a write transaction is in progress, the last @info->n_pending buffers
+ * point to the uncommitted WAL frames that it has written so far.
+ *
+ * The pages referenced by the buffers are guaranteed to not change until
+ * vfsShallowSnapshotRelease() is called: if they are written in the
+ * meantime, the file gets a fresh copy of the page.
+ *
+ * The pages are kept referenced after the release as well, so the next
+ * snapshot of the same database only needs to look at the pages written in
+ * the meantime. Only one snapshot of a given database can be in progress at
+ * any time, otherwise SQLITE_BUSY is returned. */
+int vfsShallowSnapshot(const char *vfs_name,
+		       const char *filename,
+		       struct raft_buffer bufs[],
+		       unsigned n,
+		       struct vfsSnapshotInfo *info);
+
+/* Release the buffers of a snapshot taken with vfsShallowSnapshot(), given
+ * the image returned in its info. */
+void vfsShallowSnapshotRelease(const char *vfs_name, void *image);
+
 #endif /* VFS_H_ */
@@ -120,6 +120,7 @@ struct server
 #define CLUSTER_LOGGER(I) &f->servers[I].logger
 #define CLUSTER_LEADER(I) &f->servers[I].leader
 #define CLUSTER_REGISTRY(I) &f->servers[I].registry
+#define CLUSTER_REPLICATION(I) &f->servers[I].replication
 #define CLUSTER_RAFT(I) raft_fixture_get(&f->cluster, I)
 #define CLUSTER_LAST_INDEX(I) raft_last_index(CLUSTER_RAFT(I))
 #define CLUSTER_DISCONNECT(I, J) raft_fixture_disconnect(&f->cluster, I, J)
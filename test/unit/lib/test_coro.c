@@ -0,0 +1,146 @@
+#include "../../../src/lib/coro.h"
+
+#include "../../lib/runner.h"
+
+TEST_MODULE(lib_coro);
+
+/******************************************************************************
+ *
+ * Fixture
+ *
+ ******************************************************************************/
+
+#define STACK_SIZE (64 * 1024)
+
+static cothread_t main_coro; /* Coroutine to switch back to */
+static unsigned counter;     /* Incremented by test coroutines */
+
+/* Test coroutine entry point, incrementing the counter each time it's
+ * resumed. */
+static void entry()
+{
+	while (1) {
+		counter++;
+		co_switch(main_coro);
+	}
+}
+
+struct fixture
+{
+	struct coro_pool pool;
+};
+
+static void *setup(const MunitParameter params[], void *user_data)
+{
+	struct fixture *f = munit_malloc(sizeof *f);
+	(void)params;
+	(void)user_data;
+	main_coro = co_active();
+	counter = 0;
+	coro_pool__init(&f->pool);
+	return f;
+}
+
+static void tear_down(void *data)
+{
+	struct fixture *f = data;
+	coro_pool__close(&f->pool);
+	free(f);
+}
+
+/* Get a coroutine from the pool, asserting that it's not NULL. */
+#define GET(CORO)                                                   \
+	{                                                           \
+		CORO = coro_pool__get(&f->pool, STACK_SIZE, entry); \
+		munit_assert_ptr_not_null(CORO);                    \
+	}
+
+/******************************************************************************
+ *
+ * coro_pool__get
+ *
+ ******************************************************************************/
+
+TEST_SUITE(get);
+TEST_SETUP(get, setup);
+TEST_TEAR_DOWN(get, tear_down);
+
+/* A coroutine is created if the pool is empty. */
+TEST_CASE(get, create, NULL)
+{
+	struct fixture *f = data;
+	cothread_t coro;
+	(void)params;
+	GET(coro);
+	munit_assert_int(f->pool.n_created, ==, 1);
+	munit_assert_int(f->pool.n_busy, ==, 1);
+	co_switch(coro);
+	munit_assert_int(counter, ==, 1);
+	coro_pool__put(&f->pool, coro);
+	return MUNIT_OK;
+}
+
+/* A coroutine given back to the pool is reused, and resumes from the top of
+ * its loop. */
+TEST_CASE(get, reuse, NULL)
+{
+	struct fixture *f = data;
+	cothread_t coro1;
+	cothread_t coro2;
+	(void)params;
+	GET(coro1);
+	co_switch(coro1);
+	coro_pool__put(&f->pool, coro1);
+	munit_assert_int(f->pool.n_idle, ==, 1);
+	GET(coro2);
+	munit_assert_ptr_equal(coro1, coro2);
+	munit_assert_int(f->pool.n_created, ==, 1);
+	co_switch(coro2);
+	munit_assert_int(counter, ==, 2);
+	coro_pool__put(&f->pool, coro2);
+	return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * coro_pool__put
+ *
+ ******************************************************************************/
+
+TEST_SUITE(put);
+TEST_SETUP(put, setup);
+TEST_TEAR_DOWN(put, tear_down);
+
+/* Coroutines beyond the maximum number of idle ones are deleted. */
+TEST_CASE(put, full, NULL)
+{
+	struct fixture *f = data;
+	cothread_t coros[CORO__POOL_MAX_IDLE + 1];
+	unsigned i;
+	(void)params;
+	for (i = 0; i < CORO__POOL_MAX_IDLE + 1; i++) {
+		GET(coros[i]);
+	}
+	for (i = 0; i < CORO__POOL_MAX_IDLE + 1; i++) {
+		coro_pool__put(&f->pool, coros[i]);
+	}
+	munit_assert_int(f->pool.n_idle, ==, CORO__POOL_MAX_IDLE);
+	munit_assert_int(f->pool.n_busy, ==, 0);
+	return MUNIT_OK;
+}
+
+/* A discarded coroutine is not reused. */
+TEST_CASE(put, discard, NULL)
+{
+	struct fixture *f = data;
+	cothread_t coro;
+	(void)params;
+	GET(coro);
+	coro_pool__discard(&f->pool, coro);
+	munit_assert_int(f->pool.n_idle, ==, 0);
+	munit_assert_int(f->pool.n_busy, ==, 0);
+	GET(coro);
+	munit_assert_int(f->pool.n_created, ==, 2);
+	coro_pool__put(&f->pool, coro);
+	return MUNIT_OK;
+}
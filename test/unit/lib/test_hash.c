@@ -0,0 +1,209 @@
+#include <stdlib.h>
+
+#include "../../../include/dqlite.h"
+#include "../../../src/lib/hash.h"
+
+#include "../../lib/heap.h"
+#include "../../lib/runner.h"
+#include "../../lib/sqlite.h"
+
+TEST_MODULE(lib_hash);
+
+/******************************************************************************
+ *
+ * Fixture
+ *
+ ******************************************************************************/
+
+struct item
+{
+	unsigned value;
+	struct hash_item link;
+};
+
+struct fixture
+{
+	struct hash hash;
+};
+
+static void *setup(const MunitParameter params[], void *user_data)
+{
+	struct fixture *f = munit_malloc(sizeof *f);
+	SETUP_HEAP;
+	SETUP_SQLITE;
+	hash__init(&f->hash);
+	return f;
+}
+
+static void tear_down(void *data)
+{
+	struct fixture *f = data;
+	hash__close(&f->hash);
+	TEAR_DOWN_SQLITE;
+	TEAR_DOWN_HEAP;
+	free(f);
+}
+
+/******************************************************************************
+ *
+ * Helper macros.
+ *
+ ******************************************************************************/
+
+#define INSERT(ITEM, KEY)                                          \
+	{                                                          \
+		int rv_;                                           \
+		rv_ = hash__insert(&f->hash, &(ITEM)->link, KEY); \
+		munit_assert_int(rv_, ==, 0);                      \
+	}
+
+/* Return the value of the first item with the given key, or 0. */
+static unsigned lookup(struct hash *h, uint64_t key)
+{
+	struct hash_item *item = hash__first(h, key);
+	if (item == NULL) {
+		return 0;
+	}
+	return HASH__DATA(item, struct item, link)->value;
+}
+
+/******************************************************************************
+ *
+ * hash__insert
+ *
+ ******************************************************************************/
+
+TEST_SUITE(insert);
+TEST_SETUP(insert, setup);
+TEST_TEAR_DOWN(insert, tear_down);
+
+/* Insert an item in an empty table. */
+TEST_CASE(insert, first, NULL)
+{
+	struct fixture *f = data;
+	struct item item = {1, {NULL, 0}};
+	(void)params;
+	munit_assert_ptr_null(hash__first(&f->hash, 123));
+	INSERT(&item, 123);
+	munit_assert_int(f->hash.len, ==, 1);
+	munit_assert_int(lookup(&f->hash, 123), ==, 1);
+	munit_assert_ptr_null(hash__first(&f->hash, 124));
+	return MUNIT_OK;
+}
+
+/* The table grows as items are inserted, and all of them can still be found
+ * afterwards. */
+TEST_CASE(insert, grow, NULL)
+{
+	struct fixture *f = data;
+	struct item *items = munit_malloc(10000 * sizeof *items);
+	unsigned i;
+	(void)params;
+	for (i = 0; i < 10000; i++) {
+		items[i].value = i + 1;
+		INSERT(&items[i], i);
+	}
+	munit_assert_int(f->hash.len, ==, 10000);
+	munit_assert_int(f->hash.n_buckets, >=, 10000);
+	for (i = 0; i < 10000; i++) {
+		munit_assert_int(lookup(&f->hash, i), ==, i + 1);
+	}
+	free(items);
+	return MUNIT_OK;
+}
+
+/* Items with the same key are all visited. */
+TEST_CASE(insert, same_key, NULL)
+{
+	struct fixture *f = data;
+	struct item items[3] = {{1, {NULL, 0}}, {2, {NULL, 0}}, {3, {NULL, 0}}};
+	struct hash_item *item;
+	unsigned sum = 0;
+	unsigned i;
+	(void)params;
+	for (i = 0; i < 3; i++) {
+		INSERT(&items[i], 7);
+	}
+	HASH__FOREACH(item, &f->hash, 7)
+	{
+		sum += HASH__DATA(item, struct item, link)->value;
+	}
+	munit_assert_int(sum, ==, 6);
+	return MUNIT_OK;
+}
+
+static char *insert_oom_delay[] = {"0", NULL};
+static char *insert_oom_repeat[] = {"1", NULL};
+
+static MunitParameterEnum insert_oom_params[] = {
+    {TEST_HEAP_FAULT_DELAY, insert_oom_delay},
+    {TEST_HEAP_FAULT_REPEAT, insert_oom_repeat},
+    {NULL, NULL},
+};
+
+/* Out of memory failure when allocating the first buckets. */
+TEST_CASE(insert, oom, insert_oom_params)
+{
+	struct fixture *f = data;
+	struct item item = {1, {NULL, 0}};
+	int rv;
+	(void)params;
+	test_heap_fault_enable();
+	rv = hash__insert(&f->hash, &item.link, 1);
+	munit_assert_int(rv, ==, DQLITE_NOMEM);
+	munit_assert_int(f->hash.len, ==, 0);
+	return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * hash__remove
+ *
+ ******************************************************************************/
+
+TEST_SUITE(remove);
+TEST_SETUP(remove, setup);
+TEST_TEAR_DOWN(remove, tear_down);
+
+/* Remove items sharing a bucket. */
+TEST_CASE(remove, chain, NULL)
+{
+	struct fixture *f = data;
+	struct item items[3] = {{1, {NULL, 0}}, {2, {NULL, 0}}, {3, {NULL, 0}}};
+	struct hash_item *item;
+	unsigned i;
+	(void)params;
+	for (i = 0; i < 3; i++) {
+		INSERT(&items[i], 7);
+	}
+	hash__remove(&f->hash, &items[1].link);
+	munit_assert_int(f->hash.len, ==, 2);
+	HASH__FOREACH(item, &f->hash, 7)
+	{
+		munit_assert_ptr_not_equal(item, &items[1].link);
+	}
+	hash__remove(&f->hash, &items[0].link);
+	hash__remove(&f->hash, &items[2].link);
+	munit_assert_int(f->hash.len, ==, 0);
+	munit_assert_ptr_null(hash__first(&f->hash, 7));
+	return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * hash__string
+ *
+ ******************************************************************************/
+
+TEST_SUITE(string);
+
+/* Equal strings get the same key, different ones (most likely) don't. */
+TEST_CASE(string, key, NULL)
+{
+	(void)data;
+	(void)params;
+	munit_assert_true(hash__string("test.db") == hash__string("test.db"));
+	munit_assert_true(hash__string("test.db") != hash__string("test2.db"));
+	munit_assert_true(hash__string("") != hash__string("test.db"));
+	return MUNIT_OK;
+}
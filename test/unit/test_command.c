@@ -49,3 +49,69 @@ TEST_CASE(open, decode, NULL)
 	raft_free(buf.base);
 	return MUNIT_OK;
 }
+
+/******************************************************************************
+ *
+ * Batch.
+ *
+ ******************************************************************************/
+
+TEST_SUITE(batch);
+
+TEST_CASE(batch, decode, NULL)
+{
+	struct command_open open1;
+	struct command_open open2;
+	struct command_batch c1;
+	struct command_batch *c2;
+	struct raft_buffer bufs[2];
+	struct raft_buffer buf;
+	struct raft_buffer next;
+	struct cursor cursor;
+	void *command;
+	int type;
+	int rc;
+	(void)data;
+	(void)params;
+	open1.filename = "test1.db";
+	open2.filename = "test2.db";
+	rc = command__encode(COMMAND_OPEN, &open1, &bufs[0]);
+	munit_assert_int(rc, ==, 0);
+	rc = command__encode(COMMAND_OPEN, &open2, &bufs[1]);
+	munit_assert_int(rc, ==, 0);
+	c1.commands.n = 2;
+	c1.commands.__unused__ = 0;
+	c1.commands.size = 0;
+	c1.commands.data = bufs;
+	rc = command__encode(COMMAND_BATCH, &c1, &buf);
+	munit_assert_int(rc, ==, 0);
+	raft_free(bufs[0].base);
+	raft_free(bufs[1].base);
+
+	rc = command__decode(&buf, &type, (void **)&c2);
+	munit_assert_int(rc, ==, 0);
+	munit_assert_int(type, ==, COMMAND_BATCH);
+	munit_assert_int(c2->commands.n, ==, 2);
+	command_batch__cursor(c2, &cursor);
+
+	command_batch__next(&cursor, &next);
+	rc = command__decode(&next, &type, &command);
+	munit_assert_int(rc, ==, 0);
+	munit_assert_int(type, ==, COMMAND_OPEN);
+	munit_assert_string_equal(((struct command_open *)command)->filename,
+				  "test1.db");
+	raft_free(command);
+
+	command_batch__next(&cursor, &next);
+	rc = command__decode(&next, &type, &command);
+	munit_assert_int(rc, ==, 0);
+	munit_assert_int(type, ==, COMMAND_OPEN);
+	munit_assert_string_equal(((struct command_open *)command)->filename,
+				  "test2.db");
+	raft_free(command);
+
+	munit_assert_int(cursor.cap, ==, 0);
+	raft_free(c2);
+	raft_free(buf.base);
+	return MUNIT_OK;
+}
@@ -369,6 +369,94 @@ TEST_CASE(query, one, NULL)
 	return MUNIT_OK;
 }
 
+/* Perform a query with parameters. */
+TEST_CASE(query, params, NULL)
+{
+	struct query_fixture *f = data;
+	struct value param;
+	struct row *row;
+	int rv;
+	(void)params;
+	PREPARE("SELECT n FROM test WHERE n = ?", &f->stmt_id);
+	param.type = SQLITE_INTEGER;
+	param.integer = 123;
+	rv = clientSendQueryParams(&f->client, f->stmt_id, &param, 1);
+	munit_assert_int(rv, ==, 0);
+	test_uv_run(&f->loop, 2);
+	rv = clientRecvRows(&f->client, &f->rows);
+	munit_assert_int(rv, ==, 0);
+	munit_assert_false(f->rows.more);
+	row = f->rows.next;
+	munit_assert_ptr_not_null(row);
+	munit_assert_ptr_null(row->next);
+	munit_assert_int(row->values[0].integer, ==, 123);
+	return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * Handle pipelined requests
+ *
+ ******************************************************************************/
+
+TEST_SUITE(pipeline);
+
+struct pipeline_fixture
+{
+	FIXTURE;
+};
+
+TEST_SETUP(pipeline)
+{
+	struct pipeline_fixture *f = munit_malloc(sizeof *f);
+	SETUP;
+	HANDSHAKE;
+	OPEN;
+	return f;
+}
+
+TEST_TEAR_DOWN(pipeline)
+{
+	struct pipeline_fixture *f = data;
+	TEAR_DOWN;
+	free(f);
+}
+
+/* Several requests can be sent without waiting for the responses, which come
+ * back in order, tagged with the IDs of the requests. */
+TEST_CASE(pipeline, prepare, NULL)
+{
+	struct pipeline_fixture *f = data;
+	unsigned stmt_id;
+	int rv;
+	(void)params;
+	f->client.pipeline = true;
+	f->client.next_id = 7;
+
+	rv = clientSendPrepare(&f->client, "SELECT 1");
+	munit_assert_int(rv, ==, 0);
+	rv = clientSendPrepare(&f->client, "SELECT 2");
+	munit_assert_int(rv, ==, 0);
+	rv = clientSendPrepare(&f->client, "SELECT 3");
+	munit_assert_int(rv, ==, 0);
+	test_uv_run(&f->loop, 3);
+
+	rv = clientRecvStmt(&f->client, &stmt_id);
+	munit_assert_int(rv, ==, 0);
+	munit_assert_int(stmt_id, ==, 0);
+	munit_assert_int(f->client.last_id, ==, 7);
+	rv = clientRecvStmt(&f->client, &stmt_id);
+	munit_assert_int(rv, ==, 0);
+	munit_assert_int(stmt_id, ==, 1);
+	munit_assert_int(f->client.last_id, ==, 8);
+	rv = clientRecvStmt(&f->client, &stmt_id);
+	munit_assert_int(rv, ==, 0);
+	munit_assert_int(stmt_id, ==, 2);
+	munit_assert_int(f->client.last_id, ==, 9);
+
+	return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * Handle a raft connect request
@@ -1,3 +1,5 @@
+#include <unistd.h>
+
 #include "../../include/dqlite.h"
 
 #include "../lib/cluster.h"
@@ -140,7 +142,7 @@ static void handleCb(struct handle *req, int status, int type)
 		struct tuple_decoder decoder;                                 \
 		int i2;                                                       \
 		int rc2;                                                      \
-		rc2 = tuple_decoder__init(&decoder, N, f->cursor);            \
+		rc2 = tuple_decoder__init(&decoder, N, TUPLE__ROW, f->cursor); \
 		munit_assert_int(rc2, ==, 0);                                 \
 		for (i2 = 0; i2 < N; i2++) {                                  \
 			rc2 = tuple_decoder__next(&decoder, &((VALUES)[i2])); \
@@ -400,6 +402,101 @@ TEST_CASE(open, error, twice, NULL)
 	return MUNIT_OK;
 }
 
+/* When pooling is enabled, the leader connection of a closed gateway is reused
+ * by the next gateway opening the same database. */
+TEST_CASE(open, pool, NULL)
+{
+	struct open_fixture *f = data;
+	struct config *config = CLUSTER_CONFIG(0);
+	struct leader *leader;
+	struct db *db;
+	int rv;
+	(void)params;
+	config->pool_max = 1;
+	f->request.filename = "test";
+	f->request.vfs = "";
+	ENCODE(&f->request, open);
+	HANDLE(OPEN);
+	ASSERT_CALLBACK(0, DB);
+	leader = f->gateway->leader;
+
+	gateway__close(f->gateway);
+	rv = registry__db_get(CLUSTER_REGISTRY(0), "test", &db);
+	munit_assert_int(rv, ==, 0);
+	munit_assert_int(db->n_pool, ==, 1);
+
+	gateway__init(f->gateway, CLUSTER_CONFIG(0), CLUSTER_REGISTRY(0),
+		      CLUSTER_RAFT(0));
+	ENCODE(&f->request, open);
+	HANDLE(OPEN);
+	ASSERT_CALLBACK(0, DB);
+	munit_assert_ptr_equal(f->gateway->leader, leader);
+	munit_assert_int(db->n_pool, ==, 0);
+	return MUNIT_OK;
+}
+
+/* Opening a database fills its pool up to the minimum number of idle
+ * connections. */
+TEST_CASE(open, pool_min, NULL)
+{
+	struct open_fixture *f = data;
+	struct config *config = CLUSTER_CONFIG(0);
+	struct leader *leader;
+	struct leader *pooled;
+	struct db *db;
+	int rv;
+	(void)params;
+	config->pool_min = 1;
+	config->pool_max = 2;
+	f->request.filename = "test";
+	f->request.vfs = "";
+	ENCODE(&f->request, open);
+	HANDLE(OPEN);
+	ASSERT_CALLBACK(0, DB);
+	leader = f->gateway->leader;
+	rv = registry__db_get(CLUSTER_REGISTRY(0), "test", &db);
+	munit_assert_int(rv, ==, 0);
+	munit_assert_int(db->n_pool, ==, 1);
+	pooled = QUEUE__DATA(QUEUE__HEAD(&db->pool), struct leader, pool);
+	munit_assert_ptr_not_equal(pooled, leader);
+
+	/* The most recently used connection is reused, and the pool is left
+	 * with the pre-opened one. */
+	gateway__close(f->gateway);
+	munit_assert_int(db->n_pool, ==, 2);
+	gateway__init(f->gateway, CLUSTER_CONFIG(0), CLUSTER_REGISTRY(0),
+		      CLUSTER_RAFT(0));
+	ENCODE(&f->request, open);
+	HANDLE(OPEN);
+	ASSERT_CALLBACK(0, DB);
+	munit_assert_ptr_equal(f->gateway->leader, leader);
+	munit_assert_int(db->n_pool, ==, 1);
+	return MUNIT_OK;
+}
+
+/* Pooling is disabled by default. */
+TEST_CASE(open, no_pool, NULL)
+{
+	struct open_fixture *f = data;
+	struct db *db;
+	int rv;
+	(void)params;
+	f->request.filename = "test";
+	f->request.vfs = "";
+	ENCODE(&f->request, open);
+	HANDLE(OPEN);
+	ASSERT_CALLBACK(0, DB);
+
+	gateway__close(f->gateway);
+	gateway__init(f->gateway, CLUSTER_CONFIG(0), CLUSTER_REGISTRY(0),
+		      CLUSTER_RAFT(0));
+	rv = registry__db_get(CLUSTER_REGISTRY(0), "test", &db);
+	munit_assert_int(rv, ==, 0);
+	munit_assert_int(db->n_pool, ==, 0);
+	munit_assert_true(QUEUE__IS_EMPTY(&db->leaders));
+	return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * prepare
@@ -491,6 +588,36 @@ TEST_CASE(exec, simple, NULL)
 	return MUNIT_OK;
 }
 
+/* A result response is followed by the read token, unless the client uses the
+ * legacy protocol. */
+TEST_CASE(exec, legacy_no_token, NULL)
+{
+	struct exec_fixture *f = data;
+	uint64_t stmt_id;
+	size_t n;
+	(void)params;
+	CLUSTER_ELECT(0);
+	PREPARE("CREATE TABLE test (n INT)");
+	f->request.db_id = 0;
+	f->request.stmt_id = stmt_id;
+	ENCODE(&f->request, exec);
+	HANDLE(EXEC);
+	CLUSTER_APPLIED(3);
+	ASSERT_CALLBACK(0, RESULT);
+	n = response_result__sizeof(&f->response);
+	munit_assert_ulong(buffer__offset(f->buf2), ==, n + sizeof(uint64_t));
+
+	f->gateway->protocol = DQLITE_PROTOCOL_VERSION_LEGACY;
+	PREPARE("INSERT INTO test VALUES(1)");
+	f->request.stmt_id = stmt_id;
+	ENCODE(&f->request, exec);
+	HANDLE(EXEC);
+	WAIT;
+	ASSERT_CALLBACK(0, RESULT);
+	munit_assert_ulong(buffer__offset(f->buf2), ==, n);
+	return MUNIT_OK;
+}
+
 /* Successfully execute a statement with a one parameter. */
 TEST_CASE(exec, one_param, NULL)
 {
@@ -890,6 +1017,306 @@ TEST_CASE(exec, restore, NULL)
 	return MUNIT_OK;
 }
 
+/* Re-initialize the gateway of the second connection so that it targets the
+ * first server, like the gateway of the first connection. */
+#define SECOND_GATEWAY                                                    \
+	gateway__close(&f->connections[1].gateway);                       \
+	gateway__init(&f->connections[1].gateway, CLUSTER_CONFIG(0),      \
+		      CLUSTER_REGISTRY(0), CLUSTER_RAFT(0));              \
+	SELECT(1);                                                        \
+	OPEN;                                                             \
+	SELECT(0)
+
+/* By default, a write from a connection finding the lock held by the
+ * transaction of another connection fails right away. */
+TEST_CASE(exec, busy, NULL)
+{
+	struct exec_fixture *f = data;
+	struct response_failure failure;
+	uint64_t stmt_id;
+	(void)params;
+	CLUSTER_ELECT(0);
+	EXEC("CREATE TABLE test (n INT)");
+	SECOND_GATEWAY;
+	EXEC("BEGIN");
+	EXEC("INSERT INTO test(n) VALUES(1)");
+
+	SELECT(1);
+	PREPARE("INSERT INTO test(n) VALUES(2)");
+	EXEC_SUBMIT(stmt_id);
+	WAIT;
+	ASSERT_CALLBACK(0, FAILURE);
+	DECODE(&failure, failure);
+	munit_assert_int(failure.code, ==, SQLITE_BUSY);
+
+	SELECT(0);
+	EXEC("COMMIT");
+	return MUNIT_OK;
+}
+
+/* If a write timeout is set, a write from a connection finding the lock held
+ * by the transaction of another connection waits for it to end, instead of
+ * failing. */
+TEST_CASE(exec, wait_lock, NULL)
+{
+	struct exec_fixture *f = data;
+	struct dqlite_metrics metrics;
+	struct db *db;
+	uint64_t stmt_id;
+	int rv;
+	(void)params;
+	(CLUSTER_CONFIG(0))->write_timeout = 5000;
+	CLUSTER_ELECT(0);
+	EXEC("CREATE TABLE test (n INT)");
+	SECOND_GATEWAY;
+	EXEC("BEGIN");
+	EXEC("INSERT INTO test(n) VALUES(1)");
+
+	SELECT(1);
+	PREPARE("INSERT INTO test(n) VALUES(2)");
+	EXEC_SUBMIT(stmt_id);
+	munit_assert_false(f->context->invoked);
+	rv = registry__db_get(CLUSTER_REGISTRY(0), "test", &db);
+	munit_assert_int(rv, ==, 0);
+	munit_assert_int(db->n_writers, ==, 1);
+	metrics__get(db->metrics, &metrics);
+	munit_assert_int(metrics.writers, ==, 1);
+
+	SELECT(0);
+	EXEC("COMMIT");
+
+	SELECT(1);
+	WAIT;
+	ASSERT_CALLBACK(0, RESULT);
+	DECODE(&f->response, result);
+	munit_assert_int(f->response.last_insert_id, ==, 2);
+	munit_assert_int(db->n_writers, ==, 0);
+	munit_assert_int(db->max_writers, ==, 1);
+	metrics__get(db->metrics, &metrics);
+	munit_assert_int(metrics.writers, ==, 0);
+	munit_assert_int(metrics.max_writers, ==, 1);
+	munit_assert_int(metrics.writer_timeouts, ==, 0);
+	return MUNIT_OK;
+}
+
+/* A waiting write fails with SQLITE_BUSY once the write timeout expires. */
+TEST_CASE(exec, wait_lock_timeout, NULL)
+{
+	struct exec_fixture *f = data;
+	struct response_failure failure;
+	struct dqlite_metrics metrics;
+	struct db *db;
+	uint64_t stmt_id;
+	int rv;
+	(void)params;
+	(CLUSTER_CONFIG(0))->write_timeout = 5000;
+	CLUSTER_ELECT(0);
+	EXEC("CREATE TABLE test (n INT)");
+	SECOND_GATEWAY;
+	EXEC("BEGIN");
+	EXEC("INSERT INTO test(n) VALUES(1)");
+
+	SELECT(1);
+	PREPARE("INSERT INTO test(n) VALUES(2)");
+	EXEC_SUBMIT(stmt_id);
+	rv = registry__db_get(CLUSTER_REGISTRY(0), "test", &db);
+	munit_assert_int(rv, ==, 0);
+
+	leader__expire_writers(db, lease__now(CLUSTER_RAFT(0)));
+	munit_assert_false(f->context->invoked);
+
+	leader__expire_writers(db, lease__now(CLUSTER_RAFT(0)) +
+				       f->servers[0].config.write_timeout);
+	ASSERT_CALLBACK(0, FAILURE);
+	DECODE(&failure, failure);
+	munit_assert_int(failure.code, ==, SQLITE_BUSY);
+	munit_assert_int(db->n_writers, ==, 0);
+	munit_assert_int(db->writer_timeouts, ==, 1);
+	metrics__get(db->metrics, &metrics);
+	munit_assert_int(metrics.writers, ==, 0);
+	munit_assert_int(metrics.writer_timeouts, ==, 1);
+
+	SELECT(0);
+	EXEC("COMMIT");
+	return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * exec_batch
+ *
+ ******************************************************************************/
+
+struct exec_batch_fixture
+{
+	FIXTURE;
+	struct request_exec_batch request;
+	struct response_results response;
+};
+
+TEST_SUITE(exec_batch);
+TEST_SETUP(exec_batch)
+{
+	struct exec_batch_fixture *f = munit_malloc(sizeof *f);
+	SETUP;
+	OPEN;
+	return f;
+}
+TEST_TEAR_DOWN(exec_batch)
+{
+	struct exec_batch_fixture *f = data;
+	TEAR_DOWN;
+	free(f);
+}
+
+/* Encode an exec_batch request with one single-integer tuple for each of the
+ * given N values. */
+#define ENCODE_BATCH(STMT_ID, N, VALUES)                                      \
+	{                                                                     \
+		struct tuple_encoder encoder;                                 \
+		struct value value;                                           \
+		unsigned i2;                                                  \
+		int rc2;                                                      \
+		f->request.db_id = 0;                                         \
+		f->request.stmt_id = STMT_ID;                                 \
+		f->request.n = N;                                             \
+		ENCODE(&f->request, exec_batch);                              \
+		for (i2 = 0; i2 < N; i2++) {                                  \
+			rc2 = tuple_encoder__init(&encoder, 1,                \
+						  TUPLE__PARAMS32, f->buf1);  \
+			munit_assert_int(rc2, ==, 0);                         \
+			value.type = SQLITE_INTEGER;                          \
+			value.integer = (VALUES)[i2];                         \
+			rc2 = tuple_encoder__next(&encoder, &value);          \
+			munit_assert_int(rc2, ==, 0);                         \
+		}                                                             \
+	}
+
+/* Insert several rows, all replicated by a single raft entry. */
+TEST_CASE(exec_batch, insert, NULL)
+{
+	struct exec_batch_fixture *f = data;
+	struct response_result result;
+	int64_t values[3] = {4, 5, 6};
+	uint64_t stmt_id;
+	unsigned i;
+	(void)params;
+	CLUSTER_ELECT(0);
+	EXEC("CREATE TABLE test (n INT)");
+	PREPARE("INSERT INTO test VALUES (?)");
+	ENCODE_BATCH(stmt_id, 3, values);
+	HANDLE(EXEC_BATCH);
+	CLUSTER_APPLIED(4);
+	ASSERT_CALLBACK(0, RESULTS);
+	munit_assert_int(CLUSTER_LAST_INDEX(0), ==, 4);
+	DECODE(&f->response, results);
+	munit_assert_int(f->response.last_insert_id, ==, 3);
+	munit_assert_int(f->response.rows_affected, ==, 3);
+	munit_assert_int(f->response.n, ==, 3);
+	for (i = 0; i < 3; i++) {
+		DECODE(&result, result);
+		munit_assert_int(result.last_insert_id, ==, i + 1);
+		munit_assert_int(result.rows_affected, ==, 1);
+	}
+	return MUNIT_OK;
+}
+
+/* If one of the tuples fails, the whole batch is rolled back. */
+TEST_CASE(exec_batch, rollback, NULL)
+{
+	struct exec_batch_fixture *f = data;
+	int64_t values[3] = {1, 2, 1};
+	uint64_t stmt_id;
+	(void)params;
+	CLUSTER_ELECT(0);
+	EXEC("CREATE TABLE test (n INT UNIQUE)");
+	PREPARE("INSERT INTO test VALUES (?)");
+	ENCODE_BATCH(stmt_id, 3, values);
+	HANDLE(EXEC_BATCH);
+	WAIT;
+	ASSERT_CALLBACK(0, FAILURE);
+	ASSERT_FAILURE(SQLITE_CONSTRAINT_UNIQUE,
+		       "UNIQUE constraint failed: test.n");
+
+	/* None of the rows was committed, so inserting them again works. */
+	ENCODE_BATCH(stmt_id, 2, values);
+	HANDLE(EXEC_BATCH);
+	WAIT;
+	ASSERT_CALLBACK(0, RESULTS);
+	DECODE(&f->response, results);
+	munit_assert_int(f->response.rows_affected, ==, 2);
+	return MUNIT_OK;
+}
+
+/* A tuple with fewer parameters than the previous one does not inherit the
+ * trailing bindings of the previous tuple. */
+TEST_CASE(exec_batch, short_tuple, NULL)
+{
+	struct exec_batch_fixture *f = data;
+	struct tuple_encoder encoder;
+	struct value value;
+	uint64_t stmt_id;
+	int rc;
+	(void)params;
+	CLUSTER_ELECT(0);
+	EXEC("CREATE TABLE test (a INT, b INT NOT NULL)");
+	PREPARE("INSERT INTO test VALUES (?, ?)");
+	f->request.db_id = 0;
+	f->request.stmt_id = stmt_id;
+	f->request.n = 2;
+	ENCODE(&f->request, exec_batch);
+	rc = tuple_encoder__init(&encoder, 2, TUPLE__PARAMS32, f->buf1);
+	munit_assert_int(rc, ==, 0);
+	value.type = SQLITE_INTEGER;
+	value.integer = 1;
+	rc = tuple_encoder__next(&encoder, &value);
+	munit_assert_int(rc, ==, 0);
+	value.integer = 2;
+	rc = tuple_encoder__next(&encoder, &value);
+	munit_assert_int(rc, ==, 0);
+	rc = tuple_encoder__init(&encoder, 1, TUPLE__PARAMS32, f->buf1);
+	munit_assert_int(rc, ==, 0);
+	value.integer = 3;
+	rc = tuple_encoder__next(&encoder, &value);
+	munit_assert_int(rc, ==, 0);
+	HANDLE(EXEC_BATCH);
+	WAIT;
+	ASSERT_CALLBACK(0, FAILURE);
+	ASSERT_FAILURE(SQLITE_CONSTRAINT_NOTNULL,
+		       "NOT NULL constraint failed: test.b");
+	return MUNIT_OK;
+}
+
+/* A request claiming more tuples than its payload can hold is rejected. */
+TEST_CASE(exec_batch, too_many, NULL)
+{
+	struct exec_batch_fixture *f = data;
+	struct tuple_encoder encoder;
+	struct value value;
+	uint64_t stmt_id;
+	int rc;
+	(void)params;
+	CLUSTER_ELECT(0);
+	EXEC("CREATE TABLE test (n INT)");
+	PREPARE("INSERT INTO test VALUES (?)");
+	f->request.db_id = 0;
+	f->request.stmt_id = stmt_id;
+	f->request.n = 100;
+	ENCODE(&f->request, exec_batch);
+	rc = tuple_encoder__init(&encoder, 1, TUPLE__PARAMS32, f->buf1);
+	munit_assert_int(rc, ==, 0);
+	value.type = SQLITE_INTEGER;
+	value.integer = 1;
+	rc = tuple_encoder__next(&encoder, &value);
+	munit_assert_int(rc, ==, 0);
+	f->cursor->p = buffer__cursor(f->buf1, 0);
+	f->cursor->cap = buffer__offset(f->buf1);
+	rc = gateway__handle(f->gateway, f->handle, DQLITE_REQUEST_EXEC_BATCH,
+			     f->cursor, f->buf2, handleCb);
+	munit_assert_int(rc, ==, DQLITE_PARSE);
+	return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * query
@@ -1072,6 +1499,7 @@ TEST_CASE(query, interrupt, NULL)
 {
 	struct query_fixture *f = data;
 	struct request_interrupt interrupt;
+	sqlite3_stmt *stmt;
 	unsigned i;
 	uint64_t stmt_id;
 	uint64_t n;
@@ -1110,6 +1538,12 @@ TEST_CASE(query, interrupt, NULL)
 
 	ASSERT_CALLBACK(0, EMPTY);
 
+	/* The statement was reset, releasing its read transaction. */
+	stmt = NULL;
+	while ((stmt = sqlite3_next_stmt(f->gateway->leader->conn, stmt))) {
+		munit_assert_false(sqlite3_stmt_busy(stmt));
+	}
+
 	return MUNIT_OK;
 }
 
@@ -1139,6 +1573,67 @@ TEST_CASE(query, barrier, NULL)
 	return MUNIT_OK;
 }
 
+static void noopBarrierCb(struct raft_barrier *req, int status)
+{
+	(void)req;
+	(void)status;
+}
+
+/* Right after a write got committed the leader holds a lease, so a query is
+ * served without a barrier, even if there are uncommitted entries. */
+TEST_CASE(query, lease, NULL)
+{
+	struct query_fixture *f = data;
+	struct raft_barrier barrier;
+	raft_index last_index;
+	uint64_t stmt_id;
+	int rv;
+	(void)params;
+
+	PREPARE("SELECT n FROM test");
+
+	/* Append an entry without waiting for it to be committed. */
+	rv = raft_barrier(CLUSTER_RAFT(0), &barrier, noopBarrierCb);
+	munit_assert_int(rv, ==, 0);
+	last_index = CLUSTER_LAST_INDEX(0);
+
+	f->request.db_id = 0;
+	f->request.stmt_id = stmt_id;
+	ENCODE(&f->request, query);
+	HANDLE(QUERY);
+	ASSERT_CALLBACK(0, ROWS);
+	munit_assert_int(CLUSTER_LAST_INDEX(0), ==, last_index);
+
+	CLUSTER_APPLIED(last_index);
+	return MUNIT_OK;
+}
+
+/* A leadership transfer drops the lease right away, since the transferee can
+ * get elected and commit writes before the lease would expire. */
+TEST_CASE(query, lease_transfer, NULL)
+{
+	struct query_fixture *f = data;
+	struct request_transfer transfer;
+	struct lease *lease = &(CLUSTER_REGISTRY(0))->lease;
+	unsigned i;
+	(void)params;
+
+	munit_assert_true(lease__valid(lease, CLUSTER_RAFT(0)));
+
+	transfer.id = 2;
+	ENCODE(&transfer, transfer);
+	HANDLE(TRANSFER);
+	munit_assert_false(lease__valid(lease, CLUSTER_RAFT(0)));
+
+	for (i = 0; i < 1000 && !f->context->invoked; i++) {
+		CLUSTER_STEP;
+	}
+	ASSERT_CALLBACK(0, EMPTY);
+	munit_assert_false(lease__valid(lease, CLUSTER_RAFT(0)));
+
+	return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * finalize
@@ -1284,6 +1779,63 @@ TEST_CASE(query_sql, small, NULL)
 	return MUNIT_OK;
 }
 
+/* Running the same SQL text again reuses the statement prepared the first
+ * time. */
+TEST_CASE(query_sql, cached, NULL)
+{
+	struct query_sql_fixture *f = data;
+	struct stmt__cache *cache;
+	struct dqlite_metrics metrics;
+	(void)params;
+	EXEC("INSERT INTO test VALUES(123)");
+	cache = &f->gateway->leader->stmts;
+	f->request.db_id = 0;
+	f->request.sql = "SELECT n FROM test";
+	ENCODE(&f->request, query_sql);
+	HANDLE(QUERY_SQL);
+	ASSERT_CALLBACK(0, ROWS);
+	ENCODE(&f->request, query_sql);
+	HANDLE(QUERY_SQL);
+	ASSERT_CALLBACK(0, ROWS);
+	munit_assert_int(cache->hits, ==, 1);
+	munit_assert_int(cache->misses, ==, 1);
+	munit_assert_int(cache->n, ==, 1);
+	metrics__get(&(CLUSTER_REGISTRY(0))->metrics, &metrics);
+	munit_assert_int(metrics.stmt_cache_hits, ==, 1);
+	munit_assert_int(metrics.stmt_cache_misses, ==, 1);
+	return MUNIT_OK;
+}
+
+/* When the schema changes, the cached statements are dropped. */
+TEST_CASE(query_sql, cache_invalidate, NULL)
+{
+	struct query_sql_fixture *f = data;
+	struct stmt__cache *cache;
+	(void)params;
+	cache = &f->gateway->leader->stmts;
+	f->request.db_id = 0;
+	f->request.sql = "SELECT n FROM test";
+	ENCODE(&f->request, query_sql);
+	HANDLE(QUERY_SQL);
+	ASSERT_CALLBACK(0, ROWS);
+	f->request.sql = "SELECT count(*) FROM test";
+	ENCODE(&f->request, query_sql);
+	HANDLE(QUERY_SQL);
+	ASSERT_CALLBACK(0, ROWS);
+	munit_assert_int(cache->n, ==, 2);
+
+	EXEC("CREATE TABLE test2 (n INT)");
+
+	/* The statement is re-prepared by SQLite, and the other one dropped. */
+	f->request.sql = "SELECT n FROM test";
+	ENCODE(&f->request, query_sql);
+	HANDLE(QUERY_SQL);
+	ASSERT_CALLBACK(0, ROWS);
+	munit_assert_int(cache->hits, ==, 1);
+	munit_assert_int(cache->n, ==, 1);
+	return MUNIT_OK;
+}
+
 /* Perform a query with parameters */
 TEST_CASE(query_sql, params, NULL)
 {
@@ -1310,3 +1862,481 @@ TEST_CASE(query_sql, params, NULL)
 	ASSERT_CALLBACK(0, ROWS);
 	return MUNIT_OK;
 }
+
+static void slicesWakeup(struct slices *s)
+{
+	bool *woken = s->data;
+	*woken = true;
+}
+
+/* A query running for longer than the time slice gets suspended, and
+ * completes after being resumed. */
+TEST_CASE(query_sql, time_slice, NULL)
+{
+	struct query_sql_fixture *f = data;
+	struct registry *registry = CLUSTER_REGISTRY(0);
+	struct config *config = CLUSTER_CONFIG(0);
+	struct slices *slices = &registry->slices;
+	struct value value;
+	const char *column;
+	uint64_t n;
+	bool woken = false;
+	(void)params;
+	config->time_slice = 1;
+	slices->data = &woken;
+	slices->wakeup = slicesWakeup;
+
+	f->request.db_id = 0;
+	f->request.sql =
+	    "WITH RECURSIVE c(x) AS "
+	    "(SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 1000000) "
+	    "SELECT count(*) FROM c";
+	ENCODE(&f->request, query_sql);
+	HANDLE(QUERY_SQL);
+	munit_assert_false(f->context->invoked);
+	while (!f->context->invoked) {
+		munit_assert_true(woken);
+		woken = false;
+		leader__resume_slices(slices);
+	}
+	munit_assert_int(slices->n_yields, >, 0);
+	munit_assert_int(slices->n, ==, 0);
+	ASSERT_CALLBACK(0, ROWS);
+
+	uint64__decode(f->cursor, &n);
+	munit_assert_int(n, ==, 1);
+	text__decode(f->cursor, &column);
+	DECODE_ROW(1, &value);
+	munit_assert_int(value.type, ==, SQLITE_INTEGER);
+	munit_assert_int(value.integer, ==, 1000000);
+
+	slices->wakeup = NULL;
+	return MUNIT_OK;
+}
+
+/* Interrupting a query suspended after using up its time slice stops it
+ * right away. */
+TEST_CASE(query_sql, interrupt_time_slice, NULL)
+{
+	struct query_sql_fixture *f = data;
+	struct registry *registry = CLUSTER_REGISTRY(0);
+	struct config *config = CLUSTER_CONFIG(0);
+	struct slices *slices = &registry->slices;
+	struct request_interrupt interrupt;
+	bool woken = false;
+	(void)params;
+	config->time_slice = 1;
+	slices->data = &woken;
+	slices->wakeup = slicesWakeup;
+
+	f->request.db_id = 0;
+	f->request.sql =
+	    "WITH RECURSIVE c(x) AS "
+	    "(SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 100000000) "
+	    "SELECT count(*) FROM c";
+	ENCODE(&f->request, query_sql);
+	HANDLE(QUERY_SQL);
+	munit_assert_false(f->context->invoked);
+	munit_assert_int(slices->n, ==, 1);
+
+	gateway__interrupt(f->gateway);
+	munit_assert_int(slices->n, ==, 0);
+	ASSERT_CALLBACK(0, FAILURE);
+	ASSERT_FAILURE(SQLITE_INTERRUPT, "interrupted");
+	munit_assert_ptr_null(f->gateway->leader->exec);
+
+	ENCODE(&interrupt, interrupt);
+	HANDLE(INTERRUPT);
+	ASSERT_CALLBACK(0, EMPTY);
+
+	slices->wakeup = NULL;
+	return MUNIT_OK;
+}
+
+/* With reader threads enabled, a read-only query runs in one of them and the
+ * rows are delivered in the event loop thread. */
+TEST_CASE(query_sql, readers, NULL)
+{
+	struct query_sql_fixture *f = data;
+	struct registry *registry = CLUSTER_REGISTRY(0);
+	struct config *config = CLUSTER_CONFIG(0);
+	struct readers readers;
+	struct uv_loop_s loop;
+	struct value value;
+	struct db *db;
+	const char *column;
+	uint64_t n;
+	int rv;
+	(void)params;
+	EXEC("INSERT INTO test VALUES(123)");
+
+	rv = uv_loop_init(&loop);
+	munit_assert_int(rv, ==, 0);
+	rv = readers__init(&readers, config, &loop, 2);
+	munit_assert_int(rv, ==, 0);
+	registry->readers = &readers;
+	rv = registry__db_get(registry, "test", &db);
+	munit_assert_int(rv, ==, 0);
+	db->readers = &readers;
+
+	f->request.db_id = 0;
+	f->request.sql = "SELECT n FROM test";
+	ENCODE(&f->request, query_sql);
+	HANDLE(QUERY_SQL);
+	munit_assert_false(f->context->invoked);
+	munit_assert_ptr_not_null(f->gateway->read);
+	while (!f->context->invoked) {
+		uv_run(&loop, UV_RUN_ONCE);
+	}
+	ASSERT_CALLBACK(0, ROWS);
+	munit_assert_ptr_null(f->gateway->read);
+
+	uint64__decode(f->cursor, &n);
+	munit_assert_int(n, ==, 1);
+	text__decode(f->cursor, &column);
+	munit_assert_string_equal(column, "n");
+	DECODE_ROW(1, &value);
+	munit_assert_int(value.type, ==, SQLITE_INTEGER);
+	munit_assert_int(value.integer, ==, 123);
+
+	registry->readers = NULL;
+	db->readers = NULL;
+	readers__stop(&readers);
+	uv_run(&loop, UV_RUN_DEFAULT);
+	readers__close(&readers);
+	uv_loop_close(&loop);
+	return MUNIT_OK;
+}
+
+/* While a checkpoint command is in flight, queries are not handed to reader
+ * threads, since they might start a read transaction that would prevent the
+ * checkpoint from truncating the WAL. */
+TEST_CASE(query_sql, readers_checkpointing, NULL)
+{
+	struct query_sql_fixture *f = data;
+	struct registry *registry = CLUSTER_REGISTRY(0);
+	struct config *config = CLUSTER_CONFIG(0);
+	struct readers readers;
+	struct uv_loop_s loop;
+	struct value value;
+	struct db *db;
+	const char *column;
+	uint64_t n;
+	int rv;
+	(void)params;
+	EXEC("INSERT INTO test VALUES(123)");
+
+	rv = uv_loop_init(&loop);
+	munit_assert_int(rv, ==, 0);
+	rv = readers__init(&readers, config, &loop, 2);
+	munit_assert_int(rv, ==, 0);
+	registry->readers = &readers;
+	rv = registry__db_get(registry, "test", &db);
+	munit_assert_int(rv, ==, 0);
+	db->readers = &readers;
+	db->checkpointing = true;
+
+	f->request.db_id = 0;
+	f->request.sql = "SELECT n FROM test";
+	ENCODE(&f->request, query_sql);
+	HANDLE(QUERY_SQL);
+	WAIT;
+	ASSERT_CALLBACK(0, ROWS);
+	munit_assert_ptr_null(f->gateway->read);
+	munit_assert_false(readers__busy(&readers, "test"));
+
+	uint64__decode(f->cursor, &n);
+	munit_assert_int(n, ==, 1);
+	text__decode(f->cursor, &column);
+	munit_assert_string_equal(column, "n");
+	DECODE_ROW(1, &value);
+	munit_assert_int(value.type, ==, SQLITE_INTEGER);
+	munit_assert_int(value.integer, ==, 123);
+
+	db->checkpointing = false;
+	registry->readers = NULL;
+	db->readers = NULL;
+	readers__stop(&readers);
+	uv_run(&loop, UV_RUN_DEFAULT);
+	readers__close(&readers);
+	uv_loop_close(&loop);
+	return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * query_stale
+ *
+ ******************************************************************************/
+
+struct query_stale_fixture
+{
+	FIXTURE;
+	struct request_query_stale request;
+	struct response_rows response;
+	uint64_t token; /* Read token of the last write */
+};
+
+TEST_SUITE(query_stale);
+TEST_SETUP(query_stale)
+{
+	struct query_stale_fixture *f = munit_malloc(sizeof *f);
+	struct response_result result;
+	uint64_t stmt_id;
+	SETUP;
+	CLUSTER_ELECT(0);
+	OPEN;
+	EXEC("CREATE TABLE test (n INT)");
+	PREPARE("INSERT INTO test VALUES(123)");
+	EXEC_SUBMIT(stmt_id);
+	WAIT;
+	ASSERT_CALLBACK(0, RESULT);
+	DECODE(&result, result);
+	uint64__decode(f->cursor, &f->token);
+	CLUSTER_APPLIED(f->token);
+
+	/* Use the gateway of a follower. */
+	SELECT(1);
+	OPEN;
+	return f;
+}
+TEST_TEAR_DOWN(query_stale)
+{
+	struct query_stale_fixture *f = data;
+	TEAR_DOWN;
+	free(f);
+}
+
+/* Submit a query_stale request with the given mode and bound. */
+#define QUERY_STALE(MODE, BOUND)                         \
+	f->request.db_id = 0;                            \
+	f->request.mode = MODE;                          \
+	f->request.bound = BOUND;                        \
+	f->request.sql = "SELECT n FROM test";           \
+	ENCODE(&f->request, query_stale);                \
+	HANDLE(QUERY_STALE)
+
+/* Assert that the response contains the single row of the test table. */
+#define ASSERT_ROW                                                          \
+	{                                                                   \
+		struct value value;                                         \
+		uint64_t n;                                                 \
+		const char *column;                                         \
+		uint64__decode(f->cursor, &n);                              \
+		munit_assert_int(n, ==, 1);                                 \
+		text__decode(f->cursor, &column);                           \
+		munit_assert_string_equal(column, "n");                     \
+		DECODE_ROW(1, &value);                                      \
+		munit_assert_int(value.type, ==, SQLITE_INTEGER);           \
+		munit_assert_int(value.integer, ==, 123);                   \
+		DECODE(&f->response, rows);                                 \
+		munit_assert_ulong(f->response.eof, ==,                     \
+				   DQLITE_RESPONSE_ROWS_DONE);              \
+	}
+
+/* A follower serves queries accepting any staleness. */
+TEST_CASE(query_stale, any, NULL)
+{
+	struct query_stale_fixture *f = data;
+	(void)params;
+	QUERY_STALE(DQLITE_STALE_ANY, 0);
+	ASSERT_CALLBACK(0, ROWS);
+	ASSERT_ROW;
+	return MUNIT_OK;
+}
+
+/* A follower serves a query requiring an index only once it applied it. */
+TEST_CASE(query_stale, min_index, NULL)
+{
+	struct query_stale_fixture *f = data;
+	(void)params;
+	QUERY_STALE(DQLITE_STALE_MIN_INDEX, f->token + 1);
+	ASSERT_CALLBACK(0, FAILURE);
+	ASSERT_FAILURE(SQLITE_BUSY, "requested index not applied yet");
+	QUERY_STALE(DQLITE_STALE_MIN_INDEX, f->token);
+	ASSERT_CALLBACK(0, ROWS);
+	ASSERT_ROW;
+	return MUNIT_OK;
+}
+
+/* A follower that is up to date with the leader serves queries with a lag
+ * bound. */
+TEST_CASE(query_stale, max_lag, NULL)
+{
+	struct query_stale_fixture *f = data;
+	(void)params;
+	QUERY_STALE(DQLITE_STALE_MAX_LAG, 60 * 1000);
+	ASSERT_CALLBACK(0, ROWS);
+	ASSERT_ROW;
+	return MUNIT_OK;
+}
+
+/* An unknown staleness mode is rejected. */
+TEST_CASE(query_stale, bad_mode, NULL)
+{
+	struct query_stale_fixture *f = data;
+	(void)params;
+	QUERY_STALE(666, 0);
+	ASSERT_CALLBACK(0, FAILURE);
+	ASSERT_FAILURE(SQLITE_ERROR, "unknown staleness mode");
+	return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * metrics
+ *
+ ******************************************************************************/
+
+struct metrics_fixture
+{
+	FIXTURE;
+	struct request_metrics request;
+	struct response_metrics response;
+};
+
+TEST_SUITE(metrics);
+TEST_SETUP(metrics)
+{
+	struct metrics_fixture *f = munit_malloc(sizeof *f);
+	SETUP;
+	CLUSTER_ELECT(0);
+	OPEN;
+	EXEC("CREATE TABLE test (n INT)");
+	return f;
+}
+TEST_TEAR_DOWN(metrics)
+{
+	struct metrics_fixture *f = data;
+	TEAR_DOWN;
+	free(f);
+}
+
+/* The response includes the request types seen so far, followed by the
+ * latencies of raft and of leader steps. */
+TEST_CASE(metrics, requests, NULL)
+{
+	struct metrics_fixture *f = data;
+	struct response_request_metrics entry;
+	struct response_latency latency;
+	struct response_latency barrier;
+	struct response_latency apply;
+	struct response_latency step;
+	struct response_latency encode;
+	struct response_latency raft;
+	struct response_latency fsm;
+	struct response_latency total;
+	struct response_metrics_counters counters;
+	bool exec = false;
+	uint64_t i;
+	(void)params;
+
+	ENCODE(&f->request, metrics);
+	HANDLE(METRICS);
+	ASSERT_CALLBACK(0, METRICS);
+	DECODE(&f->response, metrics);
+
+	/* Open, prepare, exec, finalize and this request. */
+	munit_assert_int(f->response.n, ==, 5);
+	for (i = 0; i < f->response.n; i++) {
+		DECODE(&entry, request_metrics);
+		DECODE(&latency, latency);
+		munit_assert_int(entry.requests, ==, 1);
+		munit_assert_int(entry.failures, ==, 0);
+		munit_assert_int(entry.bytes_in, >, 0);
+		if (entry.type == DQLITE_REQUEST_EXEC) {
+			exec = true;
+		}
+	}
+	munit_assert_true(exec);
+
+	DECODE(&barrier, latency);
+	DECODE(&apply, latency);
+	DECODE(&step, latency);
+	munit_assert_int(apply.count, ==, 1);
+	munit_assert_int(step.count, ==, 1);
+	munit_assert_int(step.max, >=, step.p50);
+	munit_assert_int(step.sum, >=, step.max);
+
+	/* The CREATE TABLE transaction. */
+	DECODE(&encode, latency);
+	DECODE(&raft, latency);
+	DECODE(&fsm, latency);
+	DECODE(&total, latency);
+	munit_assert_int(encode.count, ==, 1);
+	munit_assert_int(raft.count, ==, 1);
+	munit_assert_int(fsm.count, ==, 1);
+	munit_assert_int(total.count, ==, 1);
+	munit_assert_int(total.max, >=, raft.max);
+
+	/* No exec had to wait for the database lock. */
+	DECODE(&counters, metrics_counters);
+	munit_assert_int(counters.writers, ==, 0);
+	munit_assert_int(counters.max_writers, ==, 0);
+	munit_assert_int(counters.writer_timeouts, ==, 0);
+	munit_assert_int(counters.stmt_cache_hits, ==, 0);
+	munit_assert_int(counters.stmt_cache_misses, ==, 0);
+
+	return MUNIT_OK;
+}
+
+/* Metrics can be read through the C API too. */
+TEST_CASE(metrics, get, NULL)
+{
+	struct metrics_fixture *f = data;
+	struct registry *registry = CLUSTER_REGISTRY(0);
+	struct dqlite_metrics metrics;
+	(void)params;
+	metrics__get(&registry->metrics, &metrics);
+	munit_assert_int(metrics.requests[DQLITE_REQUEST_OPEN].requests, ==, 1);
+	munit_assert_int(metrics.requests[DQLITE_REQUEST_EXEC].requests, ==, 1);
+	munit_assert_int(metrics.requests[DQLITE_REQUEST_QUERY].requests, ==, 0);
+	munit_assert_int(metrics.apply.count, ==, 1);
+	return MUNIT_OK;
+}
+
+/* Transactions taking longer than the threshold are returned by a slow_txs
+ * request, with the time spent in each stage. */
+TEST_CASE(metrics, slow_txs, NULL)
+{
+	struct metrics_fixture *f = data;
+	struct config *config = CLUSTER_CONFIG(0);
+	struct request_slow_txs request;
+	struct response_slow_txs response;
+	struct response_slow_tx entry;
+	uint64_t stmt_id;
+	(void)params;
+
+	/* Transactions committed before enabling the threshold are not
+	 * tracked. */
+	ENCODE(&request, slow_txs);
+	HANDLE(SLOW_TXS);
+	ASSERT_CALLBACK(0, SLOW_TXS);
+	DECODE(&response, slow_txs);
+	munit_assert_int(response.n, ==, 0);
+
+	/* Hold the transaction open for longer than the threshold before
+	 * letting raft commit it. */
+	config->slow_tx_threshold = 1;
+	PREPARE("INSERT INTO test(n) VALUES(1)");
+	EXEC_SUBMIT(stmt_id);
+	usleep(2000);
+	WAIT;
+	ASSERT_CALLBACK(0, RESULT);
+
+	ENCODE(&request, slow_txs);
+	HANDLE(SLOW_TXS);
+	ASSERT_CALLBACK(0, SLOW_TXS);
+	DECODE(&response, slow_txs);
+	munit_assert_int(response.n, ==, 1);
+	DECODE(&entry, slow_tx);
+	munit_assert_string_equal(entry.filename, "test");
+	munit_assert_int(entry.n, ==, 1);
+	munit_assert_int(entry.total, >=, 2000);
+	munit_assert_int(entry.raft, >=, 2000);
+	munit_assert_int(entry.total, >=,
+			 entry.encode + entry.raft + entry.fsm);
+	munit_assert_int(entry.time, >, 0);
+
+	return MUNIT_OK;
+}
@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../src/metrics.h"
+
+#include "../lib/runner.h"
+
+TEST_MODULE(metrics);
+
+/******************************************************************************
+ *
+ * Fixture
+ *
+ ******************************************************************************/
+
+struct fixture
+{
+	struct histogram histogram;
+	struct metrics metrics;
+};
+
+static void *setup(const MunitParameter params[], void *user_data)
+{
+	struct fixture *f = munit_malloc(sizeof *f);
+	(void)params;
+	(void)user_data;
+	memset(&f->histogram, 0, sizeof f->histogram);
+	metrics__init(&f->metrics);
+	return f;
+}
+
+static void tear_down(void *data)
+{
+	free(data);
+}
+
+/******************************************************************************
+ *
+ * histogram__percentile
+ *
+ ******************************************************************************/
+
+TEST_SUITE(percentile);
+TEST_SETUP(percentile, setup);
+TEST_TEAR_DOWN(percentile, tear_down);
+
+/* An empty histogram has all percentiles at zero. */
+TEST_CASE(percentile, empty, NULL)
+{
+	struct fixture *f = data;
+	(void)params;
+	munit_assert_int(histogram__percentile(&f->histogram, 500), ==, 0);
+	munit_assert_int(histogram__percentile(&f->histogram, 1000), ==, 0);
+	return MUNIT_OK;
+}
+
+/* Small values are recorded exactly. */
+TEST_CASE(percentile, small, NULL)
+{
+	struct fixture *f = data;
+	uint64_t i;
+	(void)params;
+	for (i = 1; i <= 4; i++) {
+		histogram__record(&f->histogram, i);
+	}
+	munit_assert_int(f->histogram.count, ==, 4);
+	munit_assert_int(f->histogram.sum, ==, 10);
+	munit_assert_int(histogram__percentile(&f->histogram, 250), ==, 1);
+	munit_assert_int(histogram__percentile(&f->histogram, 500), ==, 2);
+	munit_assert_int(histogram__percentile(&f->histogram, 1000), ==, 4);
+	return MUNIT_OK;
+}
+
+/* Percentiles of a uniform distribution are within the bucket precision of
+ * the exact value, and never above the maximum. */
+TEST_CASE(percentile, uniform, NULL)
+{
+	struct fixture *f = data;
+	uint64_t p;
+	uint64_t i;
+	(void)params;
+	for (i = 1; i <= 100000; i++) {
+		histogram__record(&f->histogram, i);
+	}
+	munit_assert_int(f->histogram.max, ==, 100000);
+
+	p = histogram__percentile(&f->histogram, 500);
+	munit_assert_int(p, >=, 50000);
+	munit_assert_int(p, <=, 50000 + 50000 / METRICS__SUB_BUCKETS);
+
+	p = histogram__percentile(&f->histogram, 990);
+	munit_assert_int(p, >=, 99000);
+	munit_assert_int(p, <=, 100000);
+
+	munit_assert_int(histogram__percentile(&f->histogram, 1000), ==,
+			 100000);
+	return MUNIT_OK;
+}
+
+/* Huge values end up in the last bucket. */
+TEST_CASE(percentile, huge, NULL)
+{
+	struct fixture *f = data;
+	(void)params;
+	histogram__record(&f->histogram, UINT64_MAX / 2);
+	munit_assert_int(f->histogram.buckets[METRICS__BUCKETS - 1], ==, 1);
+	munit_assert_true(histogram__percentile(&f->histogram, 500) ==
+			  UINT64_MAX / 2);
+	return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * metrics__tx
+ *
+ ******************************************************************************/
+
+TEST_SUITE(tx);
+TEST_SETUP(tx, setup);
+TEST_TEAR_DOWN(tx, tear_down);
+
+/* Record a transaction with the given ID, taking the given total time. */
+static void recordTx(struct fixture *f, uint64_t id, uint64_t total)
+{
+	struct metrics_slow_tx tx;
+	memset(&tx, 0, sizeof tx);
+	tx.id = id;
+	tx.n = 1;
+	tx.total = total;
+	metrics__tx(&f->metrics, "test", &tx, 1000);
+}
+
+/* Every transaction feeds the stage histograms, only slow ones are saved. */
+TEST_CASE(tx, threshold, NULL)
+{
+	struct fixture *f = data;
+	const struct metrics_slow_tx *tx;
+	(void)params;
+	recordTx(f, 1, 999);
+	recordTx(f, 2, 1000);
+	munit_assert_int(f->metrics.tx_total.count, ==, 2);
+	tx = metrics__slow_tx(&f->metrics, 0);
+	munit_assert_ptr_not_null(tx);
+	munit_assert_int(tx->id, ==, 2);
+	munit_assert_string_equal(tx->filename, "test");
+	munit_assert_ptr_null(metrics__slow_tx(&f->metrics, 1));
+	return MUNIT_OK;
+}
+
+/* Once the ring is full, the oldest transactions are overwritten. */
+TEST_CASE(tx, wrap, NULL)
+{
+	struct fixture *f = data;
+	uint64_t id;
+	unsigned i;
+	(void)params;
+	for (id = 1; id <= METRICS__SLOW_TXS + 3; id++) {
+		recordTx(f, id, 5000);
+	}
+	for (i = 0; i < METRICS__SLOW_TXS; i++) {
+		const struct metrics_slow_tx *tx;
+		tx = metrics__slow_tx(&f->metrics, i);
+		munit_assert_ptr_not_null(tx);
+		munit_assert_int(tx->id, ==, METRICS__SLOW_TXS + 3 - i);
+	}
+	munit_assert_ptr_null(metrics__slow_tx(&f->metrics, METRICS__SLOW_TXS));
+	return MUNIT_OK;
+}
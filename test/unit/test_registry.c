@@ -83,3 +83,79 @@ TEST_CASE(db, get_existing, NULL)
 	munit_assert_ptr_equal(db1, db2);
 	return MUNIT_OK;
 }
+
+/* Lookup the db whose transaction has a given ID. */
+TEST_CASE(db, by_tx_id, NULL)
+{
+	struct db_fixture *f = data;
+	struct db *db1;
+	struct db *db2;
+	struct db *db;
+	(void)params;
+	int rc;
+	rc = registry__db_get(&f->registry, "test1.db", &db1);
+	munit_assert_int(rc, ==, 0);
+	rc = registry__db_get(&f->registry, "test2.db", &db2);
+	munit_assert_int(rc, ==, 0);
+	rc = db__open_follower(db1);
+	munit_assert_int(rc, ==, 0);
+	rc = db__open_follower(db2);
+	munit_assert_int(rc, ==, 0);
+	rc = db__create_tx(db1, 1, db1->follower);
+	munit_assert_int(rc, ==, 0);
+	rc = db__create_tx(db2, 2, db2->follower);
+	munit_assert_int(rc, ==, 0);
+	registry__db_by_tx_id(&f->registry, 2, &db);
+	munit_assert_ptr_equal(db, db2);
+	registry__db_by_tx_id(&f->registry, 1, &db);
+	munit_assert_ptr_equal(db, db1);
+	db__delete_tx(db2);
+	registry__db_by_tx_id(&f->registry, 2, &db);
+	munit_assert_ptr_null(db);
+	registry__db_by_tx_id(&f->registry, 3, &db);
+	munit_assert_ptr_null(db);
+	return MUNIT_OK;
+}
+
+/* Number of databases created by the db/many test, each with its database
+ * and WAL files, well beyond the former fixed limit of 64 VFS files. */
+#define MANY_DBS 48
+
+/* There's no cap on the number of databases and VFS files. */
+TEST_CASE(db, many, NULL)
+{
+	struct db_fixture *f = data;
+	int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+	char filename[32];
+	struct db *db;
+	sqlite3 *conn;
+	unsigned i;
+	int rc;
+	(void)params;
+
+	for (i = 0; i < MANY_DBS; i++) {
+		sprintf(filename, "test-%u.db", i);
+		rc = registry__db_get(&f->registry, filename, &db);
+		munit_assert_int(rc, ==, 0);
+		rc = sqlite3_open_v2(filename, &conn, flags, f->config.name);
+		munit_assert_int(rc, ==, SQLITE_OK);
+		rc = sqlite3_exec(conn,
+				  "PRAGMA synchronous=OFF;"
+				  "PRAGMA journal_mode=WAL;"
+				  "CREATE TABLE test (n INT);"
+				  "INSERT INTO test(n) VALUES(1)",
+				  NULL, NULL, NULL);
+		munit_assert_int(rc, ==, SQLITE_OK);
+		rc = sqlite3_close(conn);
+		munit_assert_int(rc, ==, SQLITE_OK);
+	}
+
+	for (i = 0; i < MANY_DBS; i++) {
+		sprintf(filename, "test-%u.db", i);
+		rc = registry__db_get(&f->registry, filename, &db);
+		munit_assert_int(rc, ==, 0);
+		munit_assert_string_equal(db->filename, filename);
+	}
+
+	return MUNIT_OK;
+}
@@ -232,8 +232,9 @@ TEST_CASE(exec, snapshot, NULL)
 	return MUNIT_OK;
 }
 
-/* If a transaction is in progress, no snapshot is taken. */
-TEST_CASE(exec, snapshot_busy, NULL)
+/* If a transaction is in progress, a snapshot is taken anyway, capturing its
+ * uncommitted frames, and the transaction can still be completed. */
+TEST_CASE(exec, snapshot_tx, NULL)
 {
 	struct exec_fixture *f = data;
 	(void)params;
@@ -247,6 +248,7 @@ TEST_CASE(exec, snapshot_busy, NULL)
 	for (i = 0; i < 163; i++) {
 		EXEC_SQL(0, "INSERT INTO test(n) VALUES(1)");
 	}
+	EXEC_SQL(0, "COMMIT");
 	return MUNIT_OK;
 }
 
@@ -303,6 +305,207 @@ TEST_CASE(exec, checkpoint_read_lock, NULL)
 	return MUNIT_OK;
 }
 
+/* Use the i'th leader object against another database of the first node, and
+ * leave it with a write transaction in progress. */
+static void beginOnDatabase(struct exec_fixture *f,
+			    unsigned i,
+			    const char *filename)
+{
+	struct registry *registry = CLUSTER_REGISTRY(0);
+	struct db *db;
+	int rv;
+	leader__close(LEADER(i));
+	rv = registry__db_get(registry, filename, &db);
+	munit_assert_int(rv, ==, 0);
+	leader__init(LEADER(i), db, CLUSTER_RAFT(0));
+	PREPARE(i, "CREATE TABLE test (n  INT)");
+	EXEC(i);
+	CLUSTER_APPLIED(CLUSTER_LAST_INDEX(0));
+	FINALIZE;
+	PREPARE(i, "BEGIN");
+	EXEC(i);
+	FINALIZE;
+	PREPARE(i, "INSERT INTO test(n) VALUES(1)");
+	EXEC(i);
+	FINALIZE;
+}
+
+/* Assert the number of rows of the test table, using the i'th leader. */
+static void assertRows(struct exec_fixture *f, unsigned i, int n)
+{
+	sqlite3_stmt *stmt;
+	int rv;
+	rv = sqlite3_prepare_v2(CONN(i), "SELECT count(*) FROM test", -1,
+				&stmt, NULL);
+	munit_assert_int(rv, ==, 0);
+	rv = sqlite3_step(stmt);
+	munit_assert_int(rv, ==, SQLITE_ROW);
+	munit_assert_int(sqlite3_column_int(stmt, 0), ==, n);
+	sqlite3_finalize(stmt);
+}
+
+static void status_exec_cb(struct exec *req, int status)
+{
+	int *s = req->data;
+	*s = status;
+}
+
+/* A commit happening while another one is being replicated waits for it, and
+ * then gets submitted as the next group. */
+TEST_CASE(exec, group_commit, NULL)
+{
+	struct exec_fixture *f = data;
+	struct exec req2;
+	sqlite3_stmt *stmt2;
+	raft_index index;
+	int status2 = -1;
+	int rv;
+	(void)params;
+	CLUSTER_ELECT(0);
+	EXEC_SQL(0, "CREATE TABLE test (n  INT)");
+	beginOnDatabase(f, 1, "test2.db");
+
+	rv = sqlite3_prepare_v2(CONN(1), "COMMIT", -1, &stmt2, NULL);
+	munit_assert_int(rv, ==, 0);
+	PREPARE(0, "INSERT INTO test(n) VALUES(1)");
+	index = CLUSTER_LAST_INDEX(0);
+	EXEC(0);
+	munit_assert_int(CLUSTER_LAST_INDEX(0), ==, index + 1);
+
+	req2.data = &status2;
+	rv = leader__exec(LEADER(1), &req2, stmt2, status_exec_cb);
+	munit_assert_int(rv, ==, 0);
+	munit_assert_int(CLUSTER_LAST_INDEX(0), ==, index + 1);
+
+	CLUSTER_APPLIED(index + 2);
+	munit_assert_int(f->status, ==, SQLITE_DONE);
+	munit_assert_int(status2, ==, SQLITE_DONE);
+
+	FINALIZE;
+	sqlite3_finalize(stmt2);
+	return MUNIT_OK;
+}
+
+/* Commits against two other databases that are issued while a commit is being
+ * replicated form a group, which is replicated as a single entry. */
+TEST_CASE(exec, group_commit_many, NULL)
+{
+	struct exec_fixture *f = data;
+	struct exec req2;
+	struct exec req3;
+	sqlite3_stmt *stmt2;
+	sqlite3_stmt *stmt3;
+	raft_index index;
+	int status2 = -1;
+	int status3 = -1;
+	int rv;
+	(void)params;
+	CLUSTER_ELECT(0);
+	EXEC_SQL(0, "CREATE TABLE test (n  INT)");
+	beginOnDatabase(f, 1, "test2.db");
+	beginOnDatabase(f, 2, "test3.db");
+
+	rv = sqlite3_prepare_v2(CONN(1), "COMMIT", -1, &stmt2, NULL);
+	munit_assert_int(rv, ==, 0);
+	rv = sqlite3_prepare_v2(CONN(2), "COMMIT", -1, &stmt3, NULL);
+	munit_assert_int(rv, ==, 0);
+	PREPARE(0, "INSERT INTO test(n) VALUES(1)");
+	index = CLUSTER_LAST_INDEX(0);
+	EXEC(0);
+
+	req2.data = &status2;
+	rv = leader__exec(LEADER(1), &req2, stmt2, status_exec_cb);
+	munit_assert_int(rv, ==, 0);
+	req3.data = &status3;
+	rv = leader__exec(LEADER(2), &req3, stmt3, status_exec_cb);
+	munit_assert_int(rv, ==, 0);
+	munit_assert_int(CLUSTER_LAST_INDEX(0), ==, index + 1);
+
+	/* Both queued commits get submitted once the first one is applied. */
+	CLUSTER_APPLIED(index + 1);
+	munit_assert_int(f->status, ==, SQLITE_DONE);
+	munit_assert_int(CLUSTER_LAST_INDEX(0), ==, index + 2);
+	munit_assert_int(status2, ==, -1);
+	munit_assert_int(status3, ==, -1);
+
+	CLUSTER_APPLIED(index + 2);
+	munit_assert_int(status2, ==, SQLITE_DONE);
+	munit_assert_int(status3, ==, SQLITE_DONE);
+
+	assertRows(f, 0, 1);
+	assertRows(f, 1, 1);
+	assertRows(f, 2, 1);
+
+	FINALIZE;
+	sqlite3_finalize(stmt2);
+	sqlite3_finalize(stmt3);
+	return MUNIT_OK;
+}
+
+/* If group commit is disabled, every commit is submitted right away. */
+TEST_CASE(exec, group_commit_disabled, NULL)
+{
+	struct exec_fixture *f = data;
+	struct config *config = CLUSTER_CONFIG(0);
+	struct exec req2;
+	sqlite3_stmt *stmt2;
+	raft_index index;
+	int status2 = -1;
+	int rv;
+	(void)params;
+	config->group_commit_size = 0;
+	CLUSTER_ELECT(0);
+	EXEC_SQL(0, "CREATE TABLE test (n  INT)");
+	beginOnDatabase(f, 1, "test2.db");
+
+	rv = sqlite3_prepare_v2(CONN(1), "COMMIT", -1, &stmt2, NULL);
+	munit_assert_int(rv, ==, 0);
+	PREPARE(0, "INSERT INTO test(n) VALUES(1)");
+	index = CLUSTER_LAST_INDEX(0);
+	EXEC(0);
+
+	req2.data = &status2;
+	rv = leader__exec(LEADER(1), &req2, stmt2, status_exec_cb);
+	munit_assert_int(rv, ==, 0);
+	munit_assert_int(CLUSTER_LAST_INDEX(0), ==, index + 2);
+
+	CLUSTER_APPLIED(index + 2);
+	munit_assert_int(f->status, ==, SQLITE_DONE);
+	munit_assert_int(status2, ==, SQLITE_DONE);
+
+	FINALIZE;
+	sqlite3_finalize(stmt2);
+	return MUNIT_OK;
+}
+
+/* If a group window is set, a commit waits for the window to end even if no
+ * other commit is being replicated. */
+TEST_CASE(exec, group_commit_window, NULL)
+{
+	struct exec_fixture *f = data;
+	struct config *config = CLUSTER_CONFIG(0);
+	raft_index index;
+	(void)params;
+	CLUSTER_ELECT(0);
+	EXEC_SQL(0, "CREATE TABLE test (n  INT)");
+	config->group_commit_window = 100;
+
+	PREPARE(0, "INSERT INTO test(n) VALUES(1)");
+	index = CLUSTER_LAST_INDEX(0);
+	EXEC(0);
+	munit_assert_int(CLUSTER_LAST_INDEX(0), ==, index);
+
+	replication__flush(CLUSTER_REPLICATION(0));
+	munit_assert_int(CLUSTER_LAST_INDEX(0), ==, index + 1);
+
+	CLUSTER_APPLIED(index + 1);
+	munit_assert_int(f->status, ==, SQLITE_DONE);
+	assertRows(f, 0, 1);
+
+	FINALIZE;
+	return MUNIT_OK;
+}
+
 TEST_GROUP(exec, error);
 
 /* The local server is not the leader. */
@@ -12,11 +12,11 @@ TEST_MODULE(tuple);
  *
  ******************************************************************************/
 
-#define DECODER_INIT(N)                                          \
-	{                                                        \
-		int rc2;                                         \
-		rc2 = tuple_decoder__init(&decoder, N, &cursor); \
-		munit_assert_int(rc2, ==, 0);                    \
+#define DECODER_INIT(N, FORMAT)                                          \
+	{                                                                \
+		int rc2;                                                 \
+		rc2 = tuple_decoder__init(&decoder, N, FORMAT, &cursor); \
+		munit_assert_int(rc2, ==, 0);                            \
 	}
 
 #define DECODER_NEXT                                         \
@@ -67,7 +67,7 @@ TEST_CASE(decoder, init, param, NULL)
 	struct cursor cursor = {buf, sizeof buf};
 	(void)data;
 	(void)params;
-	DECODER_INIT(0);
+	DECODER_INIT(0, TUPLE__PARAMS);
 	munit_assert_int(decoder.n, ==, 2);
 	munit_assert_int(tuple_decoder__n(&decoder), ==, 2);
 	return MUNIT_OK;
@@ -81,7 +81,7 @@ TEST_CASE(decoder, init, row, NULL)
 	struct cursor cursor = {buf, sizeof buf};
 	(void)data;
 	(void)params;
-	DECODER_INIT(3);
+	DECODER_INIT(3, TUPLE__ROW);
 	munit_assert_int(decoder.n, ==, 3);
 	munit_assert_int(tuple_decoder__n(&decoder), ==, 3);
 	return MUNIT_OK;
@@ -103,7 +103,7 @@ TEST_CASE(decoder, row, one_value, NULL)
 	(void)data;
 	(void)params;
 
-	DECODER_INIT(1);
+	DECODER_INIT(1, TUPLE__ROW);
 	DECODER_NEXT;
 
 	ASSERT_VALUE_TYPE(SQLITE_INTEGER);
@@ -127,7 +127,7 @@ TEST_CASE(decoder, row, two_values, NULL)
 	(void)data;
 	(void)params;
 
-	DECODER_INIT(2);
+	DECODER_INIT(2, TUPLE__ROW);
 	DECODER_NEXT;
 
 	ASSERT_VALUE_TYPE(SQLITE_INTEGER);
@@ -157,7 +157,7 @@ TEST_CASE(decoder, params, one_value, NULL)
 	(void)data;
 	(void)params;
 
-	DECODER_INIT(0);
+	DECODER_INIT(0, TUPLE__PARAMS);
 	DECODER_NEXT;
 
 	ASSERT_VALUE_TYPE(SQLITE_INTEGER);
@@ -181,7 +181,7 @@ TEST_CASE(decoder, params, two_values, NULL)
 	(void)data;
 	(void)params;
 
-	DECODER_INIT(0);
+	DECODER_INIT(0, TUPLE__PARAMS);
 	DECODER_NEXT;
 
 	ASSERT_VALUE_TYPE(SQLITE_INTEGER);
@@ -195,6 +195,35 @@ TEST_CASE(decoder, params, two_values, NULL)
 	return MUNIT_OK;
 }
 
+/* Decode a tuple with wide params format. */
+TEST_CASE(decoder, params, wide, NULL)
+{
+	struct tuple_decoder decoder;
+	uint8_t buf[][8] = {
+	    {0, 0, 0, 0, 0, 0, 0, 0},
+	    {7, 0, 0, 0, 0, 0, 0, 0},
+	};
+	struct cursor cursor = {buf, sizeof buf};
+	struct value value;
+	uint32_t n = 1;
+	void *header = buf[0];
+
+	(void)data;
+	(void)params;
+
+	uint32__encode(&n, &header);
+	buf[0][4] = SQLITE_INTEGER;
+
+	DECODER_INIT(0, TUPLE__PARAMS32);
+	munit_assert_int(tuple_decoder__n(&decoder), ==, 1);
+	DECODER_NEXT;
+
+	ASSERT_VALUE_TYPE(SQLITE_INTEGER);
+	munit_assert_int(value.integer, ==, 7);
+
+	return MUNIT_OK;
+}
+
 TEST_GROUP(decoder, type);
 
 /* Decode a floating point number. */
@@ -215,7 +244,7 @@ TEST_CASE(decoder, type, float, NULL)
 	memcpy(buf[1], &pi, sizeof pi);
 	*(uint64_t *)buf[1] = byte__flip64(*(uint64_t *)buf[1]);
 
-	DECODER_INIT(1);
+	DECODER_INIT(1, TUPLE__ROW);
 	DECODER_NEXT;
 
 	ASSERT_VALUE_TYPE(SQLITE_FLOAT);
@@ -238,7 +267,7 @@ TEST_CASE(decoder, type, null, NULL)
 	(void)data;
 	(void)params;
 
-	DECODER_INIT(1);
+	DECODER_INIT(1, TUPLE__ROW);
 	DECODER_NEXT;
 
 	ASSERT_VALUE_TYPE(SQLITE_NULL);
@@ -261,7 +290,7 @@ TEST_CASE(decoder, type, iso8601, NULL)
 
 	strcpy((char *)buf[1], "2018-07-20 09:49:05+00:00");
 
-	DECODER_INIT(1);
+	DECODER_INIT(1, TUPLE__ROW);
 	DECODER_NEXT;
 
 	ASSERT_VALUE_TYPE(DQLITE_ISO8601);
@@ -284,7 +313,7 @@ TEST_CASE(decoder, type, boolean, NULL)
 	(void)data;
 	(void)params;
 
-	DECODER_INIT(1);
+	DECODER_INIT(1, TUPLE__ROW);
 	DECODER_NEXT;
 
 	ASSERT_VALUE_TYPE(DQLITE_BOOLEAN);
@@ -420,6 +449,43 @@ TEST_CASE(encoder, params, two_values, NULL)
 	return MUNIT_OK;
 }
 
+/* Encode a tuple with wide params format and more than 255 values, then decode
+ * it back. */
+TEST_CASE(encoder, params, wide, NULL)
+{
+	struct encoder_fixture *f = data;
+	struct tuple_decoder decoder;
+	struct cursor cursor;
+	struct value value;
+	unsigned i;
+	(void)params;
+
+	ENCODER_INIT(300, TUPLE__PARAMS32);
+
+	for (i = 0; i < 300; i++) {
+		value.type = SQLITE_INTEGER;
+		value.integer = i;
+		ENCODER_NEXT;
+	}
+
+	/* 4 bytes of count and 300 type slots, padded to 38 words, followed by
+	 * 300 integers. */
+	munit_assert_int(buffer__offset(&f->buffer), ==, (38 + 300) * 8);
+
+	cursor.p = f->buffer.data;
+	cursor.cap = buffer__offset(&f->buffer);
+	DECODER_INIT(0, TUPLE__PARAMS32);
+	munit_assert_int(tuple_decoder__n(&decoder), ==, 300);
+	for (i = 0; i < 300; i++) {
+		DECODER_NEXT;
+		ASSERT_VALUE_TYPE(SQLITE_INTEGER);
+		munit_assert_int(value.integer, ==, i);
+	}
+	munit_assert_int(cursor.cap, ==, 0);
+
+	return MUNIT_OK;
+}
+
 TEST_GROUP(encoder, type);
 
 /* Encode a float parameter. */
@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <string.h>
 
 #include <sqlite3.h>
 #include <raft.h>
@@ -150,6 +151,19 @@ static void *__buf_page_2()
 	return buf;
 }
 
+/* Helper for writing the n'th page of a database file with a page size of 512
+ * bytes. */
+static void __file_write_page(sqlite3_file *file, unsigned n)
+{
+	void *buf = n == 1 ? __buf_page_1() : __buf_page_2();
+	int rc;
+
+	rc = file->pMethods->xWrite(file, buf, 512, (n - 1) * 512);
+	munit_assert_int(rc, ==, 0);
+
+	free(buf);
+}
+
 /* Helper to execute a SQL statement. */
 static void __db_exec(sqlite3 *db, const char *sql)
 {
@@ -345,8 +359,8 @@ TEST_CASE(open, noent, NULL)
 	return MUNIT_OK;
 }
 
-/* There's an hard-coded limit for the number of files that can be opened. */
-TEST_CASE(open, enfile, NULL)
+/* There's no hard-coded limit for the number of files that can be opened. */
+TEST_CASE(open, many, NULL)
 {
 	struct fixture *f = data;
 	sqlite3_file *file = munit_malloc(f->vfs.szOsFile);
@@ -360,16 +374,19 @@ TEST_CASE(open, enfile, NULL)
 
 	flags = SQLITE_OPEN_CREATE | SQLITE_OPEN_MAIN_DB;
 
-	for (i = 0; i < 64; i++) {
+	for (i = 0; i < 1000; i++) {
 		sprintf(name, "test-%d.db", i);
 		rc = f->vfs.xOpen(&f->vfs, name, file, flags, &flags);
 		munit_assert_int(rc, ==, 0);
 	}
 
-	rc = f->vfs.xOpen(&f->vfs, "test-64.db", file, flags, &flags);
-
-	munit_assert_int(rc, ==, SQLITE_CANTOPEN);
-	munit_assert_int(ENFILE, ==, f->vfs.xGetLastError(&f->vfs, 0, 0));
+	/* Files can still be looked up. */
+	flags = SQLITE_OPEN_MAIN_DB;
+	for (i = 0; i < 1000; i++) {
+		sprintf(name, "test-%d.db", i);
+		rc = f->vfs.xOpen(&f->vfs, name, file, flags, &flags);
+		munit_assert_int(rc, ==, 0);
+	}
 
 	free(file);
 
@@ -976,7 +993,7 @@ TEST_CASE(write, and_read_wal_frames, NULL)
 	return MUNIT_OK;
 }
 
-/* Out of memory when trying to create a new page. */
+/* Out of memory when trying to allocate the slab for a new page. */
 TEST_CASE(write, oom_page, NULL)
 {
 	struct fixture *f = data;
@@ -1002,8 +1019,8 @@ TEST_CASE(write, oom_page, NULL)
 	return MUNIT_OK;
 }
 
-/* Out of memory when trying to append a new page to the internal page array of
- * the content object. */
+/* Out of memory when trying to allocate the page directory of the content
+ * object. */
 TEST_CASE(write, oom_page_array, NULL)
 {
 	struct fixture *f = data;
@@ -1012,7 +1029,7 @@ TEST_CASE(write, oom_page_array, NULL)
 	char buf[512];
 	int rc;
 
-	test_heap_fault_config(2, 1);
+	test_heap_fault_config(1, 1);
 	test_heap_fault_enable();
 
 	(void)params;
@@ -1029,8 +1046,9 @@ TEST_CASE(write, oom_page_array, NULL)
 	return MUNIT_OK;
 }
 
-/* Out of memory when trying to create the content buffer of a new page. */
-TEST_CASE(write, oom_page_buf, NULL)
+/* Out of memory when trying to allocate the first chunk of the page directory
+ * of the content object. */
+TEST_CASE(write, oom_page_chunk, NULL)
 {
 	struct fixture *f = data;
 	sqlite3_file *file = __file_create_main_db(&f->vfs);
@@ -1038,7 +1056,7 @@ TEST_CASE(write, oom_page_buf, NULL)
 	char buf[512];
 	int rc;
 
-	test_heap_fault_config(1, 1);
+	test_heap_fault_config(2, 1);
 	test_heap_fault_enable();
 
 	(void)params;
@@ -1055,8 +1073,10 @@ TEST_CASE(write, oom_page_buf, NULL)
 	return MUNIT_OK;
 }
 
-/* Out of memory when trying to create the header buffer of a new WAL page. */
-TEST_CASE(write, oom_page_hdr, NULL)
+/* Out of memory when trying to append the first page of a WAL file to its page
+ * directory. The page itself is carved out of the slab already allocated for the
+ * database file, since they have the same page size. */
+TEST_CASE(write, oom_wal_page_array, NULL)
 {
 	struct fixture *f = data;
 	sqlite3_file *file1 = __file_create_main_db(&f->vfs);
@@ -1071,7 +1091,7 @@ TEST_CASE(write, oom_page_hdr, NULL)
 
 	memset(buf, 0, 512);
 
-	test_heap_fault_config(6, 1);
+	test_heap_fault_config(4, 1);
 	test_heap_fault_enable();
 
 	/* First write the main database header, which sets the page size. */
@@ -1225,6 +1245,55 @@ TEST_CASE(truncate, database, NULL)
 	return MUNIT_OK;
 }
 
+/* Truncate a database file spanning several chunks of the page directory. */
+TEST_CASE(truncate, many_pages, NULL)
+{
+	struct fixture *f = data;
+	sqlite3_file *file = __file_create_main_db(&f->vfs);
+	char buf[512];
+	sqlite_int64 size;
+	unsigned i;
+	int rc;
+
+	(void)params;
+
+	for (i = 1; i <= 2000; i++) {
+		__file_write_page(file, i);
+	}
+
+	rc = file->pMethods->xFileSize(file, &size);
+	munit_assert_int(rc, ==, 0);
+	munit_assert_int(size, ==, 2000 * 512);
+
+	/* Shrink the file to a size which falls in the middle of a chunk. */
+	rc = file->pMethods->xTruncate(file, 700 * 512);
+	munit_assert_int(rc, ==, 0);
+
+	rc = file->pMethods->xFileSize(file, &size);
+	munit_assert_int(rc, ==, 0);
+	munit_assert_int(size, ==, 700 * 512);
+
+	/* Grow it again. */
+	for (i = 701; i <= 1100; i++) {
+		__file_write_page(file, i);
+	}
+
+	rc = file->pMethods->xRead(file, buf, 512, 0);
+	munit_assert_int(rc, ==, 0);
+	munit_assert_int(buf[101], ==, 1);
+
+	for (i = 2; i <= 1100; i++) {
+		rc = file->pMethods->xRead(file, buf, 512, (i - 1) * 512);
+		munit_assert_int(rc, ==, 0);
+		munit_assert_int(buf[0], ==, 4);
+		munit_assert_int(buf[511], ==, 6);
+	}
+
+	free(file);
+
+	return MUNIT_OK;
+}
+
 /* Truncate the WAL file. */
 TEST_CASE(truncate, wal, NULL)
 {
@@ -1612,6 +1681,205 @@ TEST_CASE(shm_lock, release, NULL)
 	return MUNIT_OK;
 }
 
+/******************************************************************************
+ *
+ * xFetch/xUnfetch
+ *
+ ******************************************************************************/
+
+TEST_SUITE(fetch);
+TEST_SETUP(fetch, setup);
+TEST_TEAR_DOWN(fetch, tear_down);
+
+/* Fetching a database page returns a pointer to its content. */
+TEST_CASE(fetch, page, NULL)
+{
+	struct fixture *f = data;
+	sqlite3_file *file = __file_create_main_db(&f->vfs);
+	uint8_t *page;
+	int rc;
+
+	(void)params;
+
+	__file_write_page(file, 1);
+	__file_write_page(file, 2);
+
+	rc = file->pMethods->xFetch(file, 512, 512, (void **)&page);
+	munit_assert_int(rc, ==, 0);
+	munit_assert_ptr_not_null(page);
+
+	munit_assert_int(page[0], ==, 4);
+	munit_assert_int(page[256], ==, 5);
+	munit_assert_int(page[511], ==, 6);
+
+	rc = file->pMethods->xUnfetch(file, 512, page);
+	munit_assert_int(rc, ==, 0);
+
+	free(file);
+
+	return MUNIT_OK;
+}
+
+/* Fetching a page that doesn't exist, or a partial or misaligned page, returns
+ * a NULL pointer, so SQLite falls back to xRead. */
+TEST_CASE(fetch, fallback, NULL)
+{
+	struct fixture *f = data;
+	sqlite3_file *file = __file_create_main_db(&f->vfs);
+	void *page;
+	int rc;
+
+	(void)params;
+
+	rc = file->pMethods->xFetch(file, 0, 512, &page);
+	munit_assert_int(rc, ==, 0);
+	munit_assert_ptr_null(page);
+
+	__file_write_page(file, 1);
+
+	rc = file->pMethods->xFetch(file, 512, 512, &page);
+	munit_assert_int(rc, ==, 0);
+	munit_assert_ptr_null(page);
+
+	rc = file->pMethods->xFetch(file, 0, 100, &page);
+	munit_assert_int(rc, ==, 0);
+	munit_assert_ptr_null(page);
+
+	rc = file->pMethods->xFetch(file, 100, 512, &page);
+	munit_assert_int(rc, ==, 0);
+	munit_assert_ptr_null(page);
+
+	rc = file->pMethods->xUnfetch(file, 0, NULL);
+	munit_assert_int(rc, ==, 0);
+
+	free(file);
+
+	return MUNIT_OK;
+}
+
+/* A fetched page is not released if the file gets truncated, until it's
+ * unfetched. */
+TEST_CASE(fetch, truncate, NULL)
+{
+	struct fixture *f = data;
+	sqlite3_file *file1 = __file_create_main_db(&f->vfs);
+	sqlite3_file *file2 = __file_create(&f->vfs, "test2.db",
+					    SQLITE_OPEN_MAIN_DB);
+	uint8_t *page;
+	int rc;
+
+	(void)params;
+
+	__file_write_page(file1, 1);
+	__file_write_page(file2, 1);
+	__file_write_page(file2, 2);
+
+	rc = file2->pMethods->xFetch(file2, 512, 512, (void **)&page);
+	munit_assert_int(rc, ==, 0);
+	munit_assert_ptr_not_null(page);
+
+	rc = file2->pMethods->xTruncate(file2, 0);
+	munit_assert_int(rc, ==, 0);
+
+	/* Allocate a new page, which must not reuse the fetched one. */
+	__file_write_page(file1, 2);
+
+	munit_assert_int(page[0], ==, 4);
+	munit_assert_int(page[511], ==, 6);
+
+	rc = file2->pMethods->xUnfetch(file2, 512, page);
+	munit_assert_int(rc, ==, 0);
+
+	free(file1);
+	free(file2);
+
+	return MUNIT_OK;
+}
+
+/* Number of xFetch calls that returned a page, counted by __fetch_counted. */
+static unsigned __fetch_count;
+
+/* Original xFetch method wrapped by __fetch_counted. */
+static int (*__fetch_orig)(sqlite3_file *, sqlite3_int64, int, void **);
+
+static int __fetch_counted(sqlite3_file *file,
+			   sqlite3_int64 offset,
+			   int amount,
+			   void **out)
+{
+	int rv = __fetch_orig(file, offset, amount, out);
+	if (rv == SQLITE_OK && *out != NULL) {
+		__fetch_count++;
+	}
+	return rv;
+}
+
+/* SQLite reads pages through xFetch when memory-mapping is enabled. */
+TEST_CASE(fetch, mmap, NULL)
+{
+	struct fixture *f = data;
+	sqlite3 *db1 = __db_open();
+	sqlite3 *db2;
+	sqlite3_stmt *stmt;
+	sqlite3_file *file;
+	const sqlite3_io_methods *methods;
+	sqlite3_io_methods counted;
+	int log;
+	int ckpt;
+	int i;
+	int rv;
+
+	(void)params;
+
+	__db_exec(db1, "CREATE TABLE test (n INT)");
+	__db_exec(db1, "BEGIN");
+	for (i = 0; i < 500; i++) {
+		__db_exec(db1, "INSERT INTO test(n) VALUES(123)");
+	}
+	__db_exec(db1, "COMMIT");
+
+	/* Move all pages to the database file. */
+	rv = sqlite3_wal_checkpoint_v2(db1, "main", SQLITE_CHECKPOINT_TRUNCATE,
+				       &log, &ckpt);
+	munit_assert_int(rv, ==, 0);
+
+	/* Use a new connection, whose page cache is empty, and count the pages
+	 * that SQLite fetches through its database file. */
+	db2 = __db_open();
+	rv = sqlite3_file_control(db2, "main", SQLITE_FCNTL_FILE_POINTER,
+				  &file);
+	munit_assert_int(rv, ==, SQLITE_OK);
+	methods = file->pMethods;
+	counted = *methods;
+	__fetch_orig = methods->xFetch;
+	__fetch_count = 0;
+	counted.xFetch = __fetch_counted;
+	file->pMethods = &counted;
+
+	__db_exec(db2, "PRAGMA mmap_size=1048576");
+
+	rv = sqlite3_prepare_v2(db2, "SELECT SUM(n) FROM test", -1, &stmt,
+				NULL);
+	munit_assert_int(rv, ==, SQLITE_OK);
+	rv = sqlite3_step(stmt);
+	munit_assert_int(rv, ==, SQLITE_ROW);
+	munit_assert_int(sqlite3_column_int(stmt, 0), ==, 500 * 123);
+
+	munit_assert_int(__fetch_count, >, 0);
+
+	sqlite3_finalize(stmt);
+
+	/* No page was copied or leaked. */
+	munit_assert_int(vfsSlabCount(&f->vfs), ==, 1);
+
+	file->pMethods = methods;
+
+	__db_close(db2);
+	__db_close(db1);
+
+	return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * xFileControl
@@ -1742,7 +2010,7 @@ TEST_SUITE(create);
 TEST_SETUP(create, setup);
 TEST_TEAR_DOWN(create, tear_down);
 
-static char *test_create_oom_delay[] = {"0", "1", NULL};
+static char *test_create_oom_delay[] = {"0", NULL};
 static char *test_create_oom_repeat[] = {"1", NULL};
 
 static MunitParameterEnum test_create_oom_params[] = {
@@ -2162,3 +2430,801 @@ TEST_CASE(file_read, oom, file_read_oom_params)
 
 	return MUNIT_OK;
 }
+
+/******************************************************************************
+ *
+ * Shallow snapshots
+ *
+ ******************************************************************************/
+
+TEST_SUITE(shallow_snapshot);
+TEST_SETUP(shallow_snapshot, setup);
+TEST_TEAR_DOWN(shallow_snapshot, tear_down);
+
+/* Take a shallow snapshot of the test database, returning its buffers and
+ * their number. */
+static struct raft_buffer *__shallow_snapshot(sqlite3_vfs *vfs,
+					      unsigned *n,
+					      struct vfsSnapshotInfo *info)
+{
+	struct raft_buffer *bufs;
+	int rv;
+
+	rv = vfsShallowSnapshotLen(vfs->zName, "test.db", n);
+	munit_assert_int(rv, ==, 0);
+
+	bufs = munit_malloc(*n * sizeof *bufs);
+
+	rv = vfsShallowSnapshot(vfs->zName, "test.db", bufs, *n, info);
+	munit_assert_int(rv, ==, 0);
+
+	return bufs;
+}
+
+/* Concatenate the given snapshot buffers into a single one. */
+static uint8_t *__shallow_snapshot_concat(struct raft_buffer *bufs,
+					  unsigned n,
+					  size_t size)
+{
+	uint8_t *data = munit_malloc(size);
+	size_t offset = 0;
+	unsigned i;
+
+	for (i = 0; i < n; i++) {
+		munit_assert_int(offset + bufs[i].len, <=, size);
+		memcpy(data + offset, bufs[i].base, bufs[i].len);
+		offset += bufs[i].len;
+	}
+	munit_assert_int(offset, ==, size);
+
+	return data;
+}
+
+/* The snapshot buffers match the content of the database and WAL files. */
+TEST_CASE(shallow_snapshot, content, NULL)
+{
+	struct fixture *f = data;
+	sqlite3 *db = __db_open();
+	struct raft_buffer *bufs;
+	unsigned n;
+	struct vfsSnapshotInfo info;
+	void *main_buf;
+	void *wal_buf;
+	size_t main_len;
+	size_t wal_len;
+	uint8_t *snapshot;
+	int rv;
+
+	__db_exec(db, "CREATE TABLE test (n INT)");
+	__db_exec(db, "INSERT INTO test(n) VALUES(1)");
+
+	(void)params;
+
+	bufs = __shallow_snapshot(&f->vfs, &n, &info);
+
+	rv = vfsFileRead(f->vfs.zName, "test.db", &main_buf, &main_len);
+	munit_assert_int(rv, ==, 0);
+	rv = vfsFileRead(f->vfs.zName, "test.db-wal", &wal_buf, &wal_len);
+	munit_assert_int(rv, ==, 0);
+
+	munit_assert_int(info.main_size, ==, main_len);
+	munit_assert_int(info.wal_size, ==, wal_len);
+	munit_assert_int(info.wal_size, >, 0);
+	munit_assert_int(info.n_pending, ==, 0);
+
+	/* One buffer for each page, one for the WAL header and one for each
+	 * frame. */
+	munit_assert_int(n, ==, main_len / 512 + 1 + (wal_len - 32) / 536);
+
+	snapshot = __shallow_snapshot_concat(bufs, n, info.main_size + info.wal_size);
+	munit_assert_int(memcmp(snapshot, main_buf, main_len), ==, 0);
+	munit_assert_int(memcmp(snapshot + main_len, wal_buf, wal_len), ==, 0);
+
+	vfsShallowSnapshotRelease(f->vfs.zName, info.image);
+
+	raft_free(main_buf);
+	raft_free(wal_buf);
+	free(snapshot);
+	free(bufs);
+
+	__db_close(db);
+
+	return MUNIT_OK;
+}
+
+/* Writes and checkpoints performed after taking a snapshot don't affect it. */
+TEST_CASE(shallow_snapshot, copy_on_write, NULL)
+{
+	struct fixture *f = data;
+	sqlite3 *db = __db_open();
+	struct raft_buffer *bufs;
+	unsigned n;
+	struct vfsSnapshotInfo info;
+	uint8_t *before;
+	uint8_t *after;
+	int log;
+	int ckpt;
+	int i;
+	int rv;
+
+	(void)params;
+
+	__db_exec(db, "CREATE TABLE test (n INT)");
+	__db_exec(db, "INSERT INTO test(n) VALUES(1)");
+	rv = sqlite3_wal_checkpoint_v2(db, "main", SQLITE_CHECKPOINT_TRUNCATE,
+				       &log, &ckpt);
+	munit_assert_int(rv, ==, 0);
+	__db_exec(db, "INSERT INTO test(n) VALUES(2)");
+
+	bufs = __shallow_snapshot(&f->vfs, &n, &info);
+	before = __shallow_snapshot_concat(bufs, n, info.main_size + info.wal_size);
+
+	/* Modify the database pages, reset the WAL and write it again. */
+	for (i = 0; i < 100; i++) {
+		__db_exec(db, "UPDATE test SET n = n + 1");
+	}
+	rv = sqlite3_wal_checkpoint_v2(db, "main", SQLITE_CHECKPOINT_TRUNCATE,
+				       &log, &ckpt);
+	munit_assert_int(rv, ==, 0);
+	__db_exec(db, "DELETE FROM test");
+
+	after = __shallow_snapshot_concat(bufs, n, info.main_size + info.wal_size);
+	munit_assert_int(memcmp(before, after, info.main_size + info.wal_size), ==, 0);
+
+	vfsShallowSnapshotRelease(f->vfs.zName, info.image);
+
+	free(before);
+	free(after);
+	free(bufs);
+
+	__db_close(db);
+
+	return MUNIT_OK;
+}
+
+/* The frames written by a transaction in progress are captured separately
+ * from the committed ones, and frames of rolled back transactions are left
+ * out. */
+TEST_CASE(shallow_snapshot, pending, NULL)
+{
+	struct fixture *f = data;
+	sqlite3 *db = __db_open();
+	struct raft_buffer *bufs;
+	struct vfsSnapshotInfo info;
+	unsigned n;
+	size_t committed;
+	void *wal_buf;
+	size_t wal_len;
+	uint8_t *snapshot;
+	int i;
+	int rv;
+
+	(void)params;
+
+	__db_exec(db, "PRAGMA cache_size=1");
+	__db_exec(db, "CREATE TABLE test (n BLOB)");
+
+	bufs = __shallow_snapshot(&f->vfs, &n, &info);
+	committed = info.wal_size;
+	munit_assert_int(info.n_pending, ==, 0);
+	vfsShallowSnapshotRelease(f->vfs.zName, info.image);
+	free(bufs);
+
+	/* Spill uncommitted pages to the WAL. */
+	__db_exec(db, "BEGIN");
+	for (i = 0; i < 20; i++) {
+		__db_exec(db, "INSERT INTO test(n) VALUES(zeroblob(256))");
+	}
+
+	rv = vfsFileRead(f->vfs.zName, "test.db-wal", &wal_buf, &wal_len);
+	munit_assert_int(rv, ==, 0);
+	munit_assert_int(wal_len, >, committed);
+
+	bufs = __shallow_snapshot(&f->vfs, &n, &info);
+	munit_assert_int(info.wal_size, ==, committed);
+	munit_assert_int(info.n_pending, >, 0);
+	munit_assert_int(committed + info.n_pending * (24 + 512), ==, wal_len);
+
+	/* The pending frames follow the committed ones. */
+	snapshot = __shallow_snapshot_concat(bufs, n, info.main_size + wal_len);
+	munit_assert_int(
+	    memcmp(snapshot + info.main_size, wal_buf, wal_len), ==, 0);
+
+	vfsShallowSnapshotRelease(f->vfs.zName, info.image);
+	raft_free(wal_buf);
+	free(snapshot);
+	free(bufs);
+
+	__db_exec(db, "ROLLBACK");
+
+	bufs = __shallow_snapshot(&f->vfs, &n, &info);
+	munit_assert_int(info.wal_size, ==, committed);
+	munit_assert_int(info.n_pending, ==, 0);
+	vfsShallowSnapshotRelease(f->vfs.zName, info.image);
+	free(bufs);
+
+	__db_close(db);
+
+	return MUNIT_OK;
+}
+
+/* Pages captured by a snapshot are released only when the snapshot is, and
+ * when no more needed by the next snapshot. */
+TEST_CASE(shallow_snapshot, release, NULL)
+{
+	struct fixture *f = data;
+	sqlite3_file *file = __file_create_main_db(&f->vfs);
+	struct raft_buffer *bufs;
+	unsigned n;
+	struct vfsSnapshotInfo info;
+	int rc;
+
+	(void)params;
+
+	__file_write_page(file, 1);
+	__file_write_page(file, 2);
+
+	bufs = __shallow_snapshot(&f->vfs, &n, &info);
+	munit_assert_int(n, ==, 2);
+	munit_assert_int(info.main_size, ==, 1024);
+	munit_assert_int(info.wal_size, ==, 0);
+
+	/* Overwriting a page makes a copy of it. */
+	__file_write_page(file, 2);
+	munit_assert_int(((uint8_t *)bufs[1].base)[0], ==, 4);
+
+	rc = file->pMethods->xTruncate(file, 0);
+	munit_assert_int(rc, ==, 0);
+
+	munit_assert_int(((uint8_t *)bufs[0].base)[101], ==, 1);
+	munit_assert_int(((uint8_t *)bufs[1].base)[511], ==, 6);
+
+	vfsShallowSnapshotRelease(f->vfs.zName, info.image);
+	free(bufs);
+
+	/* The file is now empty, so the next snapshot drops the pages. */
+	bufs = __shallow_snapshot(&f->vfs, &n, &info);
+	munit_assert_int(n, ==, 0);
+	vfsShallowSnapshotRelease(f->vfs.zName, info.image);
+
+	/* Only the spare slab is left. */
+	munit_assert_int(vfsSlabCount(&f->vfs), ==, 1);
+
+	free(bufs);
+	file->pMethods->xClose(file);
+	free(file);
+
+	return MUNIT_OK;
+}
+
+/* Deleting a file drops the pages of its last snapshot. */
+TEST_CASE(shallow_snapshot, delete, NULL)
+{
+	struct fixture *f = data;
+	sqlite3_file *file = __file_create_main_db(&f->vfs);
+	struct raft_buffer *bufs;
+	unsigned n;
+	struct vfsSnapshotInfo info;
+	int rc;
+
+	(void)params;
+
+	__file_write_page(file, 1);
+
+	bufs = __shallow_snapshot(&f->vfs, &n, &info);
+	vfsShallowSnapshotRelease(f->vfs.zName, info.image);
+
+	rc = file->pMethods->xClose(file);
+	munit_assert_int(rc, ==, 0);
+	rc = f->vfs.xDelete(&f->vfs, "test.db", 0);
+	munit_assert_int(rc, ==, 0);
+
+	munit_assert_int(vfsSlabCount(&f->vfs), ==, 1);
+
+	free(bufs);
+	free(file);
+
+	return MUNIT_OK;
+}
+
+/* If nothing was written since the previous snapshot, the next one is
+ * identical. */
+TEST_CASE(shallow_snapshot, unchanged, NULL)
+{
+	struct fixture *f = data;
+	sqlite3 *db = __db_open();
+	struct raft_buffer *bufs1;
+	struct raft_buffer *bufs2;
+	struct vfsSnapshotInfo info;
+	unsigned n1;
+	unsigned n2;
+
+	(void)params;
+
+	__db_exec(db, "CREATE TABLE test (n INT)");
+	__db_exec(db, "INSERT INTO test(n) VALUES(1)");
+
+	bufs1 = __shallow_snapshot(&f->vfs, &n1, &info);
+	vfsShallowSnapshotRelease(f->vfs.zName, info.image);
+
+	__db_exec(db, "SELECT * FROM test");
+
+	bufs2 = __shallow_snapshot(&f->vfs, &n2, &info);
+	vfsShallowSnapshotRelease(f->vfs.zName, info.image);
+
+	munit_assert_int(n1, ==, n2);
+	munit_assert_int(memcmp(bufs1, bufs2, n1 * sizeof *bufs1), ==, 0);
+
+	free(bufs1);
+	free(bufs2);
+
+	__db_close(db);
+
+	return MUNIT_OK;
+}
+
+/* Only the pages written since the previous snapshot are replaced. */
+TEST_CASE(shallow_snapshot, incremental, NULL)
+{
+	struct fixture *f = data;
+	sqlite3_file *file = __file_create_main_db(&f->vfs);
+	struct raft_buffer *bufs1;
+	struct raft_buffer *bufs2;
+	struct vfsSnapshotInfo info;
+	unsigned n1;
+	unsigned n2;
+	int i;
+
+	(void)params;
+
+	for (i = 1; i <= 100; i++) {
+		__file_write_page(file, i);
+	}
+
+	bufs1 = __shallow_snapshot(&f->vfs, &n1, &info);
+	vfsShallowSnapshotRelease(f->vfs.zName, info.image);
+
+	__file_write_page(file, 2);
+	__file_write_page(file, 70);
+	__file_write_page(file, 101);
+
+	bufs2 = __shallow_snapshot(&f->vfs, &n2, &info);
+	vfsShallowSnapshotRelease(f->vfs.zName, info.image);
+
+	munit_assert_int(n1, ==, 100);
+	munit_assert_int(n2, ==, 101);
+
+	for (i = 0; i < 100; i++) {
+		if (i == 1 || i == 69) {
+			munit_assert_ptr_not_equal(bufs1[i].base,
+						   bufs2[i].base);
+		} else {
+			munit_assert_ptr_equal(bufs1[i].base, bufs2[i].base);
+		}
+	}
+
+	free(bufs1);
+	free(bufs2);
+	file->pMethods->xClose(file);
+	free(file);
+
+	return MUNIT_OK;
+}
+
+/* Only one snapshot of a database can be in progress. */
+TEST_CASE(shallow_snapshot, busy, NULL)
+{
+	struct fixture *f = data;
+	sqlite3_file *file = __file_create_main_db(&f->vfs);
+	struct raft_buffer *bufs;
+	struct raft_buffer buf;
+	struct vfsSnapshotInfo info1;
+	struct vfsSnapshotInfo info2;
+	unsigned n;
+	int rv;
+
+	(void)params;
+
+	__file_write_page(file, 1);
+
+	bufs = __shallow_snapshot(&f->vfs, &n, &info1);
+
+	rv = vfsShallowSnapshot(f->vfs.zName, "test.db", &buf, 1, &info2);
+	munit_assert_int(rv, ==, SQLITE_BUSY);
+
+	vfsShallowSnapshotRelease(f->vfs.zName, info1.image);
+
+	free(bufs);
+	file->pMethods->xClose(file);
+	free(file);
+
+	return MUNIT_OK;
+}
+
+/* Trying to snapshot a database that doesn't exist results in an error. */
+TEST_CASE(shallow_snapshot, noent, NULL)
+{
+	struct fixture *f = data;
+	unsigned n;
+	int rv;
+
+	(void)params;
+
+	rv = vfsShallowSnapshotLen(f->vfs.zName, "test.db", &n);
+	munit_assert_int(rv, ==, SQLITE_CANTOPEN);
+
+	return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * Restore
+ *
+ ******************************************************************************/
+
+TEST_SUITE(restore);
+TEST_SETUP(restore, setup);
+TEST_TEAR_DOWN(restore, tear_down);
+
+/* Create a test database with a table holding a single row, close it and
+ * return the content that its database and WAL files had before closing,
+ * concatenated in a single buffer allocated with raft_malloc(). */
+static void *__restore_image(sqlite3_vfs *vfs,
+			     size_t *main_size,
+			     size_t *wal_size)
+{
+	sqlite3 *db = __db_open();
+	void *main_buf;
+	void *wal_buf;
+	uint8_t *buf;
+	int rv;
+
+	__db_exec(db, "CREATE TABLE test (n INT)");
+	__db_exec(db, "INSERT INTO test(n) VALUES(123)");
+
+	rv = vfsFileRead(vfs->zName, "test.db", &main_buf, main_size);
+	munit_assert_int(rv, ==, 0);
+	rv = vfsFileRead(vfs->zName, "test.db-wal", &wal_buf, wal_size);
+	munit_assert_int(rv, ==, 0);
+
+	__db_close(db);
+
+	buf = raft_malloc(*main_size + *wal_size);
+	munit_assert_ptr_not_null(buf);
+	memcpy(buf, main_buf, *main_size);
+	memcpy(buf + *main_size, wal_buf, *wal_size);
+
+	raft_free(main_buf);
+	raft_free(wal_buf);
+
+	return buf;
+}
+
+/* Assert that the test database holds the row inserted by __restore_image. */
+static void __restore_assert_row(sqlite3 *db)
+{
+	sqlite3_stmt *stmt;
+	int rv;
+
+	rv = sqlite3_prepare_v2(db, "SELECT n FROM test", -1, &stmt, NULL);
+	munit_assert_int(rv, ==, SQLITE_OK);
+	rv = sqlite3_step(stmt);
+	munit_assert_int(rv, ==, SQLITE_ROW);
+	munit_assert_int(sqlite3_column_int(stmt, 0), ==, 123);
+	rv = sqlite3_finalize(stmt);
+	munit_assert_int(rv, ==, SQLITE_OK);
+}
+
+/* Without a backing block, the pages of the image get copied. */
+TEST_CASE(restore, copy, NULL)
+{
+	struct fixture *f = data;
+	sqlite3 *db;
+	uint8_t *buf;
+	void *main_buf;
+	void *wal_buf;
+	size_t main_size;
+	size_t wal_size;
+	size_t len;
+	int rv;
+
+	(void)params;
+
+	buf = __restore_image(&f->vfs, &main_size, &wal_size);
+
+	rv = vfsRestore(f->vfs.zName, "test.db", buf, main_size, wal_size,
+			NULL);
+	munit_assert_int(rv, ==, 0);
+
+	rv = vfsFileRead(f->vfs.zName, "test.db", &main_buf, &len);
+	munit_assert_int(rv, ==, 0);
+	munit_assert_int(len, ==, main_size);
+	munit_assert_int(memcmp(main_buf, buf, main_size), ==, 0);
+
+	rv = vfsFileRead(f->vfs.zName, "test.db-wal", &wal_buf, &len);
+	munit_assert_int(rv, ==, 0);
+	munit_assert_int(len, ==, wal_size);
+	munit_assert_int(memcmp(wal_buf, buf + main_size, wal_size), ==, 0);
+
+	raft_free(main_buf);
+	raft_free(wal_buf);
+	raft_free(buf);
+
+	db = __db_open();
+	__restore_assert_row(db);
+	__db_close(db);
+
+	return MUNIT_OK;
+}
+
+/* With a backing block, the restored pages point into it, and the block is
+ * freed once no page uses it anymore. */
+TEST_CASE(restore, adopt, NULL)
+{
+	struct fixture *f = data;
+	struct vfsBacking *backing;
+	struct raft_buffer *bufs;
+	unsigned n;
+	struct vfsSnapshotInfo info;
+	sqlite3_file *file;
+	sqlite3 *db;
+	uint8_t *buf;
+	void *page;
+	size_t main_size;
+	size_t wal_size;
+	int flags = SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_READWRITE;
+	int rv;
+
+	(void)params;
+
+	buf = __restore_image(&f->vfs, &main_size, &wal_size);
+
+	backing = vfsBackingCreate(buf);
+	munit_assert_ptr_not_null(backing);
+
+	rv = vfsRestore(f->vfs.zName, "test.db", buf, main_size, wal_size,
+			backing);
+	munit_assert_int(rv, ==, 0);
+
+	vfsBackingRelease(f->vfs.zName, backing);
+
+	/* The pages of the database point into the block. */
+	bufs = __shallow_snapshot(&f->vfs, &n, &info);
+	munit_assert_ptr_equal(bufs[0].base, buf);
+	munit_assert_ptr_equal(bufs[n - 1].base, buf + main_size + wal_size -
+							 bufs[n - 1].len);
+	vfsShallowSnapshotRelease(f->vfs.zName, info.image);
+	free(bufs);
+
+	/* Adopted pages are not served through xFetch. */
+	file = munit_malloc(f->vfs.szOsFile);
+	rv = f->vfs.xOpen(&f->vfs, "test.db", file, flags, &flags);
+	munit_assert_int(rv, ==, 0);
+	rv = file->pMethods->xFetch(file, 0, 512, &page);
+	munit_assert_int(rv, ==, 0);
+	munit_assert_ptr_null(page);
+	rv = file->pMethods->xClose(file);
+	munit_assert_int(rv, ==, 0);
+	free(file);
+
+	/* The restored database can be read and modified. */
+	db = __db_open();
+	__restore_assert_row(db);
+	__db_exec(db, "INSERT INTO test(n) VALUES(456)");
+	__db_close(db);
+
+	/* Deleting the database releases the last adopted pages, and with
+	 * them the block, which would be otherwise reported as leaked. */
+	rv = f->vfs.xDelete(&f->vfs, "test.db", 0);
+	munit_assert_int(rv, ==, 0);
+
+	return MUNIT_OK;
+}
+
+/* An image whose size is not a multiple of the page size is rejected. */
+TEST_CASE(restore, corrupt, NULL)
+{
+	struct fixture *f = data;
+	uint8_t *buf;
+	size_t main_size;
+	size_t wal_size;
+	int rv;
+
+	(void)params;
+
+	buf = __restore_image(&f->vfs, &main_size, &wal_size);
+
+	rv = vfsRestore(f->vfs.zName, "test.db", buf, main_size - 1, 0, NULL);
+	munit_assert_int(rv, ==, SQLITE_CORRUPT);
+
+	rv = vfsRestore(f->vfs.zName, "test.db", buf, main_size, wal_size - 1,
+			NULL);
+	munit_assert_int(rv, ==, SQLITE_CORRUPT);
+
+	raft_free(buf);
+
+	return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * Slab allocator
+ *
+ ******************************************************************************/
+
+TEST_SUITE(slab);
+TEST_SETUP(slab, setup);
+TEST_TEAR_DOWN(slab, tear_down);
+
+/* No slab is allocated until the first page is written. */
+TEST_CASE(slab, first_page, NULL)
+{
+	struct fixture *f = data;
+	sqlite3_file *file = __file_create_main_db(&f->vfs);
+
+	(void)params;
+
+	munit_assert_int(vfsSlabCount(&f->vfs), ==, 0);
+
+	__file_write_page(file, 1);
+
+	munit_assert_int(vfsSlabCount(&f->vfs), ==, 1);
+
+	free(file);
+
+	return MUNIT_OK;
+}
+
+/* Pages of database and WAL files with the same page size are carved out of
+ * the same slab. */
+TEST_CASE(slab, shared, NULL)
+{
+	struct fixture *f = data;
+	sqlite3_file *file1 = __file_create_main_db(&f->vfs);
+	sqlite3_file *file2 = __file_create_wal(&f->vfs);
+	void *buf_header_wal = __buf_header_wal();
+	void *buf_header_wal_frame = __buf_header_wal_frame();
+	int rc;
+
+	(void)params;
+
+	__file_write_page(file1, 1);
+	__file_write_page(file1, 2);
+
+	rc = file2->pMethods->xWrite(file2, buf_header_wal, 32, 0);
+	munit_assert_int(rc, ==, 0);
+
+	rc = file2->pMethods->xWrite(file2, buf_header_wal_frame, 24, 32);
+	munit_assert_int(rc, ==, 0);
+
+	munit_assert_int(vfsSlabCount(&f->vfs), ==, 1);
+
+	free(buf_header_wal);
+	free(buf_header_wal_frame);
+	free(file1);
+	free(file2);
+
+	return MUNIT_OK;
+}
+
+/* When a slab is exhausted, a new one gets allocated. Truncating the file
+ * releases all slabs except for one, which is kept around for reuse. */
+TEST_CASE(slab, grow_and_shrink, NULL)
+{
+	struct fixture *f = data;
+	sqlite3_file *file = __file_create_main_db(&f->vfs);
+	unsigned n; /* Number of pages per slab */
+	unsigned i;
+	int rc;
+
+	(void)params;
+
+	/* Add pages until a second slab is needed. */
+	for (i = 1; vfsSlabCount(&f->vfs) < 2; i++) {
+		__file_write_page(file, i);
+		munit_assert_int(i, <, 1024);
+	}
+	n = i - 2;
+	munit_assert_int(n, >, 1);
+
+	/* Fill the second slab as well, and then some more. */
+	for (; i <= 2 * n + 1; i++) {
+		__file_write_page(file, i);
+	}
+	munit_assert_int(vfsSlabCount(&f->vfs), ==, 3);
+
+	rc = file->pMethods->xTruncate(file, 0);
+	munit_assert_int(rc, ==, 0);
+
+	munit_assert_int(vfsSlabCount(&f->vfs), ==, 1);
+
+	/* Pages are then carved out of the retained slab. */
+	for (i = 1; i <= n; i++) {
+		__file_write_page(file, i);
+	}
+	munit_assert_int(vfsSlabCount(&f->vfs), ==, 1);
+
+	free(file);
+
+	return MUNIT_OK;
+}
+
+/* Deleting a file releases its pages. */
+TEST_CASE(slab, delete, NULL)
+{
+	struct fixture *f = data;
+	sqlite3_file *file1 = __file_create_main_db(&f->vfs);
+	sqlite3_file *file2 = __file_create(&f->vfs, "test2.db",
+					    SQLITE_OPEN_MAIN_DB);
+	int rc;
+
+	(void)params;
+
+	__file_write_page(file1, 1);
+	__file_write_page(file2, 1);
+
+	rc = file1->pMethods->xClose(file1);
+	munit_assert_int(rc, ==, 0);
+
+	rc = f->vfs.xDelete(&f->vfs, "test.db", 0);
+	munit_assert_int(rc, ==, 0);
+
+	/* The remaining page of test2.db still lives in the slab. */
+	munit_assert_int(vfsSlabCount(&f->vfs), ==, 1);
+
+	free(file1);
+	free(file2);
+
+	return MUNIT_OK;
+}
+
+/* Resetting a WAL that grew over several slabs releases all of them except
+ * for a spare one, next to the slab holding the database page. */
+TEST_CASE(slab, wal_reset, NULL)
+{
+	struct fixture *f = data;
+	sqlite3_file *file1 = __file_create_main_db(&f->vfs);
+	sqlite3_file *file2 = __file_create_wal(&f->vfs);
+	void *buf_header_main = __buf_header_main_db();
+	void *buf_header_wal = __buf_header_wal();
+	void *buf_header_wal_frame = __buf_header_wal_frame();
+	void *buf_page = munit_malloc(512);
+	sqlite3_int64 offset;
+	unsigned i;
+	int rc;
+
+	(void)params;
+
+	/* Set the page size to 512. */
+	rc = file1->pMethods->xWrite(file1, buf_header_main, 100, 0);
+	munit_assert_int(rc, ==, 0);
+	memset(buf_page, 0, 512);
+
+	rc = file2->pMethods->xWrite(file2, buf_header_wal, 32, 0);
+	munit_assert_int(rc, ==, 0);
+
+	/* Add frames until the WAL spans at least two slabs of its own. */
+	for (i = 0; vfsSlabCount(&f->vfs) < 3; i++) {
+		munit_assert_int(i, <, 4096);
+		offset = 32 + i * (24 + 512);
+		rc = file2->pMethods->xWrite(file2, buf_header_wal_frame, 24,
+					     offset);
+		munit_assert_int(rc, ==, 0);
+		rc = file2->pMethods->xWrite(file2, buf_page, 512, offset + 24);
+		munit_assert_int(rc, ==, 0);
+	}
+
+	rc = file2->pMethods->xTruncate(file2, 0);
+	munit_assert_int(rc, ==, 0);
+
+	munit_assert_int(vfsSlabCount(&f->vfs), ==, 2);
+
+	free(buf_header_main);
+	free(buf_header_wal);
+	free(buf_header_wal_frame);
+	free(buf_page);
+	free(file1);
+	free(file2);
+
+	return MUNIT_OK;
+}